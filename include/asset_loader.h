@@ -0,0 +1,412 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <mesh.h>
+#include <texture.h>
+#include <material.h>
+#include <objloader.h>
+#include <shader.h>
+#include <lockfree_queue.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Unit cube drawn in place of a mesh that is still loading
+inline void PlaceholderCube(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+    const Vec3 normals[6] = {
+        Vec3(1, 0, 0), Vec3(-1, 0, 0), Vec3(0, 1, 0), Vec3(0, -1, 0), Vec3(0, 0, 1), Vec3(0, 0, -1)
+    };
+
+    for (const Vec3& n : normals)
+    {
+        // Two axes spanning the face
+        Vec3 u = (n.y != 0.0f) ? Vec3(1, 0, 0) : Vec3(0, 1, 0);
+        Vec3 v = n.Cross(u);
+
+        unsigned int first = (unsigned int)vertices.size();
+
+        vertices.push_back({ (n - u - v) * 0.5f, n, Vec2(0.0f, 0.0f) });
+        vertices.push_back({ (n + u - v) * 0.5f, n, Vec2(1.0f, 0.0f) });
+        vertices.push_back({ (n + u + v) * 0.5f, n, Vec2(1.0f, 1.0f) });
+        vertices.push_back({ (n - u + v) * 0.5f, n, Vec2(0.0f, 1.0f) });
+
+        for (unsigned int i : { 0u, 1u, 2u, 0u, 2u, 3u })
+            indices.push_back(first + i);
+    }
+}
+
+// Loads textures and meshes on worker threads
+// Requests return GL objects immediately, filled with placeholders until ProcessUploads swaps in the real data
+class AssetLoader
+{
+public:
+
+    AssetLoader(MaterialRegistry& registry, unsigned int workerCount = 0) : registry(registry), results(256), pending(0), stopping(false)
+    {
+        if (workerCount == 0)
+        {
+            // Leave one core for the GL thread
+            unsigned int cores = std::thread::hardware_concurrency();
+            workerCount = (cores > 2) ? std::min(cores - 1, 4u) : 1;
+        }
+
+        for (unsigned int i = 0; i < workerCount; ++i)
+            workers.emplace_back(&AssetLoader::WorkerLoop, this);
+
+        // Textures referenced by materials (MTL files, registry lookups) load asynchronously too
+        registry.Textures().textureLoader = [this](const std::string& path) { return RequestTexture(path); };
+        registry.Textures().textureReleased = [this](unsigned int texture) { textureGenerations.erase(texture); };
+
+        // Textures evicted by the residency manager are decoded here too when they are used again
+        textureRestoreQueue = [this](unsigned int texture, const std::string& path) { RestoreTexture(texture, path); };
+    }
+
+    ~AssetLoader()
+    {
+        registry.Textures().textureLoader = nullptr;
+        registry.Textures().textureReleased = nullptr;
+        textureRestoreQueue = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+
+        for (std::thread& worker : workers)
+            worker.join();
+
+        // Drop results that were never uploaded
+        std::unique_ptr<Result> result;
+        while (results.Pop(result)) {}
+    }
+
+    // Texture object with a placeholder color, the image is decoded in the background
+    unsigned int RequestTexture(const std::string& path)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        UploadPlaceholderTexture(textureID);
+
+        Job job;
+        job.type = TEXTURE;
+        job.path = path;
+        job.texture = textureID;
+        job.generation = textureGenerations[textureID] = nextGeneration++;
+        Enqueue(std::move(job));
+
+        return textureID;
+    }
+
+    // Mesh drawn as a placeholder cube, the OBJ and its materials are parsed in the background
+    // The loader only keeps weak references: a mesh released before its upload (or a reload) is skipped
+    std::shared_ptr<Mesh> RequestMesh(const std::string& path, const Material& defaultMaterial, const Light& light)
+    {
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        PlaceholderCube(vertices, indices);
+
+        unsigned int materialID = registry.Register(defaultMaterial);
+        std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>(vertices, indices, std::vector<SubMesh>{ { 0, (unsigned int)indices.size(), materialID, defaultMaterial } }, light);
+
+        meshes[MaterialRegistry::NormalizePath(path)].push_back({ mesh, defaultMaterial });
+
+        Job job;
+        job.type = MESH;
+        job.path = path;
+        job.mesh = mesh;
+        job.defaultMaterial = defaultMaterial;
+        Enqueue(std::move(job));
+
+        return mesh;
+    }
+
+    // Decode the file again into the texture already loaded from it, false if no texture uses it
+    bool ReloadTexture(const std::string& path)
+    {
+        unsigned int textureID = registry.FindTexture(path);
+        if (!textureID)
+            return false;
+
+        Job job;
+        job.type = TEXTURE;
+        job.path = path;
+        job.texture = textureID;
+        job.generation = textureGenerations[textureID] = nextGeneration++;
+        Enqueue(std::move(job));
+
+        return true;
+    }
+
+    // Decode the file again into a texture the residency manager shrank, it keeps its coarse levels until then
+    void RestoreTexture(unsigned int textureID, const std::string& path)
+    {
+        Job job;
+        job.type = TEXTURE;
+        job.path = path;
+        job.texture = textureID;
+        job.generation = textureGenerations[textureID] = nextGeneration++;
+        Enqueue(std::move(job));
+    }
+
+    // Parse again every mesh loaded from the OBJ file or using the MTL file, false if none does
+    bool ReloadMesh(const std::string& path)
+    {
+        std::string key = MaterialRegistry::NormalizePath(path);
+
+        std::vector<std::string> objFiles;
+        if (meshes.count(key))
+            objFiles.push_back(key);
+
+        auto dependents = materialLibraryUsers.find(key);
+        if (dependents != materialLibraryUsers.end())
+            objFiles.insert(objFiles.end(), dependents->second.begin(), dependents->second.end());
+
+        bool used = false;
+        for (const std::string& objFile : objFiles)
+        {
+            std::vector<MeshRecord>& records = meshes[objFile];
+
+            // Meshes deleted since they were requested are forgotten here
+            records.erase(std::remove_if(records.begin(), records.end(), [](const MeshRecord& record) { return record.mesh.expired(); }), records.end());
+
+            for (const MeshRecord& record : records)
+            {
+                Job job;
+                job.type = MESH;
+                job.path = objFile;
+                job.mesh = record.mesh;
+                job.defaultMaterial = record.defaultMaterial;
+                Enqueue(std::move(job));
+                used = true;
+            }
+        }
+
+        return used;
+    }
+
+    // Read the sources in the background, the program is swapped during ProcessUploads if it links
+    void ReloadShader(ShaderProgram& shader)
+    {
+        Job job;
+        job.type = SHADER;
+        job.shader = &shader;
+        job.path = shader.vertexPath;
+        job.fragmentPath = shader.fragmentPath;
+        job.geometryPath = shader.geometryPath;
+        Enqueue(std::move(job));
+    }
+
+    // Upload finished assets (GL thread), stops once budgetMs has been spent
+    // Returns the number of assets uploaded
+    size_t ProcessUploads(double budgetMs)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t uploaded = 0;
+
+        std::unique_ptr<Result> result;
+        while (results.Pop(result))
+        {
+            if (result->success)
+            {
+                // The texture may have been freed by the TextureManager while it was loading (and its name reused), or
+                // reloaded since: only the latest load of a live texture is uploaded
+                if (result->type == TEXTURE)
+                {
+                    auto generation = textureGenerations.find(result->texture);
+                    if (generation != textureGenerations.end() && generation->second == result->generation)
+                        UploadTexture(result->texture, result->textureData);
+                }
+                else if (result->type == MESH)
+                {
+                    std::shared_ptr<Mesh> mesh = result->mesh.lock();
+                    if (mesh)
+                    {
+                        std::vector<unsigned int> indices;
+                        std::vector<SubMesh> submeshes;
+
+                        BuildSubMeshes(result->objData, registry, indices, submeshes);
+                        mesh->Upload(result->objData.vertices, indices, submeshes);
+
+                        // Editing an MTL file reloads the meshes that use it
+                        for (const std::string& library : result->objData.materialLibraries)
+                            materialLibraryUsers[MaterialRegistry::NormalizePath(library)].insert(MaterialRegistry::NormalizePath(result->path));
+                    }
+                }
+                else
+                {
+                    // Includes may have been added or removed, watch the new set either way
+                    result->shader->dependencies = result->dependencies;
+                    ReloadShaderProgram(*result->shader, result->vertexSource, result->fragmentSource, result->geometrySource);
+                }
+            }
+
+            result.reset();
+            pending--;
+            uploaded++;
+
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            if (elapsed >= budgetMs)
+                break;
+        }
+
+        return uploaded;
+    }
+
+    // Requests that have not been uploaded yet
+    size_t Pending() const
+    {
+        return pending.load();
+    }
+
+private:
+
+    enum JobType
+    {
+        TEXTURE,
+        MESH,
+        SHADER
+    };
+
+    struct Job
+    {
+        JobType type = TEXTURE;
+        std::string path;
+        std::string fragmentPath;
+        std::string geometryPath;
+        unsigned int texture = 0;
+        uint32_t generation = 0;
+        std::weak_ptr<Mesh> mesh;
+        ShaderProgram* shader = nullptr;
+        Material defaultMaterial = Material();
+    };
+
+    // CPU data produced by a worker
+    struct Result
+    {
+        JobType type = TEXTURE;
+        bool success = false;
+        std::string path;
+        unsigned int texture = 0;
+        uint32_t generation = 0;
+        std::weak_ptr<Mesh> mesh;
+        ShaderProgram* shader = nullptr;
+        TextureData textureData;
+        OBJData objData;
+        std::string vertexSource;
+        std::string fragmentSource;
+        std::string geometrySource;
+        std::vector<std::string> dependencies;
+    };
+
+    // Mesh created by RequestMesh, kept for reloading while it is alive
+    struct MeshRecord
+    {
+        std::weak_ptr<Mesh> mesh;
+        Material defaultMaterial;
+    };
+
+    MaterialRegistry& registry;
+
+    std::unordered_map<std::string, std::vector<MeshRecord>> meshes;
+    std::unordered_map<std::string, std::unordered_set<std::string>> materialLibraryUsers;
+
+    // Latest load of each texture this loader fills, forgotten when the TextureManager frees the texture
+    std::unordered_map<unsigned int, uint32_t> textureGenerations;
+    uint32_t nextGeneration = 1;
+
+    std::vector<std::thread> workers;
+    std::mutex jobMutex;
+    std::condition_variable jobAvailable;
+    std::deque<Job> jobs;
+
+    LockFreeQueue<std::unique_ptr<Result>> results;
+    std::atomic<size_t> pending;
+    std::atomic<bool> stopping;
+
+    void Enqueue(Job&& job)
+    {
+        pending++;
+
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            jobs.push_back(std::move(job));
+        }
+        jobAvailable.notify_one();
+    }
+
+    void WorkerLoop()
+    {
+        for (;;)
+        {
+            Job job;
+
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+                if (stopping)
+                    return;
+
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            std::unique_ptr<Result> result(new Result());
+            result->type = job.type;
+            result->path = job.path;
+            result->texture = job.texture;
+            result->generation = job.generation;
+            result->mesh = job.mesh;
+            result->shader = job.shader;
+
+            if (job.type == TEXTURE)
+            {
+                result->success = DecodeTexture(job.path.c_str(), result->textureData);
+            }
+            else if (job.type == MESH)
+            {
+                result->success = ParseOBJWithMaterials(job.path.c_str(), job.defaultMaterial, result->objData);
+            }
+            else
+            {
+                std::vector<std::string> fragmentDependencies;
+                result->vertexSource = ReadShaderSource(job.path, ShaderDefines(), &result->dependencies);
+                result->fragmentSource = ReadShaderSource(job.fragmentPath, ShaderDefines(), &fragmentDependencies);
+                result->dependencies.insert(result->dependencies.end(), fragmentDependencies.begin(), fragmentDependencies.end());
+                result->success = !result->vertexSource.empty() && !result->fragmentSource.empty();
+
+                if (!job.geometryPath.empty())
+                {
+                    std::vector<std::string> geometryDependencies;
+                    result->geometrySource = ReadShaderSource(job.geometryPath, ShaderDefines(), &geometryDependencies);
+                    result->dependencies.insert(result->dependencies.end(), geometryDependencies.begin(), geometryDependencies.end());
+                    result->success &= !result->geometrySource.empty();
+                }
+            }
+
+            // Queue is full: wait for the GL thread to drain it
+            while (!results.Push(std::move(result)))
+            {
+                if (stopping)
+                    return;
+
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,649 @@
+#ifndef BC_ENCODER_H
+#define BC_ENCODER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MG3D_SSE2
+#include <emmintrin.h>
+#endif
+
+// Block-compressed formats the encoder can produce
+enum BCFormat
+{
+    FORMAT_BC1,     // RGB, 4 bpp
+    FORMAT_BC3,     // RGBA, 8 bpp
+    FORMAT_BC5,     // Two channels (RG), 8 bpp, for normal maps
+    FORMAT_BC7      // RGBA, 8 bpp, best quality (mode 6 only)
+};
+
+// Encoding effort, higher levels refine the endpoints of every block
+enum BCQuality
+{
+    QUALITY_FAST,   // Bounding box endpoints
+    QUALITY_NORMAL, // Principal axis endpoints, one least-squares refinement
+    QUALITY_HIGH    // Principal axis endpoints, iterated refinement and endpoint search
+};
+
+// Bytes per 4x4 block
+inline size_t BCBlockSize(BCFormat format)
+{
+    return (format == FORMAT_BC1) ? 8 : 16;
+}
+
+// Bytes needed for a whole image
+inline size_t BCImageSize(BCFormat format, int width, int height)
+{
+    return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * BCBlockSize(format);
+}
+
+namespace bc
+{
+    // 16 pixels in structure-of-arrays layout, channel values 0-255
+    struct Block
+    {
+        alignas(16) float c[4][16];
+    };
+
+    // Palette entries with up to four channels
+    struct Palette
+    {
+        alignas(16) float c[16][4];
+        int size;
+    };
+
+    // Nearest palette entry for every pixel, returns the total squared error
+    inline float FitIndices(const Block& block, int channels, const Palette& palette, uint8_t indices[16])
+    {
+#ifdef MG3D_SSE2
+        __m128 total = _mm_setzero_ps();
+
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m128 best = _mm_set1_ps(1e30f);
+            __m128i bestIndex = _mm_setzero_si128();
+
+            for (int p = 0; p < palette.size; ++p)
+            {
+                __m128 distance = _mm_setzero_ps();
+                for (int ch = 0; ch < channels; ++ch)
+                {
+                    __m128 d = _mm_sub_ps(_mm_load_ps(&block.c[ch][i]), _mm_set1_ps(palette.c[p][ch]));
+                    distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+                }
+
+                __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+                bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, bestIndex));
+                best = _mm_min_ps(distance, best);
+            }
+
+            alignas(16) int32_t lanes[4];
+            _mm_store_si128((__m128i*)lanes, bestIndex);
+            for (int j = 0; j < 4; ++j)
+                indices[i + j] = (uint8_t)lanes[j];
+
+            total = _mm_add_ps(total, best);
+        }
+
+        alignas(16) float sums[4];
+        _mm_store_ps(sums, total);
+        return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+        float total = 0.0f;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            float best = 1e30f;
+            int bestIndex = 0;
+
+            for (int p = 0; p < palette.size; ++p)
+            {
+                float distance = 0.0f;
+                for (int ch = 0; ch < channels; ++ch)
+                {
+                    float d = block.c[ch][i] - palette.c[p][ch];
+                    distance += d * d;
+                }
+
+                if (distance < best)
+                {
+                    best = distance;
+                    bestIndex = p;
+                }
+            }
+
+            indices[i] = (uint8_t)bestIndex;
+            total += best;
+        }
+
+        return total;
+#endif
+    }
+
+    // Endpoints along the direction of greatest variance (or the bounding box diagonal for QUALITY_FAST)
+    inline void PrincipalEndpoints(const Block& block, int channels, BCQuality quality, float e0[4], float e1[4])
+    {
+        float minimum[4], maximum[4], mean[4] = { 0, 0, 0, 0 };
+        for (int ch = 0; ch < channels; ++ch)
+        {
+            minimum[ch] = maximum[ch] = block.c[ch][0];
+            for (int i = 0; i < 16; ++i)
+            {
+                minimum[ch] = std::min(minimum[ch], block.c[ch][i]);
+                maximum[ch] = std::max(maximum[ch], block.c[ch][i]);
+                mean[ch] += block.c[ch][i];
+            }
+            mean[ch] /= 16.0f;
+        }
+
+        if (quality == QUALITY_FAST)
+        {
+            for (int ch = 0; ch < channels; ++ch)
+            {
+                // Inset the box slightly, the extremes are rarely hit exactly after quantization
+                float inset = (maximum[ch] - minimum[ch]) / 32.0f;
+                e0[ch] = maximum[ch] - inset;
+                e1[ch] = minimum[ch] + inset;
+            }
+            return;
+        }
+
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int a = 0; a < channels; ++a)
+            {
+                for (int b = a; b < channels; ++b)
+                    covariance[a][b] += (block.c[a][i] - mean[a]) * (block.c[b][i] - mean[b]);
+            }
+        }
+        for (int a = 0; a < channels; ++a)
+        {
+            for (int b = 0; b < a; ++b)
+                covariance[a][b] = covariance[b][a];
+        }
+
+        // Power iteration, seeded with the bounding box diagonal
+        float axis[4];
+        for (int ch = 0; ch < channels; ++ch)
+            axis[ch] = maximum[ch] - minimum[ch];
+
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            float next[4] = { 0, 0, 0, 0 };
+            float length = 0.0f;
+
+            for (int a = 0; a < channels; ++a)
+            {
+                for (int b = 0; b < channels; ++b)
+                    next[a] += covariance[a][b] * axis[b];
+                length = std::max(length, std::fabs(next[a]));
+            }
+
+            if (length < 1e-8f)
+                break;
+
+            for (int ch = 0; ch < channels; ++ch)
+                axis[ch] = next[ch] / length;
+        }
+
+        float lengthSquared = 0.0f;
+        for (int ch = 0; ch < channels; ++ch)
+            lengthSquared += axis[ch] * axis[ch];
+
+        if (lengthSquared < 1e-8f)
+        {
+            // Flat block
+            for (int ch = 0; ch < channels; ++ch)
+                e0[ch] = e1[ch] = mean[ch];
+            return;
+        }
+
+        float minProjection = 1e30f, maxProjection = -1e30f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float projection = 0.0f;
+            for (int ch = 0; ch < channels; ++ch)
+                projection += (block.c[ch][i] - mean[ch]) * axis[ch];
+
+            minProjection = std::min(minProjection, projection);
+            maxProjection = std::max(maxProjection, projection);
+        }
+
+        for (int ch = 0; ch < channels; ++ch)
+        {
+            e0[ch] = std::min(std::max(mean[ch] + axis[ch] * maxProjection / lengthSquared, 0.0f), 255.0f);
+            e1[ch] = std::min(std::max(mean[ch] + axis[ch] * minProjection / lengthSquared, 0.0f), 255.0f);
+        }
+    }
+
+    // Endpoints minimizing the error for fixed indices, weights[i] is the position of palette entry i between e0 (0) and e1 (1)
+    inline bool RefineEndpoints(const Block& block, int channels, const uint8_t indices[16], const float* weights, float e0[4], float e1[4])
+    {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[4] = { 0, 0, 0, 0 }, bx[4] = { 0, 0, 0, 0 };
+
+        for (int i = 0; i < 16; ++i)
+        {
+            float b = weights[indices[i]];
+            float a = 1.0f - b;
+
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+
+            for (int ch = 0; ch < channels; ++ch)
+            {
+                ax[ch] += a * block.c[ch][i];
+                bx[ch] += b * block.c[ch][i];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1e-6f)
+            return false;
+
+        for (int ch = 0; ch < channels; ++ch)
+        {
+            e0[ch] = std::min(std::max((bb * ax[ch] - ab * bx[ch]) / determinant, 0.0f), 255.0f);
+            e1[ch] = std::min(std::max((aa * bx[ch] - ab * ax[ch]) / determinant, 0.0f), 255.0f);
+        }
+
+        return true;
+    }
+
+    inline int Quantize(float value, int maximum)
+    {
+        return std::min(std::max((int)std::lround(value * maximum / 255.0f), 0), maximum);
+    }
+
+    inline uint16_t PackRGB565(const float color[3])
+    {
+        return (uint16_t)((Quantize(color[0], 31) << 11) | (Quantize(color[1], 63) << 5) | Quantize(color[2], 31));
+    }
+
+    inline void UnpackRGB565(uint16_t packed, float color[4])
+    {
+        int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = (float)((r << 3) | (r >> 2));
+        color[1] = (float)((g << 2) | (g >> 4));
+        color[2] = (float)((b << 3) | (b >> 2));
+        color[3] = 0.0f;
+    }
+
+    // Four-color BC1 block from RGB endpoints, returns the squared error
+    inline float PackColorBlock(const Block& block, const float e0[4], const float e1[4], uint8_t out[8])
+    {
+        uint16_t c0 = PackRGB565(e0);
+        uint16_t c1 = PackRGB565(e1);
+
+        // c0 > c1 selects four-color mode
+        if (c0 < c1)
+            std::swap(c0, c1);
+
+        uint8_t indices[16] = {};
+        float error = 0.0f;
+
+        Palette palette;
+        UnpackRGB565(c0, palette.c[0]);
+        UnpackRGB565(c1, palette.c[1]);
+        for (int ch = 0; ch < 3; ++ch)
+        {
+            palette.c[2][ch] = (2.0f * palette.c[0][ch] + palette.c[1][ch]) / 3.0f;
+            palette.c[3][ch] = (palette.c[0][ch] + 2.0f * palette.c[1][ch]) / 3.0f;
+        }
+
+        if (c0 == c1)
+        {
+            // Equal endpoints would select three-color mode, index 0 is the only safe choice
+            palette.size = 1;
+            error = FitIndices(block, 3, palette, indices);
+        }
+        else
+        {
+            palette.size = 4;
+            error = FitIndices(block, 3, palette, indices);
+        }
+
+        uint32_t bits = 0;
+        for (int i = 0; i < 16; ++i)
+            bits |= (uint32_t)indices[i] << (2 * i);
+
+        out[0] = (uint8_t)(c0 & 0xFF);
+        out[1] = (uint8_t)(c0 >> 8);
+        out[2] = (uint8_t)(c1 & 0xFF);
+        out[3] = (uint8_t)(c1 >> 8);
+        out[4] = (uint8_t)(bits & 0xFF);
+        out[5] = (uint8_t)((bits >> 8) & 0xFF);
+        out[6] = (uint8_t)((bits >> 16) & 0xFF);
+        out[7] = (uint8_t)(bits >> 24);
+
+        return error;
+    }
+
+    // BC1 color block (also the color half of BC3)
+    inline void EncodeColorBlock(const Block& block, BCQuality quality, uint8_t out[8])
+    {
+        // Palette order is c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+        static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+        float e0[4], e1[4];
+        PrincipalEndpoints(block, 3, quality, e0, e1);
+
+        float bestError = PackColorBlock(block, e0, e1, out);
+
+        int iterations = (quality == QUALITY_FAST) ? 0 : (quality == QUALITY_NORMAL) ? 1 : 4;
+        for (int iteration = 0; iteration < iterations; ++iteration)
+        {
+            // Indices of the current best block
+            uint32_t bits = out[4] | (out[5] << 8) | (out[6] << 16) | ((uint32_t)out[7] << 24);
+            uint8_t indices[16];
+            for (int i = 0; i < 16; ++i)
+                indices[i] = (bits >> (2 * i)) & 3;
+
+            float c0[4], c1[4];
+            UnpackRGB565((uint16_t)(out[0] | (out[1] << 8)), c0);
+            UnpackRGB565((uint16_t)(out[2] | (out[3] << 8)), c1);
+            std::memcpy(e0, c0, sizeof(e0));
+            std::memcpy(e1, c1, sizeof(e1));
+
+            if (!RefineEndpoints(block, 3, indices, weights, e0, e1))
+                break;
+
+            uint8_t candidate[8];
+            float error = PackColorBlock(block, e0, e1, candidate);
+            if (error >= bestError)
+                break;
+
+            bestError = error;
+            std::memcpy(out, candidate, 8);
+        }
+    }
+
+    // Single-channel block (BC4 layout), used for BC3 alpha and both BC5 channels
+    inline float PackChannelBlock(const float values[16], int a0, int a1, uint8_t out[8])
+    {
+        float palette[8];
+        palette[0] = (float)a0;
+        palette[1] = (float)a1;
+        for (int i = 1; i < 7; ++i)
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7.0f;
+
+        // a0 > a1 selects the eight-value mode, equal endpoints only use index 0
+        int paletteSize = (a0 == a1) ? 1 : 8;
+
+        uint64_t bits = 0;
+        float error = 0.0f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float best = 1e30f;
+            int bestIndex = 0;
+            for (int p = 0; p < paletteSize; ++p)
+            {
+                float d = values[i] - palette[p];
+                if (d * d < best)
+                {
+                    best = d * d;
+                    bestIndex = p;
+                }
+            }
+
+            bits |= (uint64_t)bestIndex << (3 * i);
+            error += best;
+        }
+
+        out[0] = (uint8_t)a0;
+        out[1] = (uint8_t)a1;
+        for (int i = 0; i < 6; ++i)
+            out[2 + i] = (uint8_t)(bits >> (8 * i));
+
+        return error;
+    }
+
+    inline void EncodeChannelBlock(const float values[16], BCQuality quality, uint8_t out[8])
+    {
+        float minimum = values[0], maximum = values[0];
+        for (int i = 1; i < 16; ++i)
+        {
+            minimum = std::min(minimum, values[i]);
+            maximum = std::max(maximum, values[i]);
+        }
+
+        int high = (int)std::lround(maximum);
+        int low = (int)std::lround(minimum);
+
+        float bestError = PackChannelBlock(values, high, low, out);
+
+        // Pulling the endpoints in often lets more pixels land exactly on a palette entry
+        if (quality == QUALITY_HIGH && high - low > 8)
+        {
+            for (int top = 0; top <= 3; ++top)
+            {
+                for (int bottom = 0; bottom <= 3; ++bottom)
+                {
+                    if (top == 0 && bottom == 0)
+                        continue;
+
+                    uint8_t candidate[8];
+                    float error = PackChannelBlock(values, high - top, low + bottom, candidate);
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        std::memcpy(out, candidate, 8);
+                    }
+                }
+            }
+        }
+    }
+
+    // BC7 mode 6: one subset, RGBA 7.7.7.7 endpoints with a p-bit each, 4-bit indices
+    inline void QuantizeBC7Endpoint(const float endpoint[4], int quantized[4], int& pbit)
+    {
+        float bestError = 1e30f;
+
+        for (int p = 0; p < 2; ++p)
+        {
+            int candidate[4];
+            float error = 0.0f;
+            for (int ch = 0; ch < 4; ++ch)
+            {
+                candidate[ch] = std::min(std::max((int)std::lround((endpoint[ch] - p) / 2.0f), 0), 127);
+                float d = (float)((candidate[ch] << 1) | p) - endpoint[ch];
+                error += d * d;
+            }
+
+            if (error < bestError)
+            {
+                bestError = error;
+                pbit = p;
+                std::memcpy(quantized, candidate, sizeof(candidate));
+            }
+        }
+    }
+
+    struct BitWriter
+    {
+        uint8_t* out;
+        int position;
+
+        void Write(uint32_t value, int count)
+        {
+            for (int i = 0; i < count; ++i, ++position)
+            {
+                if (value & (1u << i))
+                    out[position >> 3] |= (uint8_t)(1u << (position & 7));
+            }
+        }
+    };
+
+    inline float PackBC7Block(const Block& block, const float e0[4], const float e1[4], uint8_t out[16], uint8_t indices[16])
+    {
+        static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+        int q0[4], q1[4], p0 = 0, p1 = 0;
+        QuantizeBC7Endpoint(e0, q0, p0);
+        QuantizeBC7Endpoint(e1, q1, p1);
+
+        int endpoint0[4], endpoint1[4];
+        for (int ch = 0; ch < 4; ++ch)
+        {
+            endpoint0[ch] = (q0[ch] << 1) | p0;
+            endpoint1[ch] = (q1[ch] << 1) | p1;
+        }
+
+        Palette palette;
+        palette.size = 16;
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int ch = 0; ch < 4; ++ch)
+                palette.c[i][ch] = (float)(((64 - weights[i]) * endpoint0[ch] + weights[i] * endpoint1[ch] + 32) >> 6);
+        }
+
+        float error = FitIndices(block, 4, palette, indices);
+
+        // The anchor pixel's index is stored without its top bit, swap the endpoints if it is set
+        if (indices[0] & 8)
+        {
+            std::swap(q0, q1);
+            std::swap(p0, p1);
+            for (int i = 0; i < 16; ++i)
+                indices[i] = (uint8_t)(15 - indices[i]);
+        }
+
+        std::memset(out, 0, 16);
+        BitWriter writer = { out, 0 };
+
+        writer.Write(1u << 6, 7);
+        for (int ch = 0; ch < 4; ++ch)
+        {
+            writer.Write(q0[ch], 7);
+            writer.Write(q1[ch], 7);
+        }
+        writer.Write(p0, 1);
+        writer.Write(p1, 1);
+
+        writer.Write(indices[0], 3);
+        for (int i = 1; i < 16; ++i)
+            writer.Write(indices[i], 4);
+
+        return error;
+    }
+
+    inline void EncodeBC7Block(const Block& block, BCQuality quality, uint8_t out[16])
+    {
+        static const float weights[16] = {
+            0 / 64.0f, 4 / 64.0f, 9 / 64.0f, 13 / 64.0f, 17 / 64.0f, 21 / 64.0f, 26 / 64.0f, 30 / 64.0f,
+            34 / 64.0f, 38 / 64.0f, 43 / 64.0f, 47 / 64.0f, 51 / 64.0f, 55 / 64.0f, 60 / 64.0f, 64 / 64.0f
+        };
+
+        float e0[4], e1[4];
+        PrincipalEndpoints(block, 4, quality, e0, e1);
+
+        uint8_t indices[16];
+        float bestError = PackBC7Block(block, e0, e1, out, indices);
+
+        int iterations = (quality == QUALITY_FAST) ? 0 : (quality == QUALITY_NORMAL) ? 1 : 4;
+        for (int iteration = 0; iteration < iterations; ++iteration)
+        {
+            // Indices are relative to the endpoints as written, which may have been swapped
+            float r0[4], r1[4];
+            if (!RefineEndpoints(block, 4, indices, weights, r0, r1))
+                break;
+
+            uint8_t candidate[16], candidateIndices[16];
+            float error = PackBC7Block(block, r0, r1, candidate, candidateIndices);
+            if (error >= bestError)
+                break;
+
+            bestError = error;
+            std::memcpy(out, candidate, 16);
+            std::memcpy(indices, candidateIndices, 16);
+        }
+    }
+
+    // Gather a 4x4 block, pixels past the edge repeat the last row/column
+    inline void LoadBlock(const uint8_t* rgba, int width, int height, int blockX, int blockY, Block& block)
+    {
+        for (int y = 0; y < 4; ++y)
+        {
+            int sy = std::min(blockY * 4 + y, height - 1);
+            for (int x = 0; x < 4; ++x)
+            {
+                int sx = std::min(blockX * 4 + x, width - 1);
+                const uint8_t* pixel = rgba + ((size_t)sy * width + sx) * 4;
+
+                for (int ch = 0; ch < 4; ++ch)
+                    block.c[ch][y * 4 + x] = pixel[ch];
+            }
+        }
+    }
+
+    inline void EncodeBlock(const Block& block, BCFormat format, BCQuality quality, uint8_t* out)
+    {
+        switch (format)
+        {
+        case FORMAT_BC1:
+            EncodeColorBlock(block, quality, out);
+            break;
+        case FORMAT_BC3:
+            EncodeChannelBlock(block.c[3], quality, out);
+            EncodeColorBlock(block, quality, out + 8);
+            break;
+        case FORMAT_BC5:
+            EncodeChannelBlock(block.c[0], quality, out);
+            EncodeChannelBlock(block.c[1], quality, out + 8);
+            break;
+        case FORMAT_BC7:
+            EncodeBC7Block(block, quality, out);
+            break;
+        }
+    }
+}
+
+// Compress an RGBA8 image, rows of blocks are spread over threadCount threads (0 = all cores)
+inline std::vector<uint8_t> CompressImage(const uint8_t* rgba, int width, int height, BCFormat format, BCQuality quality, unsigned int threadCount = 0)
+{
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    size_t blockSize = BCBlockSize(format);
+
+    std::vector<uint8_t> output(BCImageSize(format, width, height));
+
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = std::min(threadCount, (unsigned int)blocksY);
+
+    // Threads take one row of blocks at a time so uneven rows balance out
+    std::atomic<int> nextRow(0);
+    auto encodeRows = [&]()
+    {
+        bc::Block block;
+        for (int by = nextRow++; by < blocksY; by = nextRow++)
+        {
+            for (int bx = 0; bx < blocksX; ++bx)
+            {
+                bc::LoadBlock(rgba, width, height, bx, by, block);
+                bc::EncodeBlock(block, format, quality, &output[((size_t)by * blocksX + bx) * blockSize]);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < threadCount; ++i)
+        threads.emplace_back(encodeRows);
+
+    encodeRows();
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    return output;
+}
+
+#endif
@@ -4,7 +4,9 @@
 #include <mat4.h>
 #include <vec3.h>
 
+#ifndef M_PI
 #define M_PI 3.14
+#endif
 
 inline float degreeToRadians(float degrees) 
 {
@@ -0,0 +1,185 @@
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <glad/glad.h>
+#include <render_queue.h>
+#include <shader.h>
+#include <shader_variants.h>
+#include <mat4.h>
+
+#include <iostream>
+
+// Color targets of the G-buffer, in attachment order (see shaders/GBufferFragment.glsl)
+enum GBufferTarget
+{
+    GBUFFER_ALBEDO,         // RGBA8, diffuse color times texture
+    GBUFFER_NORMAL,         // RGBA16F, world space normal
+    GBUFFER_SPECULAR,       // RGBA8, specular color times texture and shininess / 256
+    GBUFFER_AMBIENT,        // RGBA8, ambient color times texture
+    GBUFFER_TARGET_COUNT
+};
+
+// Texture unit of the first G-buffer target while lighting, depth follows the color targets (see SAMPLER_UNITS)
+const int GBUFFER_TEXTURE_UNIT = 4;
+
+// Deferred shading: a geometry pass writes the material of the nearest surface of every pixel to the G-buffer,
+// then one full-screen pass lights each pixel once with the scene light and the point lights of its cluster.
+// Lighting cost follows the pixel count instead of pixels x overdraw x lights.
+class DeferredRenderer
+{
+public:
+
+    // Geometry pass programs, one per material feature set like the forward variants
+    ShaderVariants geometryVariants;
+
+    // Full-screen lighting pass
+    ShaderProgram lightingShader;
+
+    DeferredRenderer(int width, int height) : geometryVariants("shaders/VertexShader.glsl", "shaders/GBufferFragment.glsl"), width(0), height(0), framebuffer(0), depthTexture(0), emptyVAO(0)
+    {
+        for (int i = 0; i < GBUFFER_TARGET_COUNT; ++i)
+            targets[i] = 0;
+
+        lightingShader.vertexPath = "shaders/FullscreenVertex.glsl";
+        lightingShader.fragmentPath = "shaders/DeferredLighting.glsl";
+        CreateShaderProgram(lightingShader);
+
+        // The full-screen triangle comes from gl_VertexID, core profiles still need a VAO bound
+        glGenVertexArrays(1, &emptyVAO);
+
+        Resize(width, height);
+    }
+
+    ~DeferredRenderer()
+    {
+        Release();
+        glDeleteVertexArrays(1, &emptyVAO);
+        glDeleteProgram(lightingShader.id);
+    }
+
+    DeferredRenderer(const DeferredRenderer&) = delete;
+    DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+    // Recreate the G-buffer for a new viewport size, false if the framebuffer is incomplete
+    bool Resize(int newWidth, int newHeight)
+    {
+        if (newWidth == width && newHeight == height && framebuffer)
+            return true;
+
+        Release();
+        width = newWidth;
+        height = newHeight;
+
+        const GLenum formats[GBUFFER_TARGET_COUNT] = { GL_RGBA8, GL_RGBA16F, GL_RGBA8, GL_RGBA8 };
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+        glGenTextures(GBUFFER_TARGET_COUNT, targets);
+        GLenum attachments[GBUFFER_TARGET_COUNT];
+        for (int i = 0; i < GBUFFER_TARGET_COUNT; ++i)
+        {
+            CreateTarget(targets[i], formats[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, targets[i], 0);
+            attachments[i] = GL_COLOR_ATTACHMENT0 + i;
+        }
+        glDrawBuffers(GBUFFER_TARGET_COUNT, attachments);
+
+        glGenTextures(1, &depthTexture);
+        // Same format as the usual default framebuffer, the depth blit needs them to match
+        CreateTarget(depthTexture, GL_DEPTH24_STENCIL8);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (!complete)
+            std::cerr << "G-buffer framebuffer is incomplete (" << width << "x" << height << ")" << std::endl;
+
+        return complete;
+    }
+
+    // Draw every queued submesh into the G-buffer and clear the queue
+    void GeometryPass(RenderQueue& queue)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, width, height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        queue.Flush(geometryVariants);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Light the G-buffer into the target framebuffer, then copy the depth so later forward passes still depth test
+    // The frame, light and cluster blocks must hold this frame's data
+    void LightingPass(Mat4 projection, Mat4 view, unsigned int targetFramebuffer = 0)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+        glViewport(0, 0, width, height);
+
+        for (int i = 0; i < GBUFFER_TARGET_COUNT; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + GBUFFER_TEXTURE_UNIT + i);
+            glBindTexture(GL_TEXTURE_2D, targets[i]);
+        }
+        glActiveTexture(GL_TEXTURE0 + GBUFFER_TEXTURE_UNIT + GBUFFER_TARGET_COUNT);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glActiveTexture(GL_TEXTURE0);
+
+        // Mat4 multiplies in the opposite order to GLSL, this is inverse(projection * view) in the shader's terms
+        Mat4 inverseViewProjection = (view * projection).Inverse();
+
+        glUseProgram(lightingShader.id);
+        glUniformMatrix4fv(glGetUniformLocation(lightingShader.id, "inverseViewProjection"), 1, GL_FALSE, inverseViewProjection.value_ptr());
+
+        glDisable(GL_DEPTH_TEST);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFramebuffer);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+    }
+
+    // G-buffer target, for debugging views
+    unsigned int Target(GBufferTarget target) const
+    {
+        return targets[target];
+    }
+
+private:
+    int width, height;
+    unsigned int framebuffer;
+    unsigned int targets[GBUFFER_TARGET_COUNT];
+    unsigned int depthTexture;
+    unsigned int emptyVAO;
+
+    void CreateTarget(unsigned int texture, GLenum format)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void Release()
+    {
+        if (!framebuffer)
+            return;
+
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(GBUFFER_TARGET_COUNT, targets);
+        glDeleteTextures(1, &depthTexture);
+        framebuffer = 0;
+        depthTexture = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef DEPTH_PREPASS_H
+#define DEPTH_PREPASS_H
+
+#include <glad/glad.h>
+#include <render_queue.h>
+#include <shader.h>
+#include <mat4.h>
+
+#include <cstdint>
+#include <cstring>
+
+// Optional depth pre-pass: the queued meshes are drawn depth-only first, with the position-only vertex stream and an
+// empty fragment shader, so the shading pass after it runs with GL_EQUAL and no depth writes and lights each pixel
+// once instead of once per overlapping surface.
+// Samples passed are counted in both passes: the pre-pass count is about what the shading pass would shade without it.
+class DepthPrepass
+{
+public:
+
+    bool enabled = false;
+
+    // Depth-only program
+    ShaderProgram depthShader;
+
+    DepthPrepass() : frame(0), prepassSamples(0), shadedSamples(0), prepassDraws(0)
+    {
+        depthShader.vertexPath = "shaders/DepthPrepassVertex.glsl";
+        depthShader.fragmentPath = "shaders/ShadowDepthFragment.glsl";
+        CreateShaderProgram(depthShader);
+
+        glGenQueries(QUERY_FRAMES * 2, &queries[0][0]);
+        for (int i = 0; i < QUERY_FRAMES; ++i)
+        {
+            pending[i] = false;
+            prepassUsed[i] = false;
+        }
+    }
+
+    ~DepthPrepass()
+    {
+        glDeleteQueries(QUERY_FRAMES * 2, &queries[0][0]);
+        glDeleteProgram(depthShader.id);
+    }
+
+    DepthPrepass(const DepthPrepass&) = delete;
+    DepthPrepass& operator=(const DepthPrepass&) = delete;
+
+    // Lay down the depth of the queued meshes (if enabled), call on the cleared target framebuffer before BeginShading
+    // The frame block must hold this frame's camera
+    void Render(const RenderQueue& queue)
+    {
+        ReadResults();
+
+        prepassDraws = 0;
+        pending[frame] = false;
+        prepassUsed[frame] = enabled;
+        if (!enabled)
+            return;
+
+        glBeginQuery(GL_SAMPLES_PASSED, queries[frame][0]);
+
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glUseProgram(depthShader.id);
+
+        int modelLoc = glGetUniformLocation(depthShader.id, "model");
+        const DrawItem* previous = nullptr;
+        Mesh* boundMesh = nullptr;
+
+        for (const DrawItem& item : queue.Items())
+        {
+            // Depth needs no materials: the submeshes of one instance are drawn as one range
+            if (previous && previous->mesh == item.mesh && std::memcmp(previous->model.data, item.model.data, sizeof(item.model.data)) == 0)
+                continue;
+            previous = &item;
+
+            if (item.mesh != boundMesh)
+            {
+                item.mesh->BindPositions();
+                boundMesh = item.mesh;
+            }
+
+            Mat4 model = item.model;
+            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, model.value_ptr());
+            glDrawElements(GL_TRIANGLES, (GLsizei)item.mesh->indices.size(), GL_UNSIGNED_INT, (void*)0);
+            prepassDraws++;
+        }
+
+        glBindVertexArray(0);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        glEndQuery(GL_SAMPLES_PASSED);
+    }
+
+    // Around the shading pass: only fragments on the pre-pass depth pass, and the depth buffer is left as it is
+    void BeginShading()
+    {
+        if (enabled)
+        {
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
+
+        glBeginQuery(GL_SAMPLES_PASSED, queries[frame][1]);
+    }
+
+    void EndShading()
+    {
+        glEndQuery(GL_SAMPLES_PASSED);
+        pending[frame] = true;
+        frame = (frame + 1) % QUERY_FRAMES;
+
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+
+    // Samples that passed the depth test in the pre-pass (the shading work without it), 0 when it was off
+    uint64_t PrepassSamples() const
+    {
+        return prepassSamples;
+    }
+
+    // Samples the shading pass ran the fragment shader for, a few frames old
+    uint64_t ShadedSamples() const
+    {
+        return shadedSamples;
+    }
+
+    // Fraction of shading the pre-pass saved, 0 when it was off
+    float OverdrawSaved() const
+    {
+        return prepassSamples > shadedSamples ? (float)(prepassSamples - shadedSamples) / prepassSamples : 0.0f;
+    }
+
+    size_t PrepassDraws() const
+    {
+        return prepassDraws;
+    }
+
+private:
+
+    // Results are read a few frames late so the CPU never waits for the GPU
+    static constexpr int QUERY_FRAMES = 3;
+
+    unsigned int queries[QUERY_FRAMES][2];     // Pre-pass, shading pass
+    bool pending[QUERY_FRAMES];
+    bool prepassUsed[QUERY_FRAMES];
+    int frame;
+
+    uint64_t prepassSamples;
+    uint64_t shadedSamples;
+    size_t prepassDraws;
+
+    // Take the results of the frame about to be reused, if the GPU has them
+    void ReadResults()
+    {
+        if (!pending[frame])
+            return;
+
+        int available = 0;
+        glGetQueryObjectiv(queries[frame][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 shaded = 0, prepass = 0;
+            glGetQueryObjectui64v(queries[frame][1], GL_QUERY_RESULT, &shaded);
+            if (prepassUsed[frame])
+                glGetQueryObjectui64v(queries[frame][0], GL_QUERY_RESULT, &prepass);
+
+            shadedSamples = shaded;
+            prepassSamples = prepass;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <lockfree_queue.h>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Watches directories on a background thread and reports files that were written
+// Uses inotify on Linux, other platforms poll modification times
+class FileWatcher
+{
+public:
+
+    FileWatcher() : changes(1024), running(true)
+    {
+#ifdef __linux__
+        inotifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFD < 0)
+            std::cerr << "Failed to initialize inotify, file watching disabled" << std::endl;
+#endif
+        thread = std::thread(&FileWatcher::Run, this);
+    }
+
+    ~FileWatcher()
+    {
+        running = false;
+        thread.join();
+
+#ifdef __linux__
+        if (inotifyFD >= 0)
+            close(inotifyFD);
+#endif
+    }
+
+    // Watch every file in the directory (not recursive)
+    void WatchDirectory(const std::string& directory)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+#ifdef __linux__
+        if (inotifyFD < 0)
+            return;
+
+        // Editors often save by writing a temporary file and renaming it over the original
+        int wd = inotify_add_watch(inotifyFD, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd < 0)
+        {
+            std::cerr << "Failed to watch directory: " << directory << std::endl;
+            return;
+        }
+
+        directories[wd] = directory;
+#else
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+        {
+            if (entry.is_regular_file())
+                timestamps[directory + "/" + entry.path().filename().generic_string()] = entry.last_write_time(error);
+        }
+
+        directories[(int)directories.size()] = directory;
+#endif
+    }
+
+    // Files changed since the last call (GL thread), paths are "directory/name"
+    void Poll(std::vector<std::string>& changed)
+    {
+        std::string path;
+        while (changes.Pop(path))
+            changed.push_back(path);
+    }
+
+private:
+    LockFreeQueue<std::string> changes;
+    std::atomic<bool> running;
+    std::thread thread;
+    std::mutex mutex;
+    std::unordered_map<int, std::string> directories;
+
+#ifdef __linux__
+    int inotifyFD = -1;
+
+    void Run()
+    {
+        alignas(inotify_event) char buffer[4096];
+
+        while (running)
+        {
+            if (inotifyFD < 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+
+            // Wake up regularly to notice shutdown
+            pollfd fd = { inotifyFD, POLLIN, 0 };
+            if (poll(&fd, 1, 100) <= 0)
+                continue;
+
+            ssize_t length = read(inotifyFD, buffer, sizeof(buffer));
+            for (ssize_t offset = 0; offset < length; )
+            {
+                const inotify_event* event = (const inotify_event*)(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+
+                if (event->len == 0)
+                    continue;
+
+                std::string path;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    auto it = directories.find(event->wd);
+                    if (it == directories.end())
+                        continue;
+                    path = it->second + "/" + event->name;
+                }
+
+                Report(path);
+            }
+        }
+    }
+#else
+    std::unordered_map<std::string, std::filesystem::file_time_type> timestamps;
+
+    void Run()
+    {
+        while (running)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+            std::vector<std::string> changed;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                for (const auto& directory : directories)
+                {
+                    std::error_code error;
+                    for (const auto& entry : std::filesystem::directory_iterator(directory.second, error))
+                    {
+                        if (!entry.is_regular_file())
+                            continue;
+
+                        std::string path = directory.second + "/" + entry.path().filename().generic_string();
+                        auto time = entry.last_write_time(error);
+
+                        auto it = timestamps.find(path);
+                        if (it == timestamps.end() || it->second != time)
+                        {
+                            bool known = (it != timestamps.end());
+                            timestamps[path] = time;
+
+                            if (known)
+                                changed.push_back(path);
+                        }
+                    }
+                }
+            }
+
+            for (const std::string& path : changed)
+                Report(path);
+        }
+    }
+#endif
+
+    void Report(std::string path)
+    {
+        // Drop the event if the GL thread is not keeping up, the file will be reported again on its next save
+        changes.Push(std::move(path));
+    }
+};
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef GPU_RESIDENCY_H
+#define GPU_RESIDENCY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// Kinds of GPU memory tracked by the ResidencyManager
+enum ResidencyCategory
+{
+    RESIDENCY_MESH,                 // Vertex and index buffers of meshes
+    RESIDENCY_TEXTURE,              // Textures uploaded by UploadTexture (LoadTexture, AssetLoader)
+    RESIDENCY_STREAMED_TEXTURE,     // Loaded levels of streamed textures, dropped through the TextureStreamer
+    RESIDENCY_CATEGORY_COUNT
+};
+
+// Accounts GPU buffers and textures, tracks the last frame each was used and keeps the total under a budget
+// Over budget, resources not used this frame are shrunk or freed, least recently used first, and restored when used again.
+// Resources are keyed by category and GL name. All calls happen on the GL thread.
+class ResidencyManager
+{
+public:
+
+    // Frees some or all of the resource, returns its new size in bytes (unchanged if it cannot shrink any further)
+    typedef std::function<size_t()> EvictFunction;
+
+    // Loads the resource in full again, returns its size in bytes
+    typedef std::function<size_t()> RestoreFunction;
+
+    ResidencyManager(size_t budgetBytes = 512 * 1024 * 1024) : budget(budgetBytes), frame(0)
+    {
+        for (int i = 0; i < RESIDENCY_CATEGORY_COUNT; ++i)
+        {
+            used[i] = 0;
+            counts[i] = 0;
+            evictedCounts[i] = 0;
+        }
+    }
+
+    ~ResidencyManager()
+    {
+        if (active == this)
+            active = nullptr;
+    }
+
+    // Manager that Mesh and the texture functions report their allocations to, null if none
+    static ResidencyManager* Active()
+    {
+        return active;
+    }
+
+    void MakeActive()
+    {
+        active = this;
+    }
+
+    // Record a new allocation, or the new size of one already tracked
+    // Resources without an evict function are never evicted but still count towards the budget
+    void Track(ResidencyCategory category, unsigned int name, size_t bytes, EvictFunction evict = nullptr, RestoreFunction restore = nullptr)
+    {
+        auto it = resources.find(Key(category, name));
+        if (it == resources.end())
+        {
+            Resource resource;
+            resource.category = category;
+            resource.lastUsed = frame;
+            it = resources.emplace(Key(category, name), resource).first;
+            counts[category]++;
+        }
+
+        Resource& resource = it->second;
+        SetBytes(resource, bytes);
+        SetEvicted(resource, false);
+        resource.evict = std::move(evict);
+        resource.restore = std::move(restore);
+    }
+
+    // The resource was deleted
+    void Untrack(ResidencyCategory category, unsigned int name)
+    {
+        auto it = resources.find(Key(category, name));
+        if (it == resources.end())
+            return;
+
+        SetBytes(it->second, 0);
+        SetEvicted(it->second, false);
+        counts[category]--;
+        resources.erase(it);
+    }
+
+    // The resource is used this frame, it is restored first if it was evicted
+    void Touch(ResidencyCategory category, unsigned int name)
+    {
+        auto it = resources.find(Key(category, name));
+        if (it == resources.end())
+            return;
+
+        it->second.lastUsed = frame;
+        if (!it->second.evicted || !it->second.restore)
+            return;
+
+        // The restore may track the resource again and replace the function, run a copy
+        RestoreFunction restore = it->second.restore;
+        size_t bytes = restore();
+
+        it = resources.find(Key(category, name));
+        if (it != resources.end())
+        {
+            SetBytes(it->second, bytes);
+            SetEvicted(it->second, false);
+        }
+    }
+
+    // Evict until the tracked memory fits the budget, then start a new frame (once per frame, after drawing)
+    // Only resources not used this frame are touched, whatever the frame still needs stays resident
+    void Update()
+    {
+        if (Used() > budget)
+            Evict(budget);
+
+        frame++;
+    }
+
+    // Shrink or free unused resources, least recently used first, until at most limit bytes are tracked
+    // Returns the bytes still tracked
+    size_t Evict(size_t limit)
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> candidates;
+        for (const auto& it : resources)
+        {
+            if (it.second.evict && it.second.lastUsed != frame)
+                candidates.push_back({ it.second.lastUsed, it.first });
+        }
+
+        std::sort(candidates.begin(), candidates.end());
+
+        size_t total = Used();
+        for (const auto& candidate : candidates)
+        {
+            // A resource shrinks step by step (e.g. one mip level at a time) until it stops getting smaller
+            while (total > limit)
+            {
+                auto it = resources.find(candidate.second);
+                if (it == resources.end())
+                    break;
+
+                EvictFunction evict = it->second.evict;
+                size_t bytes = evict();
+
+                it = resources.find(candidate.second);
+                if (it == resources.end() || bytes >= it->second.bytes)
+                    break;
+
+                SetBytes(it->second, bytes);
+                SetEvicted(it->second, true);
+                total = Used();
+            }
+
+            if (total <= limit)
+                break;
+        }
+
+        return total;
+    }
+
+    // Bytes tracked in the category
+    size_t Used(ResidencyCategory category) const
+    {
+        return used[category];
+    }
+
+    // Bytes tracked across all categories
+    size_t Used() const
+    {
+        size_t total = 0;
+        for (int i = 0; i < RESIDENCY_CATEGORY_COUNT; ++i)
+            total += used[i];
+        return total;
+    }
+
+    // Resources tracked in the category, and how many of them are evicted or shrunk
+    size_t Count(ResidencyCategory category) const
+    {
+        return counts[category];
+    }
+
+    size_t EvictedCount(ResidencyCategory category) const
+    {
+        return evictedCounts[category];
+    }
+
+    size_t Budget() const
+    {
+        return budget;
+    }
+
+    void SetBudget(size_t budgetBytes)
+    {
+        budget = budgetBytes;
+    }
+
+    // Live usage per category
+    void Report(std::ostream& stream) const
+    {
+        const double MB = 1024.0 * 1024.0;
+
+        stream << "GPU memory: " << Used() / MB << " / " << budget / MB << " MB" << std::endl;
+        for (int i = 0; i < RESIDENCY_CATEGORY_COUNT; ++i)
+        {
+            ResidencyCategory category = (ResidencyCategory)i;
+            stream << "  " << CategoryName(category) << ": " << Used(category) / MB << " MB, "
+                << Count(category) << " resources, " << EvictedCount(category) << " evicted" << std::endl;
+        }
+    }
+
+    static const char* CategoryName(ResidencyCategory category)
+    {
+        switch (category)
+        {
+        case RESIDENCY_MESH: return "Meshes";
+        case RESIDENCY_TEXTURE: return "Textures";
+        case RESIDENCY_STREAMED_TEXTURE: return "Streamed textures";
+        default: return "Unknown";
+        }
+    }
+
+private:
+
+    struct Resource
+    {
+        ResidencyCategory category = RESIDENCY_MESH;
+        size_t bytes = 0;
+        uint64_t lastUsed = 0;
+        bool evicted = false;       // Shrunk or freed since it was last restored
+        EvictFunction evict;
+        RestoreFunction restore;
+    };
+
+    static inline ResidencyManager* active = nullptr;
+
+    std::unordered_map<uint64_t, Resource> resources;
+    size_t used[RESIDENCY_CATEGORY_COUNT];
+    size_t counts[RESIDENCY_CATEGORY_COUNT];
+    size_t evictedCounts[RESIDENCY_CATEGORY_COUNT];
+    size_t budget;
+    uint64_t frame;
+
+    static uint64_t Key(ResidencyCategory category, unsigned int name)
+    {
+        return ((uint64_t)category << 32) | name;
+    }
+
+    void SetBytes(Resource& resource, size_t bytes)
+    {
+        used[resource.category] += bytes;
+        used[resource.category] -= resource.bytes;
+        resource.bytes = bytes;
+    }
+
+    void SetEvicted(Resource& resource, bool evicted)
+    {
+        if (resource.evicted == evicted)
+            return;
+
+        resource.evicted = evicted;
+        if (evicted)
+            evictedCounts[resource.category]++;
+        else
+            evictedCounts[resource.category]--;
+    }
+};
+
+#endif
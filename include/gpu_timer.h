@@ -0,0 +1,123 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// GPU time of the named stages of a frame, from timestamp queries
+// Stage marks the start of a stage and the end of the one before, so stages need no nesting rules and any pass can
+// add one. Results are read a few frames late so the CPU never waits for the GPU.
+class GpuTimer
+{
+public:
+
+    static constexpr int MAX_STAGES = 16;
+
+    GpuTimer() : frame(0), recording(false)
+    {
+        glGenQueries(FRAMES * (MAX_STAGES + 1), &queries[0][0]);
+        for (int i = 0; i < FRAMES; ++i)
+            stageCounts[i] = 0;
+    }
+
+    ~GpuTimer()
+    {
+        glDeleteQueries(FRAMES * (MAX_STAGES + 1), &queries[0][0]);
+    }
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    // Start recording a frame, picking up the results of the frame that used these queries before if they are in
+    void BeginFrame()
+    {
+        ReadResults();
+
+        stageCounts[frame] = 0;
+        recording = true;
+    }
+
+    // Everything submitted from here until the next Stage or EndFrame counts as this stage
+    // The name must outlive the readback (a literal). A stage named like the one before continues it, stages beyond
+    // MAX_STAGES are folded into the last one
+    void Stage(const char* name)
+    {
+        if (!recording || stageCounts[frame] >= MAX_STAGES)
+            return;
+
+        if (stageCounts[frame] > 0 && std::strcmp(names[frame][stageCounts[frame] - 1], name) == 0)
+            return;
+
+        int stage = stageCounts[frame]++;
+        names[frame][stage] = name;
+        glQueryCounter(queries[frame][stage], GL_TIMESTAMP);
+    }
+
+    void EndFrame()
+    {
+        if (!recording)
+            return;
+
+        glQueryCounter(queries[frame][stageCounts[frame]], GL_TIMESTAMP);
+        recording = false;
+        frame = (frame + 1) % FRAMES;
+    }
+
+    // Milliseconds per stage of the latest frame read back
+    const std::vector<std::pair<std::string, double>>& Results() const
+    {
+        return results;
+    }
+
+    void Report(std::ostream& out) const
+    {
+        double total = 0.0;
+        out << "GPU:";
+        for (const std::pair<std::string, double>& result : results)
+        {
+            out << " " << result.first << " " << result.second << " ms,";
+            total += result.second;
+        }
+        out << " total " << total << " ms" << std::endl;
+    }
+
+private:
+
+    static constexpr int FRAMES = 3;
+
+    unsigned int queries[FRAMES][MAX_STAGES + 1];   // Start of each stage, then the end of the frame
+    const char* names[FRAMES][MAX_STAGES];
+    int stageCounts[FRAMES];
+    int frame;
+    bool recording;
+
+    std::vector<std::pair<std::string, double>> results;
+
+    void ReadResults()
+    {
+        int count = stageCounts[frame];
+        if (count == 0)
+            return;
+
+        // The end of the frame comes last, everything before it is in once it is
+        int available = 0;
+        glGetQueryObjectiv(queries[frame][count], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+
+        GLuint64 timestamps[MAX_STAGES + 1];
+        for (int i = 0; i <= count; ++i)
+            glGetQueryObjectui64v(queries[frame][i], GL_QUERY_RESULT, &timestamps[i]);
+
+        results.clear();
+        for (int i = 0; i < count; ++i)
+            results.push_back({ names[frame][i], (timestamps[i + 1] - timestamps[i]) / 1000000.0 });
+    }
+};
+
+#endif
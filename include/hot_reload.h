@@ -0,0 +1,126 @@
+#ifndef HOT_RELOAD_H
+#define HOT_RELOAD_H
+
+#include <asset_loader.h>
+#include <file_watcher.h>
+#include <material.h>
+#include <shader.h>
+#include <shader_variants.h>
+#include <texture_streamer.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Reloads shaders, textures and meshes when their files change on disk
+// Files are read on the loader's workers, GL objects are swapped between frames in AssetLoader::ProcessUploads
+class HotReloader
+{
+public:
+
+    HotReloader(AssetLoader& loader) : loader(loader), streamer(nullptr) {}
+
+    // Textures are owned by the streamer instead of the loader
+    void SetTextureStreamer(TextureStreamer* textureStreamer)
+    {
+        streamer = textureStreamer;
+    }
+
+    // Watch every file in the directory
+    void WatchDirectory(const std::string& directory)
+    {
+        watcher.WatchDirectory(directory);
+    }
+
+    // Rebuild the program when one of its sources changes
+    void AddShader(ShaderProgram& shader)
+    {
+        shaders.push_back(&shader);
+    }
+
+    // Rebuild every compiled variant when one of the sources changes
+    void AddShader(ShaderVariants& variants)
+    {
+        shaderVariants.push_back(&variants);
+    }
+
+    // Dispatch changes (GL thread, once per frame)
+    void Update()
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        std::vector<std::string> changed;
+        watcher.Poll(changed);
+
+        // Editors write a file in several steps, wait until it has been quiet for a moment
+        for (const std::string& path : changed)
+            pending[MaterialRegistry::NormalizePath(path)] = now;
+
+        for (auto it = pending.begin(); it != pending.end(); )
+        {
+            if (now - it->second < std::chrono::milliseconds(100))
+            {
+                ++it;
+                continue;
+            }
+
+            Reload(it->first);
+            it = pending.erase(it);
+        }
+    }
+
+private:
+    AssetLoader& loader;
+    TextureStreamer* streamer;
+    FileWatcher watcher;
+    std::vector<ShaderProgram*> shaders;
+    std::vector<ShaderVariants*> shaderVariants;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> pending;
+
+    // Whether a shader includes the file (dependencies are normalized by the shader preprocessor)
+    static bool DependsOn(const std::vector<std::string>& dependencies, const std::string& path)
+    {
+        for (const std::string& dependency : dependencies)
+        {
+            if (MaterialRegistry::NormalizePath(dependency) == path)
+                return true;
+        }
+        return false;
+    }
+
+    // Reload only the resources built from this file
+    void Reload(const std::string& path)
+    {
+        bool used = false;
+
+        for (ShaderProgram* shader : shaders)
+        {
+            if (DependsOn(shader->dependencies, path) || MaterialRegistry::NormalizePath(shader->vertexPath) == path || MaterialRegistry::NormalizePath(shader->fragmentPath) == path
+                || (!shader->geometryPath.empty() && MaterialRegistry::NormalizePath(shader->geometryPath) == path))
+            {
+                loader.ReloadShader(*shader);
+                used = true;
+            }
+        }
+
+        // Variants are rebuilt on the spot, there can be several programs per file and they keep their cache entries
+        for (ShaderVariants* variants : shaderVariants)
+        {
+            if (variants->DependsOn(path) || MaterialRegistry::NormalizePath(variants->vertexPath) == path || MaterialRegistry::NormalizePath(variants->fragmentPath) == path)
+            {
+                variants->Reload();
+                used = true;
+            }
+        }
+
+        used |= streamer ? streamer->Reload(path) : loader.ReloadTexture(path);
+        used |= loader.ReloadMesh(path);
+
+        if (used)
+            std::cout << "Reloading " << path << std::endl;
+    }
+};
+
+#endif
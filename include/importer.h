@@ -0,0 +1,203 @@
+#ifndef IMPORTER_H
+#define IMPORTER_H
+
+#include <mesh.h>
+#include <vec3.h>
+#include <vec2.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Assimp is only linked when MG3D_WITH_ASSIMP is defined (add assimp-vc143-mt.lib to lib/)
+#ifdef MG3D_WITH_ASSIMP
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#ifdef _MSC_VER
+#pragma comment(lib, "assimp-vc143-mt.lib")
+#endif
+#endif
+
+// CPU-side mesh data, ready to be uploaded as a Mesh
+struct MeshData
+{
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    Material material;
+    std::string texturePath; // Diffuse texture of the material (empty if none)
+};
+
+#ifdef MG3D_WITH_ASSIMP
+// Post-processing steps used for every import
+//  - JoinIdenticalVertices turns the triangle soup into an indexed mesh
+//  - ImproveCacheLocality reorders triangles for the post-transform vertex cache
+//  - OptimizeMeshes / OptimizeGraph merge small meshes and collapse the node hierarchy to cut draw calls
+const unsigned int IMPORT_FLAGS =
+    aiProcess_Triangulate |
+    aiProcess_JoinIdenticalVertices |
+    aiProcess_GenSmoothNormals |
+    aiProcess_SortByPType |
+    aiProcess_FindDegenerates |
+    aiProcess_FindInvalidData |
+    aiProcess_RemoveRedundantMaterials |
+    aiProcess_ImproveCacheLocality |
+    aiProcess_OptimizeMeshes |
+    aiProcess_OptimizeGraph;
+#endif
+
+// Model importer (OBJ, FBX, glTF, DAE, ... through Assimp)
+class ModelImporter
+{
+public:
+
+    // False when built without MG3D_WITH_ASSIMP, Load always fails then
+    static bool Available()
+    {
+#ifdef MG3D_WITH_ASSIMP
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Load every mesh of the file, node transforms are baked into the vertices
+    bool Load(const std::string& filename, std::vector<MeshData>& meshes)
+    {
+#ifdef MG3D_WITH_ASSIMP
+        Assimp::Importer importer;
+
+        // Only triangles are drawn, drop points and lines during SortByPType
+        importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);
+
+        const aiScene* scene = importer.ReadFile(filename, IMPORT_FLAGS);
+
+        // Check if the scene was loaded successfully
+        if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) || !scene->mRootNode)
+        {
+            std::cerr << "Failed to import model: " << filename << " (" << importer.GetErrorString() << ")" << std::endl;
+            return false;
+        }
+
+        std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+
+        ProcessNode(scene, scene->mRootNode, aiMatrix4x4(), directory, meshes);
+
+        return true;
+#else
+        (void)meshes;
+        std::cerr << "Failed to import model: " << filename << " (built without MG3D_WITH_ASSIMP)" << std::endl;
+        return false;
+#endif
+    }
+
+#ifdef MG3D_WITH_ASSIMP
+private:
+
+    // Walk the node hierarchy accumulating transforms
+    void ProcessNode(const aiScene* scene, const aiNode* node, const aiMatrix4x4& parentTransform, const std::string& directory, std::vector<MeshData>& meshes)
+    {
+        aiMatrix4x4 transform = parentTransform * node->mTransformation;
+
+        for (unsigned int i = 0; i < node->mNumMeshes; ++i)
+        {
+            const aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+
+            if (!(mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE))
+                continue;
+
+            meshes.push_back(ConvertMesh(scene, mesh, transform, directory));
+        }
+
+        for (unsigned int i = 0; i < node->mNumChildren; ++i)
+        {
+            ProcessNode(scene, node->mChildren[i], transform, directory, meshes);
+        }
+    }
+
+    // Convert aiMesh to engine vertices and indices
+    MeshData ConvertMesh(const aiScene* scene, const aiMesh* mesh, const aiMatrix4x4& transform, const std::string& directory)
+    {
+        MeshData data;
+
+        // Normals are transformed by the inverse transpose
+        aiMatrix3x3 normalTransform = aiMatrix3x3(transform);
+        normalTransform.Inverse().Transpose();
+
+        data.vertices.reserve(mesh->mNumVertices);
+
+        for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
+        {
+            aiVector3D position = transform * mesh->mVertices[i];
+
+            Vertex vertex;
+            vertex.position = Vec3(position.x, position.y, position.z);
+
+            if (mesh->HasNormals())
+            {
+                aiVector3D normal = (normalTransform * mesh->mNormals[i]).Normalize();
+                vertex.normal = Vec3(normal.x, normal.y, normal.z);
+            }
+
+            if (mesh->HasTextureCoords(0))
+            {
+                vertex.texture = Vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
+            }
+
+            data.vertices.push_back(vertex);
+        }
+
+        data.indices.reserve(mesh->mNumFaces * 3);
+
+        for (unsigned int i = 0; i < mesh->mNumFaces; ++i)
+        {
+            const aiFace& face = mesh->mFaces[i];
+
+            // Degenerate faces left over by FindDegenerates are skipped
+            if (face.mNumIndices != 3)
+                continue;
+
+            data.indices.push_back(face.mIndices[0]);
+            data.indices.push_back(face.mIndices[1]);
+            data.indices.push_back(face.mIndices[2]);
+        }
+
+        ConvertMaterial(scene->mMaterials[mesh->mMaterialIndex], directory, data);
+
+        return data;
+    }
+
+    // Convert aiMaterial to the engine material (texture is resolved by the caller)
+    void ConvertMaterial(const aiMaterial* material, const std::string& directory, MeshData& data)
+    {
+        aiColor3D ambient(0.1f, 0.1f, 0.1f);
+        aiColor3D diffuse(0.8f, 0.8f, 0.8f);
+        aiColor3D specular(1.0f, 1.0f, 1.0f);
+        float shininess = 32.0f;
+
+        material->Get(AI_MATKEY_COLOR_AMBIENT, ambient);
+        material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse);
+        material->Get(AI_MATKEY_COLOR_SPECULAR, specular);
+        material->Get(AI_MATKEY_SHININESS, shininess);
+
+        data.material.texture = 0;
+        data.material.ambient = Vec3(ambient.r, ambient.g, ambient.b);
+        data.material.diffuse = Vec3(diffuse.r, diffuse.g, diffuse.b);
+        data.material.specular = Vec3(specular.r, specular.g, specular.b);
+        data.material.shininess = (shininess > 0.0f) ? shininess : 32.0f;
+
+        aiString texturePath;
+        if (material->GetTexture(aiTextureType_DIFFUSE, 0, &texturePath) == AI_SUCCESS)
+        {
+            // Embedded textures ("*0") are not supported
+            if (texturePath.length > 0 && texturePath.C_Str()[0] != '*')
+            {
+                data.texturePath = directory + texturePath.C_Str();
+            }
+        }
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Vulkan format numbers used by KTX2 for the block-compressed formats we write
+const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+const uint32_t VK_FORMAT_BC1_RGB_SRGB_BLOCK = 132;
+const uint32_t VK_FORMAT_BC3_UNORM_BLOCK = 137;
+const uint32_t VK_FORMAT_BC3_SRGB_BLOCK = 138;
+const uint32_t VK_FORMAT_BC5_UNORM_BLOCK = 141;
+const uint32_t VK_FORMAT_BC7_UNORM_BLOCK = 145;
+const uint32_t VK_FORMAT_BC7_SRGB_BLOCK = 146;
+
+// 2D texture with a full or partial mip chain, level 0 is the largest
+struct KTX2Texture
+{
+    uint32_t vkFormat = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<std::vector<uint8_t>> levels;
+};
+
+namespace ktx2
+{
+    const uint8_t IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+    // Header, index and level index up to the first level entry
+    const size_t HEADER_SIZE = 80;
+    const size_t LEVEL_INDEX_ENTRY_SIZE = 24;
+
+    // Data format descriptor color models (Khronos Data Format spec)
+    const uint8_t KHR_DF_MODEL_BC1A = 128;
+    const uint8_t KHR_DF_MODEL_BC3 = 130;
+    const uint8_t KHR_DF_MODEL_BC5 = 132;
+    const uint8_t KHR_DF_MODEL_BC7 = 134;
+
+    inline bool IsSRGB(uint32_t vkFormat)
+    {
+        return vkFormat == VK_FORMAT_BC1_RGB_SRGB_BLOCK || vkFormat == VK_FORMAT_BC3_SRGB_BLOCK || vkFormat == VK_FORMAT_BC7_SRGB_BLOCK;
+    }
+
+    // Bytes per 4x4 block, 0 for formats we do not handle
+    inline uint32_t BlockSize(uint32_t vkFormat)
+    {
+        switch (vkFormat)
+        {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            return 8;
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+            return 16;
+        default:
+            return 0;
+        }
+    }
+
+    inline void Put32(std::vector<uint8_t>& out, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            out.push_back((uint8_t)(value >> (8 * i)));
+    }
+
+    inline void Put64(std::vector<uint8_t>& out, uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i)
+            out.push_back((uint8_t)(value >> (8 * i)));
+    }
+
+    inline uint32_t Get32(const uint8_t* data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+    }
+
+    inline uint64_t Get64(const uint8_t* data)
+    {
+        return Get32(data) | ((uint64_t)Get32(data + 4) << 32);
+    }
+
+    // Sample of a descriptor block: which bits of a block hold which channel
+    inline void PutSample(std::vector<uint8_t>& out, uint32_t bitOffset, uint32_t bitLength, uint32_t channel)
+    {
+        Put32(out, bitOffset | ((bitLength - 1) << 16) | (channel << 24));
+        Put32(out, 0);              // Sample position 0,0,0,0
+        Put32(out, 0);              // sampleLower
+        Put32(out, 0xFFFFFFFF);     // sampleUpper
+    }
+
+    // Basic data format descriptor for a block-compressed format
+    inline std::vector<uint8_t> DataFormatDescriptor(uint32_t vkFormat)
+    {
+        uint8_t model = 0;
+        std::vector<uint8_t> samples;
+
+        switch (vkFormat)
+        {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            model = KHR_DF_MODEL_BC1A;
+            PutSample(samples, 0, 64, 0);       // Color
+            break;
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+            model = KHR_DF_MODEL_BC3;
+            PutSample(samples, 0, 64, 15);      // Alpha
+            PutSample(samples, 64, 64, 0);      // Color
+            break;
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+            model = KHR_DF_MODEL_BC5;
+            PutSample(samples, 0, 64, 0);       // Red
+            PutSample(samples, 64, 64, 1);      // Green
+            break;
+        default:
+            model = KHR_DF_MODEL_BC7;
+            PutSample(samples, 0, 128, 0);      // Color
+            break;
+        }
+
+        uint32_t blockSize = 24 + (uint32_t)samples.size();
+
+        std::vector<uint8_t> descriptor;
+        Put32(descriptor, 4 + blockSize);                            // dfdTotalSize
+        Put32(descriptor, 0);                                        // Khronos vendor, basic descriptor type
+        Put32(descriptor, 2 | (blockSize << 16));                    // Version 1.3, block size
+        Put32(descriptor, model | (1 << 8) | ((IsSRGB(vkFormat) ? 2 : 1) << 16)); // BT.709 primaries, sRGB or linear transfer
+        Put32(descriptor, 3 | (3 << 8));                             // 4x4x1x1 texel blocks
+        Put32(descriptor, BlockSize(vkFormat));                      // Bytes in plane 0
+        Put32(descriptor, 0);
+        descriptor.insert(descriptor.end(), samples.begin(), samples.end());
+
+        return descriptor;
+    }
+}
+
+// Write a texture as KTX2 (no supercompression)
+inline bool WriteKTX2(const std::string& path, const KTX2Texture& texture)
+{
+    uint32_t blockSize = ktx2::BlockSize(texture.vkFormat);
+    if (blockSize == 0 || texture.levels.empty())
+    {
+        std::cerr << "Cannot write KTX2 file (unsupported format or no data): " << path << std::endl;
+        return false;
+    }
+
+    uint32_t levelCount = (uint32_t)texture.levels.size();
+
+    std::vector<uint8_t> descriptor = ktx2::DataFormatDescriptor(texture.vkFormat);
+
+    // Key/value data: writer name
+    const char key[] = "KTXwriter";
+    const char value[] = "MG3D";
+    std::vector<uint8_t> keyValues;
+    ktx2::Put32(keyValues, sizeof(key) + sizeof(value));
+    keyValues.insert(keyValues.end(), key, key + sizeof(key));
+    keyValues.insert(keyValues.end(), value, value + sizeof(value));
+    while (keyValues.size() % 4)
+        keyValues.push_back(0);
+
+    uint32_t dfdOffset = (uint32_t)(ktx2::HEADER_SIZE + ktx2::LEVEL_INDEX_ENTRY_SIZE * levelCount);
+    uint32_t kvdOffset = dfdOffset + (uint32_t)descriptor.size();
+    uint64_t dataOffset = kvdOffset + keyValues.size();
+
+    // Levels are stored smallest first, each aligned to the block size
+    std::vector<uint64_t> levelOffsets(levelCount);
+    uint64_t offset = dataOffset;
+    for (uint32_t level = levelCount; level-- > 0; )
+    {
+        offset = (offset + blockSize - 1) / blockSize * blockSize;
+        levelOffsets[level] = offset;
+        offset += texture.levels[level].size();
+    }
+
+    std::vector<uint8_t> header(ktx2::IDENTIFIER, ktx2::IDENTIFIER + 12);
+    ktx2::Put32(header, texture.vkFormat);
+    ktx2::Put32(header, 1);                 // typeSize
+    ktx2::Put32(header, texture.width);
+    ktx2::Put32(header, texture.height);
+    ktx2::Put32(header, 0);                 // pixelDepth
+    ktx2::Put32(header, 0);                 // layerCount
+    ktx2::Put32(header, 1);                 // faceCount
+    ktx2::Put32(header, levelCount);
+    ktx2::Put32(header, 0);                 // supercompressionScheme
+    ktx2::Put32(header, dfdOffset);
+    ktx2::Put32(header, (uint32_t)descriptor.size());
+    ktx2::Put32(header, kvdOffset);
+    ktx2::Put32(header, (uint32_t)keyValues.size());
+    ktx2::Put64(header, 0);                 // No supercompression global data
+    ktx2::Put64(header, 0);
+
+    for (uint32_t level = 0; level < levelCount; ++level)
+    {
+        ktx2::Put64(header, levelOffsets[level]);
+        ktx2::Put64(header, texture.levels[level].size());
+        ktx2::Put64(header, texture.levels[level].size());
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open file for writing: " << path << std::endl;
+        return false;
+    }
+
+    file.write((const char*)header.data(), header.size());
+    file.write((const char*)descriptor.data(), descriptor.size());
+    file.write((const char*)keyValues.data(), keyValues.size());
+
+    uint64_t position = dataOffset;
+    for (uint32_t level = levelCount; level-- > 0; )
+    {
+        const char padding[16] = {};
+        file.write(padding, levelOffsets[level] - position);
+        file.write((const char*)texture.levels[level].data(), texture.levels[level].size());
+        position = levelOffsets[level] + texture.levels[level].size();
+    }
+
+    return (bool)file;
+}
+
+// Read a KTX2 file holding one of the block-compressed formats above
+// Only levels [firstLevel, firstLevel + levelCount) are loaded, the others are left empty (levelCount 0 reads the header only)
+// With a destination the levels are read into the memory it returns instead of texture.levels (null aborts the read)
+inline bool ReadKTX2(const std::string& path, KTX2Texture& texture, uint32_t firstLevel = 0, uint32_t levelCount = UINT32_MAX,
+    const std::function<uint8_t*(uint32_t level, uint64_t length)>& destination = nullptr)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open KTX2 file: " << path << std::endl;
+        return false;
+    }
+
+    uint8_t header[ktx2::HEADER_SIZE];
+    if (!file.read((char*)header, sizeof(header)) || std::memcmp(header, ktx2::IDENTIFIER, 12) != 0)
+    {
+        std::cerr << "Not a KTX2 file: " << path << std::endl;
+        return false;
+    }
+
+    texture.vkFormat = ktx2::Get32(header + 12);
+    texture.width = ktx2::Get32(header + 20);
+    texture.height = ktx2::Get32(header + 24);
+
+    uint32_t depth = ktx2::Get32(header + 28);
+    uint32_t layers = ktx2::Get32(header + 32);
+    uint32_t faces = ktx2::Get32(header + 36);
+    uint32_t fileLevels = std::max(ktx2::Get32(header + 40), 1u);
+    uint32_t supercompression = ktx2::Get32(header + 44);
+
+    if (ktx2::BlockSize(texture.vkFormat) == 0 || depth > 1 || layers > 1 || faces != 1 || supercompression != 0)
+    {
+        std::cerr << "Unsupported KTX2 texture (only plain 2D BC1/BC3/BC5/BC7): " << path << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> levelIndex(ktx2::LEVEL_INDEX_ENTRY_SIZE * fileLevels);
+    if (!file.read((char*)levelIndex.data(), levelIndex.size()))
+    {
+        std::cerr << "Truncated KTX2 file: " << path << std::endl;
+        return false;
+    }
+
+    texture.levels.assign(fileLevels, std::vector<uint8_t>());
+
+    uint32_t lastLevel = (uint32_t)std::min<uint64_t>((uint64_t)firstLevel + levelCount, fileLevels);
+    for (uint32_t level = firstLevel; level < lastLevel; ++level)
+    {
+        uint64_t offset = ktx2::Get64(&levelIndex[level * ktx2::LEVEL_INDEX_ENTRY_SIZE]);
+        uint64_t length = ktx2::Get64(&levelIndex[level * ktx2::LEVEL_INDEX_ENTRY_SIZE + 8]);
+
+        uint8_t* target;
+        if (destination)
+        {
+            target = destination(level, length);
+            if (!target)
+                return false;
+        }
+        else
+        {
+            texture.levels[level].resize((size_t)length);
+            target = texture.levels[level].data();
+        }
+
+        file.seekg((std::streamoff)offset);
+        if (!file.read((char*)target, (std::streamsize)length))
+        {
+            std::cerr << "Truncated KTX2 file: " << path << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,319 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+#include <uniform_blocks.h>
+#include <mat4.h>
+#include <vec3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Identity for a new point light, unique for the run
+inline int NextPointLightID()
+{
+    static int next = 0;
+    return next++;
+}
+
+// Point light of the scene light list, lights nothing beyond radius
+struct PointLight
+{
+    Vec3 position;
+    float radius = 5.0f;
+    Vec3 color = Vec3(1.0f, 1.0f, 1.0f);
+    float intensity = 1.0f;
+    int shadow = -1;                // Entry in the point shadow atlas, set by PointShadows, -1 if unshadowed
+
+    // Same light from frame to frame whatever its place in the list, per-light caches (shadow slots) are keyed by it
+    // Copies keep it: a copy meant as another light needs NextPointLightID()
+    int id = NextPointLightID();
+};
+
+// Shader storage bindings, layout(binding) in shaders/Clusters.glsl
+enum LightBufferBinding
+{
+    LIGHT_BUFFER_POINT_LIGHTS,      // PointLightGPU per light
+    LIGHT_BUFFER_CLUSTERS,          // Offset into the light indices and light count, per cluster
+    LIGHT_BUFFER_CLUSTER_LIGHTS,    // Light indices of every cluster, one after the other
+    LIGHT_BUFFER_COUNT
+};
+
+// std430 copy of a PointLight
+struct PointLightGPU
+{
+    float position[3];
+    float radius;
+    float color[3];                 // Intensity included
+    int shadow;
+};
+
+static_assert(sizeof(PointLightGPU) == 32, "PointLightGPU must match std430");
+
+// Clustered forward lighting: the view frustum is split into a grid of clusters, tiles on screen and exponential depth slices,
+// and every frame a CPU pass lists the point lights touching each cluster. Fragments only loop over the lights of their cluster.
+// The lights, the cluster ranges and the light indices live in shader storage buffers, the grid parameters in the ClusterBlock.
+class LightClusters
+{
+public:
+
+    // The scene light list, edit it freely between frames
+    std::vector<PointLight> lights;
+
+    LightClusters(unsigned int gridX = 16, unsigned int gridY = 9, unsigned int gridZ = 24) : gridX(gridX), gridY(gridY), gridZ(gridZ),
+        fovY(0.0f), aspect(0.0f), nearPlane(0.0f), farPlane(0.0f), assigned(0), maxPerCluster(0)
+    {
+        glGenBuffers(LIGHT_BUFFER_COUNT, buffers);
+        for (int i = 0; i < LIGHT_BUFFER_COUNT; ++i)
+            capacities[i] = 0;
+
+        ranges.resize((size_t)gridX * gridY * gridZ * 2);
+        counts.resize((size_t)gridX * gridY * gridZ);
+    }
+
+    ~LightClusters()
+    {
+        glDeleteBuffers(LIGHT_BUFFER_COUNT, buffers);
+    }
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // Perspective the clusters are built for, the cluster bounds are only recomputed when it changes
+    void SetProjection(float fovYRadians, float aspectRatio, float nearDistance, float farDistance)
+    {
+        if (fovYRadians == fovY && aspectRatio == aspect && nearDistance == nearPlane && farDistance == farPlane)
+            return;
+
+        fovY = fovYRadians;
+        aspect = aspectRatio;
+        nearPlane = nearDistance;
+        farPlane = farDistance;
+        ComputeBounds();
+    }
+
+    // Assign the lights to the clusters for this view and upload everything (GL thread, once per frame before drawing)
+    void Update(Mat4 view, float screenWidth, float screenHeight)
+    {
+        Assign(view);
+        Upload(screenWidth, screenHeight);
+    }
+
+    // Light references written by the last Update, summed over clusters, and the most lights in one cluster
+    size_t AssignedCount() const
+    {
+        return assigned;
+    }
+
+    size_t MaxPerCluster() const
+    {
+        return maxPerCluster;
+    }
+
+    size_t ClusterCount() const
+    {
+        return (size_t)gridX * gridY * gridZ;
+    }
+
+private:
+    unsigned int gridX, gridY, gridZ;
+    float fovY, aspect, nearPlane, farPlane;
+
+    // View space bounds of the clusters, x only depends on the column and slice, y on the row and slice, z on the slice
+    std::vector<float> minX, maxX;      // [slice * gridX + column]
+    std::vector<float> minY, maxY;      // [slice * gridY + row]
+    std::vector<float> sliceNear;       // Depth (distance along -z) where each slice starts, gridZ + 1 entries
+
+    std::vector<uint32_t> ranges;       // Offset and count per cluster
+    std::vector<uint32_t> counts;
+    std::vector<uint32_t> indices;
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;  // Cluster and light, in the order they were found
+    std::vector<PointLightGPU> gpuLights;
+
+    unsigned int buffers[LIGHT_BUFFER_COUNT];
+    size_t capacities[LIGHT_BUFFER_COUNT];
+    size_t assigned;
+    size_t maxPerCluster;
+
+    void ComputeBounds()
+    {
+        float tanY = std::tan(fovY * 0.5f);
+        float tanX = tanY * aspect;
+
+        sliceNear.resize(gridZ + 1);
+        for (unsigned int k = 0; k <= gridZ; ++k)
+            sliceNear[k] = nearPlane * std::pow(farPlane / nearPlane, (float)k / gridZ);
+
+        minX.resize((size_t)gridZ * gridX);
+        maxX.resize((size_t)gridZ * gridX);
+        minY.resize((size_t)gridZ * gridY);
+        maxY.resize((size_t)gridZ * gridY);
+
+        // A tile's edges are planes through the eye, the box around the slice part of it takes the extremes at both depths
+        for (unsigned int k = 0; k < gridZ; ++k)
+        {
+            float dn = sliceNear[k], df = sliceNear[k + 1];
+
+            for (unsigned int i = 0; i < gridX; ++i)
+            {
+                float a0 = (-1.0f + 2.0f * i / gridX) * tanX;
+                float a1 = (-1.0f + 2.0f * (i + 1) / gridX) * tanX;
+                minX[k * gridX + i] = std::min(a0 * dn, a0 * df);
+                maxX[k * gridX + i] = std::max(a1 * dn, a1 * df);
+            }
+
+            for (unsigned int j = 0; j < gridY; ++j)
+            {
+                float b0 = (-1.0f + 2.0f * j / gridY) * tanY;
+                float b1 = (-1.0f + 2.0f * (j + 1) / gridY) * tanY;
+                minY[k * gridY + j] = std::min(b0 * dn, b0 * df);
+                maxY[k * gridY + j] = std::max(b1 * dn, b1 * df);
+            }
+        }
+    }
+
+    // Slice holding the depth, clamped to the grid
+    unsigned int Slice(float depth) const
+    {
+        float slice = std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * gridZ;
+        return (unsigned int)std::clamp(slice, 0.0f, (float)(gridZ - 1));
+    }
+
+    // List every light against every cluster its sphere touches, then pack the lists per cluster
+    void Assign(Mat4 view)
+    {
+        pairs.clear();
+        std::fill(counts.begin(), counts.end(), 0);
+
+        if (sliceNear.empty())
+            return;
+
+        for (uint32_t l = 0; l < (uint32_t)lights.size(); ++l)
+        {
+            const PointLight& light = lights[l];
+            const Vec3& p = light.position;
+            float r = light.radius;
+
+            // View space, the camera looks down -z (view.data is column major)
+            float cx = view.data[0][0] * p.x + view.data[1][0] * p.y + view.data[2][0] * p.z + view.data[3][0];
+            float cy = view.data[0][1] * p.x + view.data[1][1] * p.y + view.data[2][1] * p.z + view.data[3][1];
+            float cz = view.data[0][2] * p.x + view.data[1][2] * p.y + view.data[2][2] * p.z + view.data[3][2];
+            float depth = -cz;
+
+            if (depth + r < nearPlane || depth - r > farPlane)
+                continue;
+
+            unsigned int firstSlice = Slice(std::max(depth - r, nearPlane));
+            unsigned int lastSlice = Slice(std::min(depth + r, farPlane));
+
+            for (unsigned int k = firstSlice; k <= lastSlice; ++k)
+            {
+                float dz = std::max({ sliceNear[k] - depth, depth - sliceNear[k + 1], 0.0f });
+
+                // Rows and columns are sorted, stop at the first one past the sphere
+                for (unsigned int j = 0; j < gridY; ++j)
+                {
+                    float dy = std::max({ minY[k * gridY + j] - cy, cy - maxY[k * gridY + j], 0.0f });
+                    if (minY[k * gridY + j] > cy + r)
+                        break;
+                    if (dy * dy + dz * dz > r * r)
+                        continue;
+
+                    for (unsigned int i = 0; i < gridX; ++i)
+                    {
+                        float dx = std::max({ minX[k * gridX + i] - cx, cx - maxX[k * gridX + i], 0.0f });
+                        if (minX[k * gridX + i] > cx + r)
+                            break;
+                        if (dx * dx + dy * dy + dz * dz > r * r)
+                            continue;
+
+                        uint32_t cluster = i + gridX * (j + gridY * k);
+                        pairs.push_back({ cluster, l });
+                        counts[cluster]++;
+                    }
+                }
+            }
+        }
+
+        // Offsets from the counts, then the indices in place
+        uint32_t offset = 0;
+        maxPerCluster = 0;
+        for (size_t c = 0; c < counts.size(); ++c)
+        {
+            ranges[c * 2] = offset;
+            ranges[c * 2 + 1] = 0;
+            offset += counts[c];
+            maxPerCluster = std::max(maxPerCluster, (size_t)counts[c]);
+        }
+
+        indices.resize(std::max<size_t>(pairs.size(), 1));
+        for (const auto& pair : pairs)
+        {
+            uint32_t& count = ranges[pair.first * 2 + 1];
+            indices[ranges[pair.first * 2] + count] = pair.second;
+            count++;
+        }
+
+        assigned = pairs.size();
+    }
+
+    void Upload(float screenWidth, float screenHeight)
+    {
+        gpuLights.resize(std::max<size_t>(lights.size(), 1));
+        for (size_t i = 0; i < lights.size(); ++i)
+        {
+            const PointLight& light = lights[i];
+            PointLightGPU& gpu = gpuLights[i];
+            gpu.position[0] = light.position.x;
+            gpu.position[1] = light.position.y;
+            gpu.position[2] = light.position.z;
+            gpu.radius = light.radius;
+            gpu.color[0] = light.color.x * light.intensity;
+            gpu.color[1] = light.color.y * light.intensity;
+            gpu.color[2] = light.color.z * light.intensity;
+            gpu.shadow = light.shadow;
+        }
+
+        UploadBuffer(LIGHT_BUFFER_POINT_LIGHTS, gpuLights.data(), gpuLights.size() * sizeof(PointLightGPU));
+        UploadBuffer(LIGHT_BUFFER_CLUSTERS, ranges.data(), ranges.size() * sizeof(uint32_t));
+        UploadBuffer(LIGHT_BUFFER_CLUSTER_LIGHTS, indices.data(), indices.size() * sizeof(uint32_t));
+
+        if (UniformBuffers* uniforms = UniformBuffers::Active())
+        {
+            float logRange = std::log(farPlane / nearPlane);
+
+            ClusterBlock block = {};
+            block.grid[0] = gridX;
+            block.grid[1] = gridY;
+            block.grid[2] = gridZ;
+            block.grid[3] = (unsigned int)lights.size();
+            block.depth[0] = nearPlane;
+            block.depth[1] = farPlane;
+            block.depth[2] = gridZ / logRange;
+            block.depth[3] = -(float)gridZ * std::log(nearPlane) / logRange;
+            block.screen[0] = screenWidth;
+            block.screen[1] = screenHeight;
+            uniforms->Upload(block);
+        }
+    }
+
+    // Grow the buffer when the data outgrows it (orphaning the old storage), bind it to its slot
+    void UploadBuffer(LightBufferBinding binding, const void* data, size_t size)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[binding]);
+
+        if (size > capacities[binding])
+        {
+            capacities[binding] = std::max(size, capacities[binding] * 2);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, capacities[binding], nullptr, GL_DYNAMIC_DRAW);
+        }
+
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffers[binding]);
+    }
+};
+
+#endif
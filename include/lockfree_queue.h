@@ -0,0 +1,122 @@
+#ifndef LOCKFREE_QUEUE_H
+#define LOCKFREE_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Bounded multi-producer multi-consumer queue (Vyukov ring buffer)
+// Every slot carries a sequence number, producers and consumers only contend on one atomic each
+template <typename T>
+class LockFreeQueue
+{
+public:
+
+    // Capacity is rounded up to a power of two
+    explicit LockFreeQueue(size_t capacity = 256)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+
+        slots = std::vector<Slot>(size);
+        mask = size - 1;
+
+        for (size_t i = 0; i < size; ++i)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    LockFreeQueue(const LockFreeQueue&) = delete;
+    LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+    // Returns false if the queue is full
+    bool Push(T&& value)
+    {
+        Slot* slot;
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            slot = &slots[pos & mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->value = std::move(value);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool Pop(T& value)
+    {
+        Slot* slot;
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            slot = &slots[pos & mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+            if (diff == 0)
+            {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = std::move(slot->value);
+        slot->sequence.store(pos + mask + 1, std::memory_order_release);
+
+        return true;
+    }
+
+private:
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+
+        Slot() : sequence(0), value() {}
+        Slot(Slot&& other) : sequence(other.sequence.load(std::memory_order_relaxed)), value(std::move(other.value)) {}
+    };
+
+    std::vector<Slot> slots;
+    size_t mask;
+
+    // Producer and consumer positions live on separate cache lines
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+};
+
+#endif
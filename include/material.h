@@ -0,0 +1,306 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <mesh.h>
+#include <texture_manager.h>
+#include <texture_array.h>
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Material registry, identical materials and textures are shared across every loaded file
+// Each registered material holds a handle to its texture and lives while meshes reference it: Mesh adds a reference per
+// submesh when it is uploaded and drops it when the submesh is replaced or the mesh deleted. The last material using
+// a texture lets it go, and the TextureManager frees it with its last handle.
+class MaterialRegistry
+{
+public:
+
+    MaterialRegistry(TextureManager& textureManager) : textureManager(textureManager), textureArray(nullptr) {}
+
+    ~MaterialRegistry()
+    {
+        if (active == this)
+            active = nullptr;
+    }
+
+    MaterialRegistry(const MaterialRegistry&) = delete;
+    MaterialRegistry& operator=(const MaterialRegistry&) = delete;
+
+    // Registry that meshes take their material references from, null if none
+    static MaterialRegistry* Active()
+    {
+        return active;
+    }
+
+    void MakeActive()
+    {
+        active = this;
+    }
+
+    // Register a material, returns the ID of an identical one if it already exists
+    // The material is freed once the meshes referencing it are gone, IDs of freed materials are reused
+    unsigned int Register(const Material& material)
+    {
+        size_t hash = Hash(material);
+
+        // Take over the handle ApplyTexture kept for this material
+        TextureHandle texture = TakeAppliedTexture(material.texture);
+
+        auto range = lookup.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (Equal(materials[it->second].material, material))
+                return it->second;
+        }
+
+        unsigned int id;
+        if (!freeIDs.empty())
+        {
+            id = freeIDs.back();
+            freeIDs.pop_back();
+        }
+        else
+        {
+            id = (unsigned int)materials.size();
+            materials.emplace_back();
+        }
+
+        // Materials pointing at a texture of the manager without going through ApplyTexture (copies of a registered
+        // material) hold it too, textures of arrays and page tables are not the manager's and get no handle
+        Entry& entry = materials[id];
+        entry.material = material;
+        entry.texture = texture ? std::move(texture) : textureManager.Reference(material.texture);
+        entry.references = 0;
+        lookup.emplace(hash, id);
+
+        return id;
+    }
+
+    // Reference counting of registered materials, done by Mesh for its submeshes
+    void AddRef(unsigned int id)
+    {
+        if (id < materials.size())
+            materials[id].references++;
+    }
+
+    // Free the material and let go of its texture once nothing references it
+    void Release(unsigned int id)
+    {
+        if (id >= materials.size() || materials[id].references <= 0 || --materials[id].references > 0)
+            return;
+
+        Entry& entry = materials[id];
+        auto range = lookup.equal_range(Hash(entry.material));
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == id)
+            {
+                lookup.erase(it);
+                break;
+            }
+        }
+
+        entry.texture = TextureHandle();
+        freeIDs.push_back(id);
+    }
+
+    // Material by ID
+    const Material& Get(unsigned int id) const
+    {
+        return materials[id].material;
+    }
+
+    // Number of material IDs handed out, including freed ones waiting for reuse
+    size_t Count() const
+    {
+        return materials.size();
+    }
+
+    // Texture loaded once per file, kept alive until a material using it is registered
+    unsigned int GetTexture(const std::string& path)
+    {
+        TextureHandle texture = textureManager.Acquire(path);
+        unsigned int id = texture.GetID();
+
+        appliedTextures.push_back(std::move(texture));
+
+        return id;
+    }
+
+    // Point the material at the image: its layer if it was packed into the texture array, its own texture otherwise
+    void ApplyTexture(Material& material, const std::string& path)
+    {
+        if (textureArray && textureArray->Apply(material, path))
+            return;
+
+        material.texture = GetTexture(path);
+        material.virtualTexture = -1;
+        material.layer = -1;
+        material.uvOffset = Vec2(0.0f, 0.0f);
+        material.uvScale = Vec2(1.0f, 1.0f);
+    }
+
+    // Pack material textures into this array when they were added to it
+    void SetTextureArray(const TextureArrayPacker* packer)
+    {
+        textureArray = packer;
+    }
+
+    // Texture already loaded from this file, 0 if none
+    unsigned int FindTexture(const std::string& path) const
+    {
+        return textureManager.Find(path);
+    }
+
+    // Number of unique textures held by the registry
+    size_t TextureCount() const
+    {
+        std::unordered_set<unsigned int> textures;
+        for (const Entry& entry : materials)
+        {
+            if (entry.texture)
+                textures.insert(entry.texture.GetID());
+        }
+        for (const TextureHandle& texture : appliedTextures)
+            textures.insert(texture.GetID());
+
+        return textures.size();
+    }
+
+    // Texture cache used for material textures
+    TextureManager& Textures()
+    {
+        return textureManager;
+    }
+
+    // Use forward slashes and drop "./" so the same file always maps to one key
+    static std::string NormalizePath(std::string path)
+    {
+        for (char& c : path)
+        {
+            if (c == '\\')
+                c = '/';
+        }
+
+        size_t pos;
+        while ((pos = path.find("/./")) != std::string::npos)
+            path.erase(pos, 2);
+
+        if (path.compare(0, 2, "./") == 0)
+            path.erase(0, 2);
+
+        return path;
+    }
+
+private:
+    struct Entry
+    {
+        Material material = Material();
+        TextureHandle texture;      // Empty when the texture is not the TextureManager's or the material was freed
+        int references = 0;
+    };
+
+    std::vector<Entry> materials;
+    std::vector<unsigned int> freeIDs;
+    std::unordered_multimap<size_t, unsigned int> lookup;
+    std::vector<TextureHandle> appliedTextures;     // Applied to materials that have not been registered yet
+    TextureManager& textureManager;
+    const TextureArrayPacker* textureArray;
+
+    static inline MaterialRegistry* active = nullptr;
+
+    // One handle ApplyTexture kept for this texture, empty if there is none
+    TextureHandle TakeAppliedTexture(unsigned int id)
+    {
+        for (size_t i = 0; i < appliedTextures.size(); ++i)
+        {
+            if (appliedTextures[i].GetID() == id)
+            {
+                TextureHandle texture = std::move(appliedTextures[i]);
+                appliedTextures[i] = std::move(appliedTextures.back());
+                appliedTextures.pop_back();
+                return texture;
+            }
+        }
+
+        return TextureHandle();
+    }
+
+    static bool Equal(const Material& a, const Material& b)
+    {
+        return a.texture == b.texture &&
+            a.ambient.x == b.ambient.x && a.ambient.y == b.ambient.y && a.ambient.z == b.ambient.z &&
+            a.diffuse.x == b.diffuse.x && a.diffuse.y == b.diffuse.y && a.diffuse.z == b.diffuse.z &&
+            a.specular.x == b.specular.x && a.specular.y == b.specular.y && a.specular.z == b.specular.z &&
+            a.shininess == b.shininess && a.layer == b.layer &&
+            a.uvOffset.x == b.uvOffset.x && a.uvOffset.y == b.uvOffset.y && a.uvScale.x == b.uvScale.x && a.uvScale.y == b.uvScale.y &&
+            a.virtualTexture == b.virtualTexture && a.virtualSize == b.virtualSize;
+    }
+
+    static size_t Hash(const Material& material)
+    {
+        std::hash<float> hashFloat;
+        size_t hash = std::hash<unsigned int>()(material.texture);
+
+        const float values[] = {
+            material.ambient.x, material.ambient.y, material.ambient.z,
+            material.diffuse.x, material.diffuse.y, material.diffuse.z,
+            material.specular.x, material.specular.y, material.specular.z,
+            material.shininess, (float)material.layer,
+            material.uvOffset.x, material.uvOffset.y, material.uvScale.x, material.uvScale.y,
+            (float)material.virtualTexture, material.virtualSize
+        };
+
+        for (float value : values)
+            hash ^= hashFloat(value) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+        return hash;
+    }
+};
+
+inline void Mesh::SetSubMeshes(const std::vector<SubMesh>& submeshes)
+{
+    // Reference the new materials before releasing the old ones, a reload usually keeps most of them
+    MaterialRegistry* previousRegistry = registry;
+    std::vector<SubMesh> previous = std::move(this->submeshes);
+
+    registry = MaterialRegistry::Active();
+    this->submeshes = submeshes;
+    if (registry)
+    {
+        for (const SubMesh& submesh : this->submeshes)
+        {
+            if (submesh.materialID != INVALID_MATERIAL)
+                registry->AddRef(submesh.materialID);
+        }
+    }
+
+    if (previousRegistry)
+    {
+        for (const SubMesh& submesh : previous)
+        {
+            if (submesh.materialID != INVALID_MATERIAL)
+                previousRegistry->Release(submesh.materialID);
+        }
+    }
+}
+
+inline void Mesh::ReleaseMaterials()
+{
+    if (registry)
+    {
+        for (const SubMesh& submesh : submeshes)
+        {
+            if (submesh.materialID != INVALID_MATERIAL)
+                registry->Release(submesh.materialID);
+        }
+    }
+
+    registry = nullptr;
+}
+
+#endif
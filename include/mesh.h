@@ -1,8 +1,12 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 #include <glad/glad.h>
+#include <gpu_residency.h>
+#include <uniform_blocks.h>
 #include <mat4.h>
 #include <vec3.h>
 #include <vec2.h>
@@ -23,8 +27,30 @@ struct Material
     Vec3 diffuse;
     Vec3 specular;
     float shininess;
+
+    // texture is a GL_TEXTURE_2D_ARRAY when layer >= 0, the image covers uvOffset to uvOffset + uvScale of the layer
+    int layer = -1;
+    Vec2 uvOffset = Vec2(0.0f, 0.0f);
+    Vec2 uvScale = Vec2(1.0f, 1.0f);
+
+    // texture is the page table of a virtual texture when virtualTexture >= 0 (see VirtualTextureSystem)
+    int virtualTexture = -1;
+    float virtualSize = 0.0f;
+};
+
+// Range of the index buffer drawn with one material
+struct SubMesh
+{
+    unsigned int indexOffset;
+    unsigned int indexCount;
+    unsigned int materialID; // Registry ID, identical materials share an ID (INVALID_MATERIAL if unregistered)
+    Material material;
 };
 
+const unsigned int INVALID_MATERIAL = ~0u;
+
+class MaterialRegistry;
+
 struct Light {
     Vec3 position;
     Vec3 ambient;
@@ -32,29 +58,230 @@ struct Light {
     Vec3 specular;
 };
 
+// std140 copies for the uniform blocks
+inline LightBlock LightUniforms(const Light& light, int shadowIndex = -1)
+{
+    LightBlock block = {};
+    block.shadowIndex = shadowIndex;
+    const Vec3* fields[4] = { &light.position, &light.ambient, &light.diffuse, &light.specular };
+    float* targets[4] = { block.position, block.ambient, block.diffuse, block.specular };
+
+    for (int i = 0; i < 4; ++i)
+    {
+        targets[i][0] = fields[i]->x;
+        targets[i][1] = fields[i]->y;
+        targets[i][2] = fields[i]->z;
+    }
+    return block;
+}
+
+inline MaterialBlock MaterialUniforms(const Material& material)
+{
+    MaterialBlock block = {};
+    const Vec3* fields[3] = { &material.ambient, &material.diffuse, &material.specular };
+    float* targets[3] = { block.ambient, block.diffuse, block.specular };
+
+    for (int i = 0; i < 3; ++i)
+    {
+        targets[i][0] = fields[i]->x;
+        targets[i][1] = fields[i]->y;
+        targets[i][2] = fields[i]->z;
+    }
+
+    block.shininess = material.shininess;
+    block.layer = material.layer;
+    block.virtualTexture = material.virtualTexture;
+    block.uvOffset[0] = material.uvOffset.x;
+    block.uvOffset[1] = material.uvOffset.y;
+    block.uvScale[0] = material.uvScale.x;
+    block.uvScale[1] = material.uvScale.y;
+    block.virtualSize = material.virtualSize;
+    return block;
+}
+
 // Mesh class
 class Mesh 
 {
 public:
     unsigned int vao, vbo, ebo, textureID;
+    unsigned int positionVao = 0, positionVbo = 0;  // Positions only, tightly packed, for depth-only passes (shares ebo)
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
+    std::vector<SubMesh> submeshes;
     Material material;
-    Light light;
+    Light light;        // Used by Draw, the RenderQueue draws with the scene light block instead
+
+    // Bounding sphere in object space and texture coordinate units per object space unit, set by Upload
+    Vec3 boundsCenter;
+    float boundsRadius = 0.0f;
+    float uvDensity = 0.0f;
+
+    // Bumped by every Upload, so caches built from the old data can tell
+    unsigned int revision = 0;
+
+    // Registry the submesh materials are referenced in (the active one at Upload), null if none
+    MaterialRegistry* registry = nullptr;
 
 	// Constructor
-    Mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const Material material, const Light light, unsigned int textureID) : material(material), light(light), textureID(textureID) 
+    Mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const Material material, const Light light, unsigned int textureID) : vao(0), vbo(0), ebo(0), textureID(textureID), material(material), light(light) 
+    {
+        // Single submesh covering the whole index buffer
+        SubMesh submesh = { 0, (unsigned int)indices.size(), INVALID_MATERIAL, material };
+        submesh.material.texture = textureID;
+
+        Upload(vertices, indices, { submesh });
+    }
+
+    // Constructor (one shared vertex/index buffer split into submeshes by material)
+    Mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const std::vector<SubMesh>& submeshes, const Light light) : vao(0), vbo(0), ebo(0), light(light)
+    {
+        material = submeshes.empty() ? Material() : submeshes[0].material;
+        textureID = material.texture;
+
+        Upload(vertices, indices, submeshes);
+    }
+
+    // Destructor
+    ~Mesh() 
+    {
+        ReleaseMaterials();
+
+        if (ResidencyManager* residency = ResidencyManager::Active())
+            residency->Untrack(RESIDENCY_MESH, vao);
+
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vbo);
+        glDeleteBuffers(1, &ebo);
+        glDeleteVertexArrays(1, &positionVao);
+        glDeleteBuffers(1, &positionVbo);
+    }
+
+    // Draw function (the frame block is uploaded by the caller)
+	void Draw(unsigned int shaderProgram, Mat4 model) 
+    {
+        SetLight();
+
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, model.value_ptr());
+
+        Bind();
+
+        for (SubMesh& submesh : submeshes)
+        {
+            BindTexture(submesh.material);
+
+            SetMaterial(submesh.material);
+            DrawSubMesh(submesh);
+        }
+
+        glBindVertexArray(0);
+    }
+
+    // Upload the light block
+    void SetLight() const
+    {
+        if (UniformBuffers* buffers = UniformBuffers::Active())
+            buffers->Upload(LightUniforms(light));
+    }
+
+    // Bind the VAO, buffers evicted by the residency manager are uploaded again first
+    void Bind()
+    {
+        if (ResidencyManager* residency = ResidencyManager::Active())
+            residency->Touch(RESIDENCY_MESH, vao);
+
+        glBindVertexArray(vao);
+    }
+
+    // Bind the position-only VAO (depth passes, 12 bytes per vertex instead of 32)
+    void BindPositions()
+    {
+        if (ResidencyManager* residency = ResidencyManager::Active())
+            residency->Touch(RESIDENCY_MESH, vao);
+
+        glBindVertexArray(positionVao);
+    }
+
+    // Bind the material texture, arrays go to unit 1 and page tables to unit 2 so each sampler type keeps its own unit
+    static void BindTexture(const Material& material)
+    {
+        if (ResidencyManager* residency = ResidencyManager::Active())
+            residency->Touch(RESIDENCY_TEXTURE, material.texture);
+
+        if (material.virtualTexture >= 0)
+        {
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, material.texture);
+            glActiveTexture(GL_TEXTURE0);
+        }
+        else if (material.layer >= 0)
+        {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, material.texture);
+            glActiveTexture(GL_TEXTURE0);
+        }
+        else
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, material.texture);
+        }
+    }
+
+    // Upload the material block (texture is bound by the caller)
+    static void SetMaterial(const Material& material)
+    {
+        if (UniformBuffers* buffers = UniformBuffers::Active())
+            buffers->Upload(MaterialUniforms(material));
+    }
+
+    // Draw one submesh (VAO must be bound)
+    void DrawSubMesh(const SubMesh& submesh) const
     {
+        glDrawElements(GL_TRIANGLES, submesh.indexCount, GL_UNSIGNED_INT, (void*)(submesh.indexOffset * sizeof(unsigned int)));
+    }
 
+    // Create GPU buffers, or replace their contents (e.g. placeholder swapped for loaded data)
+    void Upload(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const std::vector<SubMesh>& submeshes)
+    {
         this->vertices = vertices;
         this->indices = indices;
+        SetSubMeshes(submeshes);
+        revision++;
+
+        ComputeBounds();
+
+        // Generate VAO and buffers on first upload only
+        if (vao == 0)
+        {
+            glGenVertexArrays(1, &vao);
+            glGenBuffers(1, &vbo);
+            glGenBuffers(1, &ebo);
+            glGenVertexArrays(1, &positionVao);
+            glGenBuffers(1, &positionVbo);
+        }
 
-        // Generate VAO
-        glGenVertexArrays(1, &vao);
+        UploadBuffers();
+
+        // The CPU copies stay around, the buffers can be freed when the mesh is unused and uploaded again later
+        if (ResidencyManager* residency = ResidencyManager::Active())
+        {
+            residency->Track(RESIDENCY_MESH, vao, BufferBytes(),
+                [this]() { ReleaseBuffers(); return (size_t)0; },
+                [this]() { UploadBuffers(); return BufferBytes(); });
+        }
+    }
+
+    // Replace the submeshes, moving the material references over to the new ones (defined in material.h)
+    inline void SetSubMeshes(const std::vector<SubMesh>& submeshes);
+
+    // Drop the material references of the submeshes (defined in material.h)
+    inline void ReleaseMaterials();
+
+    // Fill the buffers from the CPU copies and set up the vertex format
+    void UploadBuffers()
+    {
         glBindVertexArray(vao);
 
-        // Generate and bind VBO
-        glGenBuffers(1, &vbo);
+        // Bind VBO
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
 
@@ -68,55 +295,85 @@ public:
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texture)); // Texture coordinates
         glEnableVertexAttribArray(2);
 
-        // Generate and bind EBO
-        glGenBuffers(1, &ebo);
+        // Bind EBO
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
 
+        // Position stream, attribute 0 like the full vertex format so the same vertex shaders read it
+        std::vector<float> positions(vertices.size() * 3);
+        for (size_t i = 0; i < vertices.size(); ++i)
+        {
+            positions[i * 3] = vertices[i].position.x;
+            positions[i * 3 + 1] = vertices[i].position.y;
+            positions[i * 3 + 2] = vertices[i].position.z;
+        }
+
+        glBindVertexArray(positionVao);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVbo);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(float), positions.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
         // Unbind VAO
         glBindVertexArray(0);
     }
 
-    // Destructor
-    ~Mesh() 
+    // Free the buffer storage, the VAO and buffer names stay valid
+    void ReleaseBuffers()
     {
-        glDeleteVertexArrays(1, &vao);
-        glDeleteBuffers(1, &vbo);
-        glDeleteBuffers(1, &ebo);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVbo);
+        glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+        glBindVertexArray(0);
+    }
+
+    // Size of the vertex, position and index buffers
+    size_t BufferBytes() const
+    {
+        return vertices.size() * (sizeof(Vertex) + 3 * sizeof(float)) + indices.size() * sizeof(unsigned int);
     }
 
-    // Draw function
-	void Draw(unsigned int shaderProgram, Mat4 projection, Mat4 view, Mat4 model) 
+    // Bounding sphere (box center, farthest vertex) and average texture density over all triangles
+    void ComputeBounds()
     {
-        // Get uniform locations for shaders
-        int projectionLoc = glGetUniformLocation(shaderProgram, "projection");
-        int viewLoc = glGetUniformLocation(shaderProgram, "view");
-        int modelLoc = glGetUniformLocation(shaderProgram, "model");
+        boundsCenter = Vec3(0.0f, 0.0f, 0.0f);
+        boundsRadius = 0.0f;
+        uvDensity = 0.0f;
 
-        glUniform3fv(glGetUniformLocation(shaderProgram, "light.position"), 1, light.position.value_ptr());
-        glUniform3fv(glGetUniformLocation(shaderProgram, "light.ambient"), 1, light.ambient.value_ptr());
-        glUniform3fv(glGetUniformLocation(shaderProgram, "light.diffuse"), 1, light.diffuse.value_ptr());
-        glUniform3fv(glGetUniformLocation(shaderProgram, "light.specular"), 1, light.specular.value_ptr());
+        if (vertices.empty())
+            return;
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        Vec3 minimum = vertices[0].position, maximum = vertices[0].position;
+        for (const Vertex& vertex : vertices)
+        {
+            minimum = Vec3(std::min(minimum.x, vertex.position.x), std::min(minimum.y, vertex.position.y), std::min(minimum.z, vertex.position.z));
+            maximum = Vec3(std::max(maximum.x, vertex.position.x), std::max(maximum.y, vertex.position.y), std::max(maximum.z, vertex.position.z));
+        }
 
-        glUniform1i(glGetUniformLocation(shaderProgram, "material.texture1"), 0);
+        boundsCenter = (minimum + maximum) * 0.5f;
+        for (const Vertex& vertex : vertices)
+            boundsRadius = std::max(boundsRadius, boundsCenter.Distance(vertex.position));
 
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, projection.value_ptr());
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, view.value_ptr());
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, model.value_ptr());
+        float worldArea = 0.0f, uvArea = 0.0f;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            const Vertex& a = vertices[indices[i]];
+            const Vertex& b = vertices[indices[i + 1]];
+            const Vertex& c = vertices[indices[i + 2]];
 
-        float* mat_shine = &material.shininess;
+            worldArea += (b.position - a.position).Cross(c.position - a.position).Magnitude() * 0.5f;
 
-        glUniform3fv(glGetUniformLocation(shaderProgram, "material.ambient"), 1, material.ambient.value_ptr());
-        glUniform3fv(glGetUniformLocation(shaderProgram, "material.diffuse"), 1, material.diffuse.value_ptr());
-        glUniform3fv(glGetUniformLocation(shaderProgram, "material.specular"), 1, material.specular.value_ptr());
-        glUniform1f(glGetUniformLocation(shaderProgram, "material.shininess"), *mat_shine);
+            Vec2 uv1 = b.texture - a.texture, uv2 = c.texture - a.texture;
+            uvArea += std::fabs(uv1.x * uv2.y - uv1.y * uv2.x) * 0.5f;
+        }
 
-        glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);  // Use stored indices
-        glBindVertexArray(0);
+        if (worldArea > 0.0f)
+            uvDensity = std::sqrt(uvArea / worldArea);
     }
 };
 
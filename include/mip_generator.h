@@ -0,0 +1,447 @@
+#ifndef MIP_GENERATOR_H
+#define MIP_GENERATOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MG3D_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX__)
+#define MG3D_AVX
+#include <immintrin.h>
+#endif
+
+// Filter used to build each mip level from the one above it
+enum MipFilter
+{
+    MIP_FILTER_BOX,     // 2x2 average, soft
+    MIP_FILTER_KAISER,  // Kaiser-windowed sinc, sharp with little ringing
+    MIP_FILTER_LANCZOS  // Lanczos-3, sharpest, can ring on hard edges
+};
+
+struct MipOptions
+{
+    MipFilter filter = MIP_FILTER_KAISER;
+    bool srgb = true;               // RGB is sRGB encoded and filtered in linear light (alpha is always linear)
+    unsigned int threadCount = 0;   // 0 uses every core
+};
+
+// Number of levels down to 1x1
+inline int MipLevelCount(int width, int height)
+{
+    int levels = 1;
+    while (std::max(width, height) >> levels)
+        levels++;
+    return levels;
+}
+
+namespace mip
+{
+    const float PI = 3.14159265358979f;
+    const int BAND_ROWS = 32;   // Output rows filtered together by one thread
+
+    // Level kept in linear float RGBA while the next one is built from it
+    struct Image
+    {
+        int width = 0;
+        int height = 0;
+        std::vector<float> pixels;
+    };
+
+    // Conversion tables between sRGB bytes and linear values
+    struct SRGBTables
+    {
+        float toLinear[256];
+        float thresholds[257];  // Linear value where each byte starts, rounding to nearest
+        uint8_t guess[4096];    // Byte for linear i / 4095, within one of the exact answer
+
+        SRGBTables()
+        {
+            for (int i = 0; i < 256; ++i)
+                toLinear[i] = Decode(i / 255.0f);
+
+            thresholds[0] = -1.0f;
+            for (int i = 1; i < 256; ++i)
+                thresholds[i] = Decode((i - 0.5f) / 255.0f);
+            thresholds[256] = 2.0f;
+
+            for (int i = 0; i < 4096; ++i)
+            {
+                float linear = i / 4095.0f;
+                float encoded = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+                guess[i] = (uint8_t)std::min(std::max((int)(encoded * 255.0f + 0.5f), 0), 255);
+            }
+        }
+
+        static float Decode(float c)
+        {
+            return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+    };
+
+    inline const SRGBTables& Tables()
+    {
+        static const SRGBTables tables;
+        return tables;
+    }
+
+    inline uint8_t EncodeSRGB(float linear, const SRGBTables& tables)
+    {
+        linear = std::min(std::max(linear, 0.0f), 1.0f);
+
+        int value = tables.guess[(int)(linear * 4095.0f)];
+        while (linear >= tables.thresholds[value + 1])
+            value++;
+        while (linear < tables.thresholds[value])
+            value--;
+        return (uint8_t)value;
+    }
+
+    inline uint8_t EncodeLinear(float value)
+    {
+        return (uint8_t)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+
+    // RGBA8 row to linear floats
+    inline const float* DecodeRow(const uint8_t* pixel, int width, bool srgb, float* target)
+    {
+        const SRGBTables& tables = Tables();
+        for (int x = 0; x < width * 4; x += 4)
+        {
+            for (int ch = 0; ch < 3; ++ch)
+                target[x + ch] = srgb ? tables.toLinear[pixel[x + ch]] : pixel[x + ch] / 255.0f;
+            target[x + 3] = pixel[x + 3] / 255.0f;
+        }
+        return target;
+    }
+
+    inline float Sinc(float x)
+    {
+        if (std::fabs(x) < 1e-6f)
+            return 1.0f;
+        x *= PI;
+        return std::sin(x) / x;
+    }
+
+    // Modified Bessel function of the first kind, order 0
+    inline float BesselI0(float x)
+    {
+        float sum = 1.0f, term = 1.0f;
+        for (int k = 1; k < 20; ++k)
+        {
+            float t = x / (2.0f * k);
+            term *= t * t;
+            sum += term;
+        }
+        return sum;
+    }
+
+    // Support of the filter in destination pixels
+    inline float FilterRadius(MipFilter filter)
+    {
+        return filter == MIP_FILTER_BOX ? 0.5f : 3.0f;
+    }
+
+    inline float FilterWeight(MipFilter filter, float x)
+    {
+        x = std::fabs(x);
+        switch (filter)
+        {
+        case MIP_FILTER_BOX:
+            return x <= 0.5f ? 1.0f : 0.0f;
+        case MIP_FILTER_KAISER:
+        {
+            const float alpha = 4.0f;
+            if (x >= 3.0f)
+                return 0.0f;
+            float t = x / 3.0f;
+            return Sinc(x) * BesselI0(alpha * std::sqrt(1.0f - t * t)) / BesselI0(alpha);
+        }
+        default:
+            return x < 3.0f ? Sinc(x) * Sinc(x / 3.0f) : 0.0f;
+        }
+    }
+
+    // Source pixels and weights of every destination pixel along one axis, edges wrap like GL_REPEAT
+    struct Weights
+    {
+        int taps = 0;
+        std::vector<int> indices;   // Destination size * taps
+        std::vector<float> values;
+    };
+
+    inline Weights ComputeWeights(MipFilter filter, int sourceSize, int targetSize)
+    {
+        // Enlarging keeps the filter at source resolution so every target pixel still has taps
+        float scale = (float)sourceSize / targetSize;
+        float support = std::max(scale, 1.0f);
+        float radius = FilterRadius(filter) * support;
+
+        Weights weights;
+        weights.taps = (int)std::ceil(radius * 2.0f) + 1;
+        weights.indices.resize((size_t)targetSize * weights.taps);
+        weights.values.resize((size_t)targetSize * weights.taps);
+
+        for (int x = 0; x < targetSize; ++x)
+        {
+            float center = (x + 0.5f) * scale;
+            int first = (int)std::ceil(center - radius - 0.5f);
+
+            float sum = 0.0f;
+            for (int t = 0; t < weights.taps; ++t)
+            {
+                int index = first + t;
+                float weight = FilterWeight(filter, (index + 0.5f - center) / support);
+
+                weights.indices[(size_t)x * weights.taps + t] = (index % sourceSize + sourceSize) % sourceSize;
+                weights.values[(size_t)x * weights.taps + t] = weight;
+                sum += weight;
+            }
+
+            for (int t = 0; t < weights.taps; ++t)
+                weights.values[(size_t)x * weights.taps + t] /= sum;
+        }
+
+        return weights;
+    }
+
+    // Horizontal pass: one source row of RGBA floats to the destination width
+    inline void FilterRow(const float* source, float* target, const Weights& weights, int targetWidth)
+    {
+        for (int x = 0; x < targetWidth; ++x)
+        {
+            const int* indices = &weights.indices[(size_t)x * weights.taps];
+            const float* values = &weights.values[(size_t)x * weights.taps];
+
+#ifdef MG3D_SSE2
+            __m128 sum = _mm_setzero_ps();
+            for (int t = 0; t < weights.taps; ++t)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(values[t]), _mm_loadu_ps(source + (size_t)indices[t] * 4)));
+            _mm_storeu_ps(target + (size_t)x * 4, sum);
+#else
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (int t = 0; t < weights.taps; ++t)
+            {
+                for (int ch = 0; ch < 4; ++ch)
+                    sum[ch] += values[t] * source[(size_t)indices[t] * 4 + ch];
+            }
+            for (int ch = 0; ch < 4; ++ch)
+                target[(size_t)x * 4 + ch] = sum[ch];
+#endif
+        }
+    }
+
+    // Vertical pass: weighted sum of horizontally filtered rows, count floats long
+    inline void CombineRows(const float* const* rows, const float* values, int taps, float* target, size_t count)
+    {
+        size_t i = 0;
+
+#ifdef MG3D_AVX
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int t = 0; t < taps; ++t)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(values[t]), _mm256_loadu_ps(rows[t] + i)));
+            _mm256_storeu_ps(target + i, sum);
+        }
+#endif
+
+#ifdef MG3D_SSE2
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int t = 0; t < taps; ++t)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(values[t]), _mm_loadu_ps(rows[t] + i)));
+            _mm_storeu_ps(target + i, sum);
+        }
+#endif
+
+        for (; i < count; ++i)
+        {
+            float sum = 0.0f;
+            for (int t = 0; t < taps; ++t)
+                sum += values[t] * rows[t][i];
+            target[i] = sum;
+        }
+    }
+
+    // Run body(index) for every index in [0, count) on up to threadCount threads
+    inline void ParallelFor(int count, unsigned int threadCount, const std::function<void(int)>& body)
+    {
+        threadCount = std::min(threadCount, (unsigned int)std::max(count, 1));
+
+        std::atomic<int> next(0);
+        auto run = [&]()
+        {
+            for (int index = next++; index < count; index = next++)
+                body(index);
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned int i = 1; i < threadCount; ++i)
+            threads.emplace_back(run);
+
+        run();
+
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    // Filter a source image down to target (linear float RGBA), bands of output rows run in parallel
+    // row(y, scratch) returns source row y as linear floats, scratch holds width * 4 floats it may use
+    // encoded, if set, also receives the result as RGBA8
+    inline void Downsample(const std::function<const float*(int, float*)>& row, int sourceWidth, int sourceHeight,
+        Image& target, const MipOptions& options, uint8_t* encoded)
+    {
+        Weights horizontal = ComputeWeights(options.filter, sourceWidth, target.width);
+        Weights vertical = ComputeWeights(options.filter, sourceHeight, target.height);
+
+        target.pixels.resize((size_t)target.width * target.height * 4);
+        size_t rowFloats = (size_t)target.width * 4;
+
+        int bands = (target.height + BAND_ROWS - 1) / BAND_ROWS;
+
+        unsigned int threadCount = options.threadCount ? options.threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+        if ((size_t)target.width * target.height < 16384)
+            threadCount = 1;
+
+        const SRGBTables& tables = Tables();
+
+        ParallelFor(bands, threadCount, [&](int band)
+        {
+            int firstRow = band * BAND_ROWS;
+            int lastRow = std::min(firstRow + BAND_ROWS, target.height);
+
+            // Horizontally filter every source row the band needs, once
+            std::vector<int> slots(sourceHeight, -1);
+            std::vector<int> needed;
+            for (size_t i = (size_t)firstRow * vertical.taps; i < (size_t)lastRow * vertical.taps; ++i)
+            {
+                int y = vertical.indices[i];
+                if (slots[y] < 0)
+                {
+                    slots[y] = (int)needed.size();
+                    needed.push_back(y);
+                }
+            }
+
+            std::vector<float> scratch((size_t)sourceWidth * 4);
+            std::vector<float> filtered(needed.size() * rowFloats);
+            for (size_t i = 0; i < needed.size(); ++i)
+                FilterRow(row(needed[i], scratch.data()), &filtered[i * rowFloats], horizontal, target.width);
+
+            std::vector<const float*> rows(vertical.taps);
+            for (int y = firstRow; y < lastRow; ++y)
+            {
+                for (int t = 0; t < vertical.taps; ++t)
+                    rows[t] = &filtered[slots[vertical.indices[(size_t)y * vertical.taps + t]] * rowFloats];
+
+                float* result = &target.pixels[(size_t)y * rowFloats];
+                CombineRows(rows.data(), &vertical.values[(size_t)y * vertical.taps], vertical.taps, result, rowFloats);
+
+                if (!encoded)
+                    continue;
+
+                uint8_t* out = encoded + (size_t)y * rowFloats;
+                for (size_t i = 0; i < rowFloats; i += 4)
+                {
+                    for (int ch = 0; ch < 3; ++ch)
+                        out[i + ch] = options.srgb ? EncodeSRGB(result[i + ch], tables) : EncodeLinear(result[i + ch]);
+                    out[i + 3] = EncodeLinear(result[i + 3]);
+                }
+            }
+        });
+    }
+}
+
+// Build mip levels [firstLevel, lastLevel] of an RGBA8 image on the CPU (lastLevel -1: down to 1x1)
+// Every level is filtered from the float version of the level above it, so rounding does not accumulate.
+// destination(level, bytes) returns where to write a level, null aborts.
+inline bool GenerateMips(const uint8_t* rgba, int width, int height, int firstLevel, int lastLevel, const MipOptions& options,
+    const std::function<uint8_t*(int level, size_t bytes)>& destination)
+{
+    int levelCount = MipLevelCount(width, height);
+    if (lastLevel < 0 || lastLevel >= levelCount)
+        lastLevel = levelCount - 1;
+
+    if (firstLevel == 0)
+    {
+        size_t bytes = (size_t)width * height * 4;
+        uint8_t* target = destination(0, bytes);
+        if (!target)
+            return false;
+        std::memcpy(target, rgba, bytes);
+    }
+
+    // Level 0 rows are decoded to linear floats as the filter reads them
+    auto sourceRow = [&](int y, float* scratch) { return mip::DecodeRow(rgba + (size_t)y * width * 4, width, options.srgb, scratch); };
+
+    mip::Image previous;
+    for (int level = 1; level <= lastLevel; ++level)
+    {
+        mip::Image current;
+        current.width = std::max(width >> level, 1);
+        current.height = std::max(height >> level, 1);
+
+        uint8_t* target = nullptr;
+        if (level >= firstLevel)
+        {
+            target = destination(level, (size_t)current.width * current.height * 4);
+            if (!target)
+                return false;
+        }
+
+        if (level == 1)
+        {
+            mip::Downsample(sourceRow, width, height, current, options, target);
+        }
+        else
+        {
+            auto previousRow = [&](int y, float*) -> const float* { return &previous.pixels[(size_t)y * previous.width * 4]; };
+            mip::Downsample(previousRow, previous.width, previous.height, current, options, target);
+        }
+
+        previous = std::move(current);
+    }
+
+    return true;
+}
+
+// Resample an RGBA8 image to any size with the same filters, in linear light when options.srgb is set
+inline std::vector<uint8_t> ResizeImage(const uint8_t* rgba, int width, int height, int targetWidth, int targetHeight, const MipOptions& options = MipOptions())
+{
+    std::vector<uint8_t> result((size_t)targetWidth * targetHeight * 4);
+
+    auto sourceRow = [&](int y, float* scratch) { return mip::DecodeRow(rgba + (size_t)y * width * 4, width, options.srgb, scratch); };
+
+    mip::Image target;
+    target.width = targetWidth;
+    target.height = targetHeight;
+    mip::Downsample(sourceRow, width, height, target, options, result.data());
+
+    return result;
+}
+
+// Mip levels [firstLevel, lastLevel] as separate arrays
+inline std::vector<std::vector<uint8_t>> GenerateMips(const uint8_t* rgba, int width, int height, int firstLevel = 0, int lastLevel = -1,
+    const MipOptions& options = MipOptions())
+{
+    std::vector<std::vector<uint8_t>> levels;
+    GenerateMips(rgba, width, height, firstLevel, lastLevel, options, [&](int, size_t bytes)
+    {
+        levels.emplace_back(bytes);
+        return levels.back().data();
+    });
+    return levels;
+}
+
+#endif
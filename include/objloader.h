@@ -0,0 +1,399 @@
+#ifndef OBJLOADER_H
+#define OBJLOADER_H
+
+#include <mesh.h>
+#include <material.h>
+#include <vec3.h>
+#include <vec2.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Faces that use one material, in file order
+struct OBJGroup
+{
+    std::string material;
+    std::vector<unsigned int> indices;
+};
+
+// Convert an OBJ index (1-based, negative is relative to the end) to 0-based
+// An empty index is absent and gives count, false if the index is not a number or not one of the count elements
+inline bool OBJIndex(const std::string& value, size_t count, size_t& index)
+{
+    if (value.empty())
+    {
+        index = count;
+        return true;
+    }
+
+    const char* begin = value.c_str();
+    char* end = nullptr;
+    errno = 0;
+    long parsed = std::strtol(begin, &end, 10);
+
+    if (end == begin || *end != '\0' || errno == ERANGE || parsed == 0)
+        return false;
+
+    if (parsed < 0)
+    {
+        if (parsed < -(long)count)
+            return false;
+
+        index = count - (size_t)(-parsed);
+    }
+    else
+    {
+        if ((size_t)parsed > count)
+            return false;
+
+        index = (size_t)parsed - 1;
+    }
+
+    return true;
+}
+
+// Parse OBJ file, faces are collected per material when splitByMaterial is set
+inline bool ParseOBJ(const char* filename, std::vector<Vertex>& vertices, std::vector<OBJGroup>& groups, std::vector<std::string>& materialLibraries, bool splitByMaterial)
+{
+    // Open the OBJ file
+    std::ifstream file(filename);
+
+	// Check if the file was opened successfully
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open .obj file: " << filename << std::endl;
+        return false;
+    }
+
+    // Temporary storage for vertex data
+    std::vector<Vec3> tempVertexPos;    // Vertex positions
+    std::vector<Vec3> tempVertexNorm;     // Vertex normals
+    std::vector<Vec2> tempTexCoords;   // Texture coordinates
+
+    std::unordered_map<std::string, size_t> groupIndex;
+    groups.push_back({ "", {} });
+    groupIndex[""] = 0;
+    size_t currentGroup = 0;
+
+    // Read file line by line
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream s(line);
+        std::string prefix;
+        s >> prefix;
+
+        if (prefix == "v") // Vertex position
+        {
+            Vec3 position;
+            s >> position.x >> position.y >> position.z;
+            tempVertexPos.push_back(position);
+        }
+        else if (prefix == "vt") // Texture coordinate
+        {
+            Vec2 texCoord;
+            s >> texCoord.x >> texCoord.y;
+            tempTexCoords.push_back(texCoord);
+        }
+		else if (prefix == "vn") // Vertex normal
+        {
+            Vec3 normal;
+            s >> normal.x >> normal.y >> normal.z;
+            tempVertexNorm.push_back(normal);
+        }
+        else if (prefix == "mtllib") // Material libraries, several can follow on one line
+        {
+            std::string library;
+            while (s >> library)
+                materialLibraries.push_back(library);
+        }
+        else if (prefix == "usemtl" && splitByMaterial) // Following faces use this material
+        {
+            std::string material;
+            s >> material;
+
+            auto it = groupIndex.find(material);
+            if (it == groupIndex.end())
+            {
+                it = groupIndex.emplace(material, groups.size()).first;
+                groups.push_back({ material, {} });
+            }
+            currentGroup = it->second;
+        }
+		else if (prefix == "f") // Face (triangle, quad or polygon)
+        {
+            std::vector<std::string> faceData;
+            std::string vertexData;
+
+            // Collect all vertex data for this face
+            while (s >> vertexData) {
+                faceData.push_back(vertexData);
+            }
+
+			if (faceData.size() < 3) // Unsupported face type
+            {
+                std::cerr << "Unsupported face type with " << faceData.size() << " vertices." << std::endl;
+                continue;
+            }
+
+            // Create one vertex per corner
+            size_t firstVertex = vertices.size();
+            for (const std::string& corner : faceData)
+            {
+                std::istringstream viss(corner);
+                std::string posIndexStr, texIndexStr, normIndexStr;
+
+                // Parse vertex, texture, and normal indices
+                std::getline(viss, posIndexStr, '/');
+                std::getline(viss, texIndexStr, '/');
+                std::getline(viss, normIndexStr, '/');
+
+                // Convert to 0-based indices, a face pointing outside the data fails the whole file
+                size_t posIndex, texIndex, normIndex;
+                if (!OBJIndex(posIndexStr, tempVertexPos.size(), posIndex) || posIndex >= tempVertexPos.size()
+                    || !OBJIndex(texIndexStr, tempTexCoords.size(), texIndex)
+                    || !OBJIndex(normIndexStr, tempVertexNorm.size(), normIndex))
+                {
+                    std::cerr << "Invalid face vertex \"" << corner << "\" in .obj file: " << filename << std::endl;
+                    return false;
+                }
+
+                // Create vertex
+                Vertex vertex;
+                vertex.position = tempVertexPos[posIndex];
+                vertex.texture = (texIndex < tempTexCoords.size()) ? tempTexCoords[texIndex] : Vec2(0.0f, 0.0f);
+                vertex.normal = (normIndex < tempVertexNorm.size()) ? tempVertexNorm[normIndex] : Vec3(0.0f, 0.0f, 0.0f);
+
+                vertices.push_back(vertex);
+            }
+
+            // Split quads and polygons into a triangle fan: 1-2-3, 1-3-4, ...
+            std::vector<unsigned int>& indices = groups[currentGroup].indices;
+            for (size_t i = 1; i + 1 < faceData.size(); ++i)
+            {
+                indices.push_back((unsigned int)firstVertex);
+                indices.push_back((unsigned int)(firstVertex + i));
+                indices.push_back((unsigned int)(firstVertex + i + 1));
+            }
+        }
+    }
+
+    file.close();
+
+    return true;
+}
+
+// Material read from an MTL library, the texture is resolved later
+struct MTLMaterial
+{
+    std::string name;
+    Material material;
+    std::string texturePath;
+};
+
+// Parse MTL material library (no GL calls, safe on worker threads)
+inline bool ParseMTL(const std::string& filename, const Material& defaultMaterial, std::vector<MTLMaterial>& materials)
+{
+    std::ifstream file(filename);
+
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open .mtl file: " << filename << std::endl;
+        return false;
+    }
+
+    // Texture paths are relative to the library
+    std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+
+    MTLMaterial* current = nullptr;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream s(line);
+        std::string prefix;
+        s >> prefix;
+
+        if (prefix == "newmtl")
+        {
+            materials.push_back({ "", defaultMaterial, "" });
+            current = &materials.back();
+            s >> current->name;
+        }
+        else if (!current)
+        {
+            continue;
+        }
+        else if (prefix == "Ka")
+        {
+            s >> current->material.ambient.x >> current->material.ambient.y >> current->material.ambient.z;
+        }
+        else if (prefix == "Kd")
+        {
+            s >> current->material.diffuse.x >> current->material.diffuse.y >> current->material.diffuse.z;
+        }
+        else if (prefix == "Ks")
+        {
+            s >> current->material.specular.x >> current->material.specular.y >> current->material.specular.z;
+        }
+        else if (prefix == "Ns")
+        {
+            s >> current->material.shininess;
+        }
+        else if (prefix == "map_Kd")
+        {
+            // Options (-s, -o, ...) come first, the path is the last token
+            std::string token, path;
+            while (s >> token)
+                path = token;
+
+            if (!path.empty())
+                current->texturePath = directory + path;
+        }
+    }
+
+    file.close();
+
+    return true;
+}
+
+// OBJ file with its materials, parsed on the CPU
+struct OBJData
+{
+    std::vector<Vertex> vertices;
+    std::vector<OBJGroup> groups;
+    std::vector<MTLMaterial> materials;
+    std::vector<std::string> materialLibraries; // Paths of the MTL files used
+    Material defaultMaterial;
+};
+
+// Parse OBJ file and its material libraries (no GL calls, safe on worker threads)
+inline bool ParseOBJWithMaterials(const char* filename, const Material& defaultMaterial, OBJData& data)
+{
+    std::vector<std::string> materialLibraries;
+
+    if (!ParseOBJ(filename, data.vertices, data.groups, materialLibraries, true))
+        return false;
+
+    std::string path = filename;
+    std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+
+    for (const std::string& library : materialLibraries)
+    {
+        data.materialLibraries.push_back(directory + library);
+        ParseMTL(directory + library, defaultMaterial, data.materials);
+    }
+
+    data.defaultMaterial = defaultMaterial;
+
+    return true;
+}
+
+// Register the parsed materials and build the index buffer
+// Indices are grouped by material, each group becomes a submesh of the shared vertex/index buffer
+// Only materials some face uses are registered, so unused MTL entries hold no textures
+inline void BuildSubMeshes(OBJData& data, MaterialRegistry& registry, std::vector<unsigned int>& indices, std::vector<SubMesh>& submeshes)
+{
+    std::unordered_map<std::string, size_t> materialIndex;
+    for (size_t i = 0; i < data.materials.size(); ++i)
+        materialIndex[data.materials[i].name] = i;
+
+    std::unordered_map<std::string, unsigned int> materialIDs;
+    auto registerMaterial = [&](const std::string& name) -> unsigned int
+    {
+        auto registered = materialIDs.find(name);
+        if (registered != materialIDs.end())
+            return registered->second;
+
+        unsigned int id;
+        auto it = materialIndex.find(name);
+        if (it != materialIndex.end())
+        {
+            MTLMaterial& material = data.materials[it->second];
+            if (!material.texturePath.empty())
+                registry.ApplyTexture(material.material, material.texturePath);
+
+            id = registry.Register(material.material);
+        }
+        else
+        {
+            id = registry.Register(data.defaultMaterial);
+        }
+
+        materialIDs[name] = id;
+        return id;
+    };
+
+    // Groups whose materials were deduplicated to the same ID share a submesh
+    std::vector<unsigned int> groupMaterials;
+    for (const OBJGroup& group : data.groups)
+        groupMaterials.push_back(group.indices.empty() ? INVALID_MATERIAL : registerMaterial(group.material));
+
+    for (size_t i = 0; i < data.groups.size(); ++i)
+    {
+        if (data.groups[i].indices.empty())
+            continue;
+
+        SubMesh submesh;
+        submesh.indexOffset = (unsigned int)indices.size();
+        submesh.materialID = groupMaterials[i];
+        submesh.material = registry.Get(submesh.materialID);
+
+        // Faces of the same material are adjacent in the index buffer
+        for (size_t j = i; j < data.groups.size(); ++j)
+        {
+            if (groupMaterials[j] != submesh.materialID)
+                continue;
+
+            indices.insert(indices.end(), data.groups[j].indices.begin(), data.groups[j].indices.end());
+            data.groups[j].indices.clear();
+        }
+
+        submesh.indexCount = (unsigned int)indices.size() - submesh.indexOffset;
+        submeshes.push_back(submesh);
+    }
+}
+
+// Load OBJ file with its material library
+inline bool loadOBJ(const char* filename, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, std::vector<SubMesh>& submeshes, MaterialRegistry& registry, const Material& defaultMaterial)
+{
+    OBJData data;
+
+    if (!ParseOBJWithMaterials(filename, defaultMaterial, data))
+        return false;
+
+    // The parsed indices count from the file's first vertex, which goes after the vertices already there
+    unsigned int firstVertex = (unsigned int)vertices.size();
+    for (OBJGroup& group : data.groups)
+    {
+        for (unsigned int& index : group.indices)
+            index += firstVertex;
+    }
+
+    BuildSubMeshes(data, registry, indices, submeshes);
+    vertices.insert(vertices.end(), data.vertices.begin(), data.vertices.end());
+
+    return true;
+}
+
+// Load OBJ file (materials are ignored)
+inline bool loadOBJ(const char* filename, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+    std::vector<OBJGroup> groups;
+    std::vector<std::string> materialLibraries;
+
+    if (!ParseOBJ(filename, vertices, groups, materialLibraries, false))
+        return false;
+
+    indices.insert(indices.end(), groups[0].indices.begin(), groups[0].indices.end());
+
+    return true;
+}
+
+#endif
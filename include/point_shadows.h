@@ -0,0 +1,583 @@
+#ifndef POINT_SHADOWS_H
+#define POINT_SHADOWS_H
+
+#include <glad/glad.h>
+#include <light_clusters.h>
+#include <mesh.h>
+#include <render_queue.h>
+#include <shader.h>
+#include <mat4.h>
+#include <vec3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Shader storage binding of the shadow entries, after the light buffers (layout(binding) in shaders/PointShadows.glsl)
+const int POINT_SHADOW_BUFFER_BINDING = LIGHT_BUFFER_COUNT;
+
+// std430 copy of a shadow entry
+struct PointShadowGPU
+{
+    float position[3];
+    float nearPlane;
+    float origin[2];                // Corner of the 3x2 block of faces, in atlas UV
+    float faceSize;                 // In atlas UV
+    float farPlane;
+};
+
+static_assert(sizeof(PointShadowGPU) == 32, "PointShadowGPU must match std430");
+
+// Omnidirectional shadows for point lights, all of them in one depth atlas
+// Each shadowed light gets a 3x2 block of square faces, sized by how large the light's sphere is on screen: lights that
+// cover little of the screen get smaller faces, and below minScreenSize none at all. The six faces of a light are drawn in
+// one pass, a geometry shader invocation per face writing gl_ViewportIndex, and every caster is culled per face on the CPU.
+//
+// The atlas is split into fixed slots, a band of equal height per face size, and a light keeps its slot while its face
+// size stays the same. Static casters are drawn into a second atlas only when a light moves or the static casters it
+// reaches change; every frame the block is copied to the sampled atlas and the dynamic casters drawn on top. A light
+// that moved is always redrawn, lights new to a slot are drawn at most staticUpdatesPerFrame per frame, the largest
+// on screen first, and stay unshadowed until then. Slots are kept by the light's id, not its place in the list.
+class PointShadows
+{
+public:
+
+    // Range the scene light (which has no radius) casts shadows over
+    float sceneLightRange = 25.0f;
+
+    // On-screen diameter in pixels below which a light casts no shadow
+    float minScreenSize = 48.0f;
+
+    // Most lights shadowed per frame, the ones largest on screen win
+    int maxShadowedLights = 32;
+
+    // Lights whose static casters are drawn for the first time per frame after they got a slot
+    int staticUpdatesPerFrame = 8;
+
+    // Depth-only program with the per-face geometry shader
+    ShaderProgram depthShader;
+
+    PointShadows(int atlasSize = 4096, int maxFaceSize = 512, int minFaceSize = 64) : atlasSize(atlasSize), maxFaceSize(maxFaceSize),
+        minFaceSize(minFaceSize), atlas(0), staticAtlas(0),
+        framebuffer(0), staticFramebuffer(0), buffer(0), bufferCapacity(0), sceneLightShadow(-1), shadowedLights(0), casterDraws(0),
+        culledFaces(0), staticRenders(0)
+    {
+        depthShader.vertexPath = "shaders/PointShadowVertex.glsl";
+        depthShader.geometryPath = "shaders/PointShadowGeometry.glsl";
+        depthShader.fragmentPath = "shaders/ShadowDepthFragment.glsl";
+        CreateShaderProgram(depthShader);
+
+        // Sampled with hardware depth comparison (sampler2DShadow), the static atlas is only copied from
+        CreateAtlas(atlas, framebuffer);
+        CreateAtlas(staticAtlas, staticFramebuffer);
+
+        glGenBuffers(1, &buffer);
+
+        // Equal bands from the largest face size down, each filled with as many blocks as fit
+        int tierCount = 0;
+        for (int faceSize = maxFaceSize; faceSize >= minFaceSize; faceSize /= 2)
+            tierCount++;
+
+        int bandHeight = atlasSize / std::max(tierCount, 1);
+        for (int tier = 0; tier < tierCount; ++tier)
+        {
+            int faceSize = maxFaceSize >> tier;
+            for (int row = 0; row < bandHeight / (faceSize * 2); ++row)
+            {
+                for (int column = 0; column < atlasSize / (faceSize * 3); ++column)
+                {
+                    Slot slot;
+                    slot.x = column * faceSize * 3;
+                    slot.y = tier * bandHeight + row * faceSize * 2;
+                    slot.faceSize = faceSize;
+                    slots.push_back(slot);
+                }
+            }
+        }
+    }
+
+    ~PointShadows()
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteFramebuffers(1, &staticFramebuffer);
+        glDeleteTextures(1, &atlas);
+        glDeleteTextures(1, &staticAtlas);
+        glDeleteBuffers(1, &buffer);
+        glDeleteProgram(depthShader.id);
+    }
+
+    PointShadows(const PointShadows&) = delete;
+    PointShadows& operator=(const PointShadows&) = delete;
+
+    // Pick the lights that get a shadow this frame, give them slots and choose which are redrawn (once per frame,
+    // before LightClusters::Update, which uploads the shadow index written into each light)
+    void Update(const Light& sceneLight, std::vector<PointLight>& lights, Mat4 view, float fovY, float aspect, float screenHeight)
+    {
+        candidates.clear();
+        sceneLightShadow = -1;
+        shadowedLights = 0;
+
+        float tanY = std::tan(fovY * 0.5f);
+        float tanX = tanY * aspect;
+
+        // Diameter in pixels of the light's sphere on screen, 0 if the sphere is outside the view frustum
+        auto screenSize = [&](const Vec3& position, float radius)
+        {
+            float x = view.data[0][0] * position.x + view.data[1][0] * position.y + view.data[2][0] * position.z + view.data[3][0];
+            float y = view.data[0][1] * position.x + view.data[1][1] * position.y + view.data[2][1] * position.z + view.data[3][1];
+            float depth = -(view.data[0][2] * position.x + view.data[1][2] * position.y + view.data[2][2] * position.z + view.data[3][2]);
+
+            if (x * x + y * y + depth * depth <= radius * radius)
+                return screenHeight;
+
+            if (depth + radius <= 0.0f
+                || std::fabs(x) - depth * tanX > radius * std::sqrt(1.0f + tanX * tanX)
+                || std::fabs(y) - depth * tanY > radius * std::sqrt(1.0f + tanY * tanY))
+                return 0.0f;
+
+            return std::min(radius * screenHeight / (std::max(depth, radius) * tanY), screenHeight);
+        };
+
+        candidates.push_back({ -1, SCENE_LIGHT_ID, sceneLight.position, sceneLightRange, screenSize(sceneLight.position, sceneLightRange), 0, -1 });
+        for (int i = 0; i < (int)lights.size(); ++i)
+        {
+            lights[i].shadow = -1;
+            candidates.push_back({ i, lights[i].id, lights[i].position, lights[i].radius, screenSize(lights[i].position, lights[i].radius), 0, -1 });
+        }
+
+        std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.screenSize > b.screenSize; });
+
+        size_t selected = 0;
+        while (selected < candidates.size() && (int)selected < maxShadowedLights && candidates[selected].screenSize >= minScreenSize)
+            selected++;
+        candidates.resize(selected);
+
+        for (Slot& slot : slots)
+            slot.kept = false;
+
+        // Lights keep their slot while it has the face size they want (about as many texels per face as pixels on
+        // screen), or a smaller one while none of that size is free
+        for (Candidate& candidate : candidates)
+        {
+            candidate.faceSize = maxFaceSize;
+            while (candidate.faceSize > minFaceSize && candidate.faceSize >= candidate.screenSize)
+                candidate.faceSize /= 2;
+
+            bool wantedFree = HasFreeSlot(candidate.faceSize);
+            for (int i = 0; i < (int)slots.size(); ++i)
+            {
+                const Slot& slot = slots[i];
+                if (slot.used && !slot.kept && candidate.slot < 0 && slot.id == candidate.id
+                    && (slot.faceSize == candidate.faceSize || (slot.faceSize < candidate.faceSize && !wantedFree)))
+                {
+                    candidate.slot = i;
+                    slots[i].kept = true;
+                }
+            }
+        }
+
+        for (Slot& slot : slots)
+        {
+            if (!slot.kept)
+            {
+                slot.used = false;
+                slot.valid = false;
+            }
+        }
+
+        // The rest take a free slot of their size, or smaller ones when those run out
+        for (Candidate& candidate : candidates)
+        {
+            for (int i = 0; i < (int)slots.size() && candidate.slot < 0; ++i)
+            {
+                Slot& slot = slots[i];
+                if (!slot.used && slot.faceSize <= candidate.faceSize)
+                {
+                    slot.used = true;
+                    slot.id = candidate.id;
+                    candidate.slot = i;
+                }
+            }
+        }
+
+        // A light that moved is redrawn now, its old shadow would be in the wrong place. New slots are drawn a few per
+        // frame, largest on screen first (candidates are in that order)
+        int firstDraws = 0;
+        for (Candidate& candidate : candidates)
+        {
+            if (candidate.slot < 0)
+                continue;
+
+            Slot& slot = slots[candidate.slot];
+            slot.refresh = false;
+            slot.screenSize = candidate.screenSize;
+
+            bool moved = slot.radius != candidate.radius || slot.position.x != candidate.position.x
+                || slot.position.y != candidate.position.y || slot.position.z != candidate.position.z;
+
+            if (slot.valid ? moved : firstDraws++ < staticUpdatesPerFrame)
+            {
+                slot.position = candidate.position;
+                slot.radius = candidate.radius;
+                SetFaceMatrices(slot);
+                slot.refresh = true;
+                slot.valid = true;
+            }
+        }
+
+        // Lights waiting for their first draw stay unshadowed
+        for (const Candidate& candidate : candidates)
+        {
+            if (candidate.slot < 0 || !slots[candidate.slot].valid)
+                continue;
+
+            if (candidate.light < 0)
+                sceneLightShadow = candidate.slot;
+            else
+                lights[candidate.light].shadow = candidate.slot;
+            shadowedLights++;
+        }
+
+        Upload();
+    }
+
+    // Redraw the static casters of the slots that need it, lay the dynamic casters over them, then bind the atlas for
+    // the lighting shaders
+    void Render(const RenderQueue& queue)
+    {
+        casterDraws = 0;
+        culledFaces = 0;
+        staticRenders = 0;
+
+        if (shadowedLights > 0)
+        {
+            int viewport[4];
+            int previousFramebuffer = 0;
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+
+            glUseProgram(depthShader.id);
+            int faceMatricesLoc = glGetUniformLocation(depthShader.id, "faceMatrices");
+
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(1.5f, 2.0f);
+
+            const std::vector<DrawItem>& items = queue.Items();
+
+            for (Slot& slot : slots)
+            {
+                if (!slot.used || !slot.valid)
+                    continue;
+
+                // Split the casters reaching the light, the static ones hashed to notice any change
+                staticCasters.clear();
+                dynamicCasters.clear();
+                uint64_t staticHash = 14695981039346656037ull;
+
+                const DrawItem* previous = nullptr;
+                for (const DrawItem& item : items)
+                {
+                    // Depth needs no materials: the submeshes of one instance are drawn as one range
+                    if (previous && previous->mesh == item.mesh && std::memcmp(previous->model.data, item.model.data, sizeof(item.model.data)) == 0)
+                        continue;
+                    previous = &item;
+
+                    unsigned int faceMask = FaceMask(slot, *item.mesh, item.model);
+                    if (!faceMask)
+                        continue;
+
+                    if (item.isStatic)
+                    {
+                        staticCasters.push_back({ &item, faceMask });
+                        staticHash = HashDrawItem(staticHash, item);
+                    }
+                    else
+                    {
+                        dynamicCasters.push_back({ &item, faceMask });
+                    }
+                }
+
+                // Faces laid out 3x2, in the order of FACE_FORWARD
+                for (int face = 0; face < 6; ++face)
+                    glViewportIndexedf(face, (float)(slot.x + face % 3 * slot.faceSize), (float)(slot.y + face / 3 * slot.faceSize), (float)slot.faceSize, (float)slot.faceSize);
+
+                glUniformMatrix4fv(faceMatricesLoc, 6, GL_FALSE, slot.faceMatrices[0].value_ptr());
+
+                int blockWidth = slot.faceSize * 3, blockHeight = slot.faceSize * 2;
+
+                if (slot.refresh || staticHash != slot.staticHash)
+                {
+                    glBindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+                    glEnable(GL_SCISSOR_TEST);
+                    glScissor(slot.x, slot.y, blockWidth, blockHeight);
+                    glClear(GL_DEPTH_BUFFER_BIT);
+                    glDisable(GL_SCISSOR_TEST);
+                    DrawCasters(staticCasters);
+
+                    slot.staticHash = staticHash;
+                    slot.refresh = false;
+                    slot.liveIsStatic = false;
+                    staticRenders++;
+                }
+
+                // The sampled block already holds just the static casters when nothing dynamic was drawn over them since
+                if (!slot.liveIsStatic || !dynamicCasters.empty())
+                {
+                    glCopyImageSubData(staticAtlas, GL_TEXTURE_2D, 0, slot.x, slot.y, 0, atlas, GL_TEXTURE_2D, 0, slot.x, slot.y, 0, blockWidth, blockHeight, 1);
+
+                    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+                    DrawCasters(dynamicCasters);
+                    slot.liveIsStatic = dynamicCasters.empty();
+                }
+            }
+
+            glBindVertexArray(0);
+            glDisable(GL_POLYGON_OFFSET_FILL);
+
+            // glViewport resets every viewport of the array
+            glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        }
+
+        glActiveTexture(GL_TEXTURE10);
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // Shadow entry of the scene light for its LightBlock, -1 if it has none this frame
+    int SceneLightShadow() const
+    {
+        return sceneLightShadow;
+    }
+
+    // Lights shadowed by the last Update
+    size_t ShadowedLights() const
+    {
+        return shadowedLights;
+    }
+
+    // Statistics of the last Render
+    size_t CasterDraws() const
+    {
+        return casterDraws;
+    }
+
+    size_t CulledFaces() const
+    {
+        return culledFaces;
+    }
+
+    // Lights whose static casters were drawn again
+    size_t StaticRenders() const
+    {
+        return staticRenders;
+    }
+
+private:
+
+    // Id of the scene light's slot, point light ids are never negative
+    static constexpr int SCENE_LIGHT_ID = -1;
+
+    struct Candidate
+    {
+        int light;                  // Index in the light list, -1 for the scene light
+        int id;                     // PointLight::id, SCENE_LIGHT_ID for the scene light
+        Vec3 position;
+        float radius;
+        float screenSize;
+        int faceSize;               // Wanted
+        int slot;                   // Assigned, -1 if none is free
+    };
+
+    struct Slot
+    {
+        int x = 0, y = 0, faceSize = 0;   // Texels
+        bool used = false;
+        int id = SCENE_LIGHT_ID;    // Owner while used
+        bool kept = false;          // Still owned this frame
+
+        Vec3 position;              // Where the light was when its static casters were drawn
+        float radius = 0.0f;
+        Mat4 faceMatrices[6];       // World to clip space, per face
+        float screenSize = 0.0f;
+
+        uint64_t staticHash = 0;    // Static casters in the static atlas
+        bool valid = false;         // Static atlas block drawn for position
+        bool refresh = false;       // Static casters to draw this frame
+        bool liveIsStatic = false;  // Sampled block is a plain copy of the static block
+    };
+
+    struct Caster
+    {
+        const DrawItem* item;
+        unsigned int faceMask;
+    };
+
+    // Cube faces in +X, -X, +Y, -Y, +Z, -Z order, shaders/PointShadows.glsl has the same table
+    static inline const Vec3 FACE_FORWARD[6] = { Vec3(1, 0, 0), Vec3(-1, 0, 0), Vec3(0, 1, 0), Vec3(0, -1, 0), Vec3(0, 0, 1), Vec3(0, 0, -1) };
+    static inline const Vec3 FACE_UP[6] = { Vec3(0, -1, 0), Vec3(0, -1, 0), Vec3(0, 0, 1), Vec3(0, 0, -1), Vec3(0, -1, 0), Vec3(0, -1, 0) };
+
+    static constexpr float NEAR_PLANE = 0.05f;
+
+    int atlasSize, maxFaceSize, minFaceSize;
+    unsigned int atlas;             // Static and dynamic casters, sampled
+    unsigned int staticAtlas;       // Static casters only
+    unsigned int framebuffer;
+    unsigned int staticFramebuffer;
+    unsigned int buffer;
+    size_t bufferCapacity;
+
+    std::vector<Slot> slots;
+    std::vector<Candidate> candidates;
+    std::vector<Caster> staticCasters;
+    std::vector<Caster> dynamicCasters;
+    std::vector<PointShadowGPU> gpuEntries;
+    int sceneLightShadow;
+    size_t shadowedLights;
+
+    size_t casterDraws;
+    size_t culledFaces;
+    size_t staticRenders;
+
+    void CreateAtlas(unsigned int& texture, unsigned int& target)
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, atlasSize, atlasSize);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &target);
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "Point shadow atlas framebuffer is incomplete (" << atlasSize << "x" << atlasSize << ")" << std::endl;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    bool HasFreeSlot(int faceSize) const
+    {
+        for (const Slot& slot : slots)
+        {
+            if (!slot.used && slot.faceSize == faceSize)
+                return true;
+        }
+        return false;
+    }
+
+    void SetFaceMatrices(Slot& slot) const
+    {
+        // Exactly 90 degrees, camera.h's M_PI is too coarse for the faces to meet
+        Mat4 projection = Mat4().Perspective(1.57079633f, 1.0f, NEAR_PLANE, slot.radius);
+
+        for (int face = 0; face < 6; ++face)
+            slot.faceMatrices[face] = Mat4().LookAt(slot.position, slot.position + FACE_FORWARD[face], FACE_UP[face]) * projection;
+    }
+
+    void DrawCasters(const std::vector<Caster>& casters)
+    {
+        int modelLoc = glGetUniformLocation(depthShader.id, "model");
+        int faceMaskLoc = glGetUniformLocation(depthShader.id, "faceMask");
+        Mesh* boundMesh = nullptr;
+
+        for (const Caster& caster : casters)
+        {
+            if (caster.item->mesh != boundMesh)
+            {
+                caster.item->mesh->BindPositions();
+                boundMesh = caster.item->mesh;
+            }
+
+            Mat4 model = caster.item->model;
+            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, model.value_ptr());
+            glUniform1ui(faceMaskLoc, caster.faceMask);
+            glDrawElements(GL_TRIANGLES, (GLsizei)caster.item->mesh->indices.size(), GL_UNSIGNED_INT, (void*)0);
+            casterDraws++;
+        }
+    }
+
+    // Faces of the light whose frustum the instance's bounding sphere reaches, one bit per face
+    unsigned int FaceMask(const Slot& slot, const Mesh& mesh, const Mat4& model)
+    {
+        const Mat4& m = model;
+        const Vec3& c = mesh.boundsCenter;
+        Vec3 center(m.data[0][0] * c.x + m.data[1][0] * c.y + m.data[2][0] * c.z + m.data[3][0],
+            m.data[0][1] * c.x + m.data[1][1] * c.y + m.data[2][1] * c.z + m.data[3][1],
+            m.data[0][2] * c.x + m.data[1][2] * c.y + m.data[2][2] * c.z + m.data[3][2]);
+
+        float scale = 0.0f;
+        for (int axis = 0; axis < 3; ++axis)
+            scale = std::max(scale, std::sqrt(m.data[axis][0] * m.data[axis][0] + m.data[axis][1] * m.data[axis][1] + m.data[axis][2] * m.data[axis][2]));
+        float radius = mesh.boundsRadius * scale;
+
+        Vec3 offset = center - slot.position;
+        if (offset.Dot(offset) > (slot.radius + radius) * (slot.radius + radius))
+        {
+            culledFaces += 6;
+            return 0;
+        }
+
+        // A face frustum is bounded by the planes |other axis| = axis, the sphere must not lie wholly outside any of them
+        const float v[3] = { offset.x, offset.y, offset.z };
+        float reach = radius * 1.41421356f;
+        unsigned int mask = 0;
+
+        for (int face = 0; face < 6; ++face)
+        {
+            int axis = face / 2;
+            float along = face % 2 == 0 ? v[axis] : -v[axis];
+
+            if (along + radius > 0.0f && std::fabs(v[(axis + 1) % 3]) - along <= reach && std::fabs(v[(axis + 2) % 3]) - along <= reach)
+                mask |= 1u << face;
+            else
+                culledFaces++;
+        }
+
+        return mask;
+    }
+
+    // One entry per slot, the shadow index of a light is its slot
+    void Upload()
+    {
+        gpuEntries.resize(std::max<size_t>(slots.size(), 1));
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            const Slot& slot = slots[i];
+            PointShadowGPU& gpu = gpuEntries[i];
+            gpu.position[0] = slot.position.x;
+            gpu.position[1] = slot.position.y;
+            gpu.position[2] = slot.position.z;
+            gpu.nearPlane = NEAR_PLANE;
+            gpu.origin[0] = (float)slot.x / atlasSize;
+            gpu.origin[1] = (float)slot.y / atlasSize;
+            gpu.faceSize = (float)slot.faceSize / atlasSize;
+            gpu.farPlane = slot.radius;
+        }
+
+        // Grow when the entries outgrow the buffer (orphaning the old storage)
+        size_t size = gpuEntries.size() * sizeof(PointShadowGPU);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        if (size > bufferCapacity)
+        {
+            bufferCapacity = std::max(size, bufferCapacity * 2);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, bufferCapacity, nullptr, GL_DYNAMIC_DRAW);
+        }
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, gpuEntries.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, POINT_SHADOW_BUFFER_BINDING, buffer);
+    }
+};
+
+#endif
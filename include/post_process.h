@@ -0,0 +1,175 @@
+#ifndef POST_PROCESS_H
+#define POST_PROCESS_H
+
+#include <glad/glad.h>
+#include <render_graph.h>
+#include <shader.h>
+
+#include <algorithm>
+
+// Texture units of the post-process inputs (see SAMPLER_UNITS)
+const int POST_SOURCE_TEXTURE_UNIT = 11;
+const int POST_BLOOM_TEXTURE_UNIT = 12;
+
+// Bloom and tone mapping of an HDR scene, as render graph passes
+// The scene is drawn into an RGBA16F texture, so lighting above 1 survives until the end. Bloom halves the resolution
+// level by level down a pyramid of R11G11B10F textures, with a 13-tap filter and a brightness threshold on the first
+// level, then walks back up adding a tent-filtered copy of each level to the one above. The resolve adds the bloom,
+// applies the exposure and a filmic curve. The textures are transient textures of the graph.
+class PostProcess
+{
+public:
+
+    float exposure = 1.0f;
+    float bloomThreshold = 1.0f;
+    float bloomKnee = 0.5f;         // Width of the soft transition around the threshold
+    float bloomIntensity = 0.5f;
+    float bloomRadius = 1.0f;       // Tent filter spacing while going up, in texels of the smaller level
+
+    // Pyramid levels below the scene, fewer if the screen runs out of pixels first
+    int bloomLevels = 6;
+
+    ShaderProgram downsampleShader;
+    ShaderProgram upsampleShader;
+    ShaderProgram tonemapShader;
+
+    PostProcess() : emptyVAO(0)
+    {
+        downsampleShader.vertexPath = "shaders/FullscreenVertex.glsl";
+        downsampleShader.fragmentPath = "shaders/BloomDownsample.glsl";
+        CreateShaderProgram(downsampleShader);
+
+        upsampleShader.vertexPath = "shaders/FullscreenVertex.glsl";
+        upsampleShader.fragmentPath = "shaders/BloomUpsample.glsl";
+        CreateShaderProgram(upsampleShader);
+
+        tonemapShader.vertexPath = "shaders/FullscreenVertex.glsl";
+        tonemapShader.fragmentPath = "shaders/Tonemap.glsl";
+        CreateShaderProgram(tonemapShader);
+
+        // The full-screen triangle comes from gl_VertexID, core profiles still need a VAO bound
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    ~PostProcess()
+    {
+        glDeleteVertexArrays(1, &emptyVAO);
+        glDeleteProgram(downsampleShader.id);
+        glDeleteProgram(upsampleShader.id);
+        glDeleteProgram(tonemapShader.id);
+    }
+
+    PostProcess(const PostProcess&) = delete;
+    PostProcess& operator=(const PostProcess&) = delete;
+
+    // Add the passes taking the HDR scene to output (usually the backbuffer)
+    void AddPasses(RenderGraph& graph, RenderGraphTexture scene, RenderGraphTexture output)
+    {
+        RenderGraphTextureDesc sceneDesc = graph.Desc(scene);
+        int width = sceneDesc.width, height = sceneDesc.height;
+
+        // Down the pyramid
+        RenderGraphTexture levels[16];
+        int levelCount = 0;
+        RenderGraphTexture source = scene;
+
+        while (levelCount < std::min(bloomLevels, 16) && (width >> (levelCount + 1)) >= 2 && (height >> (levelCount + 1)) >= 2)
+        {
+            RenderGraphTexture level = graph.Create("bloom level", { width >> (levelCount + 1), height >> (levelCount + 1), GL_R11F_G11F_B10F });
+            bool first = levelCount == 0;
+
+            graph.AddPass("bloom down", [=](RenderGraph::PassBuilder& pass)
+                {
+                    pass.Read(source);
+                    pass.Write(level);
+                },
+                [=](const RenderGraph& built)
+                {
+                    glUseProgram(downsampleShader.id);
+                    SetPassUniforms(downsampleShader.id, built.Desc(source), built.Desc(level));
+                    glUniform1i(glGetUniformLocation(downsampleShader.id, "prefilter"), first);
+                    glUniform1f(glGetUniformLocation(downsampleShader.id, "threshold"), bloomThreshold);
+                    glUniform1f(glGetUniformLocation(downsampleShader.id, "knee"), std::max(bloomKnee, 0.0001f));
+                    DrawFullscreen(built.Texture(source), 0);
+                });
+
+            levels[levelCount++] = level;
+            source = level;
+        }
+
+        // Back up, each level blended onto the next larger one
+        for (int i = levelCount - 1; i > 0; --i)
+        {
+            RenderGraphTexture smaller = levels[i], larger = levels[i - 1];
+
+            graph.AddPass("bloom up", [=](RenderGraph::PassBuilder& pass)
+                {
+                    pass.Read(smaller);
+                    pass.Write(larger);
+                },
+                [=](const RenderGraph& built)
+                {
+                    glUseProgram(upsampleShader.id);
+                    SetPassUniforms(upsampleShader.id, built.Desc(smaller), built.Desc(larger));
+                    glUniform1f(glGetUniformLocation(upsampleShader.id, "filterRadius"), bloomRadius);
+
+                    glEnable(GL_BLEND);
+                    glBlendFunc(GL_ONE, GL_ONE);
+                    DrawFullscreen(built.Texture(smaller), 0);
+                    glDisable(GL_BLEND);
+                });
+        }
+
+        // Resolve to the output
+        RenderGraphTexture bloom = levelCount > 0 ? levels[0] : RenderGraphTexture();
+
+        graph.AddPass("tone map", [=](RenderGraph::PassBuilder& pass)
+            {
+                pass.Read(scene);
+                pass.Read(bloom);
+                pass.Write(output);
+            },
+            [=](const RenderGraph& built)
+            {
+                RenderGraphTextureDesc outputDesc = built.Desc(output);
+
+                glUseProgram(tonemapShader.id);
+                glUniform2f(glGetUniformLocation(tonemapShader.id, "targetTexelSize"), 1.0f / outputDesc.width, 1.0f / outputDesc.height);
+                glUniform1f(glGetUniformLocation(tonemapShader.id, "exposure"), exposure);
+                glUniform1f(glGetUniformLocation(tonemapShader.id, "bloomIntensity"), bloom.Valid() ? bloomIntensity : 0.0f);
+
+                unsigned int sceneTexture = built.Texture(scene);
+                DrawFullscreen(sceneTexture, bloom.Valid() ? built.Texture(bloom) : sceneTexture);
+            });
+    }
+
+private:
+    unsigned int emptyVAO;
+
+    static void SetPassUniforms(unsigned int program, const RenderGraphTextureDesc& source, const RenderGraphTextureDesc& target)
+    {
+        glUniform2f(glGetUniformLocation(program, "sourceTexelSize"), 1.0f / source.width, 1.0f / source.height);
+        glUniform2f(glGetUniformLocation(program, "targetTexelSize"), 1.0f / target.width, 1.0f / target.height);
+    }
+
+    // Full-screen triangle into the bound target, without depth testing
+    void DrawFullscreen(unsigned int source, unsigned int bloom) const
+    {
+        glActiveTexture(GL_TEXTURE0 + POST_SOURCE_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, source);
+        if (bloom)
+        {
+            glActiveTexture(GL_TEXTURE0 + POST_BLOOM_TEXTURE_UNIT);
+            glBindTexture(GL_TEXTURE_2D, bloom);
+        }
+        glActiveTexture(GL_TEXTURE0);
+
+        glDisable(GL_DEPTH_TEST);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+};
+
+#endif
@@ -0,0 +1,526 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <glad/glad.h>
+#include <gpu_timer.h>
+#include <render_target_pool.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <ostream>
+#include <vector>
+
+// Texture of a render graph, valid for the frame it was created in
+struct RenderGraphTexture
+{
+    int index = -1;
+
+    bool Valid() const
+    {
+        return index >= 0;
+    }
+};
+
+struct RenderGraphTextureDesc
+{
+    int width = 0, height = 0;
+    GLenum format = 0;
+};
+
+// The passes of a frame, declared with the textures they read and write, then run in the order they were added
+// Execute culls the passes nothing depends on (walking back from the screen and from passes with side effects), gives
+// each transient texture a lifetime from its first to its last use, and hands the textures out of a RenderTargetPool
+// at the start of their lifetime and back at the end: textures of the same size and format whose lifetimes do not
+// overlap share one GL texture. Before a pass runs its attachments are bound (skipped when the last pass had the same)
+// and the textures it is the first to write are cleared if it asked for it.
+// The graph is filled again every frame, the pool and the framebuffers behind it stay.
+class RenderGraph
+{
+public:
+
+    // Color the clears write, depth clears to 1
+    float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+    // Declares what a pass reads and writes, only valid inside the setup function of AddPass
+    class PassBuilder
+    {
+    public:
+
+        // Sampled by the pass, it binds the texture itself (see RenderGraph::Texture)
+        RenderGraphTexture Read(RenderGraphTexture texture)
+        {
+            if (texture.Valid())
+                graph.passes[pass].reads.push_back(texture.index);
+            return texture;
+        }
+
+        // Next color attachment, cleared first if clear is set and no earlier pass wrote it
+        RenderGraphTexture Write(RenderGraphTexture texture, bool clear = false)
+        {
+            if (texture.Valid())
+            {
+                graph.passes[pass].colors.push_back(texture.index);
+                AddWrite(texture.index, clear);
+            }
+            return texture;
+        }
+
+        // Depth attachment
+        RenderGraphTexture WriteDepth(RenderGraphTexture texture, bool clear = false)
+        {
+            if (texture.Valid())
+            {
+                graph.passes[pass].depth = texture.index;
+                AddWrite(texture.index, clear);
+            }
+            return texture;
+        }
+
+        // The pass does work the graph cannot see (e.g. into its own framebuffers) and is never culled
+        // It may bind any framebuffer, the graph binds again after it
+        void SideEffect()
+        {
+            graph.passes[pass].sideEffect = true;
+        }
+
+    private:
+        friend class RenderGraph;
+
+        RenderGraph& graph;
+        int pass;
+
+        PassBuilder(RenderGraph& graph, int pass) : graph(graph), pass(pass)
+        {
+        }
+
+        void AddWrite(int texture, bool clear)
+        {
+            graph.passes[pass].writes.push_back(texture);
+            if (clear)
+                graph.passes[pass].clears.push_back(texture);
+        }
+    };
+
+    RenderGraph() : timer(nullptr), backbufferWidth(1), backbufferHeight(1), boundFramebuffer(-1), passFramebuffer(0), frame(0), passCount(0),
+        resourceCount(0), culledPasses(0), physicalTargets(0), physicalBytes(0), framebufferBinds(0), clears(0), transientBytes(0), peakBytes(0)
+    {
+    }
+
+    ~RenderGraph()
+    {
+        for (auto& framebuffer : framebuffers)
+            glDeleteFramebuffers(1, &framebuffer.second.id);
+    }
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    // Every pass becomes a stage of the timer, named after the pass
+    void SetTimer(GpuTimer* gpuTimer)
+    {
+        timer = gpuTimer;
+    }
+
+    // Size of the default framebuffer this frame, start of a new graph
+    void SetBackbuffer(int width, int height)
+    {
+        backbufferWidth = std::max(width, 1);
+        backbufferHeight = std::max(height, 1);
+    }
+
+    // The default framebuffer, color and depth, writing either keeps the pass
+    RenderGraphTexture Backbuffer()
+    {
+        return Import("backbuffer");
+    }
+
+    RenderGraphTexture BackbufferDepth()
+    {
+        return Import("backbuffer depth");
+    }
+
+    // Transient texture, it exists from the first pass that uses it to the last
+    RenderGraphTexture Create(const char* name, const RenderGraphTextureDesc& desc)
+    {
+        Resource resource;
+        resource.name = name;
+        resource.desc = desc;
+        resources.push_back(resource);
+        return { (int)resources.size() - 1 };
+    }
+
+    // setup declares the reads and writes, execute runs with the attachments bound and viewport set, if the pass is kept
+    void AddPass(const char* name, const std::function<void(PassBuilder&)>& setup, const std::function<void(const RenderGraph&)>& execute)
+    {
+        Pass pass;
+        pass.name = name;
+        pass.execute = execute;
+        passes.push_back(pass);
+
+        PassBuilder builder(*this, (int)passes.size() - 1);
+        setup(builder);
+    }
+
+    RenderGraphTextureDesc Desc(RenderGraphTexture texture) const
+    {
+        const Resource& resource = resources[texture.index];
+        return resource.imported ? RenderGraphTextureDesc{ backbufferWidth, backbufferHeight, 0 } : resource.desc;
+    }
+
+    // GL texture behind a transient texture, inside the execute function of a pass that uses it
+    unsigned int Texture(RenderGraphTexture texture) const
+    {
+        const Resource& resource = resources[texture.index];
+        return resource.target ? resource.target->texture : 0;
+    }
+
+    // Framebuffer bound for the running pass (0 for the default framebuffer), for passes that bind their own and come back
+    unsigned int Framebuffer() const
+    {
+        return passFramebuffer;
+    }
+
+    // Cull, allocate, run the passes and start an empty graph
+    void Execute()
+    {
+        Cull();
+        ComputeLifetimes();
+
+        transientBytes = 0;
+        peakBytes = 0;
+        size_t liveBytes = 0;
+        framebufferBinds = 0;
+        clears = 0;
+        boundFramebuffer = -1;
+
+        for (size_t i = 0; i < passes.size(); ++i)
+        {
+            Pass& pass = passes[i];
+            if (pass.culled)
+                continue;
+
+            // Textures starting their lifetime take a free target of their size and format
+            for (Resource& resource : resources)
+            {
+                if (!resource.imported && resource.firstUse == (int)i)
+                {
+                    resource.target = pool.Acquire(resource.desc.width, resource.desc.height, resource.desc.format);
+                    size_t bytes = (size_t)resource.desc.width * resource.desc.height * RenderTargetTexelSize(resource.desc.format);
+                    transientBytes += bytes;
+                    liveBytes += bytes;
+                }
+            }
+            peakBytes = std::max(peakBytes, liveBytes);
+
+            if (timer)
+                timer->Stage(pass.name);
+
+            Begin((int)i);
+            pass.execute(*this);
+
+            if (pass.sideEffect)
+                boundFramebuffer = -1;
+
+            // Textures ending their lifetime go back for later passes
+            for (Resource& resource : resources)
+            {
+                if (!resource.imported && resource.lastUse == (int)i && resource.target)
+                {
+                    pool.Release(resource.target);
+                    liveBytes -= (size_t)resource.desc.width * resource.desc.height * RenderTargetTexelSize(resource.desc.format);
+                }
+            }
+        }
+
+        passCount = passes.size();
+        resourceCount = std::count_if(resources.begin(), resources.end(), [](const Resource& resource) { return !resource.imported; });
+        physicalTargets = pool.TargetCount();
+        physicalBytes = pool.Bytes();
+
+        passes.clear();
+        resources.clear();
+        pool.EndFrame();
+        EvictFramebuffers();
+        frame++;
+    }
+
+    // Statistics of the last Execute
+    void Report(std::ostream& out) const
+    {
+        out << "Render graph: " << passCount - culledPasses << " of " << passCount << " passes, " << resourceCount << " textures in "
+            << physicalTargets << " targets (" << physicalBytes / (1024 * 1024) << " MB, " << transientBytes / (1024 * 1024) << " MB without sharing, peak "
+            << peakBytes / (1024 * 1024) << " MB live), " << framebufferBinds << " framebuffer binds, " << clears << " clears" << std::endl;
+    }
+
+private:
+
+    struct Resource
+    {
+        const char* name = nullptr;
+        RenderGraphTextureDesc desc;
+        bool imported = false;          // The default framebuffer
+        int readers = 0;
+        int firstUse = -1, lastUse = -1;
+        RenderTarget* target = nullptr;
+    };
+
+    struct Pass
+    {
+        const char* name = nullptr;
+        std::function<void(const RenderGraph&)> execute;
+        std::vector<int> reads;
+        std::vector<int> writes;
+        std::vector<int> clears;
+        std::vector<int> colors;        // Attachments, in order
+        int depth = -1;
+        bool sideEffect = false;
+        bool culled = false;
+        int references = 0;
+    };
+
+    struct CachedFramebuffer
+    {
+        unsigned int id = 0;
+        long long lastUsed = 0;
+    };
+
+    GpuTimer* timer;
+    RenderTargetPool pool;
+    std::vector<Pass> passes;
+    std::vector<Resource> resources;
+
+    // Framebuffers of the passes with more than one attachment, by attachment list (colors, then depth)
+    std::map<std::vector<unsigned int>, CachedFramebuffer> framebuffers;
+
+    int backbufferWidth, backbufferHeight;
+    long long boundFramebuffer;     // -1 when unknown
+    unsigned int passFramebuffer;
+    long long frame;
+
+    size_t passCount, resourceCount, culledPasses;
+    size_t physicalTargets, physicalBytes;
+    size_t framebufferBinds, clears;
+    size_t transientBytes, peakBytes;
+
+    RenderGraphTexture Import(const char* name)
+    {
+        for (size_t i = 0; i < resources.size(); ++i)
+        {
+            if (resources[i].imported && std::strcmp(resources[i].name, name) == 0)
+                return { (int)i };
+        }
+
+        Resource resource;
+        resource.name = name;
+        resource.imported = true;
+        resources.push_back(resource);
+        return { (int)resources.size() - 1 };
+    }
+
+    // A pass is kept if it writes the screen, has side effects, or writes a texture a kept pass reads
+    void Cull()
+    {
+        for (Pass& pass : passes)
+        {
+            pass.culled = false;
+            pass.references = (int)pass.writes.size();
+            for (int read : pass.reads)
+                resources[read].readers++;
+        }
+
+        std::vector<int> unread;
+        for (size_t i = 0; i < resources.size(); ++i)
+        {
+            if (!resources[i].imported && resources[i].readers == 0)
+                unread.push_back((int)i);
+        }
+
+        while (!unread.empty())
+        {
+            int resource = unread.back();
+            unread.pop_back();
+
+            for (Pass& pass : passes)
+            {
+                if (pass.culled || std::find(pass.writes.begin(), pass.writes.end(), resource) == pass.writes.end())
+                    continue;
+
+                if (--pass.references > 0 || pass.sideEffect)
+                    continue;
+
+                pass.culled = true;
+                for (int read : pass.reads)
+                {
+                    if (--resources[read].readers == 0 && !resources[read].imported)
+                        unread.push_back(read);
+                }
+            }
+        }
+
+        culledPasses = 0;
+        for (const Pass& pass : passes)
+            culledPasses += pass.culled;
+    }
+
+    void ComputeLifetimes()
+    {
+        for (size_t i = 0; i < passes.size(); ++i)
+        {
+            const Pass& pass = passes[i];
+            if (pass.culled)
+                continue;
+
+            auto use = [&](int index)
+            {
+                Resource& resource = resources[index];
+                if (resource.firstUse < 0)
+                    resource.firstUse = (int)i;
+                resource.lastUse = (int)i;
+            };
+
+            for (int read : pass.reads)
+            {
+                use(read);
+                if (resources[read].firstUse == (int)i && !resources[read].imported && std::find(pass.writes.begin(), pass.writes.end(), read) == pass.writes.end())
+                    std::cerr << "Render graph pass " << pass.name << " reads " << resources[read].name << " before any pass writes it" << std::endl;
+            }
+            for (int write : pass.writes)
+                use(write);
+        }
+    }
+
+    // Bind the attachments of the pass, set the viewport and clear what it is the first to write
+    void Begin(int index)
+    {
+        const Pass& pass = passes[index];
+        if (pass.colors.empty() && pass.depth < 0)
+            return;
+
+        bool toBackbuffer = false;
+        std::vector<unsigned int> attachments;
+        std::vector<const Resource*> attached;
+        for (int color : pass.colors)
+            attached.push_back(&resources[color]);
+        if (pass.depth >= 0)
+            attached.push_back(&resources[pass.depth]);
+
+        for (const Resource* resource : attached)
+        {
+            toBackbuffer |= resource->imported;
+            attachments.push_back(resource->target ? resource->target->texture : 0);
+        }
+
+        unsigned int framebuffer = 0;
+        int width = backbufferWidth, height = backbufferHeight;
+
+        if (toBackbuffer)
+        {
+            if (std::any_of(attached.begin(), attached.end(), [](const Resource* resource) { return !resource->imported; }))
+                std::cerr << "Render graph pass " << pass.name << " mixes the backbuffer with textures, only the backbuffer is bound" << std::endl;
+        }
+        else
+        {
+            width = attached.front()->desc.width;
+            height = attached.front()->desc.height;
+
+            // A single texture is drawn through the framebuffer its target already has
+            framebuffer = attached.size() == 1 && attached.front()->target ? attached.front()->target->framebuffer : FindFramebuffer(pass, attachments);
+        }
+
+        if ((long long)framebuffer != boundFramebuffer)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            boundFramebuffer = framebuffer;
+            framebufferBinds++;
+        }
+        passFramebuffer = framebuffer;
+        glViewport(0, 0, width, height);
+
+        // Only the first writer clears, later passes add to what is there
+        for (int clear : pass.clears)
+        {
+            if (resources[clear].firstUse != index)
+                continue;
+
+            const Resource& resource = resources[clear];
+            bool depth = clear == pass.depth;
+
+            if (depth)
+            {
+                bool stencil = resource.imported || resource.desc.format == GL_DEPTH24_STENCIL8 || resource.desc.format == GL_DEPTH32F_STENCIL8;
+                if (stencil)
+                    glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+                else
+                {
+                    const float one = 1.0f;
+                    glClearBufferfv(GL_DEPTH, 0, &one);
+                }
+            }
+            else
+            {
+                int drawBuffer = (int)(std::find(pass.colors.begin(), pass.colors.end(), clear) - pass.colors.begin());
+                glClearBufferfv(GL_COLOR, drawBuffer, clearColor);
+            }
+            clears++;
+        }
+    }
+
+    unsigned int FindFramebuffer(const Pass& pass, const std::vector<unsigned int>& attachments)
+    {
+        CachedFramebuffer& cached = framebuffers[attachments];
+        cached.lastUsed = frame;
+        if (cached.id)
+            return cached.id;
+
+        glGenFramebuffers(1, &cached.id);
+        glBindFramebuffer(GL_FRAMEBUFFER, cached.id);
+        boundFramebuffer = cached.id;
+        framebufferBinds++;
+
+        std::vector<GLenum> drawBuffers;
+        for (size_t i = 0; i < pass.colors.size(); ++i)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + (GLenum)i, GL_TEXTURE_2D, attachments[i], 0);
+            drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + (GLenum)i);
+        }
+
+        if (pass.depth >= 0)
+        {
+            GLenum format = resources[pass.depth].desc.format;
+            bool stencil = format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+            glFramebufferTexture2D(GL_FRAMEBUFFER, stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, attachments.back(), 0);
+        }
+
+        if (drawBuffers.empty())
+            glDrawBuffer(GL_NONE);
+        else
+            glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "Render graph framebuffer of pass " << pass.name << " is incomplete" << std::endl;
+
+        return cached.id;
+    }
+
+    // Framebuffers not used last frame may point at targets the pool is about to delete
+    void EvictFramebuffers()
+    {
+        for (auto it = framebuffers.begin(); it != framebuffers.end();)
+        {
+            if (frame - it->second.lastUsed > 1)
+            {
+                glDeleteFramebuffers(1, &it->second.id);
+                it = framebuffers.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+};
+
+#endif
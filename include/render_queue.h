@@ -0,0 +1,183 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <mesh.h>
+#include <mat4.h>
+#include <shader_variants.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Submesh waiting to be drawn
+struct DrawItem
+{
+    Mesh* mesh;
+    const SubMesh* submesh;
+    Mat4 model;
+    bool isStatic;      // Model matrix and mesh data do not change from frame to frame, shadow maps cache it
+};
+
+// Fold an item into a hash of the casters a shadow map was rendered from (FNV-1a over mesh, mesh revision and model)
+inline uint64_t HashDrawItem(uint64_t hash, const DrawItem& item)
+{
+    auto add = [&hash](const void* data, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= ((const unsigned char*)data)[i];
+            hash *= 1099511628211ull;
+        }
+    };
+
+    add(&item.mesh, sizeof(item.mesh));
+    add(&item.mesh->revision, sizeof(item.mesh->revision));
+    add(item.model.data, sizeof(item.model.data));
+    return hash;
+}
+
+// Collects submeshes for a frame and draws them sorted by material to keep program and texture binds down
+// Items that sort equal keep their submission order (e.g. front to back for early depth rejection)
+class RenderQueue
+{
+public:
+
+    // Queue every submesh of the mesh, isStatic for meshes that stay where they are (their shadows are cached)
+    void Submit(Mesh& mesh, const Mat4& model, bool isStatic = false)
+    {
+        for (const SubMesh& submesh : mesh.submeshes)
+            items.push_back({ &mesh, &submesh, model, isStatic });
+    }
+
+    // Sort and draw all queued submeshes, then clear the queue
+    // The camera comes from the frame block, uploaded by the caller (see FrameUniforms)
+    void Flush(unsigned int shaderProgram)
+    {
+        Draw(shaderProgram);
+        items.clear();
+    }
+
+    // Sort and draw all queued submeshes, they stay queued (e.g. for another pass with a different program)
+    void Draw(unsigned int shaderProgram)
+    {
+        // Texture first (most expensive to change), then material, then mesh
+        std::stable_sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b)
+        {
+            if (a.submesh->material.texture != b.submesh->material.texture)
+                return a.submesh->material.texture < b.submesh->material.texture;
+            if (a.submesh->materialID != b.submesh->materialID)
+                return a.submesh->materialID < b.submesh->materialID;
+            return a.mesh < b.mesh;
+        });
+
+        DrawSorted([shaderProgram](const DrawItem&) { return shaderProgram; }, nullptr);
+    }
+
+    // Sort and draw all queued submeshes, each with the cheapest variant that supports its material
+    // programBound runs whenever another variant is bound, to set uniforms outside the blocks the queue does not know about
+    void Draw(ShaderVariants& variants, const std::function<void(unsigned int)>& programBound = nullptr)
+    {
+        // Variant first (program switches cost the most), then texture, material and mesh
+        std::stable_sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b)
+        {
+            uint32_t featuresA = MaterialFeatures(a.submesh->material), featuresB = MaterialFeatures(b.submesh->material);
+            if (featuresA != featuresB)
+                return featuresA < featuresB;
+            if (a.submesh->material.texture != b.submesh->material.texture)
+                return a.submesh->material.texture < b.submesh->material.texture;
+            if (a.submesh->materialID != b.submesh->materialID)
+                return a.submesh->materialID < b.submesh->materialID;
+            return a.mesh < b.mesh;
+        });
+
+        DrawSorted([&variants](const DrawItem& item) { return variants.Get(item.submesh->material); }, programBound);
+    }
+
+    // Draw with variants, then clear the queue
+    void Flush(ShaderVariants& variants, const std::function<void(unsigned int)>& programBound = nullptr)
+    {
+        Draw(variants, programBound);
+        items.clear();
+    }
+
+    // Items queued since the last flush
+    const std::vector<DrawItem>& Items() const
+    {
+        return items;
+    }
+
+    // Statistics of the last flush
+    size_t drawCount = 0;
+    size_t textureBinds = 0;
+    size_t programBinds = 0;
+
+private:
+    std::vector<DrawItem> items;
+
+    // Draw the items in their current order, switching programs when programFor changes
+    template <typename ProgramFor>
+    void DrawSorted(ProgramFor programFor, const std::function<void(unsigned int)>& programBound)
+    {
+        unsigned int shaderProgram = 0;
+        int modelLoc = -1;
+
+        glActiveTexture(GL_TEXTURE0);
+
+        Mesh* boundMesh = nullptr;
+        const SubMesh* boundMaterial = nullptr;
+        unsigned int boundTexture = 0;
+        textureBinds = 0;
+        programBinds = 0;
+
+        for (DrawItem& item : items)
+        {
+            unsigned int program = programFor(item);
+            if (!program)
+                continue;
+
+            // Plain uniforms are per program and set again after a switch, the blocks are shared by all programs
+            if (program != shaderProgram)
+            {
+                shaderProgram = program;
+                glUseProgram(shaderProgram);
+                programBinds++;
+
+                modelLoc = glGetUniformLocation(shaderProgram, "model");
+
+                if (programBound)
+                    programBound(shaderProgram);
+            }
+
+            // The light block holds the scene light, uploaded by the caller
+            if (item.mesh != boundMesh)
+            {
+                item.mesh->Bind();
+                boundMesh = item.mesh;
+            }
+
+            if (item.submesh->material.texture != boundTexture || textureBinds == 0)
+            {
+                Mesh::BindTexture(item.submesh->material);
+                boundTexture = item.submesh->material.texture;
+                textureBinds++;
+            }
+
+            // Registered materials are uploaded once per run of identical IDs
+            if (!boundMaterial || item.submesh->materialID == INVALID_MATERIAL || item.submesh->materialID != boundMaterial->materialID)
+            {
+                Mesh::SetMaterial(item.submesh->material);
+                boundMaterial = item.submesh;
+            }
+
+            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, item.model.value_ptr());
+            item.mesh->DrawSubMesh(*item.submesh);
+        }
+
+        glBindVertexArray(0);
+
+        drawCount = items.size();
+    }
+};
+
+#endif
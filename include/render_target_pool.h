@@ -0,0 +1,223 @@
+#ifndef RENDER_TARGET_POOL_H
+#define RENDER_TARGET_POOL_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// Depth formats are attached as depth, everything else as color
+inline bool IsDepthFormat(GLenum format)
+{
+    return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32F
+        || format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+// Bytes per texel of the formats render targets use, for memory statistics
+inline size_t RenderTargetTexelSize(GLenum format)
+{
+    switch (format)
+    {
+    case GL_RGBA32F: return 16;
+    case GL_RGBA16F: case GL_DEPTH32F_STENCIL8: return 8;
+    case GL_DEPTH_COMPONENT16: case GL_RG8: return 2;
+    case GL_R8: return 1;
+    default: return 4;
+    }
+}
+
+// Framebuffer with one texture, and optionally a depth-stencil texture behind a color one
+struct RenderTarget
+{
+    unsigned int framebuffer = 0;
+    unsigned int texture = 0;
+    unsigned int depthTexture = 0;
+    int width = 0, height = 0;
+    GLenum format = 0;
+    bool hasDepth = false;
+};
+
+// Transient render targets for the passes of a frame
+// Targets are handed out by size and format and come back at EndFrame (or earlier with Release), so the same textures
+// serve every frame. A target idle for maxIdleFrames is deleted: after a resize the old sizes go away once, instead
+// of targets being created and deleted every frame.
+class RenderTargetPool
+{
+public:
+
+    int maxIdleFrames = 60;
+
+    RenderTargetPool() : frame(0), allocations(0)
+    {
+    }
+
+    ~RenderTargetPool()
+    {
+        for (std::unique_ptr<Entry>& entry : entries)
+            Delete(*entry);
+    }
+
+    RenderTargetPool(const RenderTargetPool&) = delete;
+    RenderTargetPool& operator=(const RenderTargetPool&) = delete;
+
+    // A free target of exactly this size and format, created if there is none, nullptr if the framebuffer is incomplete
+    // Color is linear filtered, depth nearest, both clamped to the edge, valid until Release or EndFrame
+    RenderTarget* Acquire(int width, int height, GLenum format, bool hasDepth = false)
+    {
+        for (std::unique_ptr<Entry>& entry : entries)
+        {
+            RenderTarget& target = entry->target;
+            if (!entry->inUse && target.width == width && target.height == height && target.format == format && target.hasDepth == hasDepth)
+            {
+                entry->inUse = true;
+                entry->lastUsed = frame;
+                return &target;
+            }
+        }
+
+        std::unique_ptr<Entry> entry = std::make_unique<Entry>();
+        RenderTarget& target = entry->target;
+        target.width = width;
+        target.height = height;
+        target.format = format;
+        target.hasDepth = hasDepth;
+
+        glGenFramebuffers(1, &target.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+
+        if (IsDepthFormat(format))
+        {
+            target.texture = CreateTexture(width, height, format, GL_NEAREST);
+            bool stencil = format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+            glFramebufferTexture2D(GL_FRAMEBUFFER, stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, target.texture, 0);
+            glDrawBuffer(GL_NONE);
+        }
+        else
+        {
+            target.texture = CreateTexture(width, height, format, GL_LINEAR);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
+        }
+
+        // Same format as the usual default framebuffer and the G-buffer, depth blits need them to match
+        if (hasDepth && !IsDepthFormat(format))
+        {
+            target.depthTexture = CreateTexture(width, height, GL_DEPTH24_STENCIL8, GL_NEAREST);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, target.depthTexture, 0);
+        }
+
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (!complete)
+        {
+            std::cerr << "Render target framebuffer is incomplete (" << width << "x" << height << ", format 0x" << std::hex << format << std::dec << ")" << std::endl;
+            Delete(*entry);
+            return nullptr;
+        }
+
+        entry->inUse = true;
+        entry->lastUsed = frame;
+        allocations++;
+        entries.push_back(std::move(entry));
+        return &entries.back()->target;
+    }
+
+    // Hand a target back before the end of the frame, so a later pass of the same frame can reuse it
+    void Release(RenderTarget* target)
+    {
+        for (std::unique_ptr<Entry>& entry : entries)
+        {
+            if (&entry->target == target)
+                entry->inUse = false;
+        }
+    }
+
+    // Take every target back and delete the ones that have been idle too long
+    void EndFrame()
+    {
+        for (size_t i = 0; i < entries.size();)
+        {
+            Entry& entry = *entries[i];
+            entry.inUse = false;
+
+            if (frame - entry.lastUsed > maxIdleFrames)
+            {
+                Delete(entry);
+                entries[i] = std::move(entries.back());
+                entries.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+
+        frame++;
+    }
+
+    // Targets alive
+    size_t TargetCount() const
+    {
+        return entries.size();
+    }
+
+    // Targets created since the start, stays flat while nothing is resized
+    size_t Allocations() const
+    {
+        return allocations;
+    }
+
+    // Memory of the targets alive
+    size_t Bytes() const
+    {
+        size_t bytes = 0;
+        for (const std::unique_ptr<Entry>& entry : entries)
+        {
+            const RenderTarget& target = entry->target;
+            bytes += (size_t)target.width * target.height * (RenderTargetTexelSize(target.format) + (target.hasDepth ? 4 : 0));
+        }
+        return bytes;
+    }
+
+private:
+
+    struct Entry
+    {
+        RenderTarget target;
+        bool inUse = false;
+        long long lastUsed = 0;
+    };
+
+    std::vector<std::unique_ptr<Entry>> entries;
+    long long frame;
+    size_t allocations;
+
+    static unsigned int CreateTexture(int width, int height, GLenum format, GLint filter)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    static void Delete(Entry& entry)
+    {
+        RenderTarget& target = entry.target;
+        if (target.framebuffer)
+            glDeleteFramebuffers(1, &target.framebuffer);
+        if (target.texture)
+            glDeleteTextures(1, &target.texture);
+        if (target.depthTexture)
+            glDeleteTextures(1, &target.depthTexture);
+        target = RenderTarget();
+    }
+};
+
+#endif
@@ -0,0 +1,338 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <glad/glad.h>
+#include <shader_preprocessor.h>
+#include <uniform_blocks.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Linked program and the files it was built from
+struct ShaderProgram
+{
+    unsigned int id = 0;
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string geometryPath;               // Optional
+    std::vector<std::string> dependencies; // Files included by any stage, the stage paths included
+};
+
+// Shader after #include, #if and unused function removal (see ShaderPreprocessor), empty if a file could not be read
+// dependencies receives every file read, for hot reload
+inline std::string ReadShaderSource(const std::string& filename, const ShaderDefines& defines = ShaderDefines(), std::vector<std::string>* dependencies = nullptr)
+{
+    PreprocessedShader shader = ShaderPreprocessor().Process(filename, defines);
+
+    if (dependencies)
+        *dependencies = shader.dependencies;
+
+    return shader.success ? shader.source : std::string();
+}
+
+// Shader objects and program of a build that was started but not checked yet
+struct ProgramBuild
+{
+    unsigned int program = 0;
+    unsigned int vertexShader = 0;
+    unsigned int fragmentShader = 0;
+    unsigned int geometryShader = 0;    // 0 without a geometry stage
+};
+
+// Whether the driver compiles and links in the background (KHR/ARB_parallel_shader_compile)
+inline bool ParallelShaderCompileSupported()
+{
+    return GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile;
+}
+
+// Issue the compiles and the link without querying any status, so a driver with parallel compile keeps working on them
+// An empty geometry source builds a program without a geometry stage
+inline ProgramBuild StartShaderProgram(const std::string& vertexShaderSource, const std::string& fragmentShaderSource, const std::string& geometryShaderSource = "")
+{
+    ProgramBuild build;
+    const char* vertexSource = vertexShaderSource.c_str();
+    const char* fragmentSource = fragmentShaderSource.c_str();
+
+    build.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(build.vertexShader, 1, &vertexSource, nullptr);
+    glCompileShader(build.vertexShader);
+
+    build.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(build.fragmentShader, 1, &fragmentSource, nullptr);
+    glCompileShader(build.fragmentShader);
+
+    if (!geometryShaderSource.empty())
+    {
+        const char* geometrySource = geometryShaderSource.c_str();
+        build.geometryShader = glCreateShader(GL_GEOMETRY_SHADER);
+        glShaderSource(build.geometryShader, 1, &geometrySource, nullptr);
+        glCompileShader(build.geometryShader);
+    }
+
+    // Create shader program, the binary is kept retrievable for the program cache
+    build.program = glCreateProgram();
+    glAttachShader(build.program, build.vertexShader);
+    glAttachShader(build.program, build.fragmentShader);
+    if (build.geometryShader)
+        glAttachShader(build.program, build.geometryShader);
+    glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(build.program);
+
+    return build;
+}
+
+// Whether FinishShaderProgram would return without waiting, always true without parallel compile
+inline bool ShaderProgramReady(const ProgramBuild& build)
+{
+    if (!ParallelShaderCompileSupported())
+        return true;
+
+    int done = GL_FALSE;
+    glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
+}
+
+// Check the build for errors and release the shader objects, returns the program or 0 on failure
+// Waits for the driver if the build is still in progress
+inline unsigned int FinishShaderProgram(ProgramBuild& build)
+{
+    int success;
+    char infoLog[512];
+
+	// Check for compilation errors
+    for (unsigned int shader : { build.vertexShader, build.fragmentShader, build.geometryShader })
+    {
+        if (!shader)
+            continue;
+
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+            std::cerr << "ERROR::SHADER::COMPILATION_FAILED\n" << infoLog << std::endl;
+        }
+    }
+
+    // Check for linking errors
+    glGetProgramiv(build.program, GL_LINK_STATUS, &success);
+
+    // Clean up shaders (no longer needed once linked)
+    glDeleteShader(build.vertexShader);
+    glDeleteShader(build.fragmentShader);
+    glDeleteShader(build.geometryShader);
+
+    unsigned int program = build.program;
+    build = ProgramBuild();
+
+    if (!success)
+    {
+        glGetProgramInfoLog(program, 512, nullptr, infoLog);
+        std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    BindUniformBlocks(program);
+    return program;
+}
+
+// Compile and link a program from sources, returns 0 on failure
+inline unsigned int BuildShaderProgram(const std::string& vertexShaderSource, const std::string& fragmentShaderSource, const std::string& geometryShaderSource = "")
+{
+    ProgramBuild build = StartShaderProgram(vertexShaderSource, fragmentShaderSource, geometryShaderSource);
+    return FinishShaderProgram(build);
+}
+
+// Linked program binaries are cached here, one file per program
+const char* const PROGRAM_CACHE_DIRECTORY = "shader_cache";
+const uint32_t PROGRAM_CACHE_MAGIC = 0x42504744; // "DGPB"
+
+// FNV-1a hash of the sources, the defines and the driver, a binary is only valid for the driver that produced it
+inline uint64_t ProgramCacheKey(const std::string& vertexShaderSource, const std::string& fragmentShaderSource, const std::string& defines = "", const std::string& geometryShaderSource = "")
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const char* text, size_t length)
+    {
+        for (size_t i = 0; i < length; ++i)
+        {
+            hash ^= (unsigned char)text[i];
+            hash *= 1099511628211ull;
+        }
+
+        // Separator so moving text from one part to the next changes the key
+        hash ^= 0xff;
+        hash *= 1099511628211ull;
+    };
+
+    add(vertexShaderSource.data(), vertexShaderSource.size());
+    add(fragmentShaderSource.data(), fragmentShaderSource.size());
+    add(defines.data(), defines.size());
+    add(geometryShaderSource.data(), geometryShaderSource.size());
+
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+    {
+        const char* value = (const char*)glGetString(name);
+        add(value ? value : "", value ? std::strlen(value) : 0);
+    }
+
+    return hash;
+}
+
+inline std::string ProgramCachePath(uint64_t key)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return (std::filesystem::path(PROGRAM_CACHE_DIRECTORY) / name).generic_string();
+}
+
+// Whether the driver can return program binaries at all
+inline bool ProgramBinariesSupported()
+{
+    int formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+// Program from a cached binary, 0 if there is none or the driver rejects it (e.g. after a driver update)
+inline unsigned int LoadProgramBinary(uint64_t key)
+{
+    std::ifstream file(ProgramCachePath(key), std::ios::binary);
+    if (!file.is_open())
+        return 0;
+
+    uint32_t header[3] = {}; // Magic, binary format, binary size
+    if (!file.read((char*)header, sizeof(header)) || header[0] != PROGRAM_CACHE_MAGIC)
+        return 0;
+
+    std::vector<char> binary(header[2]);
+    if (!file.read(binary.data(), binary.size()))
+        return 0;
+
+    unsigned int program = glCreateProgram();
+    glProgramBinary(program, header[1], binary.data(), (GLsizei)binary.size());
+
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    BindUniformBlocks(program);
+    return program;
+}
+
+// Write the binary of a linked program to the cache
+inline void SaveProgramBinary(unsigned int program, uint64_t key)
+{
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    if (length <= 0)
+        return;
+
+    std::error_code error;
+    std::filesystem::create_directories(PROGRAM_CACHE_DIRECTORY, error);
+
+    // Written under a temporary name and renamed, a crash never leaves a truncated binary behind
+    std::string path = ProgramCachePath(key);
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        uint32_t header[3] = { PROGRAM_CACHE_MAGIC, (uint32_t)format, (uint32_t)length };
+        file.write((const char*)header, sizeof(header));
+        file.write(binary.data(), length);
+
+        if (!file)
+        {
+            std::cerr << "Failed to write program cache: " << temporary << std::endl;
+            return;
+        }
+    }
+
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+        std::filesystem::remove(temporary, error);
+}
+
+// Load the program from the binary cache, compile and link it from source when the cache is missing or stale
+inline unsigned int BuildCachedShaderProgram(const std::string& vertexShaderSource, const std::string& fragmentShaderSource, const std::string& defines = "",
+    const std::string& geometryShaderSource = "")
+{
+    if (!ProgramBinariesSupported())
+        return BuildShaderProgram(vertexShaderSource, fragmentShaderSource, geometryShaderSource);
+
+    uint64_t key = ProgramCacheKey(vertexShaderSource, fragmentShaderSource, defines, geometryShaderSource);
+
+    unsigned int program = LoadProgramBinary(key);
+    if (program)
+        return program;
+
+    program = BuildShaderProgram(vertexShaderSource, fragmentShaderSource, geometryShaderSource);
+    if (program)
+        SaveProgramBinary(program, key);
+
+    return program;
+}
+
+inline unsigned int CreateShaderProgram(const std::string& vertexShaderPath, const std::string& fragmentShaderPath)
+{
+    // Read shader sources
+    std::string vertexShaderSource = ReadShaderSource(vertexShaderPath);
+    std::string fragmentShaderSource = ReadShaderSource(fragmentShaderPath);
+
+    return BuildCachedShaderProgram(vertexShaderSource, fragmentShaderSource);
+}
+
+// Build the program from its paths and record the files it depends on
+inline unsigned int CreateShaderProgram(ShaderProgram& shader)
+{
+    std::vector<std::string> vertexDependencies, fragmentDependencies;
+    std::string vertexShaderSource = ReadShaderSource(shader.vertexPath, ShaderDefines(), &vertexDependencies);
+    std::string fragmentShaderSource = ReadShaderSource(shader.fragmentPath, ShaderDefines(), &fragmentDependencies);
+
+    shader.dependencies = vertexDependencies;
+    shader.dependencies.insert(shader.dependencies.end(), fragmentDependencies.begin(), fragmentDependencies.end());
+
+    std::string geometryShaderSource;
+    if (!shader.geometryPath.empty())
+    {
+        std::vector<std::string> geometryDependencies;
+        geometryShaderSource = ReadShaderSource(shader.geometryPath, ShaderDefines(), &geometryDependencies);
+        shader.dependencies.insert(shader.dependencies.end(), geometryDependencies.begin(), geometryDependencies.end());
+    }
+
+    shader.id = BuildCachedShaderProgram(vertexShaderSource, fragmentShaderSource, "", geometryShaderSource);
+
+    return shader.id;
+}
+
+// Replace the program only if the new sources compile and link, the last good program stays in use otherwise
+inline bool ReloadShaderProgram(ShaderProgram& shader, const std::string& vertexShaderSource, const std::string& fragmentShaderSource, const std::string& geometryShaderSource = "")
+{
+    unsigned int program = BuildCachedShaderProgram(vertexShaderSource, fragmentShaderSource, "", geometryShaderSource);
+
+    if (!program)
+    {
+        std::cerr << "Shader reload failed, keeping previous program: " << shader.vertexPath << ", " << shader.fragmentPath << std::endl;
+        return false;
+    }
+
+    glDeleteProgram(shader.id);
+    shader.id = program;
+
+    return true;
+}
+
+#endif
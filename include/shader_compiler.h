@@ -0,0 +1,354 @@
+#ifndef SHADER_COMPILER_H
+#define SHADER_COMPILER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <shader.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// How a ShaderCompiler gets programs built off the frame
+enum ShaderCompileMode
+{
+    SHADER_COMPILE_PARALLEL,        // The driver compiles in the background, completion is polled (KHR/ARB_parallel_shader_compile)
+    SHADER_COMPILE_WORKER,          // A worker thread compiles on a context shared with the main window
+    SHADER_COMPILE_DEFERRED         // Neither is available, builds run one per Poll on the GL thread
+};
+
+// Compiles and links programs without stalling the frame that asks for them
+// Submit hands the sources over and returns at once, Poll (GL thread, once per frame) calls back with the program when it is ready.
+// Programs go through the binary cache: a cache hit calls back inside Submit, new binaries are saved when their build completes.
+class ShaderCompiler
+{
+public:
+
+    // Called on the GL thread with the linked program, or 0 if it failed to compile or link
+    typedef std::function<void(unsigned int program)> Callback;
+
+    // window: context the worker thread shares objects with, only used without parallel compile (may be null)
+    ShaderCompiler(GLFWwindow* window) : mode(SHADER_COMPILE_DEFERRED), nextJob(1), workerWindow(nullptr), stopping(false)
+    {
+        if (ParallelShaderCompileSupported())
+        {
+            // Let the driver use as many threads as it wants
+            if (GLAD_GL_KHR_parallel_shader_compile)
+                glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            else
+                glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+            mode = SHADER_COMPILE_PARALLEL;
+            return;
+        }
+
+        if (!window)
+            return;
+
+        // Hidden 1x1 window whose context shares programs and sync objects with the main one
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        workerWindow = glfwCreateWindow(1, 1, "", nullptr, window);
+        glfwDefaultWindowHints();
+
+        if (!workerWindow)
+        {
+            std::cerr << "Failed to create shader compile context, shaders compile on the GL thread" << std::endl;
+            return;
+        }
+
+        mode = SHADER_COMPILE_WORKER;
+        worker = std::thread(&ShaderCompiler::WorkerLoop, this);
+    }
+
+    ~ShaderCompiler()
+    {
+        if (worker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            worker.join();
+        }
+
+        // Builds still running are dropped
+        for (Job& job : jobs)
+        {
+            glDeleteShader(job.build.vertexShader);
+            glDeleteShader(job.build.fragmentShader);
+            glDeleteShader(job.build.geometryShader);
+            glDeleteProgram(job.build.program);
+            if (job.program)
+                glDeleteProgram(job.program);
+            if (job.fence)
+                glDeleteSync(job.fence);
+        }
+
+        if (workerWindow)
+            glfwDestroyWindow(workerWindow);
+    }
+
+    ShaderCompiler(const ShaderCompiler&) = delete;
+    ShaderCompiler& operator=(const ShaderCompiler&) = delete;
+
+    // Start building the program, returns the job to Cancel it, or 0 if it was found in the cache and done has already been called
+    uint64_t Submit(const std::string& vertexShaderSource, const std::string& fragmentShaderSource, Callback done)
+    {
+        Job job;
+        job.id = nextJob++;
+        job.done = std::move(done);
+        job.cacheable = ProgramBinariesSupported();
+
+        if (job.cacheable)
+        {
+            job.key = ProgramCacheKey(vertexShaderSource, fragmentShaderSource);
+
+            unsigned int program = LoadProgramBinary(job.key);
+            if (program)
+            {
+                job.done(program);
+                return 0;
+            }
+        }
+
+        if (mode == SHADER_COMPILE_PARALLEL)
+        {
+            job.build = StartShaderProgram(vertexShaderSource, fragmentShaderSource);
+        }
+        else
+        {
+            job.vertexSource = vertexShaderSource;
+            job.fragmentSource = fragmentShaderSource;
+        }
+
+        uint64_t id = job.id;
+        if (mode == SHADER_COMPILE_WORKER)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(std::move(job));
+            }
+            wake.notify_one();
+        }
+        else
+        {
+            jobs.push_back(std::move(job));
+        }
+
+        return id;
+    }
+
+    // The callback of the job will not be called, its program is deleted when the build completes
+    void Cancel(uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Job& job : jobs)
+        {
+            if (job.id == id)
+                job.done = nullptr;
+        }
+    }
+
+    // Hand completed programs to their callbacks (GL thread, once per frame), never waits on the driver
+    void Poll()
+    {
+        std::vector<Job> completed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < jobs.size(); )
+            {
+                if (Complete(jobs[i]))
+                {
+                    completed.push_back(std::move(jobs[i]));
+                    jobs.erase(jobs.begin() + i);
+
+                    // One build per Poll spreads the cost over frames
+                    if (mode == SHADER_COMPILE_DEFERRED)
+                        break;
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+
+        // Callbacks run outside the lock, they may submit more work
+        for (Job& job : completed)
+        {
+            if (job.done)
+                job.done(job.program);
+            else if (job.program)
+                glDeleteProgram(job.program);
+        }
+    }
+
+    // Wait for everything submitted so far (e.g. the variants needed for the first frame)
+    void Finish()
+    {
+        while (Pending() > 0)
+        {
+            if (mode == SHADER_COMPILE_WORKER)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            Poll();
+        }
+    }
+
+    // Jobs submitted and not handed back yet
+    size_t Pending()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return jobs.size();
+    }
+
+    ShaderCompileMode Mode() const
+    {
+        return mode;
+    }
+
+    static const char* ModeName(ShaderCompileMode mode)
+    {
+        switch (mode)
+        {
+        case SHADER_COMPILE_PARALLEL: return "parallel (driver)";
+        case SHADER_COMPILE_WORKER: return "worker thread";
+        case SHADER_COMPILE_DEFERRED: return "deferred (GL thread)";
+        default: return "unknown";
+        }
+    }
+
+private:
+
+    struct Job
+    {
+        uint64_t id = 0;
+        uint64_t key = 0;                   // Program cache key
+        bool cacheable = false;
+        Callback done;
+        std::string vertexSource;           // Worker and deferred builds
+        std::string fragmentSource;
+        ProgramBuild build;                 // Parallel builds
+        bool started = false;               // Worker picked the job up
+        bool built = false;                 // Worker finished the job
+        GLsync fence = nullptr;             // Signaled once the worker's GL commands are done
+        unsigned int program = 0;
+    };
+
+    ShaderCompileMode mode;
+    uint64_t nextJob;
+    std::deque<Job> jobs;
+
+    GLFWwindow* workerWindow;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    // Finish the job if it can be done without waiting (mutex held), true once program holds the result
+    bool Complete(Job& job)
+    {
+        switch (mode)
+        {
+        case SHADER_COMPILE_PARALLEL:
+            if (!ShaderProgramReady(job.build))
+                return false;
+
+            job.program = FinishShaderProgram(job.build);
+            if (job.program && job.cacheable)
+                SaveProgramBinary(job.program, job.key);
+            return true;
+
+        case SHADER_COMPILE_WORKER:
+        {
+            if (!job.built)
+                return false;
+
+            // The program object is shared, but only usable here once the worker's commands have executed
+            GLenum status = glClientWaitSync(job.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED && status != GL_WAIT_FAILED)
+                return false;
+
+            glDeleteSync(job.fence);
+            job.fence = nullptr;
+            return true;
+        }
+
+        default:
+        {
+            job.program = BuildShaderProgram(job.vertexSource, job.fragmentSource);
+            if (job.program && job.cacheable)
+                SaveProgramBinary(job.program, job.key);
+            return true;
+        }
+        }
+    }
+
+    void WorkerLoop()
+    {
+        glfwMakeContextCurrent(workerWindow);
+
+        while (true)
+        {
+            std::string vertexSource, fragmentSource;
+            uint64_t id = 0, key = 0;
+            bool cacheable = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || NextWorkerJob() != nullptr; });
+                if (stopping)
+                    break;
+
+                Job* job = NextWorkerJob();
+                job->started = true;
+                id = job->id;
+                key = job->key;
+                cacheable = job->cacheable;
+                vertexSource = std::move(job->vertexSource);
+                fragmentSource = std::move(job->fragmentSource);
+            }
+
+            // Blocks this thread only
+            unsigned int program = BuildShaderProgram(vertexSource, fragmentSource);
+            if (program && cacheable)
+                SaveProgramBinary(program, key);
+
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Job& job : jobs)
+            {
+                if (job.id == id)
+                {
+                    job.program = program;
+                    job.fence = fence;
+                    job.built = true;
+                }
+            }
+        }
+
+        glfwMakeContextCurrent(nullptr);
+    }
+
+    // Oldest job the worker has not picked up yet (mutex held)
+    Job* NextWorkerJob()
+    {
+        for (Job& job : jobs)
+        {
+            if (!job.started)
+                return &job;
+        }
+        return nullptr;
+    }
+};
+
+#endif
@@ -0,0 +1,883 @@
+#ifndef SHADER_PREPROCESSOR_H
+#define SHADER_PREPROCESSOR_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Macros defined for a shader build, name -> value ("1" for plain flags)
+typedef std::map<std::string, std::string> ShaderDefines;
+
+// Source after preprocessing and every file it was built from
+struct PreprocessedShader
+{
+    std::string source;
+    std::vector<std::string> dependencies;  // Root file first, then includes in the order they were read
+    bool success = false;
+};
+
+// Resolves #include, evaluates #if blocks on macros whose values are known and strips functions main never reaches
+// Driver macros (GL_*, __*) and anything defined inside a block that could not be evaluated are left to the driver.
+// Stripped lines become empty lines and included files are wrapped in #line directives, so compiler messages still
+// point at the right line; the source string number is the index of the file in dependencies.
+// No GL calls, safe on worker threads.
+class ShaderPreprocessor
+{
+public:
+
+    // Remove functions that main never calls
+    bool stripUnusedFunctions = true;
+
+    // Preprocess the file, defines are injected after #version and known while evaluating #if
+    PreprocessedShader Process(const std::string& path, const ShaderDefines& defines = ShaderDefines())
+    {
+        PreprocessedShader result;
+
+        macros.clear();
+        included.clear();
+        dependencies = &result.dependencies;
+
+        for (const auto& define : defines)
+            macros[define.first] = { true, define.second, true, false };
+
+        std::string body;
+        std::string version;
+        result.success = ProcessFile(NormalizePath(path), body, &version, 0);
+
+        // #version has to stay first, injected defines follow it (the body restarts the line count after them)
+        std::string source = version.empty() ? "" : version + "\n";
+        for (const auto& define : defines)
+            source += "#define " + define.first + (define.second.empty() ? "" : " " + define.second) + "\n";
+        if (version.empty() && !defines.empty())
+            source += "#line 1 0\n";
+        source += body;
+
+        if (result.success && stripUnusedFunctions)
+            StripUnusedFunctions(source);
+
+        result.source = std::move(source);
+        dependencies = nullptr;
+
+        return result;
+    }
+
+    // Forget cached file contents (after files changed on disk)
+    void ClearCache()
+    {
+        files.clear();
+    }
+
+    // Value of an integer #if expression, false if it uses a macro whose value is unknown
+    bool Evaluate(const std::string& expression, long long& value) const
+    {
+        std::vector<std::string> tokens = Tokenize(expression);
+        size_t position = 0;
+
+        if (!ParseExpression(tokens, position, value, 0) || position != tokens.size())
+            return false;
+
+        return true;
+    }
+
+private:
+
+    struct Macro
+    {
+        bool defined;
+        std::string value;
+        bool known;         // False when it was defined or undefined in a block only the driver can evaluate
+        bool functionLike;
+    };
+
+    // One #if ... #endif chain
+    struct Conditional
+    {
+        bool outerActive;   // The enclosing block is emitted
+        bool evaluated;     // Every branch so far was evaluated here, the directives are dropped
+        bool taken;         // A branch was taken (evaluated chains)
+        bool active;        // The current branch is emitted
+    };
+
+    std::unordered_map<std::string, std::string> files;
+    std::unordered_map<std::string, Macro> macros;
+    std::unordered_set<std::string> included;
+    std::vector<std::string>* dependencies = nullptr;
+
+    static const int MAX_INCLUDE_DEPTH = 32;
+
+    static std::string NormalizePath(const std::string& path)
+    {
+        return std::filesystem::path(path).lexically_normal().generic_string();
+    }
+
+    // File contents with comments replaced by spaces (line breaks kept), cached until ClearCache
+    bool ReadFile(const std::string& path, std::string& text)
+    {
+        auto it = files.find(path);
+        if (it != files.end())
+        {
+            text = it->second;
+            return true;
+        }
+
+        std::ifstream file(path);
+        if (!file.is_open())
+            return false;
+
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        text = StripComments(buffer.str());
+
+        files[path] = text;
+        return true;
+    }
+
+    static std::string StripComments(const std::string& text)
+    {
+        std::string result;
+        result.reserve(text.size());
+
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] == '/' && i + 1 < text.size() && text[i + 1] == '/')
+            {
+                while (i < text.size() && text[i] != '\n')
+                    i++;
+                if (i < text.size())
+                    result += '\n';
+            }
+            else if (text[i] == '/' && i + 1 < text.size() && text[i + 1] == '*')
+            {
+                result += ' ';
+                for (i += 2; i < text.size() && !(text[i] == '*' && i + 1 < text.size() && text[i + 1] == '/'); ++i)
+                {
+                    if (text[i] == '\n')
+                        result += '\n';
+                }
+                i++;
+            }
+            else if (text[i] != '\r')
+            {
+                result += text[i];
+            }
+        }
+
+        return result;
+    }
+
+    // Append the processed file to output, version receives the #version line of the root file
+    bool ProcessFile(const std::string& path, std::string& output, std::string* version, int depth)
+    {
+        if (depth > MAX_INCLUDE_DEPTH)
+        {
+            std::cerr << "Shader includes nested too deeply: " << path << std::endl;
+            return false;
+        }
+
+        std::string text;
+        if (!ReadFile(path, text))
+        {
+            std::cerr << "Failed to read shader: " << path << std::endl;
+            return false;
+        }
+
+        int fileIndex = (int)dependencies->size();
+        dependencies->push_back(path);
+        included.insert(path);
+
+        std::vector<Conditional> conditionals;
+        bool success = true;
+
+        std::istringstream lines(text);
+        std::string line;
+        int lineNumber = 0;
+
+        while (std::getline(lines, line))
+        {
+            lineNumber++;
+
+            bool emitting = conditionals.empty() || (conditionals.back().outerActive && conditionals.back().active);
+            bool uncertain = Uncertain(conditionals);
+
+            std::string directive, rest;
+            if (!ParseDirective(line, directive, rest))
+            {
+                output += emitting ? line + "\n" : "\n";
+                continue;
+            }
+
+            if (directive == "if" || directive == "ifdef" || directive == "ifndef")
+            {
+                Conditional conditional = { emitting, false, false, false };
+                if (emitting)
+                {
+                    long long value;
+                    if (EvaluateCondition(directive, rest, value))
+                    {
+                        conditional.evaluated = true;
+                        conditional.taken = conditional.active = value != 0;
+                        line.clear();
+                    }
+                    else
+                    {
+                        conditional.active = true;
+                    }
+                }
+
+                conditionals.push_back(conditional);
+                output += emitting ? line + "\n" : "\n";
+                continue;
+            }
+
+            if (directive == "elif" || directive == "else")
+            {
+                if (conditionals.empty())
+                {
+                    std::cerr << path << "(" << lineNumber << "): #" << directive << " without #if" << std::endl;
+                    return false;
+                }
+
+                Conditional& conditional = conditionals.back();
+                if (!conditional.outerActive)
+                {
+                    output += "\n";
+                }
+                else if (!conditional.evaluated)
+                {
+                    output += line + "\n";
+                }
+                else if (conditional.taken)
+                {
+                    conditional.active = false;
+                    output += "\n";
+                }
+                else
+                {
+                    long long value = 1;
+                    if (directive == "else" || EvaluateCondition("if", rest, value))
+                    {
+                        conditional.taken = conditional.active = value != 0;
+                        output += "\n";
+                    }
+                    else
+                    {
+                        // Earlier branches were all false, the driver decides from here on
+                        conditional.evaluated = false;
+                        conditional.active = true;
+                        output += "#if " + rest + "\n";
+                    }
+                }
+                continue;
+            }
+
+            if (directive == "endif")
+            {
+                if (conditionals.empty())
+                {
+                    std::cerr << path << "(" << lineNumber << "): #endif without #if" << std::endl;
+                    return false;
+                }
+
+                bool keep = conditionals.back().outerActive && !conditionals.back().evaluated;
+                conditionals.pop_back();
+                output += keep ? line + "\n" : "\n";
+                continue;
+            }
+
+            if (!emitting)
+            {
+                output += "\n";
+                continue;
+            }
+
+            // The root's #version moves to the top, ahead of the injected defines
+            if (directive == "version")
+            {
+                if (version && version->empty())
+                {
+                    *version = Trim(line);
+                    output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+                }
+                else
+                {
+                    output += "\n";
+                }
+                continue;
+            }
+
+            if (directive == "pragma" && Trim(rest) == "once")
+            {
+                output += "\n";
+                continue;
+            }
+
+            if (directive == "include")
+            {
+                std::string name = IncludeName(rest);
+                if (name.empty())
+                {
+                    std::cerr << path << "(" << lineNumber << "): malformed #include" << std::endl;
+                    return false;
+                }
+
+                std::string includePath = NormalizePath((std::filesystem::path(path).parent_path() / name).generic_string());
+
+                // Every file is included once per program, guards or not
+                if (included.count(includePath))
+                {
+                    output += "\n";
+                    continue;
+                }
+
+                output += "#line 1 " + std::to_string(dependencies->size()) + "\n";
+                success = ProcessFile(includePath, output, nullptr, depth + 1) && success;
+                output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+                continue;
+            }
+
+            if (directive == "define" || directive == "undef")
+            {
+                Define(directive == "define", rest, uncertain);
+                output += line + "\n";
+                continue;
+            }
+
+            output += line + "\n";
+        }
+
+        if (!conditionals.empty())
+        {
+            std::cerr << path << ": unterminated #if" << std::endl;
+            return false;
+        }
+
+        return success;
+    }
+
+    // Inside a block the driver has to evaluate
+    static bool Uncertain(const std::vector<Conditional>& conditionals)
+    {
+        for (const Conditional& conditional : conditionals)
+        {
+            if (!conditional.evaluated)
+                return true;
+        }
+        return false;
+    }
+
+    // Split "#name rest", false if the line is not a directive
+    static bool ParseDirective(const std::string& line, std::string& directive, std::string& rest)
+    {
+        size_t i = line.find_first_not_of(" \t");
+        if (i == std::string::npos || line[i] != '#')
+            return false;
+
+        i = line.find_first_not_of(" \t", i + 1);
+        if (i == std::string::npos)
+            return false;
+
+        size_t end = i;
+        while (end < line.size() && (std::isalnum((unsigned char)line[end]) || line[end] == '_'))
+            end++;
+
+        directive = line.substr(i, end - i);
+        rest = Trim(line.substr(end));
+        return true;
+    }
+
+    static std::string Trim(const std::string& text)
+    {
+        size_t first = text.find_first_not_of(" \t");
+        if (first == std::string::npos)
+            return "";
+        size_t last = text.find_last_not_of(" \t");
+        return text.substr(first, last - first + 1);
+    }
+
+    // File name of #include "name" or #include <name>
+    static std::string IncludeName(const std::string& rest)
+    {
+        if (rest.size() < 2)
+            return "";
+
+        char close = (rest[0] == '"') ? '"' : (rest[0] == '<') ? '>' : 0;
+        size_t end = close ? rest.find(close, 1) : std::string::npos;
+
+        return (end == std::string::npos) ? "" : rest.substr(1, end - 1);
+    }
+
+    void Define(bool define, const std::string& rest, bool uncertain)
+    {
+        size_t end = 0;
+        while (end < rest.size() && (std::isalnum((unsigned char)rest[end]) || rest[end] == '_'))
+            end++;
+
+        std::string name = rest.substr(0, end);
+        if (name.empty())
+            return;
+
+        Macro macro = { define, define ? Trim(rest.substr(end)) : "", !uncertain, define && end < rest.size() && rest[end] == '(' };
+        macros[name] = macro;
+    }
+
+    bool EvaluateCondition(const std::string& directive, const std::string& rest, long long& value) const
+    {
+        if (directive == "if")
+            return Evaluate(rest, value);
+
+        bool defined;
+        if (!IsDefined(Trim(rest), defined))
+            return false;
+
+        value = (directive == "ifdef") == defined;
+        return true;
+    }
+
+    // Whether the macro is defined, false if only the driver knows
+    bool IsDefined(const std::string& name, bool& defined) const
+    {
+        auto it = macros.find(name);
+        if (it != macros.end())
+        {
+            defined = it->second.defined;
+            return it->second.known;
+        }
+
+        // Predefined by the driver: __VERSION__, GL_core_profile, extension macros
+        if (name.compare(0, 3, "GL_") == 0 || name.compare(0, 2, "__") == 0)
+            return false;
+
+        defined = false;
+        return true;
+    }
+
+    static std::vector<std::string> Tokenize(const std::string& text)
+    {
+        static const char* operators[] = { "&&", "||", "==", "!=", "<=", ">=", "<<", ">>" };
+
+        std::vector<std::string> tokens;
+        size_t i = 0;
+
+        while (i < text.size())
+        {
+            unsigned char c = (unsigned char)text[i];
+            if (std::isspace(c))
+            {
+                i++;
+                continue;
+            }
+
+            size_t start = i;
+            if (std::isalpha(c) || c == '_')
+            {
+                while (i < text.size() && (std::isalnum((unsigned char)text[i]) || text[i] == '_'))
+                    i++;
+            }
+            else if (std::isdigit(c))
+            {
+                while (i < text.size() && std::isalnum((unsigned char)text[i]))
+                    i++;
+            }
+            else
+            {
+                i++;
+                for (const char* op : operators)
+                {
+                    if (text.compare(start, 2, op) == 0)
+                    {
+                        i = start + 2;
+                        break;
+                    }
+                }
+            }
+
+            tokens.push_back(text.substr(start, i - start));
+        }
+
+        return tokens;
+    }
+
+    // Binary operators from loosest to tightest
+    static int Precedence(const std::string& op)
+    {
+        if (op == "||") return 1;
+        if (op == "&&") return 2;
+        if (op == "|") return 3;
+        if (op == "^") return 4;
+        if (op == "&") return 5;
+        if (op == "==" || op == "!=") return 6;
+        if (op == "<" || op == ">" || op == "<=" || op == ">=") return 7;
+        if (op == "<<" || op == ">>") return 8;
+        if (op == "+" || op == "-") return 9;
+        if (op == "*" || op == "/" || op == "%") return 10;
+        return 0;
+    }
+
+    // Precedence climbing over the tokens
+    bool ParseExpression(const std::vector<std::string>& tokens, size_t& position, long long& value, int minimum, int depth = 0) const
+    {
+        if (depth > 16 || !ParseUnary(tokens, position, value, depth))
+            return false;
+
+        while (position < tokens.size())
+        {
+            const std::string& op = tokens[position];
+            int precedence = Precedence(op);
+            if (precedence == 0 || precedence <= minimum)
+                break;
+
+            position++;
+
+            long long right;
+            if (!ParseExpression(tokens, position, right, precedence, depth))
+                return false;
+
+            if ((op == "/" || op == "%") && right == 0)
+                return false;
+
+            if (op == "||") value = value || right;
+            else if (op == "&&") value = value && right;
+            else if (op == "|") value = value | right;
+            else if (op == "^") value = value ^ right;
+            else if (op == "&") value = value & right;
+            else if (op == "==") value = value == right;
+            else if (op == "!=") value = value != right;
+            else if (op == "<") value = value < right;
+            else if (op == ">") value = value > right;
+            else if (op == "<=") value = value <= right;
+            else if (op == ">=") value = value >= right;
+            else if (op == "<<") value = value << right;
+            else if (op == ">>") value = value >> right;
+            else if (op == "+") value = value + right;
+            else if (op == "-") value = value - right;
+            else if (op == "*") value = value * right;
+            else if (op == "/") value = value / right;
+            else value = value % right;
+        }
+
+        return true;
+    }
+
+    bool ParseUnary(const std::vector<std::string>& tokens, size_t& position, long long& value, int depth) const
+    {
+        if (position >= tokens.size())
+            return false;
+
+        const std::string token = tokens[position++];
+
+        if (token == "!" || token == "-" || token == "+" || token == "~")
+        {
+            if (!ParseUnary(tokens, position, value, depth))
+                return false;
+
+            if (token == "!") value = !value;
+            else if (token == "-") value = -value;
+            else if (token == "~") value = ~value;
+            return true;
+        }
+
+        if (token == "(")
+        {
+            if (!ParseExpression(tokens, position, value, 0, depth + 1) || position >= tokens.size() || tokens[position] != ")")
+                return false;
+            position++;
+            return true;
+        }
+
+        if (token == "defined")
+        {
+            bool parenthesized = position < tokens.size() && tokens[position] == "(";
+            if (parenthesized)
+                position++;
+
+            if (position >= tokens.size())
+                return false;
+
+            bool defined;
+            if (!IsDefined(tokens[position++], defined))
+                return false;
+
+            if (parenthesized)
+            {
+                if (position >= tokens.size() || tokens[position] != ")")
+                    return false;
+                position++;
+            }
+
+            value = defined;
+            return true;
+        }
+
+        if (std::isdigit((unsigned char)token[0]))
+        {
+            char* end;
+            value = std::strtoll(token.c_str(), &end, 0);
+            while (*end == 'u' || *end == 'U' || *end == 'l' || *end == 'L')
+                end++;
+            return *end == 0;
+        }
+
+        if (std::isalpha((unsigned char)token[0]) || token[0] == '_')
+        {
+            bool defined;
+            if (!IsDefined(token, defined))
+                return false;
+
+            // Undefined identifiers are 0, defined ones are evaluated from their value
+            if (!defined)
+            {
+                value = 0;
+                return true;
+            }
+
+            const Macro& macro = macros.find(token)->second;
+            if (macro.functionLike)
+                return false;
+
+            std::vector<std::string> valueTokens = Tokenize(macro.value);
+            size_t valuePosition = 0;
+            return !valueTokens.empty() && ParseExpression(valueTokens, valuePosition, value, 0, depth + 1) && valuePosition == valueTokens.size();
+        }
+
+        return false;
+    }
+
+    // Function definition or prototype at file scope
+    struct FunctionSpan
+    {
+        std::string name;
+        size_t start;
+        size_t end;
+        std::vector<std::string> references;
+    };
+
+    static bool IsIdentifierStart(char c)
+    {
+        return std::isalpha((unsigned char)c) || c == '_';
+    }
+
+    static bool IsIdentifierChar(char c)
+    {
+        return std::isalnum((unsigned char)c) || c == '_';
+    }
+
+    // Replace functions main cannot reach with empty lines, leaves the source alone if it cannot be parsed
+    static void StripUnusedFunctions(std::string& source)
+    {
+        std::vector<FunctionSpan> spans;
+        std::vector<std::string> roots = { "main" };
+
+        // Identifiers of the file scope statement being read, they belong to the function if it turns out to be one
+        std::vector<std::string> statement;
+        size_t statementStart = 0;
+        bool statementHasAssignment = false;
+        std::string parenName;              // Identifier before the first parenthesis of the statement
+
+        int braces = 0, parens = 0;
+        char lastToken = 0;                 // Last significant character, 'a' for an identifier
+        std::string lastIdentifier;
+        int body = -1;                      // Span of the definition whose body is being read
+        bool lineStart = true;
+        size_t i = 0;
+
+        auto endStatement = [&](size_t position)
+        {
+            roots.insert(roots.end(), statement.begin(), statement.end());
+            statement.clear();
+            statementStart = position;
+            statementHasAssignment = false;
+            parenName.clear();
+        };
+
+        while (i < source.size())
+        {
+            char c = source[i];
+
+            if (c == '\n')
+            {
+                lineStart = true;
+                i++;
+                continue;
+            }
+
+            if (std::isspace((unsigned char)c))
+            {
+                i++;
+                continue;
+            }
+
+            // Directives are kept whole, their identifiers count as used
+            if (c == '#' && lineStart)
+            {
+                size_t end = source.find('\n', i);
+                if (end == std::string::npos)
+                    end = source.size();
+
+                for (const std::string& identifier : Identifiers(source, i, end))
+                    (body >= 0 ? spans[body].references : roots).push_back(identifier);
+
+                if (braces == 0 && parens == 0 && statement.empty())
+                    statementStart = end;
+
+                i = end;
+                continue;
+            }
+
+            lineStart = false;
+
+            if (IsIdentifierStart(c))
+            {
+                size_t start = i;
+                while (i < source.size() && IsIdentifierChar(source[i]))
+                    i++;
+
+                lastIdentifier = source.substr(start, i - start);
+                lastToken = 'a';
+
+                if (body >= 0)
+                    spans[body].references.push_back(lastIdentifier);
+                else if (braces == 0)
+                    statement.push_back(lastIdentifier);
+                else
+                    roots.push_back(lastIdentifier);
+                continue;
+            }
+
+            if (braces == 0)
+            {
+                if (c == '(')
+                {
+                    if (parens == 0 && parenName.empty() && lastToken == 'a')
+                        parenName = lastIdentifier;
+                    parens++;
+                }
+                else if (c == ')')
+                {
+                    if (--parens < 0)
+                        return;
+                }
+                else if (c == '=' && parens == 0)
+                {
+                    statementHasAssignment = true;
+                }
+                else if (c == ';' && parens == 0)
+                {
+                    // Prototype: "type name(...);"
+                    if (lastToken == ')' && !parenName.empty() && !statementHasAssignment)
+                    {
+                        spans.push_back({ parenName, statementStart, i + 1, statement });
+                        statement.clear();
+                    }
+
+                    endStatement(i + 1);
+                }
+                else if (c == '{' && parens == 0)
+                {
+                    // Definition: "type name(...) {", anything else (struct, uniform block) is file scope
+                    if (lastToken == ')' && !parenName.empty() && !statementHasAssignment)
+                    {
+                        spans.push_back({ parenName, statementStart, 0, statement });
+                        statement.clear();
+                        body = (int)spans.size() - 1;
+                    }
+                    braces++;
+                }
+            }
+            else if (c == '{')
+            {
+                braces++;
+            }
+            else if (c == '}')
+            {
+                if (--braces < 0)
+                    return;
+
+                if (braces == 0 && body >= 0)
+                {
+                    spans[body].end = i + 1;
+                    body = -1;
+                    endStatement(i + 1);
+                }
+            }
+
+            lastToken = c;
+            i++;
+        }
+
+        if (braces != 0 || parens != 0)
+            return;
+
+        roots.insert(roots.end(), statement.begin(), statement.end());
+
+        // Everything reachable from main and from file scope code
+        std::unordered_multimap<std::string, size_t> byName;
+        for (size_t span = 0; span < spans.size(); ++span)
+            byName.emplace(spans[span].name, span);
+
+        std::unordered_set<std::string> reached;
+        std::vector<std::string> pending(roots.begin(), roots.end());
+        while (!pending.empty())
+        {
+            std::string name = pending.back();
+            pending.pop_back();
+
+            if (!reached.insert(name).second)
+                continue;
+
+            auto range = byName.equal_range(name);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                for (const std::string& reference : spans[it->second].references)
+                {
+                    if (!reached.count(reference))
+                        pending.push_back(reference);
+                }
+            }
+        }
+
+        // Remove back to front so earlier offsets stay valid, line breaks are kept
+        for (size_t span = spans.size(); span-- > 0; )
+        {
+            if (reached.count(spans[span].name))
+                continue;
+
+            size_t start = spans[span].start, end = spans[span].end;
+            std::string lineBreaks(std::count(source.begin() + start, source.begin() + end, '\n'), '\n');
+            source.replace(start, end - start, lineBreaks);
+        }
+    }
+
+    static std::vector<std::string> Identifiers(const std::string& text, size_t start, size_t end)
+    {
+        std::vector<std::string> identifiers;
+        size_t i = start;
+
+        while (i < end)
+        {
+            if (IsIdentifierStart(text[i]) && (i == start || !IsIdentifierChar(text[i - 1])))
+            {
+                size_t first = i;
+                while (i < end && IsIdentifierChar(text[i]))
+                    i++;
+                identifiers.push_back(text.substr(first, i - first));
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        return identifiers;
+    }
+};
+
+#endif
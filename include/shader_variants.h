@@ -0,0 +1,306 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <shader.h>
+#include <shader_compiler.h>
+#include <mesh.h>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Optional parts of the lighting shaders, each one is a #define in the sources
+enum ShaderFeature : uint32_t
+{
+    SHADER_HAS_TEXTURE = 1 << 0,            // Sample texture1
+    SHADER_HAS_TEXTURE_ARRAY = 1 << 1,      // Sample a layer of textureArray instead
+    SHADER_HAS_VIRTUAL_TEXTURE = 1 << 2,    // Sample through the virtual texture page table instead
+    SHADER_HAS_SPECULAR = 1 << 3            // Phong specular term
+};
+
+// Number of feature bits, kept out of the enum so it is not mistaken for a feature (it equals SHADER_HAS_VIRTUAL_TEXTURE)
+constexpr int SHADER_FEATURE_COUNT = 4;
+
+// Define names, in the order of the feature bits
+inline const char* ShaderFeatureName(int bit)
+{
+    static const char* names[SHADER_FEATURE_COUNT] = { "HAS_TEXTURE", "HAS_TEXTURE_ARRAY", "HAS_VIRTUAL_TEXTURE", "HAS_SPECULAR" };
+    return (bit >= 0 && bit < SHADER_FEATURE_COUNT) ? names[bit] : "";
+}
+
+// Defines for every feature set in the mask
+inline ShaderDefines ShaderFeatureDefines(uint32_t features)
+{
+    ShaderDefines defines;
+    for (int bit = 0; bit < SHADER_FEATURE_COUNT; ++bit)
+    {
+        if (features & (1u << bit))
+            defines[ShaderFeatureName(bit)] = "1";
+    }
+    return defines;
+}
+
+// Smallest feature set that draws the material correctly
+inline uint32_t MaterialFeatures(const Material& material)
+{
+    uint32_t features = 0;
+
+    if (material.virtualTexture >= 0)
+        features |= SHADER_HAS_VIRTUAL_TEXTURE;
+    else if (material.layer >= 0)
+        features |= SHADER_HAS_TEXTURE_ARRAY;
+    else if (material.texture != 0)
+        features |= SHADER_HAS_TEXTURE;
+
+    if (material.shininess > 0.0f && (material.specular.x > 0.0f || material.specular.y > 0.0f || material.specular.z > 0.0f))
+        features |= SHADER_HAS_SPECULAR;
+
+    return features;
+}
+
+// Programs built from one vertex/fragment pair with different feature defines
+// Variants are compiled on first use (or ahead of time with Precompile) and go through the program binary cache.
+// The preprocessor resolves the feature #ifs, each variant's source only holds the code it runs.
+// With a ShaderCompiler set, variants build in the background and Get returns a fallback variant until they are ready.
+class ShaderVariants
+{
+public:
+
+    std::string vertexPath;
+    std::string fragmentPath;
+
+    ShaderVariants(const std::string& vertexPath, const std::string& fragmentPath) : vertexPath(vertexPath), fragmentPath(fragmentPath), compiler(nullptr) {}
+
+    ~ShaderVariants()
+    {
+        SetCompiler(nullptr);
+
+        for (auto& it : programs)
+            glDeleteProgram(it.second);
+    }
+
+    ShaderVariants(const ShaderVariants&) = delete;
+    ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+    // Build new variants in the background (null builds them on the spot), the compiler must outlive the variants
+    void SetCompiler(ShaderCompiler* shaderCompiler)
+    {
+        if (compiler)
+        {
+            for (auto& it : pending)
+                compiler->Cancel(it.second);
+        }
+
+        pending.clear();
+        compiler = shaderCompiler;
+    }
+
+    // Program for the feature set
+    // Without a compiler the variant is compiled now if it is the first request. With one, or if the variant does not compile,
+    // the closest ready variant with fewer features is returned instead (0 if none is ready yet).
+    unsigned int Get(uint32_t features)
+    {
+        auto it = programs.find(features);
+        if (it != programs.end())
+            return it->second;
+
+        if (!failed.count(features) && !pending.count(features))
+        {
+            if (compiler)
+                Submit(features);
+            else
+                Completed(features, Build(features));
+
+            // Built already (no compiler, or a program cache hit)
+            it = programs.find(features);
+            if (it != programs.end())
+                return it->second;
+        }
+
+        return Fallback(features);
+    }
+
+    // Program for the cheapest variant that draws the material
+    unsigned int Get(const Material& material)
+    {
+        return Get(MaterialFeatures(material));
+    }
+
+    // Compile variants ahead of time (e.g. every feature set used by the registered materials)
+    // The builds run in parallel when there is a compiler, this returns once all of them are done.
+    void Precompile(const std::vector<uint32_t>& featureSets)
+    {
+        for (uint32_t features : featureSets)
+            Get(features);
+
+        if (compiler)
+            compiler->Finish();
+    }
+
+    // Whether the feature set has its own program (false while it builds, or if it failed)
+    bool Ready(uint32_t features) const
+    {
+        return programs.count(features) > 0;
+    }
+
+    // Re-read the sources and rebuild every variant requested so far, variants that fail keep their previous program
+    // Returns false if any variant failed. With a compiler the rebuilds finish later and only failures to read the sources are reported here.
+    bool Reload()
+    {
+        preprocessor.ClearCache();
+        dependencies.clear();
+
+        std::vector<uint32_t> featureSets;
+        for (auto& it : programs)
+            featureSets.push_back(it.first);
+        for (uint32_t features : failed)
+            featureSets.push_back(features);
+        for (auto& it : pending)
+        {
+            if (!programs.count(it.first))
+                featureSets.push_back(it.first);
+        }
+
+        failed.clear();
+        SetCompiler(compiler);
+
+        bool success = true;
+        for (uint32_t features : featureSets)
+        {
+            if (compiler)
+            {
+                success &= Submit(features);
+                continue;
+            }
+
+            unsigned int program = Build(features);
+            success &= program != 0;
+            Completed(features, program);
+        }
+
+        if (!success)
+            std::cerr << "Shader reload failed for some variants, keeping their previous programs: " << vertexPath << ", " << fragmentPath << std::endl;
+
+        return success;
+    }
+
+    // Number of variants built so far
+    size_t Count() const
+    {
+        return programs.size();
+    }
+
+    // Variants still building in the background
+    size_t PendingCount() const
+    {
+        return pending.size();
+    }
+
+    // Files read by any variant built so far, a change to one of them calls for Reload
+    bool DependsOn(const std::string& path) const
+    {
+        return dependencies.count(path) > 0;
+    }
+
+private:
+    ShaderPreprocessor preprocessor;    // Caches the files between variants
+    ShaderCompiler* compiler;
+    std::unordered_map<uint32_t, unsigned int> programs;
+    std::unordered_map<uint32_t, uint64_t> pending;     // Feature set -> compiler job
+    std::unordered_set<uint32_t> failed;                // Requested but never built successfully
+    std::unordered_set<std::string> dependencies;
+
+    // Preprocess both stages for the feature set, false if a file could not be read
+    bool Preprocess(uint32_t features, std::string& vertexSource, std::string& fragmentSource)
+    {
+        ShaderDefines defines = ShaderFeatureDefines(features);
+
+        PreprocessedShader vertex = preprocessor.Process(vertexPath, defines);
+        PreprocessedShader fragment = preprocessor.Process(fragmentPath, defines);
+
+        dependencies.insert(vertex.dependencies.begin(), vertex.dependencies.end());
+        dependencies.insert(fragment.dependencies.begin(), fragment.dependencies.end());
+
+        vertexSource = vertex.source;
+        fragmentSource = fragment.source;
+
+        return vertex.success && fragment.success;
+    }
+
+    unsigned int Build(uint32_t features)
+    {
+        std::string vertexSource, fragmentSource;
+        if (!Preprocess(features, vertexSource, fragmentSource))
+            return 0;
+
+        return BuildCachedShaderProgram(vertexSource, fragmentSource);
+    }
+
+    // Hand the variant to the compiler, false if its sources could not be read
+    bool Submit(uint32_t features)
+    {
+        std::string vertexSource, fragmentSource;
+        if (!Preprocess(features, vertexSource, fragmentSource))
+        {
+            Completed(features, 0);
+            return false;
+        }
+
+        uint64_t job = compiler->Submit(vertexSource, fragmentSource, [this, features](unsigned int program) { Completed(features, program); });
+
+        // 0: found in the cache, Completed has run already
+        if (job)
+            pending[features] = job;
+
+        return true;
+    }
+
+    // A build finished, a failed one keeps the previous program of the variant if there is one
+    void Completed(uint32_t features, unsigned int program)
+    {
+        pending.erase(features);
+
+        auto it = programs.find(features);
+        if (!program)
+        {
+            if (it == programs.end())
+                failed.insert(features);
+            return;
+        }
+
+        if (it != programs.end())
+            glDeleteProgram(it->second);
+
+        programs[features] = program;
+    }
+
+    // Ready variant with the most features that are all in the requested set (e.g. untextured while the textured one builds)
+    unsigned int Fallback(uint32_t features) const
+    {
+        unsigned int program = 0;
+        int best = -1;
+
+        for (auto& it : programs)
+        {
+            if (it.first & ~features)
+                continue;
+
+            int count = 0;
+            for (int bit = 0; bit < SHADER_FEATURE_COUNT; ++bit)
+                count += (it.first >> bit) & 1;
+
+            if (count > best)
+            {
+                best = count;
+                program = it.second;
+            }
+        }
+
+        return program;
+    }
+};
+
+#endif
@@ -0,0 +1,472 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <glad/glad.h>
+#include <camera.h>
+#include <render_queue.h>
+#include <shader.h>
+#include <uniform_blocks.h>
+#include <mat4.h>
+#include <vec3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Directional light, lights everything from the same direction (e.g. the sun)
+struct DirectionalLight
+{
+    Vec3 direction = Vec3(0.4f, -1.0f, 0.3f);   // Direction the light travels, need not be normalized
+    Vec3 color = Vec3(0.6f, 0.55f, 0.5f);       // Intensity included
+};
+
+// Cascaded shadow maps for a directional light
+// The camera frustum up to maxDistance is split into slices (logarithmic blended with uniform), each gets its own layer
+// of a depth texture array. Each slice is fitted with a bounding sphere whose size depends only on the split distances,
+// and the cascade origin is snapped to whole texels, so the shadow edges do not crawl as the camera turns and moves.
+// Casters are culled per cascade and drawn with the position-only vertex stream; GL_DEPTH_CLAMP flattens casters in
+// front of a cascade onto its near plane instead of extending its depth range.
+//
+// Static casters are cached: each cascade is fitted with refitMargin to spare and keeps its placement until the camera
+// slice gets close to its edge, its static casters are drawn into a second texture array only when it is refitted or
+// they change, and every frame that layer is copied to the sampled one and the dynamic casters drawn on top.
+// Refits that are not urgent yet are spread over frames, at most refitsPerFrame, nearest cascade first.
+class ShadowCascades
+{
+public:
+
+    DirectionalLight sun;
+
+    // Camera distance the cascades cover, and the blend between logarithmic (1) and uniform (0) splits
+    float maxDistance = 60.0f;
+    float splitLambda = 0.75f;
+
+    // Depth bias applied when sampling, in shadow map depth, on top of the slope scaled offset while rendering
+    float depthBias = 0.0005f;
+
+    // Extra size of a cascade over its slice, as a fraction of the slice radius: the camera moves this far before a refit
+    float refitMargin = 0.15f;
+
+    // Refits done ahead of need per frame, refits that cannot wait are always done
+    int refitsPerFrame = 1;
+
+    // Depth-only program
+    ShaderProgram depthShader;
+
+    // cascadeCount 0 keeps the sun but renders no shadows
+    ShadowCascades(int cascadeCount = 4, int resolution = 2048) : cascadeCount(0), resolution(0), depthTexture(0), staticTexture(0), framebuffer(0),
+        casterDraws(0), culledCasters(0), staticRenders(0)
+    {
+        depthShader.vertexPath = "shaders/ShadowDepthVertex.glsl";
+        depthShader.fragmentPath = "shaders/ShadowDepthFragment.glsl";
+        CreateShaderProgram(depthShader);
+
+        Configure(cascadeCount, resolution);
+    }
+
+    ~ShadowCascades()
+    {
+        Release();
+        glDeleteProgram(depthShader.id);
+    }
+
+    ShadowCascades(const ShadowCascades&) = delete;
+    ShadowCascades& operator=(const ShadowCascades&) = delete;
+
+    // Trade quality for GPU time: fewer cascades mean fewer caster passes, lower resolution means cheaper ones
+    // Returns false if the framebuffer is incomplete (shadows are then off)
+    bool Configure(int newCascadeCount, int newResolution)
+    {
+        newCascadeCount = std::clamp(newCascadeCount, 0, MAX_SHADOW_CASCADES);
+        newResolution = std::max(newResolution, 16);
+        if (newCascadeCount == cascadeCount && newResolution == resolution)
+            return cascadeCount == 0 || framebuffer != 0;
+
+        Release();
+        cascadeCount = newCascadeCount;
+        resolution = newResolution;
+
+        for (Cascade& cascade : cascades)
+            cascade = Cascade();
+
+        if (cascadeCount == 0)
+            return true;
+
+        // Sampled with hardware depth comparison (sampler2DArrayShadow), the static layers are only copied from
+        CreateDepthArray(depthTexture);
+        CreateDepthArray(staticTexture);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (!complete)
+        {
+            std::cerr << "Shadow map framebuffer is incomplete (" << cascadeCount << " x " << resolution << ")" << std::endl;
+            Release();
+            cascadeCount = 0;
+        }
+
+        return complete;
+    }
+
+    // Fit the cascades to the camera frustum and upload the shadow block (once per frame, before Render and drawing)
+    void Update(const Camera& camera, float fovY, float aspect, float nearPlane, float farPlane)
+    {
+        Vec3 direction = sun.direction.Normalize();
+
+        // Light space rotation, only changes with the sun so it never makes the cascades shimmer
+        // A new sun direction moves every cascade
+        bool sunMoved = direction.x != fittedDirection.x || direction.y != fittedDirection.y || direction.z != fittedDirection.z;
+        if (sunMoved)
+        {
+            Vec3 up = std::fabs(direction.y) < 0.99f ? Vec3(0.0f, 1.0f, 0.0f) : Vec3(0.0f, 0.0f, 1.0f);
+            lightView = Mat4().LookAt(Vec3(0.0f, 0.0f, 0.0f), direction, up);
+            fittedDirection = direction;
+        }
+
+        // Lateral distance of a frustum corner per unit of depth, squared
+        float tanY = std::tan(fovY * 0.5f);
+        float cornerSlope = tanY * tanY * (1.0f + aspect * aspect);
+
+        float shadowFar = std::min(maxDistance, farPlane);
+        float splitNear = nearPlane;
+
+        Vec3 sliceCenters[MAX_SHADOW_CASCADES];
+        float sliceRadii[MAX_SHADOW_CASCADES];
+        bool refitSoon[MAX_SHADOW_CASCADES];
+
+        for (int i = 0; i < cascadeCount; ++i)
+        {
+            float fraction = (float)(i + 1) / cascadeCount;
+            float logarithmic = nearPlane * std::pow(shadowFar / nearPlane, fraction);
+            float uniform = nearPlane + (shadowFar - nearPlane) * fraction;
+            float splitFar = splitLambda * logarithmic + (1.0f - splitLambda) * uniform;
+
+            // Smallest sphere around the slice, on the view axis, equidistant from the near and far corners
+            float centerDepth = std::min((1.0f + cornerSlope) * (splitNear + splitFar) * 0.5f, splitFar);
+            float radius = std::sqrt((splitFar - centerDepth) * (splitFar - centerDepth) + splitFar * splitFar * cornerSlope);
+            Vec3 center = Transform(lightView, camera.position + camera.front * centerDepth);
+
+            Cascade& cascade = cascades[i];
+            cascade.split = splitFar;
+            sliceCenters[i] = center;
+            sliceRadii[i] = radius;
+            refitSoon[i] = false;
+
+            // Room left between the slice sphere and the cascade box, refit now once the sphere pokes out
+            float offset = std::max({ std::fabs(center.x - cascade.lightCenter.x), std::fabs(center.y - cascade.lightCenter.y), std::fabs(center.z - cascade.lightCenter.z) });
+            float slack = cascade.radius - radius - offset;
+
+            if (sunMoved || !cascade.fitted || slack < 0.0f)
+                Fit(cascade, center, radius);
+            else
+                refitSoon[i] = slack < radius * refitMargin * 0.5f;
+
+            splitNear = splitFar;
+        }
+
+        // Cascades that are getting close to their edge, a few per frame
+        int refits = refitsPerFrame;
+        for (int i = 0; i < cascadeCount && refits > 0; ++i)
+        {
+            if (refitSoon[i])
+            {
+                Fit(cascades[i], sliceCenters[i], sliceRadii[i]);
+                refits--;
+            }
+        }
+
+        if (UniformBuffers* uniforms = UniformBuffers::Active())
+        {
+            ShadowBlock block = {};
+            for (int i = 0; i < cascadeCount; ++i)
+            {
+                std::memcpy(block.cascadeMatrices[i], cascades[i].viewProjection.value_ptr(), sizeof(block.cascadeMatrices[i]));
+                block.cascadeSplits[i] = cascades[i].split;
+                block.cascadeTexelSizes[i] = cascades[i].texelSize;
+            }
+
+            block.sunDirection[0] = direction.x;
+            block.sunDirection[1] = direction.y;
+            block.sunDirection[2] = direction.z;
+            block.sunColor[0] = sun.color.x;
+            block.sunColor[1] = sun.color.y;
+            block.sunColor[2] = sun.color.z;
+            block.cascadeCount = (unsigned int)cascadeCount;
+            block.shadowBias = depthBias;
+            block.shadowTexelSize = 1.0f / resolution;
+            uniforms->Upload(block);
+        }
+    }
+
+    // Bring every cascade up to date with the queued meshes, then bind the cascades for the lighting shaders
+    // Static casters are drawn only into cascades that were refitted or whose static casters changed
+    void Render(const RenderQueue& queue)
+    {
+        casterDraws = 0;
+        culledCasters = 0;
+        staticRenders = 0;
+
+        if (cascadeCount == 0)
+            return;
+
+        int viewport[4];
+        int previousFramebuffer = 0;
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, resolution, resolution);
+        glUseProgram(depthShader.id);
+
+        int viewProjectionLoc = glGetUniformLocation(depthShader.id, "lightViewProjection");
+
+        glEnable(GL_DEPTH_CLAMP);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.5f, 2.0f);
+
+        const std::vector<DrawItem>& items = queue.Items();
+
+        for (int i = 0; i < cascadeCount; ++i)
+        {
+            Cascade& cascade = cascades[i];
+
+            // Split the casters reaching the cascade, the static ones hashed to notice any change
+            staticCasters.clear();
+            dynamicCasters.clear();
+            uint64_t staticHash = 14695981039346656037ull;
+
+            const DrawItem* previous = nullptr;
+            for (const DrawItem& item : items)
+            {
+                // Depth needs no materials: the submeshes of one instance are drawn as one range
+                if (previous && previous->mesh == item.mesh && std::memcmp(previous->model.data, item.model.data, sizeof(item.model.data)) == 0)
+                    continue;
+                previous = &item;
+
+                if (!Touches(cascade, *item.mesh, item.model))
+                {
+                    culledCasters++;
+                    continue;
+                }
+
+                if (item.isStatic)
+                {
+                    staticCasters.push_back(&item);
+                    staticHash = HashDrawItem(staticHash, item);
+                }
+                else
+                {
+                    dynamicCasters.push_back(&item);
+                }
+            }
+
+            glUniformMatrix4fv(viewProjectionLoc, 1, GL_FALSE, cascade.viewProjection.value_ptr());
+
+            if (!cascade.staticValid || staticHash != cascade.staticHash)
+            {
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticTexture, 0, i);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                DrawCasters(staticCasters);
+
+                cascade.staticHash = staticHash;
+                cascade.staticValid = true;
+                cascade.liveIsStatic = false;
+                staticRenders++;
+            }
+
+            // The sampled layer already holds just the static casters when nothing dynamic was drawn over them since
+            if (!cascade.liveIsStatic || !dynamicCasters.empty())
+            {
+                glCopyImageSubData(staticTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, depthTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, resolution, resolution, 1);
+
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, i);
+                DrawCasters(dynamicCasters);
+                cascade.liveIsStatic = dynamicCasters.empty();
+            }
+        }
+
+        glBindVertexArray(0);
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_DEPTH_CLAMP);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+        glActiveTexture(GL_TEXTURE9);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    int CascadeCount() const
+    {
+        return cascadeCount;
+    }
+
+    int Resolution() const
+    {
+        return resolution;
+    }
+
+    // Statistics of the last Render, summed over cascades
+    size_t CasterDraws() const
+    {
+        return casterDraws;
+    }
+
+    size_t CulledCasters() const
+    {
+        return culledCasters;
+    }
+
+    // Cascades whose static casters were drawn again
+    size_t StaticRenders() const
+    {
+        return staticRenders;
+    }
+
+private:
+
+    struct Cascade
+    {
+        Mat4 viewProjection;        // World to shadow clip space
+        Vec3 lightCenter;           // Box around the frustum slice, in light space, snapped
+        float radius = 0.0f;        // Half the box side
+        float split = 0.0f;         // View depth the cascade ends at
+        float texelSize = 0.0f;     // World units per texel
+        bool fitted = false;
+
+        uint64_t staticHash = 0;    // Static casters in the static layer
+        bool staticValid = false;
+        bool liveIsStatic = false;  // Sampled layer is a plain copy of the static layer
+    };
+
+    int cascadeCount;
+    int resolution;
+    Cascade cascades[MAX_SHADOW_CASCADES];
+    Mat4 lightView;
+    Vec3 fittedDirection;
+
+    unsigned int depthTexture;      // Static and dynamic casters, sampled
+    unsigned int staticTexture;     // Static casters only
+    unsigned int framebuffer;
+
+    std::vector<const DrawItem*> staticCasters;
+    std::vector<const DrawItem*> dynamicCasters;
+
+    size_t casterDraws;
+    size_t culledCasters;
+    size_t staticRenders;
+
+    // Place the cascade around the slice sphere with refitMargin to spare, its static layer has to be drawn again
+    void Fit(Cascade& cascade, Vec3 center, float radius)
+    {
+        // Two texels of margin keep the sphere inside after snapping and under the PCF kernel
+        float extent = radius * (1.0f + refitMargin) * resolution / (resolution - 4.0f);
+
+        // Snap the center to whole texels in light space, so the same world point stays on the same texel
+        float texelSize = 2.0f * extent / resolution;
+        center.x = std::floor(center.x / texelSize) * texelSize;
+        center.y = std::floor(center.y / texelSize) * texelSize;
+
+        cascade.lightCenter = center;
+        cascade.radius = extent;
+        cascade.texelSize = texelSize;
+        cascade.fitted = true;
+        cascade.staticValid = false;
+
+        // The camera looks down -z, so depth along the light is -z
+        Mat4 projection = Mat4().Orthographic(center.x - extent, center.x + extent, center.y - extent, center.y + extent,
+            -center.z - extent, -center.z + extent);
+        cascade.viewProjection = lightView * projection;
+    }
+
+    void DrawCasters(const std::vector<const DrawItem*>& casters)
+    {
+        int modelLoc = glGetUniformLocation(depthShader.id, "model");
+        Mesh* boundMesh = nullptr;
+
+        for (const DrawItem* item : casters)
+        {
+            if (item->mesh != boundMesh)
+            {
+                item->mesh->BindPositions();
+                boundMesh = item->mesh;
+            }
+
+            Mat4 model = item->model;
+            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, model.value_ptr());
+            glDrawElements(GL_TRIANGLES, (GLsizei)item->mesh->indices.size(), GL_UNSIGNED_INT, (void*)0);
+            casterDraws++;
+        }
+    }
+
+    void CreateDepthArray(unsigned int& texture)
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT24, resolution, resolution, cascadeCount);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        const float border[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    // Point through a matrix (m.data is column major)
+    static Vec3 Transform(const Mat4& m, const Vec3& p)
+    {
+        return Vec3(m.data[0][0] * p.x + m.data[1][0] * p.y + m.data[2][0] * p.z + m.data[3][0],
+            m.data[0][1] * p.x + m.data[1][1] * p.y + m.data[2][1] * p.z + m.data[3][1],
+            m.data[0][2] * p.x + m.data[1][2] * p.y + m.data[2][2] * p.z + m.data[3][2]);
+    }
+
+    // Bounding sphere of the instance against the cascade box, open towards the light since depth clamping keeps
+    // casters in front of the near plane
+    bool Touches(const Cascade& cascade, const Mesh& mesh, const Mat4& model) const
+    {
+        Vec3 worldCenter = Transform(model, mesh.boundsCenter);
+
+        float scale = 0.0f;
+        for (int axis = 0; axis < 3; ++axis)
+            scale = std::max(scale, std::sqrt(model.data[axis][0] * model.data[axis][0] + model.data[axis][1] * model.data[axis][1] + model.data[axis][2] * model.data[axis][2]));
+        float radius = mesh.boundsRadius * scale;
+
+        Vec3 center = Transform(lightView, worldCenter);
+        const Vec3& box = cascade.lightCenter;
+
+        if (std::fabs(center.x - box.x) > cascade.radius + radius || std::fabs(center.y - box.y) > cascade.radius + radius)
+            return false;
+
+        // Entirely behind the far plane (farther along the light than every receiver)
+        return -center.z - radius <= -box.z + cascade.radius;
+    }
+
+    void Release()
+    {
+        if (framebuffer)
+            glDeleteFramebuffers(1, &framebuffer);
+        if (depthTexture)
+            glDeleteTextures(1, &depthTexture);
+        if (staticTexture)
+            glDeleteTextures(1, &staticTexture);
+        framebuffer = 0;
+        depthTexture = 0;
+        staticTexture = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef STAGING_RING_H
+#define STAGING_RING_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+
+// Persistently mapped GL_PIXEL_UNPACK_BUFFER used as a ring of staging memory
+// Worker threads write pixels straight into the mapped memory, the GL thread uploads from it and fences each region.
+// Regions are recycled in allocation order once their fence shows the GPU has finished reading them.
+class StagingRing
+{
+public:
+
+    // Region of the ring, pointer is null when nothing was allocated
+    struct Allocation
+    {
+        uint64_t id = 0;
+        size_t offset = 0;
+        size_t size = 0;
+        unsigned char* pointer = nullptr;
+
+        explicit operator bool() const { return pointer != nullptr; }
+    };
+
+    // Create and map the buffer (GL thread)
+    // Persistent mapping needs GL 4.4 or ARB_buffer_storage. Without it the ring stays empty: Fits is false and callers
+    // upload from client memory instead, a buffer mapped the old way cannot be written by workers while the GPU reads it
+    StagingRing(size_t capacity = 64 * 1024 * 1024) : capacity(capacity), buffer(0), mapped(nullptr), head(0), used(0), nextID(1)
+    {
+        if (!GLAD_GL_VERSION_4_4 && !GLAD_GL_ARB_buffer_storage)
+        {
+            std::cerr << "Persistent buffer mapping is not supported (needs GL 4.4 or ARB_buffer_storage), textures will upload from client memory" << std::endl;
+            return;
+        }
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, flags);
+        mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, capacity, flags);
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (!mapped)
+            std::cerr << "Failed to map staging buffer, textures will upload from client memory" << std::endl;
+    }
+
+    ~StagingRing()
+    {
+        for (Region& region : regions)
+        {
+            if (region.fence)
+                glDeleteSync(region.fence);
+        }
+
+        if (!buffer)
+            return;
+
+        if (mapped)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+
+    // Whether an allocation of this size can ever succeed
+    bool Fits(size_t size) const
+    {
+        return mapped && Align(size) <= capacity;
+    }
+
+    // Reserve memory for the caller to write into (any thread), waits up to timeout for the GPU to release space
+    Allocation Allocate(size_t size, std::chrono::milliseconds timeout)
+    {
+        Allocation allocation;
+        if (!Fits(size))
+            return allocation;
+
+        size = Align(size);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        spaceAvailable.wait_for(lock, timeout, [&] { return TryAllocate(size, allocation); });
+
+        return allocation;
+    }
+
+    // The uploads reading the allocation have been issued (GL thread), it is recycled once they complete
+    void Submit(const Allocation& allocation)
+    {
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (Region* region = Find(allocation.id))
+        {
+            region->fence = fence;
+            region->submitted = true;
+        }
+        else
+        {
+            glDeleteSync(fence);
+        }
+    }
+
+    // Give back an allocation that will not be uploaded
+    void Cancel(const Allocation& allocation)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (Region* region = Find(allocation.id))
+            region->submitted = true;
+    }
+
+    // Recycle regions the GPU is done with (GL thread, once per frame)
+    void Retire()
+    {
+        bool freed = false;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            while (!regions.empty() && regions.front().submitted)
+            {
+                Region& region = regions.front();
+                if (region.fence)
+                {
+                    GLenum status = glClientWaitSync(region.fence, 0, 0);
+                    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                        break;
+
+                    glDeleteSync(region.fence);
+                }
+
+                used -= region.footprint;
+                regions.pop_front();
+                freed = true;
+            }
+
+            if (regions.empty())
+            {
+                head = 0;
+                used = 0;
+            }
+        }
+
+        if (freed)
+            spaceAvailable.notify_all();
+    }
+
+    // Buffer to bind to GL_PIXEL_UNPACK_BUFFER, allocation offsets are relative to it
+    unsigned int Buffer() const
+    {
+        return buffer;
+    }
+
+    size_t Capacity() const
+    {
+        return capacity;
+    }
+
+    size_t Used()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return used;
+    }
+
+private:
+
+    struct Region
+    {
+        uint64_t id;
+        size_t start;       // Where the reservation began, before offset when it skipped the end of the buffer
+        size_t footprint;   // Bytes taken from the ring, skipped ones included
+        bool submitted;     // Uploaded or cancelled, only the fence remains
+        GLsync fence;
+    };
+
+    // Offsets stay aligned for any pixel or block format
+    static const size_t ALIGNMENT = 256;
+
+    size_t capacity;
+    unsigned int buffer;
+    unsigned char* mapped;
+
+    std::mutex mutex;
+    std::condition_variable spaceAvailable;
+    std::deque<Region> regions;
+    size_t head;
+    size_t used;
+    uint64_t nextID;
+
+    static size_t Align(size_t size)
+    {
+        return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    Region* Find(uint64_t id)
+    {
+        for (Region& region : regions)
+        {
+            if (region.id == id)
+                return &region;
+        }
+        return nullptr;
+    }
+
+    // Place size bytes at the head, wrapping to the start of the buffer if the end is too short (mutex held)
+    bool TryAllocate(size_t size, Allocation& allocation)
+    {
+        size_t offset;
+
+        if (regions.empty())
+        {
+            head = 0;
+            offset = 0;
+        }
+        else
+        {
+            size_t tail = regions.front().start;
+
+            if (head > tail)
+            {
+                if (capacity - head >= size)
+                    offset = head;
+                else if (tail >= size)
+                    offset = 0;
+                else
+                    return false;
+            }
+            else if (head < tail && tail - head >= size)
+            {
+                offset = head;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        size_t footprint = (offset == head) ? size : (capacity - head) + size;
+
+        Region region = { nextID++, head, footprint, false, nullptr };
+        regions.push_back(region);
+
+        head = offset + size;
+        used += footprint;
+
+        allocation.id = region.id;
+        allocation.offset = offset;
+        allocation.size = size;
+        allocation.pointer = mapped + offset;
+        return true;
+    }
+};
+
+#endif
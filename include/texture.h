@@ -0,0 +1,352 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <glad/glad.h>
+#include <gpu_residency.h>
+#include <ktx2.h>
+#include <mip_generator.h>
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stb_image.h>
+
+// Decoded image waiting for upload
+struct TextureData
+{
+    std::string path;
+    int width = 0;
+    int height = 0;
+    int nrChannels = 0;
+    unsigned char* pixels = nullptr;
+
+    // Block-compressed mip chain read from a KTX2 file (pixels is null in that case),
+    // otherwise the levels below pixels built on the CPU
+    unsigned int compressedFormat = 0;
+    std::vector<std::vector<unsigned char>> levels;
+
+    TextureData() {}
+    TextureData(const TextureData&) = delete;
+    TextureData& operator=(const TextureData&) = delete;
+
+    TextureData(TextureData&& other) { *this = std::move(other); }
+
+    TextureData& operator=(TextureData&& other)
+    {
+        if (this != &other)
+        {
+            Free();
+            path = std::move(other.path);
+            width = other.width;
+            height = other.height;
+            nrChannels = other.nrChannels;
+            pixels = other.pixels;
+            other.pixels = nullptr;
+            compressedFormat = other.compressedFormat;
+            levels = std::move(other.levels);
+        }
+        return *this;
+    }
+
+    ~TextureData() { Free(); }
+
+    void Free()
+    {
+        if (pixels)
+            stbi_image_free(pixels); // Free the image memory
+        pixels = nullptr;
+        compressedFormat = 0;
+        levels.clear();
+    }
+};
+
+// GL internal format for a KTX2 format, 0 if unsupported
+inline unsigned int KTX2GLFormat(uint32_t vkFormat)
+{
+    switch (vkFormat)
+    {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK: return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+    case VK_FORMAT_BC3_UNORM_BLOCK: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case VK_FORMAT_BC3_SRGB_BLOCK: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+    case VK_FORMAT_BC5_UNORM_BLOCK: return GL_COMPRESSED_RG_RGTC2;
+    case VK_FORMAT_BC7_UNORM_BLOCK: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    case VK_FORMAT_BC7_SRGB_BLOCK: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+    default: return 0;
+    }
+}
+
+// Compressed file written for an image by CookTexture ("textures/a.jpg" -> "textures/a.ktx2")
+inline std::string CookedTexturePath(const std::string& path)
+{
+    return std::filesystem::path(path).replace_extension(".ktx2").generic_string();
+}
+
+// File to load for an image: its cooked KTX2 version when one exists and is not older than the source
+inline std::string ResolveTexturePath(const std::string& path)
+{
+    std::filesystem::path source(path);
+    if (source.extension() == ".ktx2")
+        return path;
+
+    std::string cooked = CookedTexturePath(path);
+
+    std::error_code error;
+    auto cookedTime = std::filesystem::last_write_time(cooked, error);
+    if (error)
+        return path;
+
+    auto sourceTime = std::filesystem::last_write_time(source, error);
+    if (!error && sourceTime > cookedTime)
+        return path;
+
+    return cooked;
+}
+
+// Load image from disk (no GL calls, safe on worker threads)
+inline bool DecodeTexture(const char* path, TextureData& texture)
+{
+    texture.Free();
+    texture.path = path;
+
+    std::string resolved = ResolveTexturePath(path);
+    if (std::filesystem::path(resolved).extension() == ".ktx2")
+    {
+        KTX2Texture compressed;
+        if (!ReadKTX2(resolved, compressed))
+            return false;
+
+        texture.width = (int)compressed.width;
+        texture.height = (int)compressed.height;
+        texture.nrChannels = 4;
+        texture.compressedFormat = KTX2GLFormat(compressed.vkFormat);
+        texture.levels = std::move(compressed.levels);
+        return true;
+    }
+
+    texture.pixels = stbi_load(path, &texture.width, &texture.height, &texture.nrChannels, 4);
+
+	// Check if image was loaded successfully
+    if (!texture.pixels)
+    {
+        std::cerr << "Failed to load texture: " << path << std::endl;
+        return false;
+    }
+
+    // Expanded to RGBA, the mip generator works on four channels
+    texture.nrChannels = 4;
+    texture.levels = GenerateMips(texture.pixels, texture.width, texture.height, 1);
+
+    return true;
+}
+
+// Bytes of a mip chain made by UploadTexture, RGBA8 unless compressedFormat is set
+inline size_t TextureBytes(unsigned int compressedFormat, int width, int height, int levelCount)
+{
+    bool halfBlocks = compressedFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || compressedFormat == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+
+    size_t bytes = 0;
+    for (int level = 0; level < levelCount; ++level)
+    {
+        size_t w = std::max(width >> level, 1), h = std::max(height >> level, 1);
+        bytes += compressedFormat ? ((w + 3) / 4) * ((h + 3) / 4) * (halfBlocks ? 8 : 16) : w * h * 4;
+    }
+    return bytes;
+}
+
+// Free the finest level of a texture made by UploadTexture, level 1 becomes level 0
+// The levels are moved with GPU copies through a temporary texture, nothing is read back
+inline void DropTextureLevel(unsigned int textureID, unsigned int compressedFormat, int width, int height, int levelCount)
+{
+    int newWidth = std::max(width / 2, 1);
+    int newHeight = std::max(height / 2, 1);
+    int newCount = levelCount - 1;
+    unsigned int format = compressedFormat ? compressedFormat : GL_RGBA8;
+
+    unsigned int copy;
+    glGenTextures(1, &copy);
+    glBindTexture(GL_TEXTURE_2D, copy);
+    glTexStorage2D(GL_TEXTURE_2D, newCount, format, newWidth, newHeight);
+
+    for (int level = 0; level < newCount; ++level)
+        glCopyImageSubData(textureID, GL_TEXTURE_2D, level + 1, 0, 0, 0, copy, GL_TEXTURE_2D, level, 0, 0, 0, std::max(newWidth >> level, 1), std::max(newHeight >> level, 1), 1);
+
+    // Respecify the smaller chain, the old 1x1 level is left beyond GL_TEXTURE_MAX_LEVEL
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    for (int level = 0; level < newCount; ++level)
+    {
+        int w = std::max(newWidth >> level, 1), h = std::max(newHeight >> level, 1);
+        if (compressedFormat)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, format, w, h, 0, (GLsizei)TextureBytes(compressedFormat, w, h, 1), nullptr);
+        else
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, newCount - 1);
+
+    for (int level = 0; level < newCount; ++level)
+        glCopyImageSubData(copy, GL_TEXTURE_2D, level, 0, 0, 0, textureID, GL_TEXTURE_2D, level, 0, 0, 0, std::max(newWidth >> level, 1), std::max(newHeight >> level, 1), 1);
+
+    glDeleteTextures(1, &copy);
+}
+
+inline void UploadTexture(unsigned int textureID, const TextureData& texture);
+
+// Queues the decode of an evicted texture on a worker thread, the image is uploaded with UploadTexture once it is ready
+// Set by the AssetLoader, without one evicted textures are decoded on the GL thread when they are used again
+inline std::function<void(unsigned int textureID, const std::string& path)> textureRestoreQueue;
+
+// Report a texture made by UploadTexture to the residency manager
+// Evicting it drops its finest levels one at a time down to 64 texels, using it again reloads the file
+inline void TrackTexture(unsigned int textureID, const TextureData& texture, int levelCount)
+{
+    ResidencyManager* residency = ResidencyManager::Active();
+    if (!residency)
+        return;
+
+    struct Tracked
+    {
+        std::string path;
+        unsigned int compressedFormat;
+        int width;
+        int height;
+        int levelCount;
+    };
+
+    std::shared_ptr<Tracked> tracked(new Tracked{ texture.path, texture.compressedFormat, texture.width, texture.height, levelCount });
+
+    auto evict = [textureID, tracked]()
+    {
+        if (tracked->levelCount > 1 && std::max(tracked->width, tracked->height) > 64)
+        {
+            DropTextureLevel(textureID, tracked->compressedFormat, tracked->width, tracked->height, tracked->levelCount);
+            tracked->width = std::max(tracked->width / 2, 1);
+            tracked->height = std::max(tracked->height / 2, 1);
+            tracked->levelCount--;
+        }
+        return TextureBytes(tracked->compressedFormat, tracked->width, tracked->height, tracked->levelCount);
+    };
+
+    // The texture keeps drawing with the levels eviction left until the reload is uploaded
+    auto restore = [textureID, tracked]()
+    {
+        if (textureRestoreQueue)
+        {
+            textureRestoreQueue(textureID, tracked->path);
+            return TextureBytes(tracked->compressedFormat, tracked->width, tracked->height, tracked->levelCount);
+        }
+
+        TextureData data;
+        if (!DecodeTexture(tracked->path.c_str(), data))
+            return TextureBytes(tracked->compressedFormat, tracked->width, tracked->height, tracked->levelCount);
+
+        UploadTexture(textureID, data);
+
+        int levels = (int)data.levels.size() + (data.compressedFormat ? 0 : 1);
+        return TextureBytes(data.compressedFormat, data.width, data.height, levels);
+    };
+
+    residency->Track(RESIDENCY_TEXTURE, textureID, TextureBytes(tracked->compressedFormat, tracked->width, tracked->height, levelCount), evict, restore);
+}
+
+// Delete a texture and stop accounting for it
+inline void DeleteTexture(unsigned int textureID)
+{
+    if (ResidencyManager* residency = ResidencyManager::Active())
+    {
+        residency->Untrack(RESIDENCY_TEXTURE, textureID);
+        residency->Untrack(RESIDENCY_STREAMED_TEXTURE, textureID);
+    }
+
+    glDeleteTextures(1, &textureID);
+}
+
+// Upload a decoded image into an existing texture object
+inline void UploadTexture(unsigned int textureID, const TextureData& texture)
+{
+	// Bind the texture
+    glBindTexture(GL_TEXTURE_2D, textureID);
+
+    // Set texture parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);  // Horizontal wrapping
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);  // Vertical wrapping
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Pre-compressed mip chain, uploaded as is
+    if (texture.compressedFormat)
+    {
+        int width = texture.width;
+        int height = texture.height;
+
+        for (size_t level = 0; level < texture.levels.size(); ++level)
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, texture.compressedFormat, width, height, 0,
+                (GLsizei)texture.levels[level].size(), texture.levels[level].data());
+
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.levels.size() - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+        TrackTexture(textureID, texture, (int)texture.levels.size());
+        return;
+    }
+
+    // Load the texture to OpenGL
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.width, texture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture.pixels);
+
+    // Mipmaps were built by DecodeTexture
+    int width = texture.width;
+    int height = texture.height;
+
+    for (size_t level = 0; level < texture.levels.size(); ++level)
+    {
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+        glTexImage2D(GL_TEXTURE_2D, (GLint)level + 1, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture.levels[level].data());
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.levels.size());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    TrackTexture(textureID, texture, (int)texture.levels.size() + 1);
+}
+
+// Fill a texture with a single color, shown while the real image is loading
+inline void UploadPlaceholderTexture(unsigned int textureID, unsigned char r = 255, unsigned char g = 255, unsigned char b = 255)
+{
+    unsigned char pixel[4] = { r, g, b, 255 };
+
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+}
+
+// Texture
+inline unsigned int LoadTexture(const char* path)
+{
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    // Load image
+    TextureData texture;
+    if (DecodeTexture(path, texture))
+    {
+        UploadTexture(textureID, texture);
+    }
+
+    return textureID;
+}
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <mesh.h>
+#include <mip_generator.h>
+#include <texture.h>
+#include <texture_manager.h>
+#include <vec2.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Where a packed image ended up: array layer and the rectangle it covers in texture coordinates
+struct TextureSlot
+{
+    int layer = -1;
+    Vec2 uvOffset = Vec2(0.0f, 0.0f);
+    Vec2 uvScale = Vec2(1.0f, 1.0f);
+};
+
+// Packs images into the layers of one GL_TEXTURE_2D_ARRAY so materials differ by a layer index instead of a texture name
+// Large images get a layer each (resampled to the layer size), small ones share layers as a shelf-packed atlas.
+// Atlas images sit in power-of-two cells filled with their own repeats, so mip levels stay inside a cell
+// down to the smallest cell's 1x1 level, where the mip chain of the whole array stops.
+// Every packed material samples the same texture object, so draws sorted by material never rebind textures.
+class TextureArrayPacker
+{
+public:
+
+    // layerSize: width and height of every layer (rounded up to a power of two)
+    // padding: border repeated around atlas images against filtering bleed, at least
+    TextureArrayPacker(int layerSize = 2048, int padding = 4) : layerSize(NextPowerOfTwo(layerSize)), padding(padding), arrayID(0), layerCount(0) {}
+
+    ~TextureArrayPacker()
+    {
+        if (arrayID)
+            glDeleteTextures(1, &arrayID);
+    }
+
+    // Queue an image for the next Build
+    void Add(const std::string& path)
+    {
+        std::string key = TextureManager::CanonicalPath(path);
+        if (!slots.count(key))
+        {
+            slots[key] = TextureSlot();
+            paths.push_back(key);
+        }
+    }
+
+    // Decode, pack and upload every queued image, returns false if nothing could be packed
+    bool Build()
+    {
+        std::vector<Image> images;
+        for (const std::string& path : paths)
+        {
+            Image image;
+            image.path = path;
+
+            int channels;
+            unsigned char* pixels = stbi_load(path.c_str(), &image.width, &image.height, &channels, 4);
+            if (!pixels)
+            {
+                std::cerr << "Failed to load texture: " << path << std::endl;
+                slots.erase(path);
+                continue;
+            }
+
+            image.pixels.assign(pixels, pixels + (size_t)image.width * image.height * 4);
+            stbi_image_free(pixels);
+            images.push_back(std::move(image));
+        }
+
+        paths.clear();
+        if (images.empty())
+            return false;
+
+        // Shelf packing, tallest cells first, each image keeps at least its padding on all sides
+        std::vector<Image*> small;
+        std::vector<Image*> large;
+        for (Image& image : images)
+        {
+            image.cellWidth = NextPowerOfTwo(image.width + 2 * padding);
+            image.cellHeight = NextPowerOfTwo(image.height + 2 * padding);
+            image.atlas = image.cellWidth <= layerSize / 2 && image.cellHeight <= layerSize / 2;
+            if (image.atlas)
+                small.push_back(&image);
+            else
+                large.push_back(&image);
+        }
+
+        std::sort(small.begin(), small.end(), [](const Image* a, const Image* b)
+        {
+            return a->cellHeight != b->cellHeight ? a->cellHeight > b->cellHeight : a->cellWidth > b->cellWidth;
+        });
+
+        int layer = 0;
+        for (Image* image : large)
+        {
+            image->layer = layer++;
+            image->x = 0;
+            image->y = 0;
+        }
+
+        // Cells are aligned to their own size: shelves get shorter, so shelfY stays aligned, shelfX is rounded up
+        int shelfX = 0, shelfY = 0, shelfHeight = 0;
+        int smallestCell = layerSize;
+        bool atlasLayerOpen = false;
+        for (Image* image : small)
+        {
+            int width = image->cellWidth;
+            int height = image->cellHeight;
+            smallestCell = std::min(smallestCell, std::min(width, height));
+
+            shelfX = (shelfX + width - 1) / width * width;
+            if (atlasLayerOpen && shelfX + width > layerSize)
+            {
+                shelfX = 0;
+                shelfY += shelfHeight;
+                shelfHeight = 0;
+            }
+
+            if (!atlasLayerOpen || shelfY + height > layerSize)
+            {
+                layer++;
+                atlasLayerOpen = true;
+                shelfX = shelfY = shelfHeight = 0;
+            }
+
+            image->layer = layer - 1;
+            image->x = shelfX + padding;
+            image->y = shelfY + padding;
+
+            shelfX += width;
+            shelfHeight = std::max(shelfHeight, height);
+        }
+
+        layerCount = layer;
+
+        // Below the smallest cell's 1x1 level, atlas texels would average neighbouring images
+        int levels = MipLevelCount(smallestCell, smallestCell);
+
+        if (arrayID)
+            glDeleteTextures(1, &arrayID);
+
+        glGenTextures(1, &arrayID);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, arrayID);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, layerSize, layerSize, layerCount);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        // Compose one layer at a time and upload its mip chain
+        for (int current = 0; current < layerCount; ++current)
+        {
+            std::vector<uint8_t> pixels((size_t)layerSize * layerSize * 4, 0);
+
+            for (const Image& image : images)
+            {
+                if (image.layer != current)
+                    continue;
+
+                TextureSlot& slot = slots[image.path];
+                slot.layer = current;
+
+                if (image.atlas)
+                {
+                    Blit(image, pixels);
+                    slot.uvOffset = Vec2((float)image.x / layerSize, (float)image.y / layerSize);
+                    slot.uvScale = Vec2((float)image.width / layerSize, (float)image.height / layerSize);
+                }
+                else
+                {
+                    pixels = ResizeImage(image.pixels.data(), image.width, image.height, layerSize, layerSize);
+                    slot.uvOffset = Vec2(0.0f, 0.0f);
+                    slot.uvScale = Vec2(1.0f, 1.0f);
+                }
+            }
+
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, current, layerSize, layerSize, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+            // Atlas cells are filled with repeats, so wrapping filter taps stay inside the layer's own images
+            std::vector<std::vector<uint8_t>> mips = GenerateMips(pixels.data(), layerSize, layerSize, 1, levels - 1);
+            for (size_t level = 0; level < mips.size(); ++level)
+            {
+                int size = std::max(layerSize >> (level + 1), 1);
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level + 1, 0, 0, current, size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE, mips[level].data());
+            }
+        }
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        std::cout << "Packed " << images.size() << " textures into " << layerCount << " layers of " << layerSize << "x" << layerSize << std::endl;
+        return true;
+    }
+
+    // Slot of a packed image, false if the file was not packed
+    bool Find(const std::string& path, TextureSlot& slot) const
+    {
+        auto it = slots.find(TextureManager::CanonicalPath(path));
+        if (it == slots.end() || it->second.layer < 0)
+            return false;
+
+        slot = it->second;
+        return true;
+    }
+
+    // Point the material at the packed image, false if the file was not packed
+    bool Apply(Material& material, const std::string& path) const
+    {
+        TextureSlot slot;
+        if (!arrayID || !Find(path, slot))
+            return false;
+
+        material.texture = arrayID;
+        material.virtualTexture = -1;
+        material.layer = slot.layer;
+        material.uvOffset = slot.uvOffset;
+        material.uvScale = slot.uvScale;
+        return true;
+    }
+
+    // GL_TEXTURE_2D_ARRAY holding every packed image
+    unsigned int ArrayID() const
+    {
+        return arrayID;
+    }
+
+    int LayerCount() const
+    {
+        return layerCount;
+    }
+
+private:
+
+    struct Image
+    {
+        std::string path;
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> pixels;
+        int cellWidth = 0;  // Power-of-two cell the image repeats across in an atlas
+        int cellHeight = 0;
+        bool atlas = false; // Shares a layer with other images
+        int layer = -1;
+        int x = 0;
+        int y = 0;
+    };
+
+    int layerSize;
+    int padding;
+    unsigned int arrayID;
+    int layerCount;
+
+    std::unordered_map<std::string, TextureSlot> slots;
+    std::vector<std::string> paths;
+
+    static int NextPowerOfTwo(int value)
+    {
+        int result = 1;
+        while (result < value)
+            result <<= 1;
+        return result;
+    }
+
+    // Copy the image at its atlas position and repeat it over the rest of its cell, so tiling and mips stay seamless
+    void Blit(const Image& image, std::vector<uint8_t>& layer) const
+    {
+        for (int y = -padding; y < image.cellHeight - padding; ++y)
+        {
+            int sy = (y % image.height + image.height) % image.height;
+            for (int x = -padding; x < image.cellWidth - padding; ++x)
+            {
+                int sx = (x % image.width + image.width) % image.width;
+                const uint8_t* pixel = &image.pixels[((size_t)sy * image.width + sx) * 4];
+                uint8_t* target = &layer[((size_t)(image.y + y) * layerSize + image.x + x) * 4];
+
+                for (int ch = 0; ch < 4; ++ch)
+                    target[ch] = pixel[ch];
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef TEXTURE_COOKER_H
+#define TEXTURE_COOKER_H
+
+#include <bc_encoder.h>
+#include <ktx2.h>
+#include <mip_generator.h>
+#include <texture.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// KTX2 format written for an encoder format
+inline uint32_t BCFormatToVk(BCFormat format)
+{
+    switch (format)
+    {
+    case FORMAT_BC1: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    case FORMAT_BC3: return VK_FORMAT_BC3_UNORM_BLOCK;
+    case FORMAT_BC5: return VK_FORMAT_BC5_UNORM_BLOCK;
+    default: return VK_FORMAT_BC7_UNORM_BLOCK;
+    }
+}
+
+// Compress an image and its whole mip chain into a KTX2 file next to it (see CookedTexturePath)
+// BC5 holds normal or other non-colour data and is always filtered as linear values
+inline bool CookTexture(const std::string& path, BCFormat format, BCQuality quality, MipOptions mipOptions = MipOptions())
+{
+    int width, height, channels;
+    unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+    if (!pixels)
+    {
+        std::cerr << "Failed to load texture: " << path << std::endl;
+        return false;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if (format == FORMAT_BC5)
+        mipOptions.srgb = false;
+
+    std::vector<std::vector<uint8_t>> levels = GenerateMips(pixels, width, height, 0, -1, mipOptions);
+    stbi_image_free(pixels);
+
+    KTX2Texture texture;
+    texture.vkFormat = BCFormatToVk(format);
+    texture.width = width;
+    texture.height = height;
+
+    size_t uncompressedSize = 0;
+    for (size_t level = 0; level < levels.size(); ++level)
+    {
+        int levelWidth = std::max(width >> level, 1), levelHeight = std::max(height >> level, 1);
+        texture.levels.push_back(CompressImage(levels[level].data(), levelWidth, levelHeight, format, quality));
+        uncompressedSize += levels[level].size();
+    }
+
+    size_t compressedSize = 0;
+    for (const std::vector<uint8_t>& data : texture.levels)
+        compressedSize += data.size();
+
+    std::string cooked = CookedTexturePath(path);
+    if (!WriteKTX2(cooked, texture))
+        return false;
+
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << path << " -> " << cooked << ": " << texture.levels.size() << " levels, "
+        << uncompressedSize / 1024 << " KB -> " << compressedSize / 1024 << " KB in " << elapsed << " ms" << std::endl;
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include <texture.h>
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class TextureManager;
+
+// Shared reference to a texture owned by the TextureManager, the texture is freed with its last handle
+// Handles are not thread-safe, copy and release them on the GL thread only
+class TextureHandle
+{
+public:
+
+    TextureHandle() : manager(nullptr), id(0) {}
+
+    TextureHandle(const TextureHandle& other) : manager(other.manager), id(other.id) { AddRef(); }
+
+    TextureHandle(TextureHandle&& other) : manager(other.manager), id(other.id)
+    {
+        other.manager = nullptr;
+        other.id = 0;
+    }
+
+    TextureHandle& operator=(TextureHandle other)
+    {
+        std::swap(manager, other.manager);
+        std::swap(id, other.id);
+        return *this;
+    }
+
+    ~TextureHandle() { Release(); }
+
+    // GL texture name
+    unsigned int GetID() const { return id; }
+
+    explicit operator bool() const { return id != 0; }
+
+private:
+    friend class TextureManager;
+
+    TextureManager* manager;
+    unsigned int id;
+
+    TextureHandle(TextureManager* manager, unsigned int id) : manager(manager), id(id) { AddRef(); }
+
+    inline void AddRef();
+    inline void Release();
+};
+
+// Texture cache, each file is loaded once and files with identical contents share one texture
+class TextureManager
+{
+public:
+
+    ~TextureManager()
+    {
+        for (auto& entry : entries)
+            DeleteTexture(entry.first);
+    }
+
+    // Texture for the file, loaded on first use
+    TextureHandle Acquire(const std::string& path)
+    {
+        std::string key = CanonicalPath(path);
+
+        auto byPathIt = byPath.find(key);
+        if (byPathIt != byPath.end())
+            return TextureHandle(this, byPathIt->second);
+
+        // Same image under another name (copied files, different relative paths)
+        // Only files of the same size are compared, so a new image costs a stat rather than a read on this thread
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(key, error);
+        bool sized = !error;
+
+        if (sized)
+        {
+            auto range = bySize.equal_range(size);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                if (FilesEqual(key, entries[it->second].paths[0]))
+                {
+                    byPath[key] = it->second;
+                    entries[it->second].paths.push_back(key);
+                    return TextureHandle(this, it->second);
+                }
+            }
+        }
+
+        unsigned int id = textureLoader ? textureLoader(key) : LoadTexture(key.c_str());
+
+        Entry& entry = entries[id];
+        entry.references = 0;
+        entry.sized = sized;
+        entry.size = size;
+        entry.paths.push_back(key);
+
+        byPath[key] = id;
+        if (sized)
+            bySize.emplace(size, id);
+
+        return TextureHandle(this, id);
+    }
+
+    // Another handle to a texture of this manager, empty if the texture is not one of its own
+    TextureHandle Reference(unsigned int id)
+    {
+        return entries.count(id) ? TextureHandle(this, id) : TextureHandle();
+    }
+
+    // Texture already loaded from this file, 0 if none
+    unsigned int Find(const std::string& path) const
+    {
+        auto it = byPath.find(CanonicalPath(path));
+        return (it != byPath.end()) ? it->second : 0;
+    }
+
+    // Number of live textures
+    size_t Count() const
+    {
+        return entries.size();
+    }
+
+    // Number of handles referencing the texture
+    int References(unsigned int id) const
+    {
+        auto it = entries.find(id);
+        return (it != entries.end()) ? it->second.references : 0;
+    }
+
+    // Replaces LoadTexture for new textures (e.g. to load them asynchronously)
+    std::function<unsigned int(const std::string&)> textureLoader;
+
+    // Called just before a texture is deleted (e.g. to stop streaming it)
+    std::function<void(unsigned int)> textureReleased;
+
+    // Same file always maps to one key, whatever relative path was used to reach it
+    static std::string CanonicalPath(const std::string& path)
+    {
+        std::error_code error;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+
+        if (error)
+            return std::filesystem::path(path).lexically_normal().generic_string();
+
+        return canonical.generic_string();
+    }
+
+private:
+    friend class TextureHandle;
+
+    struct Entry
+    {
+        int references = 0;
+        bool sized = false;
+        uintmax_t size = 0;             // Of the file first loaded, when it could be read
+        std::vector<std::string> paths;
+    };
+
+    std::unordered_map<unsigned int, Entry> entries;
+    std::unordered_map<std::string, unsigned int> byPath;
+    std::unordered_multimap<uintmax_t, unsigned int> bySize;
+
+    void AddRef(unsigned int id)
+    {
+        entries[id].references++;
+    }
+
+    // Free the texture once nothing references it
+    void Release(unsigned int id)
+    {
+        auto it = entries.find(id);
+        if (it == entries.end() || --it->second.references > 0)
+            return;
+
+        for (const std::string& path : it->second.paths)
+            byPath.erase(path);
+
+        if (it->second.sized)
+        {
+            auto range = bySize.equal_range(it->second.size);
+            for (auto sizeIt = range.first; sizeIt != range.second; ++sizeIt)
+            {
+                if (sizeIt->second == id)
+                {
+                    bySize.erase(sizeIt);
+                    break;
+                }
+            }
+        }
+
+        if (textureReleased)
+            textureReleased(id);
+
+        DeleteTexture(id);
+        entries.erase(it);
+    }
+
+    // Byte comparison of two files, stops at the first difference
+    static bool FilesEqual(const std::string& a, const std::string& b)
+    {
+        std::ifstream fileA(a, std::ios::binary);
+        std::ifstream fileB(b, std::ios::binary);
+        if (!fileA.is_open() || !fileB.is_open())
+            return false;
+
+        char bufferA[64 * 1024];
+        char bufferB[64 * 1024];
+        for (;;)
+        {
+            fileA.read(bufferA, sizeof(bufferA));
+            fileB.read(bufferB, sizeof(bufferB));
+
+            std::streamsize count = fileA.gcount();
+            if (count != fileB.gcount() || std::memcmp(bufferA, bufferB, (size_t)count) != 0)
+                return false;
+
+            if (count < (std::streamsize)sizeof(bufferA))
+                return true;
+        }
+    }
+};
+
+inline void TextureHandle::AddRef()
+{
+    if (manager && id)
+        manager->AddRef(id);
+}
+
+inline void TextureHandle::Release()
+{
+    if (manager && id)
+        manager->Release(id);
+
+    manager = nullptr;
+    id = 0;
+}
+
+#endif
@@ -0,0 +1,803 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <texture.h>
+#include <mip_generator.h>
+#include <texture_manager.h>
+#include <render_queue.h>
+#include <lockfree_queue.h>
+#include <staging_ring.h>
+#include <ktx2.h>
+#include <mesh.h>
+#include <mat4.h>
+#include <vec3.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Streams texture mip levels in and out based on how large the textures appear on screen
+// Every texture gets immutable storage for its whole mip chain up front, only the small mip tail is loaded at first.
+// Finer levels are read on a worker thread when the screen needs them and exposed by lowering GL_TEXTURE_BASE_LEVEL,
+// levels are dropped again (BASE_LEVEL raised) when the loaded data exceeds the budget.
+// The budget limits the data read, decoded and uploaded; the storage itself stays allocated, freeing it needs sparse textures.
+// The worker writes levels straight into a persistently mapped staging ring, so uploads are GPU copies from a pixel buffer.
+class TextureStreamer
+{
+public:
+
+    // budgetBytes: loaded mip data across all textures, tailSize: largest mip loaded up front, stagingBytes: size of the upload ring
+    TextureStreamer(TextureManager& manager, size_t budgetBytes = 256 * 1024 * 1024, int tailSize = 64, size_t stagingBytes = 64 * 1024 * 1024)
+        : manager(manager), budget(budgetBytes), tailSize(tailSize), results(64), staging(stagingBytes), stopping(false)
+    {
+        worker = std::thread(&TextureStreamer::WorkerLoop, this);
+
+        // New textures are streamed, released ones are still reported to whoever listened before (the asset loader,
+        // created before the streamer so it outlives it); both hooks are handed back on destruction
+        previousLoader = std::move(manager.textureLoader);
+        previousReleased = std::move(manager.textureReleased);
+        manager.textureLoader = [this](const std::string& path) { return Load(path); };
+        manager.textureReleased = [this](unsigned int texture)
+        {
+            Release(texture);
+            if (previousReleased)
+                previousReleased(texture);
+        };
+    }
+
+    ~TextureStreamer()
+    {
+        manager.textureLoader = std::move(previousLoader);
+        manager.textureReleased = std::move(previousReleased);
+
+        // Textures outliving the streamer keep their levels, the residency manager must not call back into it
+        if (ResidencyManager* residency = ResidencyManager::Active())
+        {
+            for (const auto& it : entries)
+                residency->Track(RESIDENCY_STREAMED_TEXTURE, it.first, ResidentBytes(it.second));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        worker.join();
+
+        std::unique_ptr<Result> result;
+        while (results.Pop(result))
+        {
+            if (result->staging)
+                staging.Cancel(result->staging);
+        }
+    }
+
+    // Create a streamed texture for the image (GL thread), only the mip tail is loaded
+    unsigned int Load(const std::string& path)
+    {
+        Entry entry;
+        entry.source = path;
+        entry.path = ResolveTexturePath(path);
+        entry.generation = nextGeneration++;
+
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+
+        if (!ReadInfo(entry))
+        {
+            UploadPlaceholderTexture(textureID);
+            return textureID;
+        }
+
+        entry.tailLevel = entry.levelCount - 1;
+        while (entry.tailLevel > 0 && std::max(LevelWidth(entry, entry.tailLevel - 1), LevelHeight(entry, entry.tailLevel - 1)) <= tailSize)
+            entry.tailLevel--;
+
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexStorage2D(GL_TEXTURE_2D, entry.levelCount, entry.internalFormat, entry.width, entry.height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        // The compressed tail is a few KB, read it now so the texture is never blank
+        bool tailLoaded = false;
+        if (entry.compressed)
+        {
+            KTX2Texture tail;
+            if (ReadKTX2(entry.path, tail, entry.tailLevel, entry.levelCount - entry.tailLevel))
+            {
+                for (int level = entry.tailLevel; level < entry.levelCount; ++level)
+                    UploadLevel(entry, level, tail.levels[level].data(), tail.levels[level].size());
+                tailLoaded = true;
+            }
+        }
+
+        if (tailLoaded)
+        {
+            entry.residentLevel = entry.tailLevel;
+        }
+        else
+        {
+            // Images have to be decoded in full to build the tail: show white until the worker is done
+            std::vector<uint8_t> white(4, 255);
+            if (!entry.compressed)
+                UploadLevel(entry, entry.levelCount - 1, white.data(), white.size());
+
+            entry.residentLevel = entry.levelCount - 1;
+            Schedule(textureID, entry, entry.tailLevel, entry.levelCount - 1);
+        }
+
+        ApplyLevels(textureID, entry);
+
+        entries[textureID] = std::move(entry);
+        TrackResidency(textureID, entries[textureID]);
+        return textureID;
+    }
+
+    // Reload the image into its texture after the file changed, false if no streamed texture uses it
+    bool Reload(const std::string& path)
+    {
+        std::string key = TextureManager::CanonicalPath(path);
+        bool used = false;
+
+        for (auto& it : entries)
+        {
+            Entry& entry = it.second;
+            if (TextureManager::CanonicalPath(entry.source) != key && TextureManager::CanonicalPath(entry.path) != key)
+                continue;
+
+            // Storage is immutable, the new file must fit it
+            Entry updated;
+            updated.source = entry.source;
+            updated.path = ResolveTexturePath(entry.source);
+            if (!ReadInfo(updated))
+                continue;
+
+            if (updated.width != entry.width || updated.height != entry.height || updated.internalFormat != entry.internalFormat || updated.levelCount != entry.levelCount)
+            {
+                std::cerr << "Texture size or format changed, restart to reload it: " << path << std::endl;
+                continue;
+            }
+
+            entry.path = updated.path;
+            entry.generation = nextGeneration++;
+            entry.loading = false;
+            Schedule(it.first, entry, entry.residentLevel, entry.levelCount - 1);
+            used = true;
+        }
+
+        return used;
+    }
+
+    // Camera used to estimate texture demand for the next Request calls
+    void SetView(const Vec3& cameraPosition, float fovY, float viewportHeight)
+    {
+        viewPosition = cameraPosition;
+        pixelsPerUnitAtOne = viewportHeight / (2.0f * std::tan(fovY * 0.5f));
+    }
+
+    // Record the mip level needed by every queued submesh (call before Flush)
+    void Request(const RenderQueue& queue)
+    {
+        for (const DrawItem& item : queue.Items())
+            Request(item.submesh->material.texture, *item.mesh, item.model);
+    }
+
+    // Record the mip level the texture needs on this mesh
+    void Request(unsigned int texture, const Mesh& mesh, const Mat4& model)
+    {
+        auto it = entries.find(texture);
+        if (it == entries.end())
+            return;
+
+        Entry& entry = it->second;
+
+        // Largest axis scale and world position of the bounding sphere (row-vector matrices, translation in row 3)
+        float scale = 0.0f;
+        for (int row = 0; row < 3; ++row)
+            scale = std::max(scale, Vec3(model.data[row][0], model.data[row][1], model.data[row][2]).Magnitude());
+
+        const Vec3& c = mesh.boundsCenter;
+        Vec3 center(
+            c.x * model.data[0][0] + c.y * model.data[1][0] + c.z * model.data[2][0] + model.data[3][0],
+            c.x * model.data[0][1] + c.y * model.data[1][1] + c.z * model.data[2][1] + model.data[3][1],
+            c.x * model.data[0][2] + c.y * model.data[1][2] + c.z * model.data[2][2] + model.data[3][2]);
+
+        // Closest point of the mesh, the nearest part decides the sharpest level needed
+        float distance = std::max(center.Distance(viewPosition) - mesh.boundsRadius * scale, 0.1f);
+
+        float pixelsPerUnit = pixelsPerUnitAtOne / distance;
+        float texelsPerUnit = (scale > 0.0f) ? mesh.uvDensity / scale * std::max(entry.width, entry.height) : 0.0f;
+
+        int level = entry.tailLevel;
+        if (texelsPerUnit > 0.0f)
+            level = std::min(std::max((int)std::floor(std::log2(texelsPerUnit / pixelsPerUnit)), 0), entry.tailLevel);
+
+        if (entry.requestFrame != frame)
+        {
+            entry.requestFrame = frame;
+            entry.wantedLevel = level;
+        }
+        else
+        {
+            entry.wantedLevel = std::min(entry.wantedLevel, level);
+        }
+    }
+
+    // Upload finished levels, drop levels over budget and start loading the levels requested this frame (GL thread)
+    // Uploads stop once budgetMs has been spent
+    void Update(double budgetMs)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        // Staging regions whose uploads the GPU has finished can take new levels
+        staging.Retire();
+
+        std::unique_ptr<Result> result;
+        while (results.Pop(result))
+        {
+            inFlightBytes -= result->bytes;
+            bool uploaded = false;
+
+            // The texture may have been released or reloaded since (its name reused by another texture even)
+            auto it = entries.find(result->texture);
+            if (it != entries.end() && it->second.generation == result->generation)
+            {
+                Entry& entry = it->second;
+                entry.loading = false;
+
+                if (result->success)
+                {
+                    glBindTexture(GL_TEXTURE_2D, it->first);
+                    UploadResult(entry, *result);
+                    uploaded = true;
+
+                    // Blend in the finest new level over a few frames instead of popping (not needed for the tail or reloads)
+                    if (result->lastLevel < entry.residentLevel)
+                        entry.fade = 1.0f;
+
+                    entry.residentLevel = std::min(entry.residentLevel, result->firstLevel);
+
+                    ApplyLevels(it->first, entry);
+                    TrackResidency(it->first, entry);
+                }
+            }
+
+            // The pixel buffer is reused once the GPU has read it, or right away if nothing was uploaded
+            if (result->staging)
+            {
+                if (uploaded)
+                    staging.Submit(result->staging);
+                else
+                    staging.Cancel(result->staging);
+            }
+
+            result.reset();
+
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            if (elapsed >= budgetMs)
+                break;
+        }
+
+        for (auto& it : entries)
+        {
+            Entry& entry = it.second;
+            if (entry.fade > 0.0f)
+            {
+                entry.fade = std::max(entry.fade - 0.1f, 0.0f);
+                glBindTexture(GL_TEXTURE_2D, it.first);
+                glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, entry.fade);
+            }
+        }
+
+        Evict(budget, false);
+        Stream();
+
+        frame++;
+    }
+
+    // Mip data currently loaded, and the limit
+    size_t ResidentBytes() const
+    {
+        size_t bytes = 0;
+        for (const auto& it : entries)
+            bytes += ResidentBytes(it.second);
+        return bytes;
+    }
+
+    size_t Budget() const
+    {
+        return budget;
+    }
+
+    // Number of textures still loading levels
+    size_t Pending() const
+    {
+        size_t count = 0;
+        for (const auto& it : entries)
+            count += it.second.loading ? 1 : 0;
+        return count;
+    }
+
+private:
+
+    struct Entry
+    {
+        std::string source;             // Path given to Load
+        std::string path;               // File actually read (cooked KTX2 or the image)
+        bool compressed = false;
+        unsigned int internalFormat = 0;
+        uint32_t blockBytes = 0;
+        int width = 0;
+        int height = 0;
+        int levelCount = 1;
+        int tailLevel = 0;              // Levels from here on are always loaded
+        int residentLevel = 0;          // Finest level loaded (GL_TEXTURE_BASE_LEVEL)
+        int wantedLevel = 0;            // Finest level needed in the last frame it was drawn
+        uint64_t requestFrame = ~0ull;  // Last frame it was drawn
+        uint32_t generation = 0;        // Changes on reload, results of older loads are dropped
+        bool loading = false;
+        float fade = 0.0f;              // GL_TEXTURE_MIN_LOD while blending in new levels
+    };
+
+    struct Job
+    {
+        unsigned int texture = 0;
+        uint32_t generation = 0;
+        std::string path;
+        bool compressed = false;
+        int width = 0;
+        int height = 0;
+        int firstLevel = 0;
+        int lastLevel = 0;
+        size_t bytes = 0;
+    };
+
+    struct Result
+    {
+        unsigned int texture = 0;
+        uint32_t generation = 0;
+        bool success = false;
+        int firstLevel = 0;
+        int lastLevel = 0;
+        size_t bytes = 0;
+        StagingRing::Allocation staging;            // Levels back to back in the staging ring
+        std::vector<std::vector<uint8_t>> levels;   // Levels in client memory when they do not fit the ring
+    };
+
+    TextureManager& manager;
+    std::function<unsigned int(const std::string&)> previousLoader;
+    std::function<void(unsigned int)> previousReleased;
+    size_t budget;
+    int tailSize;
+
+    std::unordered_map<unsigned int, Entry> entries;
+    size_t inFlightBytes = 0;
+    uint64_t frame = 0;
+    uint32_t nextGeneration = 1;
+
+    Vec3 viewPosition;
+    float pixelsPerUnitAtOne = 1000.0f;
+
+    std::thread worker;
+    std::mutex jobMutex;
+    std::condition_variable jobAvailable;
+    std::deque<Job> jobs;
+    LockFreeQueue<std::unique_ptr<Result>> results;
+    StagingRing staging;
+    std::atomic<bool> stopping;
+
+    static const int MAX_IN_FLIGHT = 4;
+
+    void Release(unsigned int texture)
+    {
+        // A result still on its way will not find the entry and is dropped
+        entries.erase(texture);
+    }
+
+    // Size and format of the file, without loading pixels
+    static bool ReadInfo(Entry& entry)
+    {
+        if (std::filesystem::path(entry.path).extension() == ".ktx2")
+        {
+            KTX2Texture header;
+            if (!ReadKTX2(entry.path, header, 0, 0))
+                return false;
+
+            entry.compressed = true;
+            entry.internalFormat = KTX2GLFormat(header.vkFormat);
+            entry.blockBytes = ktx2::BlockSize(header.vkFormat);
+            entry.width = (int)header.width;
+            entry.height = (int)header.height;
+            entry.levelCount = (int)header.levels.size();
+            return true;
+        }
+
+        int channels;
+        if (!stbi_info(entry.path.c_str(), &entry.width, &entry.height, &channels))
+        {
+            std::cerr << "Failed to load texture: " << entry.path << std::endl;
+            return false;
+        }
+
+        entry.compressed = false;
+        entry.internalFormat = GL_RGBA8;
+        entry.levelCount = 1;
+        while (std::max(entry.width, entry.height) >> entry.levelCount)
+            entry.levelCount++;
+        return true;
+    }
+
+    static int LevelWidth(const Entry& entry, int level)
+    {
+        return std::max(entry.width >> level, 1);
+    }
+
+    static int LevelHeight(const Entry& entry, int level)
+    {
+        return std::max(entry.height >> level, 1);
+    }
+
+    static size_t LevelBytes(const Entry& entry, int level)
+    {
+        size_t width = LevelWidth(entry, level), height = LevelHeight(entry, level);
+        if (entry.compressed)
+            return ((width + 3) / 4) * ((height + 3) / 4) * entry.blockBytes;
+        return width * height * 4;
+    }
+
+    static size_t LevelRangeBytes(const Entry& entry, int firstLevel, int lastLevel)
+    {
+        size_t bytes = 0;
+        for (int level = firstLevel; level <= lastLevel; ++level)
+            bytes += LevelBytes(entry, level);
+        return bytes;
+    }
+
+    static size_t ResidentBytes(const Entry& entry)
+    {
+        return LevelRangeBytes(entry, entry.residentLevel, entry.levelCount - 1);
+    }
+
+    // Texture must be bound, data is an offset into the bound GL_PIXEL_UNPACK_BUFFER if there is one
+    static void UploadLevel(const Entry& entry, int level, const void* data, size_t size)
+    {
+        if (entry.compressed)
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, LevelWidth(entry, level), LevelHeight(entry, level), entry.internalFormat, (GLsizei)size, data);
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, LevelWidth(entry, level), LevelHeight(entry, level), GL_RGBA, GL_UNSIGNED_BYTE, data);
+    }
+
+    // Upload every level of a finished load, texture must be bound
+    void UploadResult(const Entry& entry, const Result& result)
+    {
+        if (!result.staging)
+        {
+            for (int level = result.firstLevel; level <= result.lastLevel; ++level)
+            {
+                const std::vector<uint8_t>& data = result.levels[level - result.firstLevel];
+                UploadLevel(entry, level, data.data(), data.size());
+            }
+            return;
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.Buffer());
+
+        size_t offset = result.staging.offset;
+        for (int level = result.firstLevel; level <= result.lastLevel; ++level)
+        {
+            size_t size = LevelBytes(entry, level);
+            UploadLevel(entry, level, (const void*)(uintptr_t)offset, size);
+            offset += size;
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // Report the loaded levels to the residency manager, not the whole storage: raising the base level is all it can do
+    void TrackResidency(unsigned int texture, const Entry& entry)
+    {
+        if (ResidencyManager* residency = ResidencyManager::Active())
+            residency->Track(RESIDENCY_STREAMED_TEXTURE, texture, ResidentBytes(entry), [this, texture]() { return DropLevel(texture); });
+    }
+
+    // Evict function of the residency manager: drop the finest level unless the view still needs it, returns the data still loaded
+    // The levels are streamed in again by demand, there is no restore function
+    size_t DropLevel(unsigned int texture)
+    {
+        auto it = entries.find(texture);
+        if (it == entries.end())
+            return 0;
+
+        Entry& entry = it->second;
+        if (entry.loading || entry.residentLevel >= entry.tailLevel || entry.residentLevel >= WantedLevel(entry))
+            return ResidentBytes(entry);
+
+        entry.residentLevel++;
+        entry.fade = 0.0f;
+        ApplyLevels(texture, entry);
+        return ResidentBytes(entry);
+    }
+
+    // Sample only the loaded levels
+    static void ApplyLevels(unsigned int texture, const Entry& entry)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.residentLevel);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, entry.fade);
+    }
+
+    // Wanted level of a texture, textures not drawn last frame only need their tail
+    int WantedLevel(const Entry& entry) const
+    {
+        return (entry.requestFrame == frame) ? entry.wantedLevel : entry.tailLevel;
+    }
+
+    // Drop finest levels until the loaded data fits the limit, returns the data still loaded
+    // Levels finer than needed go first, then textures unused for the longest time
+    size_t Evict(size_t limit, bool surplusOnly)
+    {
+        size_t resident = ResidentBytes() + inFlightBytes;
+
+        while (resident > limit)
+        {
+            Entry* victim = nullptr;
+            unsigned int victimID = 0;
+
+            for (auto& it : entries)
+            {
+                Entry& entry = it.second;
+                if (entry.loading || entry.residentLevel >= entry.tailLevel)
+                    continue;
+
+                if (surplusOnly && entry.residentLevel >= WantedLevel(entry))
+                    continue;
+
+                if (!victim)
+                {
+                    victim = &entry;
+                    victimID = it.first;
+                    continue;
+                }
+
+                bool surplus = entry.residentLevel < WantedLevel(entry);
+                bool victimSurplus = victim->residentLevel < WantedLevel(*victim);
+
+                // Never drawn (~0) wraps around to 0 and goes first
+                if (surplus != victimSurplus ? surplus : (entry.requestFrame + 1) < (victim->requestFrame + 1))
+                {
+                    victim = &entry;
+                    victimID = it.first;
+                }
+            }
+
+            if (!victim)
+                break;
+
+            resident -= LevelBytes(*victim, victim->residentLevel);
+            victim->residentLevel++;
+            victim->fade = 0.0f;
+            ApplyLevels(victimID, *victim);
+            TrackResidency(victimID, *victim);
+        }
+
+        return resident;
+    }
+
+    // Start loading the levels most needed, as far as the budget allows
+    void Stream()
+    {
+        std::vector<std::pair<int, unsigned int>> candidates;
+        int inFlight = 0;
+
+        for (auto& it : entries)
+        {
+            const Entry& entry = it.second;
+            if (entry.loading)
+            {
+                inFlight++;
+                continue;
+            }
+
+            int missing = entry.residentLevel - WantedLevel(entry);
+            if (missing > 0)
+                candidates.push_back({ missing, it.first });
+        }
+
+        // Textures furthest from what the screen needs first
+        std::sort(candidates.begin(), candidates.end(), [](const std::pair<int, unsigned int>& a, const std::pair<int, unsigned int>& b) { return a.first > b.first; });
+
+        size_t resident = ResidentBytes() + inFlightBytes;
+
+        for (const auto& candidate : candidates)
+        {
+            if (inFlight >= MAX_IN_FLIGHT)
+                break;
+
+            Entry& entry = entries[candidate.second];
+
+            // All missing levels if they fit, otherwise step one level finer
+            int firstLevel = WantedLevel(entry);
+            size_t bytes = LevelRangeBytes(entry, firstLevel, entry.residentLevel - 1);
+
+            // Make room by dropping levels other textures no longer need
+            if (resident + bytes > budget && bytes <= budget)
+                resident = Evict(budget - bytes, true);
+
+            if (resident + bytes > budget)
+            {
+                firstLevel = entry.residentLevel - 1;
+                bytes = LevelBytes(entry, firstLevel);
+                if (resident + bytes > budget)
+                    continue;
+            }
+
+            Schedule(candidate.second, entry, firstLevel, entry.residentLevel - 1);
+            resident += bytes;
+            inFlight++;
+        }
+    }
+
+    void Schedule(unsigned int texture, Entry& entry, int firstLevel, int lastLevel)
+    {
+        Job job;
+        job.texture = texture;
+        job.generation = entry.generation;
+        job.path = entry.path;
+        job.compressed = entry.compressed;
+        job.width = entry.width;
+        job.height = entry.height;
+        job.firstLevel = firstLevel;
+        job.lastLevel = lastLevel;
+        job.bytes = LevelRangeBytes(entry, firstLevel, lastLevel);
+
+        entry.loading = true;
+        inFlightBytes += job.bytes;
+
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            jobs.push_back(std::move(job));
+        }
+        jobAvailable.notify_one();
+    }
+
+    // Staging memory for all levels of the job, empty if the ring is too small for them (worker thread)
+    // Waits while the GPU is still reading earlier uploads
+    StagingRing::Allocation AllocateStaging(size_t bytes)
+    {
+        StagingRing::Allocation allocation;
+        if (!staging.Fits(bytes))
+            return allocation;
+
+        while (!stopping && !(allocation = staging.Allocate(bytes, std::chrono::milliseconds(50)))) {}
+        return allocation;
+    }
+
+    // Read the requested levels (worker thread)
+    void LoadLevels(const Job& job, Result& result)
+    {
+        if (job.compressed)
+        {
+            KTX2Texture header;
+            if (!ReadKTX2(job.path, header, 0, 0))
+                return;
+
+            if ((int)header.width != job.width || (int)header.height != job.height || (int)header.levels.size() <= job.lastLevel)
+                return;
+
+            // Read the file straight into the pixel buffer, levels must match the sizes the texture was created with
+            result.staging = AllocateStaging(job.bytes);
+            if (result.staging)
+            {
+                size_t offset = 0;
+                auto destination = [&](uint32_t, uint64_t length) -> uint8_t*
+                {
+                    if (offset + length > job.bytes)
+                        return nullptr;
+
+                    uint8_t* target = result.staging.pointer + offset;
+                    offset += (size_t)length;
+                    return target;
+                };
+
+                result.success = ReadKTX2(job.path, header, job.firstLevel, job.lastLevel - job.firstLevel + 1, destination) && offset == job.bytes;
+                return;
+            }
+
+            KTX2Texture texture;
+            if (!ReadKTX2(job.path, texture, job.firstLevel, job.lastLevel - job.firstLevel + 1))
+                return;
+
+            for (int level = job.firstLevel; level <= job.lastLevel; ++level)
+                result.levels.push_back(std::move(texture.levels[level]));
+
+            result.success = true;
+            return;
+        }
+
+        int width, height, channels;
+        unsigned char* pixels = stbi_load(job.path.c_str(), &width, &height, &channels, 4);
+        if (!pixels)
+        {
+            std::cerr << "Failed to load texture: " << job.path << std::endl;
+            return;
+        }
+
+        if (width != job.width || height != job.height)
+        {
+            stbi_image_free(pixels);
+            return;
+        }
+
+        // Mip levels are written straight into the pixel buffer when it has room
+        result.staging = AllocateStaging(job.bytes);
+        size_t offset = 0;
+
+        auto destination = [&](int, size_t bytes) -> uint8_t*
+        {
+            if (result.staging)
+            {
+                uint8_t* target = result.staging.pointer + offset;
+                offset += bytes;
+                return target;
+            }
+
+            result.levels.emplace_back(bytes);
+            return result.levels.back().data();
+        };
+
+        result.success = GenerateMips(pixels, width, height, job.firstLevel, job.lastLevel, MipOptions(), destination);
+        stbi_image_free(pixels);
+    }
+
+    void WorkerLoop()
+    {
+        for (;;)
+        {
+            Job job;
+
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+                if (stopping)
+                    return;
+
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            std::unique_ptr<Result> result(new Result());
+            result->texture = job.texture;
+            result->generation = job.generation;
+            result->firstLevel = job.firstLevel;
+            result->lastLevel = job.lastLevel;
+            result->bytes = job.bytes;
+
+            LoadLevels(job, *result);
+
+            while (!results.Push(std::move(result)))
+            {
+                if (stopping)
+                    return;
+
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+#endif
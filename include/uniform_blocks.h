@@ -0,0 +1,386 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <cmath>
+#include <glad/glad.h>
+#include <mat4.h>
+#include <vec3.h>
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Binding points of the uniform blocks declared in shaders/UniformBlocks.glsl
+enum UniformBlockBinding
+{
+    UNIFORM_BLOCK_FRAME,        // Camera, once per frame
+    UNIFORM_BLOCK_LIGHT,        // Light of the mesh being drawn
+    UNIFORM_BLOCK_MATERIAL,     // Material of the submesh being drawn
+    UNIFORM_BLOCK_CLUSTERS,     // Light cluster grid, once per frame (see LightClusters)
+    UNIFORM_BLOCK_SHADOWS,      // Sun and its shadow cascades, once per frame (see ShadowCascades)
+    UNIFORM_BLOCK_COUNT
+};
+
+// C++ mirrors of the std140 blocks, each field sits at the offset std140 gives the GLSL member
+// vec3 takes 16 bytes unless a scalar fills its last 4, mat4 is 16 floats (column major, as Mat4 stores them).
+// The static_asserts pin the layout here, BindUniformBlocks checks it against every linked program.
+
+// layout(std140) uniform FrameBlock
+struct FrameBlock
+{
+    static const UniformBlockBinding BINDING = UNIFORM_BLOCK_FRAME;
+
+    float projection[16];
+    float view[16];
+    float viewPos[3];
+    float padding0;
+};
+
+static_assert(offsetof(FrameBlock, projection) == 0, "FrameBlock.projection must match std140");
+static_assert(offsetof(FrameBlock, view) == 64, "FrameBlock.view must match std140");
+static_assert(offsetof(FrameBlock, viewPos) == 128, "FrameBlock.viewPos must match std140");
+static_assert(sizeof(FrameBlock) == 144, "FrameBlock size must match std140");
+
+// layout(std140) uniform LightBlock { Light light; }
+struct LightBlock
+{
+    static const UniformBlockBinding BINDING = UNIFORM_BLOCK_LIGHT;
+
+    float position[3];
+    int shadowIndex;            // Point shadow entry, -1 if unshadowed
+    float ambient[3];
+    float padding1;
+    float diffuse[3];
+    float padding2;
+    float specular[3];
+    float padding3;
+};
+
+static_assert(offsetof(LightBlock, position) == 0, "LightBlock.position must match std140");
+static_assert(offsetof(LightBlock, shadowIndex) == 12, "LightBlock.shadowIndex must match std140");
+static_assert(offsetof(LightBlock, ambient) == 16, "LightBlock.ambient must match std140");
+static_assert(offsetof(LightBlock, diffuse) == 32, "LightBlock.diffuse must match std140");
+static_assert(offsetof(LightBlock, specular) == 48, "LightBlock.specular must match std140");
+static_assert(sizeof(LightBlock) == 64, "LightBlock size must match std140");
+
+// layout(std140) uniform MaterialBlock { Material material; }, scalars fill the tail of each vec3
+struct MaterialBlock
+{
+    static const UniformBlockBinding BINDING = UNIFORM_BLOCK_MATERIAL;
+
+    float ambient[3];
+    float shininess;
+    float diffuse[3];
+    int layer;
+    float specular[3];
+    int virtualTexture;
+    float uvOffset[2];
+    float uvScale[2];
+    float virtualSize;
+    float padding0[3];
+};
+
+static_assert(offsetof(MaterialBlock, ambient) == 0, "MaterialBlock.ambient must match std140");
+static_assert(offsetof(MaterialBlock, shininess) == 12, "MaterialBlock.shininess must match std140");
+static_assert(offsetof(MaterialBlock, diffuse) == 16, "MaterialBlock.diffuse must match std140");
+static_assert(offsetof(MaterialBlock, layer) == 28, "MaterialBlock.layer must match std140");
+static_assert(offsetof(MaterialBlock, specular) == 32, "MaterialBlock.specular must match std140");
+static_assert(offsetof(MaterialBlock, virtualTexture) == 44, "MaterialBlock.virtualTexture must match std140");
+static_assert(offsetof(MaterialBlock, uvOffset) == 48, "MaterialBlock.uvOffset must match std140");
+static_assert(offsetof(MaterialBlock, uvScale) == 56, "MaterialBlock.uvScale must match std140");
+static_assert(offsetof(MaterialBlock, virtualSize) == 64, "MaterialBlock.virtualSize must match std140");
+static_assert(sizeof(MaterialBlock) == 80, "MaterialBlock size must match std140");
+
+// layout(std140) uniform ClusterBlock
+struct ClusterBlock
+{
+    static const UniformBlockBinding BINDING = UNIFORM_BLOCK_CLUSTERS;
+
+    unsigned int grid[4];       // Clusters along x, y and z, point lights in the scene
+    float depth[4];             // Near, far, slice scale and bias (slice = log(depth) * scale + bias)
+    float screen[4];            // Viewport size in pixels
+};
+
+static_assert(offsetof(ClusterBlock, grid) == 0, "ClusterBlock.grid must match std140");
+static_assert(offsetof(ClusterBlock, depth) == 16, "ClusterBlock.depth must match std140");
+static_assert(offsetof(ClusterBlock, screen) == 32, "ClusterBlock.screen must match std140");
+static_assert(sizeof(ClusterBlock) == 48, "ClusterBlock size must match std140");
+
+// Most cascades the ShadowBlock holds
+const int MAX_SHADOW_CASCADES = 4;
+
+// layout(std140) uniform ShadowBlock
+struct ShadowBlock
+{
+    static const UniformBlockBinding BINDING = UNIFORM_BLOCK_SHADOWS;
+
+    float cascadeMatrices[MAX_SHADOW_CASCADES][16];
+    float cascadeSplits[4];         // View depth where each cascade ends
+    float cascadeTexelSizes[4];     // World units per shadow map texel
+    float sunDirection[4];          // Direction the light travels
+    float sunColor[4];              // Intensity included
+    unsigned int cascadeCount;      // 0 without shadows
+    float shadowBias;               // In shadow map depth
+    float shadowTexelSize;          // 1 / resolution
+    float padding0;
+};
+
+static_assert(offsetof(ShadowBlock, cascadeMatrices) == 0, "ShadowBlock.cascadeMatrices must match std140");
+static_assert(offsetof(ShadowBlock, cascadeSplits) == 256, "ShadowBlock.cascadeSplits must match std140");
+static_assert(offsetof(ShadowBlock, cascadeTexelSizes) == 272, "ShadowBlock.cascadeTexelSizes must match std140");
+static_assert(offsetof(ShadowBlock, sunDirection) == 288, "ShadowBlock.sunDirection must match std140");
+static_assert(offsetof(ShadowBlock, sunColor) == 304, "ShadowBlock.sunColor must match std140");
+static_assert(offsetof(ShadowBlock, cascadeCount) == 320, "ShadowBlock.cascadeCount must match std140");
+static_assert(offsetof(ShadowBlock, shadowBias) == 324, "ShadowBlock.shadowBias must match std140");
+static_assert(offsetof(ShadowBlock, shadowTexelSize) == 328, "ShadowBlock.shadowTexelSize must match std140");
+static_assert(sizeof(ShadowBlock) == 336, "ShadowBlock size must match std140");
+
+// Member of a block as the GL names it, and where the C++ struct keeps it
+struct UniformBlockMember
+{
+    const char* name;
+    size_t offset;
+};
+
+// What a linked program's block is checked against
+struct UniformBlockLayout
+{
+    const char* name;
+    UniformBlockBinding binding;
+    size_t size;
+    std::vector<UniformBlockMember> members;
+};
+
+inline const std::vector<UniformBlockLayout>& UniformBlockLayouts()
+{
+    static const std::vector<UniformBlockLayout> layouts =
+    {
+        { "FrameBlock", UNIFORM_BLOCK_FRAME, sizeof(FrameBlock), {
+            { "projection", offsetof(FrameBlock, projection) },
+            { "view", offsetof(FrameBlock, view) },
+            { "viewPos", offsetof(FrameBlock, viewPos) } } },
+        { "LightBlock", UNIFORM_BLOCK_LIGHT, sizeof(LightBlock), {
+            { "light.position", offsetof(LightBlock, position) },
+            { "light.shadowIndex", offsetof(LightBlock, shadowIndex) },
+            { "light.ambient", offsetof(LightBlock, ambient) },
+            { "light.diffuse", offsetof(LightBlock, diffuse) },
+            { "light.specular", offsetof(LightBlock, specular) } } },
+        { "MaterialBlock", UNIFORM_BLOCK_MATERIAL, sizeof(MaterialBlock), {
+            { "material.ambient", offsetof(MaterialBlock, ambient) },
+            { "material.shininess", offsetof(MaterialBlock, shininess) },
+            { "material.diffuse", offsetof(MaterialBlock, diffuse) },
+            { "material.layer", offsetof(MaterialBlock, layer) },
+            { "material.specular", offsetof(MaterialBlock, specular) },
+            { "material.virtualTexture", offsetof(MaterialBlock, virtualTexture) },
+            { "material.uvOffset", offsetof(MaterialBlock, uvOffset) },
+            { "material.uvScale", offsetof(MaterialBlock, uvScale) },
+            { "material.virtualSize", offsetof(MaterialBlock, virtualSize) } } },
+        { "ClusterBlock", UNIFORM_BLOCK_CLUSTERS, sizeof(ClusterBlock), {
+            { "clusterGrid", offsetof(ClusterBlock, grid) },
+            { "clusterDepth", offsetof(ClusterBlock, depth) },
+            { "clusterScreen", offsetof(ClusterBlock, screen) } } },
+        { "ShadowBlock", UNIFORM_BLOCK_SHADOWS, sizeof(ShadowBlock), {
+            { "cascadeMatrices[0]", offsetof(ShadowBlock, cascadeMatrices) },
+            { "cascadeSplits", offsetof(ShadowBlock, cascadeSplits) },
+            { "cascadeTexelSizes", offsetof(ShadowBlock, cascadeTexelSizes) },
+            { "sunDirection", offsetof(ShadowBlock, sunDirection) },
+            { "sunColor", offsetof(ShadowBlock, sunColor) },
+            { "cascadeCount", offsetof(ShadowBlock, cascadeCount) },
+            { "shadowBias", offsetof(ShadowBlock, shadowBias) },
+            { "shadowTexelSize", offsetof(ShadowBlock, shadowTexelSize) } } },
+    };
+    return layouts;
+}
+
+// Texture unit of each sampler, samplers cannot live in uniform blocks (see Mesh::BindTexture)
+struct SamplerUnit
+{
+    const char* name;
+    int unit;
+};
+
+const SamplerUnit SAMPLER_UNITS[] =
+{
+    { "texture1", 0 },
+    { "textureArray", 1 },
+    { "pageTable", 2 },
+    { "pageCache", 3 },
+    { "gAlbedo", 4 },       // G-buffer of the deferred path, in GBufferTarget order from GBUFFER_TEXTURE_UNIT
+    { "gNormal", 5 },
+    { "gSpecular", 6 },
+    { "gAmbient", 7 },
+    { "gDepth", 8 },
+    { "shadowMap", 9 },     // Cascades of the sun, see ShadowCascades
+    { "pointShadowAtlas", 10 }, // Cube faces of the shadowed point lights, see PointShadows
+    { "postSource", 11 },   // Input of a post-process pass, see PostProcess
+    { "postBloom", 12 },
+};
+
+// Compare the block the driver laid out with the C++ struct, false (and the differences on cerr) if they disagree
+inline bool ValidateUniformBlock(unsigned int program, unsigned int blockIndex, const UniformBlockLayout& layout)
+{
+    bool valid = true;
+
+    // Drivers may or may not round the block up to a whole vec4, the C++ struct always is
+    int size = 0;
+    glGetActiveUniformBlockiv(program, blockIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+    if ((size_t)size > layout.size || layout.size - size >= 16)
+    {
+        std::cerr << "Uniform block " << layout.name << " is " << size << " bytes in the shader, " << layout.size << " in C++" << std::endl;
+        valid = false;
+    }
+
+    // std140 keeps every member active, so the counts must agree too
+    int memberCount = 0;
+    glGetActiveUniformBlockiv(program, blockIndex, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &memberCount);
+    if ((size_t)memberCount != layout.members.size())
+    {
+        std::cerr << "Uniform block " << layout.name << " has " << memberCount << " members in the shader, " << layout.members.size() << " in C++" << std::endl;
+        valid = false;
+    }
+
+    for (const UniformBlockMember& member : layout.members)
+    {
+        unsigned int index = GL_INVALID_INDEX;
+        glGetUniformIndices(program, 1, &member.name, &index);
+        if (index == GL_INVALID_INDEX)
+        {
+            std::cerr << "Uniform block " << layout.name << " has no member " << member.name << std::endl;
+            valid = false;
+            continue;
+        }
+
+        int offset = -1;
+        glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_OFFSET, &offset);
+        if ((size_t)offset != member.offset)
+        {
+            std::cerr << "Uniform " << member.name << " is at offset " << offset << " in the shader, " << member.offset << " in C++" << std::endl;
+            valid = false;
+        }
+    }
+
+    return valid;
+}
+
+// After linking: point the program's blocks at their binding points and its samplers at their units
+// Blocks are matched by name so the shaders need no layout(binding), this runs for every program, from source or from the binary cache
+// Returns false if a block does not match its C++ struct
+inline bool BindUniformBlocks(unsigned int program)
+{
+    bool valid = true;
+
+    for (const UniformBlockLayout& layout : UniformBlockLayouts())
+    {
+        unsigned int index = glGetUniformBlockIndex(program, layout.name);
+        if (index == GL_INVALID_INDEX)
+            continue;
+
+        glUniformBlockBinding(program, index, layout.binding);
+        valid &= ValidateUniformBlock(program, index, layout);
+    }
+
+    for (const SamplerUnit& sampler : SAMPLER_UNITS)
+    {
+        int location = glGetUniformLocation(program, sampler.name);
+        if (location >= 0)
+            glProgramUniform1i(program, location, sampler.unit);
+    }
+
+    return valid;
+}
+
+// One uniform buffer per block, bound to its binding point for the whole run
+// Upload copies a block in with a single glBufferSubData, and skips it when the contents did not change.
+class UniformBuffers
+{
+public:
+
+    UniformBuffers() : uploads(0)
+    {
+        const size_t sizes[UNIFORM_BLOCK_COUNT] = { sizeof(FrameBlock), sizeof(LightBlock), sizeof(MaterialBlock), sizeof(ClusterBlock), sizeof(ShadowBlock) };
+
+        // Zeroed, so a block nobody uploads reads as empty (e.g. no shadow cascades)
+        glGenBuffers(UNIFORM_BLOCK_COUNT, buffers);
+        for (int i = 0; i < UNIFORM_BLOCK_COUNT; ++i)
+        {
+            contents[i].assign(sizes[i], 0);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffers[i]);
+            glBufferData(GL_UNIFORM_BUFFER, sizes[i], contents[i].data(), GL_DYNAMIC_DRAW);
+            glBindBufferBase(GL_UNIFORM_BUFFER, i, buffers[i]);
+            valid[i] = false;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    ~UniformBuffers()
+    {
+        if (active == this)
+            active = nullptr;
+
+        glDeleteBuffers(UNIFORM_BLOCK_COUNT, buffers);
+    }
+
+    UniformBuffers(const UniformBuffers&) = delete;
+    UniformBuffers& operator=(const UniformBuffers&) = delete;
+
+    // Buffers that Mesh and RenderQueue upload their blocks to, null if none
+    static UniformBuffers* Active()
+    {
+        return active;
+    }
+
+    void MakeActive()
+    {
+        active = this;
+    }
+
+    template <typename Block>
+    void Upload(const Block& block)
+    {
+        std::vector<unsigned char>& previous = contents[Block::BINDING];
+        if (valid[Block::BINDING] && std::memcmp(previous.data(), &block, sizeof(Block)) == 0)
+            return;
+
+        std::memcpy(previous.data(), &block, sizeof(Block));
+        valid[Block::BINDING] = true;
+
+        glBindBuffer(GL_UNIFORM_BUFFER, buffers[Block::BINDING]);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        uploads++;
+    }
+
+    // Block uploads that changed the buffer, since the last ResetStats
+    size_t Uploads() const
+    {
+        return uploads;
+    }
+
+    void ResetStats()
+    {
+        uploads = 0;
+    }
+
+private:
+    static inline UniformBuffers* active = nullptr;
+
+    unsigned int buffers[UNIFORM_BLOCK_COUNT];
+    std::vector<unsigned char> contents[UNIFORM_BLOCK_COUNT];   // Last upload, to skip identical ones
+    bool valid[UNIFORM_BLOCK_COUNT];
+    size_t uploads;
+};
+
+// Camera block for the frame
+inline FrameBlock FrameUniforms(Mat4 projection, Mat4 view, const Vec3& viewPos)
+{
+    FrameBlock block = {};
+    std::memcpy(block.projection, projection.value_ptr(), sizeof(block.projection));
+    std::memcpy(block.view, view.value_ptr(), sizeof(block.view));
+    block.viewPos[0] = viewPos.x;
+    block.viewPos[1] = viewPos.y;
+    block.viewPos[2] = viewPos.z;
+    return block;
+}
+
+#endif
@@ -0,0 +1,765 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <glad/glad.h>
+#include <lockfree_queue.h>
+#include <mesh.h>
+#include <mip_generator.h>
+#include <staging_ring.h>
+#include <texture.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Page layout of virtual textures, the VT_ constants in FragmentShader.glsl and FeedbackFragment.glsl must match
+const int VT_PAGE_SIZE = 128;                               // Image texels per page side
+const int VT_PAGE_BORDER = 4;                               // Texels copied from the neighbouring pages, for filtering
+const int VT_TILE_SIZE = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER; // Page with its border, as stored on disk and in the cache
+const size_t VT_TILE_BYTES = (size_t)VT_TILE_SIZE * VT_TILE_SIZE * 4;
+
+namespace vt
+{
+    const uint32_t MAGIC = 0x54564D47;  // "MGVT"
+    const size_t HEADER_SIZE = 20;      // Magic, size, levels, page size, border
+    const int MAX_SIZE = VT_PAGE_SIZE * 256; // Page coordinates are 8 bit in the page table and feedback
+
+    // Tile file cooked for an image ("textures/a.jpg" -> "textures/a.vtex")
+    inline std::string TilePath(const std::string& path)
+    {
+        return std::filesystem::path(path).replace_extension(".vtex").generic_string();
+    }
+
+    inline int PagesPerSide(int size, int level)
+    {
+        return std::max((size >> level) / VT_PAGE_SIZE, 1);
+    }
+
+    // Pages are stored level by level (finest first), row by row
+    inline uint64_t TileOffset(int size, int level, int x, int y)
+    {
+        uint64_t tiles = 0;
+        for (int l = 0; l < level; ++l)
+            tiles += (uint64_t)PagesPerSide(size, l) * PagesPerSide(size, l);
+
+        tiles += (uint64_t)y * PagesPerSide(size, level) + x;
+        return HEADER_SIZE + tiles * VT_TILE_BYTES;
+    }
+
+    // Page table and feedback identify a page by texture, level and position
+    inline uint32_t PageKey(int texture, int level, int x, int y)
+    {
+        return ((uint32_t)texture << 24) | ((uint32_t)level << 16) | ((uint32_t)y << 8) | (uint32_t)x;
+    }
+
+    inline int KeyTexture(uint32_t key) { return (int)(key >> 24); }
+    inline int KeyLevel(uint32_t key) { return (int)((key >> 16) & 0xFF); }
+    inline int KeyY(uint32_t key) { return (int)((key >> 8) & 0xFF); }
+    inline int KeyX(uint32_t key) { return (int)(key & 0xFF); }
+}
+
+// Cut an image and its mip chain into the page tiles of a virtual texture (see vt::TilePath)
+// The image is resampled to the nearest square power-of-two size, pages wrap around the edges so the surface can tile.
+inline bool CookVirtualTexture(const std::string& path, const MipOptions& options = MipOptions())
+{
+    int width, height, channels;
+    unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+    if (!pixels)
+    {
+        std::cerr << "Failed to load texture: " << path << std::endl;
+        return false;
+    }
+
+    int largest = std::max(width, height);
+    int size = VT_PAGE_SIZE;
+    while (size < largest && size < vt::MAX_SIZE)
+        size *= 2;
+    if (size > VT_PAGE_SIZE && largest - size / 2 < size - largest)
+        size /= 2;
+
+    std::vector<uint8_t> square;
+    if (width == size && height == size)
+        square.assign(pixels, pixels + (size_t)size * size * 4);
+    else
+        square = ResizeImage(pixels, width, height, size, size, options);
+    stbi_image_free(pixels);
+
+    int levelCount = 1;
+    while (vt::PagesPerSide(size, levelCount - 1) > 1)
+        levelCount++;
+
+    std::vector<std::vector<uint8_t>> mips = GenerateMips(square.data(), size, size, 1, levelCount - 1, options);
+
+    std::string tilePath = vt::TilePath(path);
+    std::ofstream file(tilePath, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open file for writing: " << tilePath << std::endl;
+        return false;
+    }
+
+    const uint32_t header[5] = { vt::MAGIC, (uint32_t)size, (uint32_t)levelCount, (uint32_t)VT_PAGE_SIZE, (uint32_t)VT_PAGE_BORDER };
+    file.write((const char*)header, sizeof(header));
+
+    std::vector<uint8_t> tile(VT_TILE_BYTES);
+    for (int level = 0; level < levelCount; ++level)
+    {
+        const uint8_t* image = (level == 0) ? square.data() : mips[level - 1].data();
+        int levelSize = size >> level;
+        int pages = vt::PagesPerSide(size, level);
+
+        for (int y = 0; y < pages; ++y)
+        {
+            for (int x = 0; x < pages; ++x)
+            {
+                for (int ty = 0; ty < VT_TILE_SIZE; ++ty)
+                {
+                    int sy = ((y * VT_PAGE_SIZE + ty - VT_PAGE_BORDER) % levelSize + levelSize) % levelSize;
+                    for (int tx = 0; tx < VT_TILE_SIZE; ++tx)
+                    {
+                        int sx = ((x * VT_PAGE_SIZE + tx - VT_PAGE_BORDER) % levelSize + levelSize) % levelSize;
+                        std::memcpy(&tile[((size_t)ty * VT_TILE_SIZE + tx) * 4], &image[((size_t)sy * levelSize + sx) * 4], 4);
+                    }
+                }
+
+                file.write((const char*)tile.data(), tile.size());
+            }
+        }
+    }
+
+    std::cout << path << " -> " << tilePath << ": " << size << "x" << size << ", " << levelCount << " levels" << std::endl;
+    return (bool)file;
+}
+
+// Virtual texturing: huge textures are split into pages and only the pages visible on screen are kept in memory
+// Every virtual texture has a page table (one texel per page and level) pointing into a shared physical page cache.
+// A low resolution feedback pass writes the page each pixel needs; it is read back asynchronously, missing pages are
+// read from the tile file on a worker thread and replace the least recently used pages of the cache.
+// Pages not loaded yet fall back to the closest loaded coarser page, the coarsest page of every texture stays loaded.
+class VirtualTextureSystem
+{
+public:
+
+    // cacheSize: pages per side of the physical cache, feedbackScale: the feedback pass renders at viewport size / feedbackScale
+    VirtualTextureSystem(int cacheSize = 16, int feedbackScale = 8)
+        : cacheSize(cacheSize), feedbackScale(feedbackScale), staging(4 * 1024 * 1024), results(64), stopping(false)
+    {
+        glGenTextures(1, &cacheTexture);
+        glBindTexture(GL_TEXTURE_2D, cacheTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, cacheSize * VT_TILE_SIZE, cacheSize * VT_TILE_SIZE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        slots.resize((size_t)cacheSize * cacheSize);
+
+        worker = std::thread(&VirtualTextureSystem::WorkerLoop, this);
+    }
+
+    ~VirtualTextureSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        worker.join();
+
+        std::unique_ptr<TileResult> result;
+        while (results.Pop(result))
+            staging.Cancel(result->staging);
+
+        for (Readback& readback : readbacks)
+        {
+            if (readback.fence)
+                glDeleteSync(readback.fence);
+            glDeleteBuffers(1, &readback.buffer);
+        }
+
+        for (VirtualTexture& texture : textures)
+            glDeleteTextures(1, &texture.pageTable);
+
+        glDeleteTextures(1, &cacheTexture);
+        glDeleteTextures(1, &feedbackTexture);
+        glDeleteRenderbuffers(1, &feedbackDepth);
+        glDeleteFramebuffers(1, &feedbackFramebuffer);
+    }
+
+    // Open the virtual texture of an image (its tile file is cooked first if missing or outdated), returns its index or -1
+    int Load(const std::string& path)
+    {
+        if (textures.size() >= 255)
+        {
+            std::cerr << "Too many virtual textures: " << path << std::endl;
+            return -1;
+        }
+
+        std::string tilePath = vt::TilePath(path);
+
+        std::error_code error;
+        auto tileTime = std::filesystem::last_write_time(tilePath, error);
+        bool outdated = error || std::filesystem::last_write_time(path, error) > tileTime;
+        if (outdated && !CookVirtualTexture(path))
+            return -1;
+
+        uint32_t header[5];
+        std::ifstream file(tilePath, std::ios::binary);
+        if (!file.read((char*)header, sizeof(header)) || header[0] != vt::MAGIC || header[3] != VT_PAGE_SIZE || header[4] != VT_PAGE_BORDER)
+        {
+            std::cerr << "Not a virtual texture tile file: " << tilePath << std::endl;
+            return -1;
+        }
+
+        VirtualTexture texture;
+        texture.path = tilePath;
+        texture.size = (int)header[1];
+        texture.levels = (int)header[2];
+
+        int pages = vt::PagesPerSide(texture.size, 0);
+
+        glGenTextures(1, &texture.pageTable);
+        glBindTexture(GL_TEXTURE_2D, texture.pageTable);
+        glTexStorage2D(GL_TEXTURE_2D, texture.levels, GL_RGBA8UI, pages, pages);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levels - 1);
+
+        for (int level = 0; level < texture.levels; ++level)
+        {
+            int levelPages = vt::PagesPerSide(texture.size, level);
+            texture.entries.emplace_back((size_t)levelPages * levelPages * 4, 0);
+            texture.dirty.push_back(true);
+        }
+
+        int index = (int)textures.size();
+        textures.push_back(std::move(texture));
+
+        // The coarsest page covers the whole texture and is the fallback for every other page, load it now
+        VirtualTexture& added = textures.back();
+        int root = added.levels - 1;
+
+        std::vector<uint8_t> tile(VT_TILE_BYTES);
+        file.seekg((std::streamoff)vt::TileOffset(added.size, root, 0, 0));
+        if (!file.read((char*)tile.data(), tile.size()))
+        {
+            std::cerr << "Truncated virtual texture tile file: " << tilePath << std::endl;
+        }
+        else
+        {
+            int slot = FindSlot();
+            if (slot >= 0)
+            {
+                slots[slot].pinned = true;
+                MapPage(vt::PageKey(index, root, 0, 0), slot, tile.data());
+            }
+        }
+
+        UploadPageTables();
+        return index;
+    }
+
+    // Point the material at a virtual texture
+    bool Apply(Material& material, int index) const
+    {
+        if (index < 0 || index >= (int)textures.size())
+            return false;
+
+        material.texture = textures[index].pageTable;
+        material.virtualTexture = index;
+        material.virtualSize = (float)textures[index].size;
+        material.layer = -1;
+        material.uvOffset = Vec2(0.0f, 0.0f);
+        material.uvScale = Vec2(1.0f, 1.0f);
+        return true;
+    }
+
+    // Render target for the feedback pass, draw the scene with the feedback program afterwards and call EndFeedback
+    // Returns false if every readback buffer is still in use (skip the pass this frame)
+    bool BeginFeedback(unsigned int feedbackProgram)
+    {
+        Readback& readback = readbacks[nextReadback];
+        if (readback.fence)
+            return false;
+
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+
+        int width = std::max(savedViewport[2] / feedbackScale, 1);
+        int height = std::max(savedViewport[3] / feedbackScale, 1);
+        if (width != feedbackWidth || height != feedbackHeight)
+            CreateFeedbackTarget(width, height);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glViewport(0, 0, feedbackWidth, feedbackHeight);
+
+        const GLuint none[4] = { 0, 0, 0, 0 };
+        glClearBufferuiv(GL_COLOR, 0, none);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        // Derivatives are feedbackScale times larger than on screen
+        glUseProgram(feedbackProgram);
+        glUniform1f(glGetUniformLocation(feedbackProgram, "feedbackBias"), -std::log2((float)feedbackScale));
+
+        return true;
+    }
+
+    // Start the asynchronous readback of the feedback pass and restore the screen framebuffer
+    void EndFeedback()
+    {
+        Readback& readback = readbacks[nextReadback];
+        nextReadback = (nextReadback + 1) % READBACK_COUNT;
+
+        size_t bytes = (size_t)feedbackWidth * feedbackHeight * 4;
+
+        if (!readback.buffer)
+            glGenBuffers(1, &readback.buffer);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        if (readback.bytes != bytes)
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+            readback.bytes = bytes;
+        }
+
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+    }
+
+    // Bind the physical page cache for drawing (texture unit 3)
+    void Bind() const
+    {
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, cacheTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // Read finished feedback, upload loaded pages, and request the missing ones (GL thread)
+    // Page uploads stop once budgetMs has been spent
+    void Update(double budgetMs)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        frame++;
+        staging.Retire();
+        ReadFeedback();
+
+        // Pages visible in the latest feedback are not evicted this frame
+        for (uint32_t key : requested)
+        {
+            auto it = resident.find(key);
+            if (it != resident.end())
+                slots[it->second].lastUsed = frame;
+        }
+
+        std::unique_ptr<TileResult> result;
+        while (results.Pop(result))
+        {
+            pending.erase(result->key);
+
+            int slot = -1;
+            if (result->success && vt::KeyTexture(result->key) < (int)textures.size() && !resident.count(result->key))
+                slot = FindSlot();
+
+            // Cache full of pages visible this frame: drop the page, feedback asks for it again
+            if (slot < 0)
+            {
+                staging.Cancel(result->staging);
+                continue;
+            }
+
+            MapPage(result->key, slot, (const void*)(uintptr_t)result->staging.offset, true);
+            staging.Submit(result->staging);
+
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            if (elapsed >= budgetMs)
+                break;
+        }
+
+        RequestPages();
+        UploadPageTables();
+    }
+
+    // Number of virtual textures loaded
+    size_t Count() const
+    {
+        return textures.size();
+    }
+
+    // Pages in the physical cache, and pages being read
+    size_t ResidentPages() const
+    {
+        return resident.size();
+    }
+
+    size_t PendingPages() const
+    {
+        return pending.size();
+    }
+
+private:
+
+    struct VirtualTexture
+    {
+        std::string path;                           // Tile file
+        int size = 0;                               // Texels per side at level 0
+        int levels = 0;
+        unsigned int pageTable = 0;
+        std::vector<std::vector<uint8_t>> entries;  // Page table levels: cache x, cache y, mapped level, valid
+        std::vector<bool> dirty;
+    };
+
+    struct Slot
+    {
+        uint32_t key = 0;
+        bool used = false;
+        bool pinned = false;
+        uint64_t lastUsed = 0;
+    };
+
+    struct Readback
+    {
+        unsigned int buffer = 0;
+        size_t bytes = 0;
+        GLsync fence = nullptr;
+    };
+
+    struct TileJob
+    {
+        uint32_t key = 0;
+        std::string path;
+        uint64_t offset = 0;
+    };
+
+    struct TileResult
+    {
+        uint32_t key = 0;
+        bool success = false;
+        StagingRing::Allocation staging;
+    };
+
+    static const int READBACK_COUNT = 3;
+    static const int MAX_PENDING = 32;
+
+    int cacheSize;
+    int feedbackScale;
+    unsigned int cacheTexture = 0;
+
+    std::vector<VirtualTexture> textures;
+    std::vector<Slot> slots;
+    std::unordered_map<uint32_t, int> resident;     // Page key -> cache slot
+    std::unordered_set<uint32_t> pending;           // Pages being read
+    std::unordered_set<uint32_t> requested;         // Pages seen in the last feedback
+    uint64_t frame = 0;
+
+    unsigned int feedbackFramebuffer = 0;
+    unsigned int feedbackTexture = 0;
+    unsigned int feedbackDepth = 0;
+    int feedbackWidth = 0;
+    int feedbackHeight = 0;
+    int savedViewport[4] = { 0, 0, 0, 0 };
+    Readback readbacks[READBACK_COUNT];
+    int nextReadback = 0;
+
+    StagingRing staging;
+    std::thread worker;
+    std::mutex jobMutex;
+    std::condition_variable jobAvailable;
+    std::deque<TileJob> jobs;
+    LockFreeQueue<std::unique_ptr<TileResult>> results;
+    std::atomic<bool> stopping;
+
+    void CreateFeedbackTarget(int width, int height)
+    {
+        if (!feedbackFramebuffer)
+        {
+            glGenFramebuffers(1, &feedbackFramebuffer);
+            glGenRenderbuffers(1, &feedbackDepth);
+        }
+
+        if (feedbackTexture)
+            glDeleteTextures(1, &feedbackTexture);
+
+        glGenTextures(1, &feedbackTexture);
+        glBindTexture(GL_TEXTURE_2D, feedbackTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "Virtual texture feedback framebuffer is incomplete" << std::endl;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        feedbackWidth = width;
+        feedbackHeight = height;
+    }
+
+    // Collect the pages of every finished readback, with their coarser ancestors as fallbacks
+    void ReadFeedback()
+    {
+        for (Readback& readback : readbacks)
+        {
+            if (!readback.fence)
+                continue;
+
+            GLenum status = glClientWaitSync(readback.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                continue;
+
+            glDeleteSync(readback.fence);
+            readback.fence = nullptr;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            const uint8_t* pixels = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.bytes, GL_MAP_READ_BIT);
+            if (pixels)
+            {
+                requested.clear();
+
+                uint32_t previous = ~0u;
+                for (size_t i = 0; i < readback.bytes; i += 4)
+                {
+                    if (pixels[i + 3] == 0)
+                        continue;
+
+                    uint32_t key = vt::PageKey(pixels[i + 3] - 1, pixels[i + 2], pixels[i], pixels[i + 1]);
+                    if (key == previous)
+                        continue;
+                    previous = key;
+
+                    int texture = vt::KeyTexture(key);
+                    if (texture >= (int)textures.size())
+                        continue;
+
+                    for (int level = vt::KeyLevel(key), x = vt::KeyX(key), y = vt::KeyY(key); level < textures[texture].levels; ++level, x /= 2, y /= 2)
+                    {
+                        if (!requested.insert(vt::PageKey(texture, level, x, y)).second)
+                            break;
+                    }
+                }
+
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+    }
+
+    // Start reading the visible pages missing from the cache, coarsest first
+    void RequestPages()
+    {
+        std::vector<uint32_t> missing;
+        for (uint32_t key : requested)
+        {
+            if (!resident.count(key) && !pending.count(key))
+                missing.push_back(key);
+        }
+
+        std::sort(missing.begin(), missing.end(), [](uint32_t a, uint32_t b) { return vt::KeyLevel(a) > vt::KeyLevel(b); });
+
+        for (uint32_t key : missing)
+        {
+            if (pending.size() >= MAX_PENDING)
+                break;
+
+            const VirtualTexture& texture = textures[vt::KeyTexture(key)];
+
+            TileJob job;
+            job.key = key;
+            job.path = texture.path;
+            job.offset = vt::TileOffset(texture.size, vt::KeyLevel(key), vt::KeyX(key), vt::KeyY(key));
+
+            pending.insert(key);
+
+            {
+                std::lock_guard<std::mutex> lock(jobMutex);
+                jobs.push_back(std::move(job));
+            }
+            jobAvailable.notify_one();
+        }
+    }
+
+    // Free cache slot, or the least recently used one not needed this frame (its page is unmapped), -1 if none
+    int FindSlot()
+    {
+        int best = -1;
+        for (int i = 0; i < (int)slots.size(); ++i)
+        {
+            if (!slots[i].used)
+                return i;
+
+            if (slots[i].pinned || slots[i].lastUsed >= frame)
+                continue;
+
+            if (best < 0 || slots[i].lastUsed < slots[best].lastUsed)
+                best = i;
+        }
+
+        if (best >= 0)
+        {
+            uint32_t key = slots[best].key;
+            resident.erase(key);
+            slots[best].used = false;
+            RefreshEntries(vt::KeyTexture(key), vt::KeyLevel(key), vt::KeyX(key), vt::KeyY(key));
+        }
+
+        return best;
+    }
+
+    // Upload a page into a cache slot and point the page table at it, data is an offset into the staging ring if fromStaging
+    void MapPage(uint32_t key, int slot, const void* data, bool fromStaging = false)
+    {
+        if (fromStaging)
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.Buffer());
+
+        glBindTexture(GL_TEXTURE_2D, cacheTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cacheSize) * VT_TILE_SIZE, (slot / cacheSize) * VT_TILE_SIZE, VT_TILE_SIZE, VT_TILE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, data);
+
+        if (fromStaging)
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        slots[slot].key = key;
+        slots[slot].used = true;
+        slots[slot].lastUsed = frame;
+        resident[key] = slot;
+
+        RefreshEntries(vt::KeyTexture(key), vt::KeyLevel(key), vt::KeyX(key), vt::KeyY(key));
+    }
+
+    // Recompute the page table entries of a page and the finer pages under it
+    // A page not in the cache uses the entry of its parent, so it samples the closest loaded coarser page
+    void RefreshEntries(int index, int level, int x, int y)
+    {
+        VirtualTexture& texture = textures[index];
+        int pages = vt::PagesPerSide(texture.size, level);
+        uint8_t* entry = &texture.entries[level][((size_t)y * pages + x) * 4];
+
+        auto it = resident.find(vt::PageKey(index, level, x, y));
+        if (it != resident.end())
+        {
+            entry[0] = (uint8_t)(it->second % cacheSize);
+            entry[1] = (uint8_t)(it->second / cacheSize);
+            entry[2] = (uint8_t)level;
+            entry[3] = 255;
+        }
+        else if (level + 1 < texture.levels)
+        {
+            int parentPages = vt::PagesPerSide(texture.size, level + 1);
+            std::memcpy(entry, &texture.entries[level + 1][((size_t)(y / 2) * parentPages + x / 2) * 4], 4);
+        }
+        else
+        {
+            std::memset(entry, 0, 4);
+        }
+
+        texture.dirty[level] = true;
+
+        if (level == 0)
+            return;
+
+        int childPages = vt::PagesPerSide(texture.size, level - 1);
+        for (int cy = y * 2; cy < std::min(y * 2 + 2, childPages); ++cy)
+        {
+            for (int cx = x * 2; cx < std::min(x * 2 + 2, childPages); ++cx)
+            {
+                // Children with their own page keep it
+                if (!resident.count(vt::PageKey(index, level - 1, cx, cy)))
+                    RefreshEntries(index, level - 1, cx, cy);
+            }
+        }
+    }
+
+    void UploadPageTables()
+    {
+        for (VirtualTexture& texture : textures)
+        {
+            for (int level = 0; level < texture.levels; ++level)
+            {
+                if (!texture.dirty[level])
+                    continue;
+
+                int pages = vt::PagesPerSide(texture.size, level);
+                glBindTexture(GL_TEXTURE_2D, texture.pageTable);
+                glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, pages, pages, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, texture.entries[level].data());
+                texture.dirty[level] = false;
+            }
+        }
+    }
+
+    // Read tiles into the staging ring (worker thread)
+    void WorkerLoop()
+    {
+        std::unordered_map<std::string, std::ifstream> files;
+
+        for (;;)
+        {
+            TileJob job;
+
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+                if (stopping)
+                    return;
+
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            std::unique_ptr<TileResult> result(new TileResult());
+            result->key = job.key;
+
+            while (!stopping && !(result->staging = staging.Allocate(VT_TILE_BYTES, std::chrono::milliseconds(50)))) {}
+            if (!result->staging)
+                return;
+
+            std::ifstream& file = files[job.path];
+            if (!file.is_open())
+                file.open(job.path, std::ios::binary);
+
+            file.clear();
+            file.seekg((std::streamoff)job.offset);
+            result->success = (bool)file.read((char*)result->staging.pointer, VT_TILE_BYTES);
+
+            if (!result->success)
+                std::cerr << "Failed to read virtual texture page from " << job.path << std::endl;
+
+            while (!results.Push(std::move(result)))
+            {
+                if (stopping)
+                    return;
+
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+#endif
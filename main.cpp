@@ -1,6 +1,32 @@
 #define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#undef STB_IMAGE_IMPLEMENTATION
 
 #include <mesh.h>
+#include <shader.h>
+#include <shader_compiler.h>
+#include <shader_variants.h>
+#include <texture.h>
+#include <material.h>
+#include <objloader.h>
+#include <asset_loader.h>
+#include <hot_reload.h>
+#include <importer.h>
+#include <render_queue.h>
+#include <texture_cooker.h>
+#include <texture_streamer.h>
+#include <texture_array.h>
+#include <virtual_texture.h>
+#include <gpu_residency.h>
+#include <uniform_blocks.h>
+#include <light_clusters.h>
+#include <deferred_renderer.h>
+#include <shadow_cascades.h>
+#include <point_shadows.h>
+#include <depth_prepass.h>
+#include <post_process.h>
+#include <render_graph.h>
+#include <gpu_timer.h>
 #include <camera.h>
 #include <mat4.h>
 #include <vec3.h>
@@ -9,9 +35,14 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <sstream>
-#include <stb_image.h>
 
 float resolutionX = 1920;
 float resolutionY = 1080;
@@ -113,269 +144,300 @@ void static MouseInput(GLFWwindow* window, double posX, double posY)
     }
 }
 
-// Shader
-std::string static ReadShaderSource(const std::string& filename) 
+// Average cache miss ratio (misses per triangle) for a FIFO post-transform vertex cache
+float static ComputeACMR(const std::vector<unsigned int>& indices, size_t cacheSize = 32)
 {
-    std::ifstream file(filename);
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    return buffer.str();
+    if (indices.size() < 3)
+        return 0.0f;
+
+    std::deque<unsigned int> cache;
+    size_t misses = 0;
+
+    for (unsigned int index : indices)
+    {
+        if (std::find(cache.begin(), cache.end(), index) != cache.end())
+            continue;
+
+        misses++;
+        cache.push_back(index);
+
+        if (cache.size() > cacheSize)
+            cache.pop_front();
+    }
+
+    return (float)misses / (indices.size() / 3);
 }
 
-unsigned int static CompileShader(unsigned int shaderType, const std::string& shaderSource) 
+// Compare import time and mesh quality of loadOBJ and the Assimp importer
+// Without MG3D_WITH_ASSIMP only loadOBJ is timed, the output says no comparison was made
+void static BenchmarkImport(const char* filename, int iterations = 20)
 {
-    unsigned int shader = glCreateShader(shaderType);
-    const char* src = shaderSource.c_str();
-    glShaderSource(shader, 1, &src, nullptr);
-    glCompileShader(shader);
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<MeshData> meshes;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        vertices.clear();
+        indices.clear();
+        loadOBJ(filename, vertices, indices);
+    }
+    double objTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
 
-	// Check for compilation errors
-    int success;
-    char infoLog[512];
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    std::cout << filename << std::endl;
+    std::cout << "  loadOBJ: " << objTime << " ms, " << vertices.size() << " vertices, " << indices.size() / 3 << " triangles, ACMR " << ComputeACMR(indices) << std::endl;
 
-    if (!success) 
+    if (!ModelImporter::Available())
     {
-        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
-        std::cerr << "ERROR::SHADER::COMPILATION_FAILED\n" << infoLog << std::endl;
+        std::cout << "  Assimp:  not run, built without MG3D_WITH_ASSIMP (no comparison made)" << std::endl;
+        return;
     }
-    return shader;
-}
 
-unsigned int static CreateShaderProgram(const std::string& vertexShaderPath, const std::string& fragmentShaderPath) 
-{
-    // Read shader sources
-    std::string vertexShaderSource = ReadShaderSource(vertexShaderPath);
-    std::string fragmentShaderSource = ReadShaderSource(fragmentShaderPath);
-
-    // Compile shaders
-    unsigned int vertexShader = CompileShader(GL_VERTEX_SHADER, vertexShaderSource);
-    unsigned int fragmentShader = CompileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
-
-    // Create shader program
-    unsigned int shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-
-    // Check for linking errors
-    int success;
-    char infoLog[512];
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-
-    if (!success) 
+    ModelImporter importer;
+    bool imported = true;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations && imported; ++i)
     {
-        glGetProgramInfoLog(shaderProgram, 512, nullptr, infoLog);
-        std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        meshes.clear();
+        imported = importer.Load(filename, meshes);
     }
+    double assimpTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
 
-    // Clean up shaders (no longer needed once linked)
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    if (!imported)
+    {
+        std::cout << "  Assimp:  import failed (no comparison made)" << std::endl;
+        return;
+    }
 
-    return shaderProgram;
+    size_t importedVertices = 0, importedTriangles = 0;
+    float acmr = 0.0f;
+    for (const MeshData& mesh : meshes)
+    {
+        importedVertices += mesh.vertices.size();
+        importedTriangles += mesh.indices.size() / 3;
+        acmr += ComputeACMR(mesh.indices) * (mesh.indices.size() / 3);
+    }
+    acmr = (importedTriangles > 0) ? acmr / importedTriangles : 0.0f;
 
+    std::cout << "  Assimp:  " << assimpTime << " ms, " << importedVertices << " vertices, " << importedTriangles << " triangles, ACMR " << acmr << ", " << meshes.size() << " meshes" << std::endl;
 }
 
-// Texture
-unsigned int static LoadTexture(const char* path) 
+// Forward against deferred shading on a dense scene: layers of wall quads drawn back to front, so every layer is shaded
+// in the forward path, lit by the scene point lights. GPU time per frame is measured with timer queries.
+void static BenchmarkLighting(int layers, const Material& material, ShaderVariants& forwardVariants, DeferredRenderer& deferred,
+    LightClusters& lightClusters, UniformBuffers& uniformBuffers, int frames = 100)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    std::vector<Vertex> quadVertices = {
+        {Vec3(-20.0f, 0.0f, 0.0f), Vec3(0.0f, 0.0f, 1.0f), Vec2(0.0f, 0.0f)},
+        {Vec3(20.0f, 0.0f, 0.0f), Vec3(0.0f, 0.0f, 1.0f), Vec2(10.0f, 0.0f)},
+        {Vec3(20.0f, 4.0f, 0.0f), Vec3(0.0f, 0.0f, 1.0f), Vec2(10.0f, 1.0f)},
+        {Vec3(-20.0f, 4.0f, 0.0f), Vec3(0.0f, 0.0f, 1.0f), Vec2(0.0f, 1.0f)}
+    };
+    std::vector<unsigned int> quadIndices = { 0, 1, 2, 0, 2, 3 };
+    Mesh quad(quadVertices, quadIndices, std::vector<SubMesh>{ { 0, 6, INVALID_MATERIAL, material } }, light);
 
-    // Load image
-    int width, height, nrChannels;
-    unsigned char* data = stbi_load(path, &width, &height, &nrChannels, 0);
+    Mat4 view = Mat4().LookAt(Vec3(0.0f, 2.0f, 22.0f), Vec3(0.0f, 1.5f, 0.0f), Vec3(0.0f, 1.0f, 0.0f));
+    Mat4 projection = Mat4().Perspective(degreeToRadians(45.0f), (float)1920 / 1080, 0.1f, 100.0f);
 
-	// Check if image was loaded successfully
-    if (data) 
-    {
-		// Bind the texture
-        glBindTexture(GL_TEXTURE_2D, textureID);
+    uniformBuffers.Upload(FrameUniforms(projection, view, Vec3(0.0f, 2.0f, 22.0f)));
+    uniformBuffers.Upload(LightUniforms(light));
 
-        // Set texture parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);  // Horizontal wrapping
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);  // Vertical wrapping
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Clusters are picked from gl_FragCoord, so they need the size actually drawn to
+    int framebufferWidth = 0, framebufferHeight = 0;
+    glfwGetFramebufferSize(glfwGetCurrentContext(), &framebufferWidth, &framebufferHeight);
+    lightClusters.Update(view, (float)std::max(framebufferWidth, 1), (float)std::max(framebufferHeight, 1));
 
-        // Load the texture to OpenGL
-        if (nrChannels == 3)
-        {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        } 
-        else if (nrChannels == 4)
-        {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        }
+    // Build every program before timing
+    forwardVariants.Precompile({ MaterialFeatures(material) });
+    deferred.geometryVariants.Precompile({ MaterialFeatures(material) });
 
-		// Generate mipmaps
-        glGenerateMipmap(GL_TEXTURE_2D);
+    unsigned int query;
+    glGenQueries(1, &query);
 
-        stbi_image_free(data); // Free the image memory
-    }
-	else // Failed to load texture
+    RenderQueue queue;
+    double times[2] = { 0.0, 0.0 };
+
+    for (int path = 0; path < 2; ++path)
     {
-        std::cerr << "Failed to load texture: " << path << std::endl;
-        stbi_image_free(data);
+        for (int frame = -10; frame < frames; ++frame)
+        {
+            // Farthest layer first
+            for (int i = 0; i < layers; ++i)
+                queue.Submit(quad, Mat4().Translate(0.0f, 0.0f, -18.0f + 36.0f * i / std::max(layers - 1, 1)));
+
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            if (path == 0)
+            {
+                queue.Flush(forwardVariants);
+            }
+            else
+            {
+                deferred.GeometryPass(queue);
+                deferred.LightingPass(projection, view);
+            }
+
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+            // The first frames warm the driver up
+            if (frame >= 0)
+                times[path] += elapsed / 1.0e6;
+        }
     }
 
-    return textureID;
+    glDeleteQueries(1, &query);
+
+    std::cout << "Lighting benchmark: " << layers << " layers, " << lightClusters.lights.size() << " point lights, "
+        << lightClusters.AssignedCount() << " cluster references" << std::endl;
+    std::cout << "  Forward:  " << times[0] / frames << " ms" << std::endl;
+    std::cout << "  Deferred: " << times[1] / frames << " ms" << std::endl;
 }
 
-// Load OBJ file
-bool static loadOBJ(const char* filename, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+// Compress every image in the directory to KTX2, LoadTexture picks the cooked files up from then on
+void static CookTextures(const char* directory, BCFormat format, BCQuality quality, const MipOptions& mipOptions)
 {
-    // Open the OBJ file
-    std::ifstream file(filename);
-
-	// Check if the file was opened successfully
-    if (!file.is_open()) 
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
     {
-        std::cerr << "Failed to open .obj file: " << filename << std::endl;
-        return false;
+        std::string extension = entry.path().extension().string();
+        if (extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".tga" || extension == ".bmp")
+            CookTexture(entry.path().generic_string(), format, quality, mipOptions);
     }
+}
 
-    // Temporary storage for vertex data
-    std::vector<Vec3> tempVertexPos;    // Vertex positions
-    std::vector<Vec3> tempVertexNorm;     // Vertex normals
-    std::vector<Vec2> tempTexCoords;   // Texture coordinates
-
-    // Read file line by line
-    std::string line;
-    while (std::getline(file, line)) 
+int main(int argc, char** argv) 
+{
+    const char* modelPath = nullptr;
+    int textureArraySize = 0;
+    const char* virtualTexturePath = nullptr;
+    size_t gpuBudget = 512;
+    int pointLightCount = 0;
+    bool useDeferred = false;
+    int benchLightingLayers = 0;
+    int shadowCascadeCount = 0;
+    int shadowResolution = 1024;
+    int pointShadowCount = 0;
+    bool useDepthPrepass = false;
+    bool usePostProcess = false;
+
+    for (int i = 1; i < argc; ++i)
     {
-        std::istringstream s(line);
-        std::string prefix;
-        s >> prefix;
+        // Import benchmark, runs without a window
+        if (std::strcmp(argv[i], "--bench-import") == 0)
+        {
+            BenchmarkImport("assets/box.obj");
+            BenchmarkImport("assets/sphere.obj");
+            BenchmarkImport("assets/cylinder.obj");
+            return 0;
+        }
+
+        // Offline texture compression: --cook-textures [bc1|bc3|bc5|bc7] [fast|normal|high] [box|kaiser|lanczos]
+        if (std::strcmp(argv[i], "--cook-textures") == 0)
+        {
+            BCFormat format = FORMAT_BC7;
+            BCQuality quality = QUALITY_NORMAL;
+            MipOptions mipOptions;
+
+            for (++i; i < argc; ++i)
+            {
+                if (std::strcmp(argv[i], "bc1") == 0) format = FORMAT_BC1;
+                else if (std::strcmp(argv[i], "bc3") == 0) format = FORMAT_BC3;
+                else if (std::strcmp(argv[i], "bc5") == 0) format = FORMAT_BC5;
+                else if (std::strcmp(argv[i], "bc7") == 0) format = FORMAT_BC7;
+                else if (std::strcmp(argv[i], "fast") == 0) quality = QUALITY_FAST;
+                else if (std::strcmp(argv[i], "normal") == 0) quality = QUALITY_NORMAL;
+                else if (std::strcmp(argv[i], "high") == 0) quality = QUALITY_HIGH;
+                else if (std::strcmp(argv[i], "box") == 0) mipOptions.filter = MIP_FILTER_BOX;
+                else if (std::strcmp(argv[i], "kaiser") == 0) mipOptions.filter = MIP_FILTER_KAISER;
+                else if (std::strcmp(argv[i], "lanczos") == 0) mipOptions.filter = MIP_FILTER_LANCZOS;
+            }
+
+            CookTextures("textures", format, quality, mipOptions);
+            return 0;
+        }
 
-        if (prefix == "v") // Vertex position
+        // Pack the scene textures into one texture array: --texture-array [layer size]
+        if (std::strcmp(argv[i], "--texture-array") == 0)
         {
-            Vec3 position;
-            s >> position.x >> position.y >> position.z;
-            tempVertexPos.push_back(position);
+            textureArraySize = 2048;
+            if (i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+                textureArraySize = std::atoi(argv[++i]);
         }
-        else if (prefix == "vt") // Texture coordinate
+
+        // Ground plane textured with a virtual texture: --virtual-texture <image>
+        if (std::strcmp(argv[i], "--virtual-texture") == 0 && i + 1 < argc)
         {
-            Vec2 texCoord;
-            s >> texCoord.x >> texCoord.y;
-            tempTexCoords.push_back(texCoord);
+            virtualTexturePath = argv[++i];
         }
-		else if (prefix == "vn") // Vertex normal
+
+        // GPU memory kept for meshes and textures before unused ones are evicted: --gpu-budget <MB>
+        if (std::strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc)
         {
-            Vec3 normal;
-            s >> normal.x >> normal.y >> normal.z;
-            tempVertexNorm.push_back(normal);
+            gpuBudget = (size_t)std::max(std::atoi(argv[++i]), 1);
         }
-		else if (prefix == "f") // Face (triangle or quad)
+
+        // Light the scene from a G-buffer instead of in the forward pass: --deferred
+        if (std::strcmp(argv[i], "--deferred") == 0)
         {
-            std::vector<std::string> faceData;
-            std::string vertexData;
+            useDeferred = true;
+        }
 
-            // Collect all vertex data for this face
-            while (s >> vertexData) {
-                faceData.push_back(vertexData);
-            }
+        // Time forward against deferred shading on a dense scene, then exit: --bench-lighting [layers]
+        if (std::strcmp(argv[i], "--bench-lighting") == 0)
+        {
+            benchLightingLayers = 32;
+            if (i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+                benchLightingLayers = std::atoi(argv[++i]);
+        }
 
-            // If the face is a quad, split it into two triangles
-			if (faceData.size() == 4) // Quad face
-            {
-                // Triangle 1: vertices 1, 2, 3
-                for (int i : {0, 1, 2})
-                {
-                    std::istringstream viss(faceData[i]);
-                    std::string posIndexStr, texIndexStr, normIndexStr;
-
-                    // Parse vertex, texture, and normal indices
-                    std::getline(viss, posIndexStr, '/');
-                    std::getline(viss, texIndexStr, '/');
-                    std::getline(viss, normIndexStr, '/');
-
-                    // Convert to 0-based indices
-                    unsigned int posIndex = (posIndexStr.empty()) ? 0 : std::stoi(posIndexStr) - 1;
-                    unsigned int texIndex = (texIndexStr.empty()) ? 0 : std::stoi(texIndexStr) - 1;
-                    unsigned int normIndex = (normIndexStr.empty()) ? 0 : std::stoi(normIndexStr) - 1;
-
-                    // Create vertex
-                    Vertex vertex;
-                    vertex.position = tempVertexPos[posIndex];
-                    vertex.texture = (texIndex < tempTexCoords.size()) ? tempTexCoords[texIndex] : Vec2(0.0f, 0.0f);
-                    vertex.normal = (normIndex < tempVertexNorm.size()) ? tempVertexNorm[normIndex] : Vec3(0.0f, 0.0f, 0.0f);
-
-                    // Add vertex and index
-                    vertices.push_back(vertex);
-                    indices.push_back(vertices.size() - 1);
-                }
-
-                // Triangle 2: vertices 1, 3, 4
-                for (int i : {0, 2, 3}) 
-                {
-                    std::istringstream viss(faceData[i]);
-                    std::string posIndexStr, texIndexStr, normIndexStr;
-
-                    // Parse vertex, texture, and normal indices
-                    std::getline(viss, posIndexStr, '/');
-                    std::getline(viss, texIndexStr, '/');
-                    std::getline(viss, normIndexStr, '/');
-
-                    // Convert to 0-based indices
-                    unsigned int posIndex = (posIndexStr.empty()) ? 0 : std::stoi(posIndexStr) - 1;
-                    unsigned int texIndex = (texIndexStr.empty()) ? 0 : std::stoi(texIndexStr) - 1;
-                    unsigned int normIndex = (normIndexStr.empty()) ? 0 : std::stoi(normIndexStr) - 1;
-
-                    // Create vertex
-                    Vertex vertex;
-                    vertex.position = tempVertexPos[posIndex];
-                    vertex.texture = (texIndex < tempTexCoords.size()) ? tempTexCoords[texIndex] : Vec2(0.0f, 0.0f);
-                    vertex.normal = (normIndex < tempVertexNorm.size()) ? tempVertexNorm[normIndex] : Vec3(0.0f, 0.0f, 0.0f);
-
-                    // Add vertex and index
-                    vertices.push_back(vertex);
-                    indices.push_back(vertices.size() - 1);
-                }
-            }
-            else if (faceData.size() == 3)// Triangle face
-            {
-                for (int i : {0, 1, 2})
-                {
-                    std::istringstream viss(faceData[i]);
-                    std::string posIndexStr, texIndexStr, normIndexStr;
-
-                    // Parse vertex, texture, and normal indices
-                    std::getline(viss, posIndexStr, '/');
-                    std::getline(viss, texIndexStr, '/');
-                    std::getline(viss, normIndexStr, '/');
-
-                    // Convert to 0-based indices
-                    unsigned int posIndex = (posIndexStr.empty()) ? 0 : std::stoi(posIndexStr) - 1;
-                    unsigned int texIndex = (texIndexStr.empty()) ? 0 : std::stoi(texIndexStr) - 1;
-                    unsigned int normIndex = (normIndexStr.empty()) ? 0 : std::stoi(normIndexStr) - 1;
-
-                    // Create vertex
-                    Vertex vertex;
-                    vertex.position = tempVertexPos[posIndex];
-                    vertex.texture = (texIndex < tempTexCoords.size()) ? tempTexCoords[texIndex] : Vec2(0.0f, 0.0f);
-                    vertex.normal = (normIndex < tempVertexNorm.size()) ? tempVertexNorm[normIndex] : Vec3(0.0f, 0.0f, 0.0f);
-
-                    // Add vertex and index
-                    vertices.push_back(vertex);
-                    indices.push_back(vertices.size() - 1);
-                }
-            }
-			else // Unsupported face type
-            {
-                std::cerr << "Unsupported face type with " << faceData.size() << " vertices." << std::endl;
-            }
+        // Sun shadow quality: --shadow-cascades <0-4> (0 turns shadows off), --shadow-resolution <texels>
+        if (std::strcmp(argv[i], "--shadow-cascades") == 0 && i + 1 < argc)
+        {
+            shadowCascadeCount = std::atoi(argv[++i]);
         }
-    }
 
-    file.close();
+        if (std::strcmp(argv[i], "--shadow-resolution") == 0 && i + 1 < argc)
+        {
+            shadowResolution = std::atoi(argv[++i]);
+        }
 
-    return true;
-}
+        // Most point lights with a cube shadow per frame: --point-shadows <count>
+        if (std::strcmp(argv[i], "--point-shadows") == 0 && i + 1 < argc)
+        {
+            pointShadowCount = std::atoi(argv[++i]);
+        }
+
+        // Depth-only pass before forward shading, toggled with F2: --z-prepass
+        if (std::strcmp(argv[i], "--z-prepass") == 0)
+        {
+            useDepthPrepass = true;
+        }
+
+        // Draw into an HDR target with bloom and tone mapping instead of straight to the 8-bit screen: --hdr
+        if (std::strcmp(argv[i], "--hdr") == 0)
+        {
+            usePostProcess = true;
+        }
+
+        // Dynamic point lights scattered over the ground: --point-lights <count>
+        if (std::strcmp(argv[i], "--point-lights") == 0 && i + 1 < argc)
+        {
+            pointLightCount = std::max(std::atoi(argv[++i]), 0);
+        }
+
+        // Extra model loaded through the importer (FBX, glTF, DAE, ...)
+        if (std::strcmp(argv[i], "--model") == 0 && i + 1 < argc)
+        {
+            modelPath = argv[++i];
+        }
+    }
 
-int main() 
-{
     // Initialize GLFW
     if (!glfwInit()) 
     {
@@ -383,15 +445,33 @@ int main()
         return -1;
     }
     
+    // Core 4.3 context: immutable texture storage, image copies, shader storage buffers and #version 430 shaders
+    // (the texture streamer's persistently mapped ring also wants 4.4 or ARB_buffer_storage, it does without)
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
     // Create a windowed mode window
     GLFWwindow* window = glfwCreateWindow(1920, 1080, "MG3D", nullptr, nullptr);
     if (!window) 
     {
-        std::cerr << "Failed to create GLFW window!" << std::endl;
+        std::cerr << "Failed to create GLFW window! (OpenGL 4.3 or newer is required)" << std::endl;
         glfwTerminate();
         return -1;
     }
     
+    // Destroys the window and terminates GLFW when main returns, declared before every GL object so it runs after their
+    // destructors (and after the shader compiler has joined its worker and destroyed the hidden window)
+    struct WindowGuard
+    {
+        GLFWwindow* window;
+        ~WindowGuard()
+        {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
+    } windowGuard{ window };
+
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, ResizeWindow);
     glfwSetCursorPosCallback(window, MouseInput);
@@ -403,18 +483,67 @@ int main()
         std::cerr << "Failed to initialize GLAD!" << std::endl;
         return -1;
     }
+
+    // Drivers may hand out a lower version than asked for, the renderer calls 4.3 functions unconditionally
+    if (!GLAD_GL_VERSION_4_3)
+    {
+        std::cerr << "OpenGL 4.3 or newer is required, the driver created " << (const char*)glGetString(GL_VERSION) << std::endl;
+        return -1;
+    }
     
     // Enable depth testing
     glEnable(GL_DEPTH_TEST);
+
+    // Accounts every mesh buffer and texture, created first so it outlives them
+    ResidencyManager residency(gpuBudget * 1024 * 1024);
+    residency.MakeActive();
+
+    // Camera, light and material uniforms are uploaded as whole blocks, shared by every program
+    UniformBuffers uniformBuffers;
+    uniformBuffers.MakeActive();
     
-    // Create a shader program
-    unsigned int shaderProgram = CreateShaderProgram("shaders/VertexShader.glsl", "shaders/FragmentShader.glsl");
+    // Builds shader variants off the frame, created before the variants so it outlives them
+    ShaderCompiler shaderCompiler(window);
+    std::cout << "Shader compilation: " << ShaderCompiler::ModeName(shaderCompiler.Mode()) << std::endl;
+
+    // Lighting shader, each material is drawn with the variant that has just the features it uses
+    // Variants requested mid-game build in the background, their materials draw with a simpler variant meanwhile
+    ShaderVariants shaderVariants("shaders/VertexShader.glsl", "shaders/FragmentShader.glsl");
+    shaderVariants.SetCompiler(&shaderCompiler);
+
+    // Writes the virtual texture pages each pixel needs
+    ShaderProgram feedbackShader;
+    feedbackShader.vertexPath = "shaders/VertexShader.glsl";
+    feedbackShader.fragmentPath = "shaders/FeedbackFragment.glsl";
+    CreateShaderProgram(feedbackShader);
     
-    // Loadd textures
-    unsigned int texture1 = LoadTexture("textures/Scratches-Textures.jpg");
-    unsigned int texture2 = LoadTexture("textures/Triangles-Textures.png");
-    unsigned int texture3 = LoadTexture("textures/Color-Textures.jpg");
-    unsigned int texture4 = LoadTexture("textures/Vibrant-Swirl-Textures-1.jpg");
+    // Textures are cached by path and content, materials are shared through the registry
+    TextureManager textures;
+    MaterialRegistry registry(textures);
+    registry.MakeActive();
+
+    // Textures and meshes are decoded on worker threads and show placeholders until uploaded
+    AssetLoader loader(registry);
+
+    // Textures start with their smallest mips, finer ones stream in as they get close to the camera
+    TextureStreamer streamer(textures);
+
+    // Textures
+    const char* texture1 = "textures/Scratches-Textures.jpg";
+    const char* texture2 = "textures/Triangles-Textures.png";
+    const char* texture3 = "textures/Color-Textures.jpg";
+    const char* texture4 = "textures/Vibrant-Swirl-Textures-1.jpg";
+
+    // Materials use layers of one texture array instead of separate textures, nothing is rebound between draws
+    TextureArrayPacker texturePacker(std::max(textureArraySize, 1));
+    if (textureArraySize > 0)
+    {
+        for (const char* texture : { texture1, texture2, texture3, texture4 })
+            texturePacker.Add(texture);
+
+        if (texturePacker.Build())
+            registry.SetTextureArray(&texturePacker);
+    }
     
     // Define vertex data
     std::vector<Vertex> vertices1 = {
@@ -431,7 +560,7 @@ int main()
     
     // Define material properties
     Material material1 = {
-        texture1,
+        0,
         Vec3(0.1f, 0.1f, 0.1f),  // Ambient
         Vec3(0.8f, 0.0f, 0.0f),  // Diffuse
         Vec3(1.0f, 1.0f, 1.0f),  // Specular
@@ -439,52 +568,160 @@ int main()
     };
 
     Material material2 = {
-        texture1,
+        0,
         Vec3(0.5f, 0.5f, 0.5f),  // Ambient
         Vec3(0.4f, 0.4f, 0.4f),  // Diffuse
         Vec3(1.0f, 1.0f, 1.0f),  // Specular
         32.0f                         // Shininess
     };
 
+    registry.ApplyTexture(material1, texture1);
+    registry.ApplyTexture(material2, texture1);
+
     light.position = Vec3(-4.0f, 3.0f, 0.0f);
     light.ambient = Vec3(0.5f, 0.5f, 0.5f);
     light.diffuse = Vec3(0.7f, 0.7f, 0.7f);
     light.specular = Vec3(1.0f, 1.0f, 1.0f);
     
     // Create a mesh
-    Mesh triangle(vertices1, indices1, material1, light, texture1);
+    unsigned int triangleMaterial = registry.Register(material1);
+    Mesh triangle(vertices1, indices1, { { 0, (unsigned int)indices1.size(), triangleMaterial, registry.Get(triangleMaterial) } }, light);
     
-    // Load OBJ file - box
-    std::vector<Vertex> vertices_box;
-    std::vector<unsigned int> indices_box;
-    if (!loadOBJ("assets/box.obj", vertices_box, indices_box)) {
-        std::cerr << "Failed to load OBJ file!" << std::endl;
-        return -1;
+    // Load OBJ files in the background, faces without an MTL material use the given default
+    auto loadMesh = [&](const char* filename, Material material, const char* texture) -> std::shared_ptr<Mesh>
+    {
+        registry.ApplyTexture(material, texture);
+        return loader.RequestMesh(filename, material, light);
+    };
+
+    std::shared_ptr<Mesh> box = loadMesh("assets/box.obj", material2, texture4);
+    std::shared_ptr<Mesh> sphere = loadMesh("assets/sphere.obj", material1, texture2);
+    std::shared_ptr<Mesh> cylinder = loadMesh("assets/cylinder.obj", material2, texture3);
+
+    // Load model passed on the command line
+    std::vector<std::unique_ptr<Mesh>> importedModel;
+    if (modelPath)
+    {
+        std::vector<MeshData> meshes;
+        if (ModelImporter().Load(modelPath, meshes))
+        {
+            for (MeshData& data : meshes)
+            {
+                registry.ApplyTexture(data.material, data.texturePath.empty() ? texture1 : data.texturePath);
+
+                unsigned int materialID = registry.Register(data.material);
+                importedModel.push_back(std::make_unique<Mesh>(data.vertices, data.indices, std::vector<SubMesh>{ { 0, (unsigned int)data.indices.size(), materialID, data.material } }, light));
+            }
+        }
     }
-    
-    Mesh box(vertices_box, indices_box, material2, light, texture4);
-    
-    // Load OBJ file - sphere
-    std::vector<Vertex> vertices_sphere;
-    std::vector<unsigned int> indices_sphere;
-    if (!loadOBJ("assets/sphere.obj", vertices_sphere, indices_sphere)) {
-        std::cerr << "Failed to load OBJ file!" << std::endl;
-        return -1;
+
+    // Large ground plane, only the pages of its texture that are on screen are kept in memory
+    VirtualTextureSystem virtualTextures;
+    std::unique_ptr<Mesh> ground;
+    if (virtualTexturePath)
+    {
+        int index = virtualTextures.Load(virtualTexturePath);
+
+        Material groundMaterial = material2;
+        if (virtualTextures.Apply(groundMaterial, index))
+        {
+            // 40x40 units, the texture repeats 8 times
+            std::vector<Vertex> groundVertices = {
+                {Vec3(-20.0f, 0.0f, -20.0f), Vec3(0.0f, 1.0f, 0.0f), Vec2(0.0f, 0.0f)},
+                {Vec3(20.0f, 0.0f, -20.0f), Vec3(0.0f, 1.0f, 0.0f), Vec2(8.0f, 0.0f)},
+                {Vec3(20.0f, 0.0f, 20.0f), Vec3(0.0f, 1.0f, 0.0f), Vec2(8.0f, 8.0f)},
+                {Vec3(-20.0f, 0.0f, 20.0f), Vec3(0.0f, 1.0f, 0.0f), Vec2(0.0f, 8.0f)}
+            };
+            std::vector<unsigned int> groundIndices = { 0, 2, 1, 0, 3, 2 };
+
+            unsigned int groundMaterialID = registry.Register(groundMaterial);
+            ground = std::make_unique<Mesh>(groundVertices, groundIndices, std::vector<SubMesh>{ { 0, (unsigned int)groundIndices.size(), groundMaterialID, groundMaterial } }, light);
+        }
     }
-    
-    Mesh sphere(vertices_sphere, indices_sphere, material1, light, texture2);
-    
-    // Load OBJ file - cylinder
-    std::vector<Vertex> vertices_cylinder;
-    std::vector<unsigned int> indices_cylinder;
-    if (!loadOBJ("assets/cylinder.obj", vertices_cylinder, indices_cylinder)) {
-        std::cerr << "Failed to load OBJ file!" << std::endl;
-        return -1;
+
+    // Compile the variants the scene needs up front (in parallel), materials loaded later compile theirs on first use
+    // The featureless variant is always there to fall back on
+    std::vector<uint32_t> featureSets = { 0 };
+    for (size_t i = 0; i < registry.Count(); ++i)
+        featureSets.push_back(MaterialFeatures(registry.Get((unsigned int)i)));
+    shaderVariants.Precompile(featureSets);
+
+    // Deferred path, created before the hot reloader that watches its shaders
+    std::unique_ptr<DeferredRenderer> deferredRenderer;
+    if (useDeferred || benchLightingLayers > 0)
+    {
+        deferredRenderer = std::make_unique<DeferredRenderer>((int)resolutionX, (int)resolutionY);
+        deferredRenderer->geometryVariants.SetCompiler(&shaderCompiler);
+        deferredRenderer->geometryVariants.Precompile(featureSets);
+    }
+
+    // Reload shaders, textures and meshes when they are edited
+    HotReloader hotReload(loader);
+    hotReload.SetTextureStreamer(&streamer);
+    hotReload.WatchDirectory("shaders");
+    hotReload.WatchDirectory("textures");
+    hotReload.WatchDirectory("assets");
+    hotReload.AddShader(shaderVariants);
+    hotReload.AddShader(feedbackShader);
+    // Sun with cascaded shadows, rendered from the queued meshes every frame
+    ShadowCascades shadows(shadowCascadeCount, shadowResolution);
+    hotReload.AddShader(shadows.depthShader);
+
+    // Cube shadows of the scene light and the point lights largest on screen, sharing one atlas
+    PointShadows pointShadows;
+    pointShadows.maxShadowedLights = pointShadowCount;
+    hotReload.AddShader(pointShadows.depthShader);
+
+    // Depth of the queued meshes ahead of forward shading, so each pixel is lit once
+    DepthPrepass depthPrepass;
+    depthPrepass.enabled = useDepthPrepass;
+    hotReload.AddShader(depthPrepass.depthShader);
+
+    // Bloom and tone mapping of the HDR scene, and GPU time per pass of the frame
+    PostProcess postProcess;
+    hotReload.AddShader(postProcess.downsampleShader);
+    hotReload.AddShader(postProcess.upsampleShader);
+    hotReload.AddShader(postProcess.tonemapShader);
+    GpuTimer gpuTimer;
+
+    // Passes of the frame, every one timed
+    RenderGraph renderGraph;
+    renderGraph.SetTimer(&gpuTimer);
+
+    if (deferredRenderer)
+    {
+        hotReload.AddShader(deferredRenderer->geometryVariants);
+        hotReload.AddShader(deferredRenderer->lightingShader);
+    }
+
+    RenderQueue renderQueue;
+
+    // Scene point lights, assigned to view frustum clusters every frame, some circle around where they were placed
+    LightClusters lightClusters;
+    lightClusters.SetProjection(degreeToRadians(45.0f), (float)1920 / 1080, 0.1f, 100.0f);
+
+    std::vector<Vec3> pointLightCenters;
+    std::srand(7);
+    for (int i = 0; i < pointLightCount; ++i)
+    {
+        auto random = [](float low, float high) { return low + (high - low) * (float)std::rand() / RAND_MAX; };
+
+        PointLight pointLight;
+        pointLight.position = Vec3(random(-20.0f, 20.0f), random(0.3f, 2.0f), random(-20.0f, 20.0f));
+        pointLight.radius = random(2.0f, 4.0f);
+        pointLight.color = Vec3(random(0.2f, 1.0f), random(0.2f, 1.0f), random(0.2f, 1.0f));
+        pointLight.intensity = 2.0f;
+
+        lightClusters.lights.push_back(pointLight);
+        pointLightCenters.push_back(pointLight.position);
+    }
+
+    if (benchLightingLayers > 0)
+    {
+        BenchmarkLighting(benchLightingLayers, material2, shaderVariants, *deferredRenderer, lightClusters, uniformBuffers);
+        glfwSetWindowShouldClose(window, true);
     }
-    
-    Mesh cylinder(vertices_cylinder, indices_cylinder, material2, light, texture3);
 
-    
     // Rendering loop
     while (!glfwWindowShouldClose(window)) {
     
@@ -493,46 +730,191 @@ int main()
         lastFrame = currentFrame;
     
         PlayerInput(window);
-    
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glUseProgram(shaderProgram);
 
-        glUniform3fv(glGetUniformLocation(shaderProgram, "viewPos"), 1, camera.position.value_ptr());
+        // Upload assets finished by the loader, a few milliseconds per frame
+        hotReload.Update();
+        shaderCompiler.Poll();
+        loader.ProcessUploads(4.0);
 
         Mat4 view = camera.GetViewMatrix();
         Mat4 projection = Mat4().Perspective(degreeToRadians(45.0f), (float)1920 / 1080, 0.1f, 100.0f);
+        uniformBuffers.Upload(FrameUniforms(projection, view, camera.position));
+
+        // A quarter of the lights circle, the others stay put and reuse their cached shadows
+        for (size_t i = 0; i < lightClusters.lights.size(); i += 4)
+        {
+            float phase = currentFrame + (float)i * 0.37f;
+            lightClusters.lights[i].position = pointLightCenters[i] + Vec3(std::cos(phase), 0.0f, std::sin(phase)) * 1.5f;
+        }
+
+        // Size drawn to this frame, resolutionX/Y stay at the initial window size
+        int framebufferWidth = 0, framebufferHeight = 0;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        float screenWidth = (float)std::max(framebufferWidth, 1), screenHeight = (float)std::max(framebufferHeight, 1);
+
+        // Shadow atlas entries first, the light block and the cluster upload carry them
+        pointShadows.Update(light, lightClusters.lights, view, degreeToRadians(45.0f), (float)1920 / 1080, screenHeight);
+        uniformBuffers.Upload(LightUniforms(light, pointShadows.SceneLightShadow()));
+        lightClusters.Update(view, screenWidth, screenHeight);
         Mat4 model = Mat4();
     
         model = model * Mat4().Scale(0.5f, 0.5f, 0.5f);
         model = model * Mat4().Translate(0, 1, -3);
-        triangle.Draw(shaderProgram, projection, view, model);
+        renderQueue.Submit(triangle, model, true);
     
         model = Mat4();
         model = model * Mat4().Scale(0.5f, 0.5f, 0.5f);
         model = model * Mat4().RotateZ(45);
+        model = model * Mat4().RotateY(currentFrame);
         model = model * Mat4().Translate(-1, 0, -3);
-        box.Draw(shaderProgram, projection, view, model);
+        // Spinning, the only dynamic shadow caster
+        renderQueue.Submit(*box, model);
     
         model = Mat4();
         model = model * Mat4().Scale(0.5f, 0.5f, 0.5f);
         model = model * Mat4().Translate(0, 0, -3);
-        sphere.Draw(shaderProgram, projection, view, model);
+        renderQueue.Submit(*sphere, model, true);
     
         model = Mat4();
         model = model * Mat4().Scale(0.5f, 0.5f, 0.5f);
         model = model * Mat4().RotateX(45);
         model = model * Mat4().Translate(1, 0, -3);
-        cylinder.Draw(shaderProgram, projection, view, model);
+        renderQueue.Submit(*cylinder, model, true);
+
+        model = Mat4();
+        model = model * Mat4().Translate(0, -1, -5);
+        for (const std::unique_ptr<Mesh>& mesh : importedModel)
+            renderQueue.Submit(*mesh, model, true);
+
+        if (ground)
+        {
+            model = Mat4().Translate(0, -1.5f, -5);
+            renderQueue.Submit(*ground, model, true);
+        }
+
+        // Stream in the mip levels this frame needs
+        streamer.SetView(camera.position, degreeToRadians(45.0f), screenHeight);
+        streamer.Request(renderQueue);
+        streamer.Update(2.0);
+
+        // The frame as a render graph: passes declare their targets, the graph binds, clears and allocates them
+        renderGraph.SetBackbuffer(framebufferWidth, framebufferHeight);
+
+        // Low resolution pass recording the virtual texture pages on screen, read back a few frames later
+        if (virtualTextures.Count() > 0)
+        {
+            renderGraph.AddPass("feedback", [](RenderGraph::PassBuilder& pass) { pass.SideEffect(); }, [&](const RenderGraph&)
+                {
+                    if (virtualTextures.BeginFeedback(feedbackShader.id))
+                    {
+                        renderQueue.Draw(feedbackShader.id);
+                        virtualTextures.EndFeedback();
+                    }
+
+                    virtualTextures.Update(2.0);
+                    virtualTextures.Bind();
+                });
+        }
+
+        // Shadow cascades fitted to the camera, drawn from everything queued this frame
+        renderGraph.AddPass("shadows", [](RenderGraph::PassBuilder& pass) { pass.SideEffect(); }, [&](const RenderGraph&)
+            {
+                shadows.Update(camera, degreeToRadians(45.0f), (float)1920 / 1080, 0.1f, 100.0f);
+                shadows.Render(renderQueue);
+                pointShadows.Render(renderQueue);
+            });
+
+        // Into an HDR texture at the window's size, or straight to the screen
+        RenderGraphTexture sceneColor = renderGraph.Backbuffer();
+        RenderGraphTexture sceneDepth = renderGraph.BackbufferDepth();
+        if (usePostProcess)
+        {
+            sceneColor = renderGraph.Create("scene color", { std::max(framebufferWidth, 1), std::max(framebufferHeight, 1), GL_RGBA16F });
+            sceneDepth = renderGraph.Create("scene depth", { std::max(framebufferWidth, 1), std::max(framebufferHeight, 1), GL_DEPTH24_STENCIL8 });
+        }
+
+        // Draw everything sorted by shader variant and material, lit per fragment (forward) or once per pixel from the G-buffer (deferred)
+        if (useDeferred)
+        {
+            renderGraph.AddPass("scene", [&](RenderGraph::PassBuilder& pass)
+                {
+                    pass.Write(sceneColor, true);
+                    pass.WriteDepth(sceneDepth, true);
+                },
+                [&](const RenderGraph& graph)
+                {
+                    deferredRenderer->Resize(std::max(framebufferWidth, 1), std::max(framebufferHeight, 1));
+                    deferredRenderer->GeometryPass(renderQueue);
+                    deferredRenderer->LightingPass(projection, view, graph.Framebuffer());
+                });
+        }
+        else
+        {
+            // Same targets as the shading pass (color writes masked off), so it stays bound and is cleared once
+            renderGraph.AddPass("depth prepass", [&](RenderGraph::PassBuilder& pass)
+                {
+                    pass.Write(sceneColor, true);
+                    pass.WriteDepth(sceneDepth, true);
+                },
+                [&](const RenderGraph&) { depthPrepass.Render(renderQueue); });
+
+            renderGraph.AddPass("scene", [&](RenderGraph::PassBuilder& pass)
+                {
+                    pass.Write(sceneColor);
+                    pass.WriteDepth(sceneDepth);
+                },
+                [&](const RenderGraph&)
+                {
+                    depthPrepass.BeginShading();
+                    renderQueue.Flush(shaderVariants);
+                    depthPrepass.EndShading();
+                });
+        }
+
+        if (usePostProcess)
+            postProcess.AddPasses(renderGraph, sceneColor, renderGraph.Backbuffer());
+
+        gpuTimer.BeginFrame();
+        renderGraph.Execute();
+        gpuTimer.EndFrame();
+
+        // Evict what this frame did not use if the budget is exceeded, F1 prints the usage
+        residency.Update();
+
+        static bool reportPressed = false;
+        bool reportKey = glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS;
+        if (reportKey && !reportPressed)
+        {
+            residency.Report(std::cout);
+            std::cout << "Point lights: " << lightClusters.lights.size() << ", " << lightClusters.AssignedCount() << " cluster references, at most "
+                << lightClusters.MaxPerCluster() << " in one of " << lightClusters.ClusterCount() << " clusters" << std::endl;
+            std::cout << "Shadows: " << shadows.CascadeCount() << " cascades of " << shadows.Resolution() << "x" << shadows.Resolution() << ", "
+                << shadows.CasterDraws() << " caster draws, " << shadows.CulledCasters() << " culled, " << shadows.StaticRenders() << " static redraws" << std::endl;
+            std::cout << "Point shadows: " << pointShadows.ShadowedLights() << " lights, " << pointShadows.CasterDraws() << " caster draws, "
+                << pointShadows.CulledFaces() << " faces culled, " << pointShadows.StaticRenders() << " static redraws" << std::endl;
+            gpuTimer.Report(std::cout);
+            renderGraph.Report(std::cout);
+            std::cout << "Z-prepass: " << (depthPrepass.enabled ? "on" : "off") << ", " << depthPrepass.ShadedSamples() << " samples shaded";
+            if (depthPrepass.PrepassSamples() > 0)
+                std::cout << " of " << depthPrepass.PrepassSamples() << " drawn, " << depthPrepass.OverdrawSaved() * 100.0f << "% overdraw saved";
+            std::cout << std::endl;
+        }
+        reportPressed = reportKey;
+
+        static bool prepassPressed = false;
+        bool prepassKey = glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS;
+        if (prepassKey && !prepassPressed)
+        {
+            depthPrepass.enabled = !depthPrepass.enabled;
+            std::cout << "Z-prepass " << (depthPrepass.enabled ? "on" : "off") << std::endl;
+        }
+        prepassPressed = prepassKey;
     
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
     
-    // Cleanup
-    glfwDestroyWindow(window);
-    glfwTerminate();
-    
+    // Render objects go out of scope before windowGuard, which destroys the window and terminates GLFW
     return 0;
 }
 
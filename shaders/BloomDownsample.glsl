@@ -0,0 +1,51 @@
+#version 430 core
+
+// One level down the bloom pyramid: a 13-tap filter over the level above, which keeps the result from flickering as
+// bright pixels move. The first level also keeps only what is brighter than the threshold, with a soft knee.
+
+out vec4 FragColor;
+
+uniform sampler2D postSource;       // Level above, the HDR scene for the first level
+
+uniform vec2 sourceTexelSize;
+uniform vec2 targetTexelSize;
+uniform bool prefilter;
+uniform float threshold;
+uniform float knee;
+
+vec3 Sample(vec2 uv, vec2 offset)
+{
+    return texture(postSource, uv + offset * sourceTexelSize).rgb;
+}
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * targetTexelSize;
+
+    vec3 a = Sample(uv, vec2(-2.0, 2.0));
+    vec3 b = Sample(uv, vec2(0.0, 2.0));
+    vec3 c = Sample(uv, vec2(2.0, 2.0));
+    vec3 d = Sample(uv, vec2(-2.0, 0.0));
+    vec3 e = Sample(uv, vec2(0.0, 0.0));
+    vec3 f = Sample(uv, vec2(2.0, 0.0));
+    vec3 g = Sample(uv, vec2(-2.0, -2.0));
+    vec3 h = Sample(uv, vec2(0.0, -2.0));
+    vec3 i = Sample(uv, vec2(2.0, -2.0));
+    vec3 j = Sample(uv, vec2(-1.0, 1.0));
+    vec3 k = Sample(uv, vec2(1.0, 1.0));
+    vec3 l = Sample(uv, vec2(-1.0, -1.0));
+    vec3 m = Sample(uv, vec2(1.0, -1.0));
+
+    // Inner box weighs half, the four outer boxes an eighth each
+    vec3 color = e * 0.125 + (a + c + g + i) * 0.03125 + (b + d + f + h) * 0.0625 + (j + k + l + m) * 0.125;
+
+    if (prefilter)
+    {
+        float brightness = max(color.r, max(color.g, color.b));
+        float soft = clamp(brightness - threshold + knee, 0.0, 2.0 * knee);
+        soft = soft * soft / (4.0 * knee + 0.00001);
+        color *= max(soft, brightness - threshold) / max(brightness, 0.00001);
+    }
+
+    FragColor = vec4(color, 1.0);
+}
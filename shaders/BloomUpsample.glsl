@@ -0,0 +1,25 @@
+#version 430 core
+
+// One level up the bloom pyramid: a 3x3 tent filter over the level below, added to this level by blending
+
+out vec4 FragColor;
+
+uniform sampler2D postSource;       // Level below
+
+uniform vec2 sourceTexelSize;
+uniform vec2 targetTexelSize;
+uniform float filterRadius;         // In source texels
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * targetTexelSize;
+    vec2 offset = sourceTexelSize * filterRadius;
+
+    vec3 color = texture(postSource, uv).rgb * 4.0;
+    color += (texture(postSource, uv + vec2(-offset.x, 0.0)).rgb + texture(postSource, uv + vec2(offset.x, 0.0)).rgb
+        + texture(postSource, uv + vec2(0.0, -offset.y)).rgb + texture(postSource, uv + vec2(0.0, offset.y)).rgb) * 2.0;
+    color += texture(postSource, uv + vec2(-offset.x, -offset.y)).rgb + texture(postSource, uv + vec2(offset.x, -offset.y)).rgb
+        + texture(postSource, uv + vec2(-offset.x, offset.y)).rgb + texture(postSource, uv + vec2(offset.x, offset.y)).rgb;
+
+    FragColor = vec4(color / 16.0, 1.0);
+}
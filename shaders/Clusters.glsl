@@ -0,0 +1,69 @@
+// Clustered point lights, filled every frame by LightClusters, HAS_SPECULAR adds the specular term
+#pragma once
+
+#include "UniformBlocks.glsl"
+#include "PointShadows.glsl"
+
+struct PointLight {
+    vec3 position;
+    float radius;                // No light beyond this distance
+    vec3 color;                  // Intensity included
+    int shadow;                  // Point shadow entry, -1 if unshadowed
+};
+
+layout(std430, binding = 0) readonly buffer PointLightBuffer {
+    PointLight pointLights[];
+};
+
+// Offset into clusterLights and light count, per cluster
+layout(std430, binding = 1) readonly buffer ClusterBuffer {
+    uvec2 clusters[];
+};
+
+layout(std430, binding = 2) readonly buffer ClusterLightBuffer {
+    uint clusterLights[];
+};
+
+// Cluster holding a fragment, from its window position and its distance along the view direction
+uint ClusterIndex(vec2 fragCoord, float viewDepth)
+{
+    uvec2 tile = uvec2(clamp(fragCoord / clusterScreen.xy, 0.0, 0.9999) * vec2(clusterGrid.xy));
+    float slice = clamp(log(max(viewDepth, clusterDepth.x)) * clusterDepth.z + clusterDepth.w, 0.0, float(clusterGrid.z - 1u));
+    return tile.x + clusterGrid.x * (tile.y + clusterGrid.y * uint(slice));
+}
+
+// Light reflected towards the viewer from the point lights of the fragment's cluster
+vec3 ClusteredLighting(vec2 fragCoord, float viewDepth, vec3 position, vec3 normal, vec3 viewPosition, vec3 diffuseColor, vec3 specularColor, float shininess)
+{
+    uvec2 range = clusters[ClusterIndex(fragCoord, viewDepth)];
+    vec3 norm = normalize(normal);
+    vec3 viewDir = normalize(viewPosition - position);
+    vec3 result = vec3(0.0);
+
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        PointLight pointLight = pointLights[clusterLights[range.x + i]];
+
+        vec3 toLight = pointLight.position - position;
+        float lightDistance = length(toLight);
+        if (lightDistance >= pointLight.radius)
+            continue;
+
+        // Inverse square falloff windowed to reach zero at the radius
+        float window = clamp(1.0 - pow(lightDistance / pointLight.radius, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (lightDistance * lightDistance + 1.0);
+
+        vec3 lightDir = toLight / max(lightDistance, 0.0001);
+        float diff = max(dot(norm, lightDir), 0.0);
+        vec3 lit = diff * diffuseColor;
+
+#ifdef HAS_SPECULAR
+        vec3 reflectDir = reflect(-lightDir, norm);
+        lit += pow(max(dot(viewDir, reflectDir), 0.0), shininess) * specularColor;
+#endif
+
+        result += pointLight.color * attenuation * lit * PointLightShadow(pointLight.shadow, position, norm);
+    }
+
+    return result;
+}
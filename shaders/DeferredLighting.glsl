@@ -0,0 +1,49 @@
+#version 430 core
+
+// Lighting pass of the deferred path: every pixel is shaded once from the G-buffer, with the scene light, its cluster's point lights and the sun
+
+out vec4 FragColor;
+
+// Every G-buffer may hold specular surfaces
+#define HAS_SPECULAR 1
+
+#include "Lighting.glsl"
+#include "Clusters.glsl"
+#include "Shadows.glsl"
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gSpecular;
+uniform sampler2D gAmbient;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseViewProjection;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+
+    // Nothing was drawn here, keep the clear color
+    if (depth >= 1.0)
+        discard;
+
+    // World position from the depth, the G-buffer is the size of the target this pass draws to
+    vec4 clip = vec4(gl_FragCoord.xy / vec2(textureSize(gDepth, 0)) * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world = inverseViewProjection * clip;
+    vec3 position = world.xyz / world.w;
+
+    vec3 albedo = texelFetch(gAlbedo, pixel, 0).rgb;
+    vec3 normal = texelFetch(gNormal, pixel, 0).xyz;
+    vec4 specular = texelFetch(gSpecular, pixel, 0);
+    vec3 ambient = texelFetch(gAmbient, pixel, 0).rgb;
+    float shininess = max(specular.a * 256.0, 1.0);
+
+    vec3 result = PhongLighting(light, position, normal, viewPos, ambient, albedo, specular.rgb, shininess);
+
+    float viewDepth = -(view * vec4(position, 1.0)).z;
+    result += ClusteredLighting(gl_FragCoord.xy, viewDepth, position, normal, viewPos, albedo, specular.rgb, shininess);
+    result += SunLighting(position, normal, viewDepth, viewPos, albedo, specular.rgb, shininess);
+
+    FragColor = vec4(result, 1.0);
+}
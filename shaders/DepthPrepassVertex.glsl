@@ -0,0 +1,17 @@
+#version 430 core
+
+// Depth pre-pass, reads the position-only vertex stream (Mesh::BindPositions)
+layout(location = 0) in vec3 aPos;      // Vertex position
+
+#include "UniformBlocks.glsl"
+
+uniform mat4 model;
+
+// Same expression as VertexShader.glsl, the main pass tests its depth with GL_EQUAL against this one
+invariant gl_Position;
+
+void main()
+{
+    vec3 worldPosition = vec3(model * vec4(aPos, 1.0f));
+    gl_Position = projection * view * vec4(worldPosition, 1.0);
+}
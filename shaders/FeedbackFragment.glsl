@@ -0,0 +1,26 @@
+#version 430 core
+
+in vec2 TexCoord;    // Texture coordinates from the vertex shader
+
+layout(location = 0) out uvec4 Feedback; // Page needed by this pixel: x, y, level, virtual texture + 1 (0: none)
+
+#include "UniformBlocks.glsl"
+
+uniform float feedbackBias;      // Log2 of screen size / feedback size (negative), the pass renders at low resolution
+
+#include "VirtualTexture.glsl"
+
+void main()
+{
+    if (material.virtualTexture < 0)
+    {
+        Feedback = uvec4(0u);
+        return;
+    }
+
+    float level = VirtualLevel(TexCoord, material.virtualSize, feedbackBias);
+    float pages = material.virtualSize / VT_PAGE_SIZE / exp2(level);
+    ivec2 page = ivec2(fract(TexCoord) * pages);
+
+    Feedback = uvec4(uvec2(page), uint(level), uint(material.virtualTexture + 1));
+}
@@ -1,4 +1,4 @@
-#version 330 core
+#version 430 core
 
 in vec2 TexCoord;    // Texture coordinates from the vertex shader
 in vec3 FragPos;     // Fragment position in world space
@@ -6,49 +6,27 @@ in vec3 Normal;      // Normal vector in world space
 
 out vec4 FragColor;  // Final fragment color
 
-// Uniforms for the lighting
+// Feature defines (HAS_TEXTURE, HAS_TEXTURE_ARRAY, HAS_VIRTUAL_TEXTURE, HAS_SPECULAR) are injected by ShaderVariants
+// Material, light and camera come from the uniform blocks
 
-struct Material {
-    sampler2D texture1;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-    float shininess;
-};
-
-struct Light {
-    vec3 position;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-uniform Material material;
-uniform Light light;
-uniform vec3 viewPos;
+#include "Lighting.glsl"
+#include "Clusters.glsl"
+#include "Shadows.glsl"
+#include "MaterialTexture.glsl"
 
 void main()
 {
-    // Ambient lighting
-    vec3 ambient = light.ambient * material.ambient;  // Basic ambient lighting with the material's ambient color
-
-    // Diffuse lighting
-    vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(light.position - FragPos);
-    float diff = max(dot(norm, lightDir), 0.0);  // Lambertian reflection
-    vec3 diffuse = light.diffuse * diff * material.diffuse;
+    vec3 result = PhongLighting(light, FragPos, Normal, viewPos, material.ambient, material.diffuse, material.specular, material.shininess);
 
-    // Specular lighting
-    vec3 viewDir = normalize(viewPos - FragPos);
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * spec * material.specular;
+    // Point lights of this fragment's cluster
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    result += ClusteredLighting(gl_FragCoord.xy, viewDepth, FragPos, Normal, viewPos, material.diffuse, material.specular, material.shininess);
 
-    // Combine the results
-    vec3 result = ambient + diffuse + specular;
+    // Sun, shadowed by the cascades
+    result += SunLighting(FragPos, Normal, viewDepth, viewPos, material.diffuse, material.specular, material.shininess);
 
     // Apply the texture
-    vec4 textureColor = texture(material.texture1, TexCoord);
+    vec4 textureColor = MaterialTexture(TexCoord);
 
     // Final color: blend the lighting result with the texture
     FragColor = textureColor * vec4(result, 1.0);
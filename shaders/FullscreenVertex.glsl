@@ -0,0 +1,8 @@
+#version 430 core
+
+// Triangle covering the screen, drawn with glDrawArrays(GL_TRIANGLES, 0, 3) and an empty VAO
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,30 @@
+#version 430 core
+
+in vec2 TexCoord;    // Texture coordinates from the vertex shader
+in vec3 FragPos;     // Fragment position in world space
+in vec3 Normal;      // Normal vector in world space
+
+// G-buffer of the deferred path, lit later by DeferredLighting.glsl (depth comes from the depth attachment)
+layout(location = 0) out vec4 GAlbedo;      // Diffuse color times texture
+layout(location = 1) out vec4 GNormal;      // World space normal
+layout(location = 2) out vec4 GSpecular;    // Specular color times texture, shininess / 256 in alpha
+layout(location = 3) out vec4 GAmbient;     // Ambient color times texture
+
+// Feature defines (HAS_TEXTURE, HAS_TEXTURE_ARRAY, HAS_VIRTUAL_TEXTURE, HAS_SPECULAR) are injected by ShaderVariants
+
+#include "MaterialTexture.glsl"
+
+void main()
+{
+    vec3 textureColor = MaterialTexture(TexCoord).rgb;
+
+    GAlbedo = vec4(material.diffuse * textureColor, 1.0);
+    GNormal = vec4(normalize(Normal), 0.0);
+    GAmbient = vec4(material.ambient * textureColor, 1.0);
+
+#ifdef HAS_SPECULAR
+    GSpecular = vec4(material.specular * textureColor, clamp(material.shininess / 256.0, 0.0, 1.0));
+#else
+    GSpecular = vec4(0.0);
+#endif
+}
@@ -0,0 +1,31 @@
+// Phong lighting shared by the lighting shaders, HAS_SPECULAR adds the specular term
+#pragma once
+
+#include "UniformBlocks.glsl"
+#include "PointShadows.glsl"
+
+// Light reflected towards the viewer by a surface point
+vec3 PhongLighting(Light light, vec3 position, vec3 normal, vec3 viewPosition, vec3 ambientColor, vec3 diffuseColor, vec3 specularColor, float shininess)
+{
+    // Ambient lighting
+    vec3 ambient = light.ambient * ambientColor;
+
+    // Diffuse lighting
+    vec3 norm = normalize(normal);
+    vec3 lightDir = normalize(light.position - position);
+    float diff = max(dot(norm, lightDir), 0.0);  // Lambertian reflection
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+
+    vec3 result = diffuse;
+
+#ifdef HAS_SPECULAR
+    // Specular lighting
+    vec3 viewDir = normalize(viewPosition - position);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    result += light.specular * spec * specularColor;
+#endif
+
+    // Ambient light is never shadowed
+    return ambient + result * PointLightShadow(light.shadowIndex, position, norm);
+}
@@ -0,0 +1,48 @@
+// Material texture lookup shared by the forward and G-buffer shaders
+// The texture path is chosen by the feature defines (HAS_TEXTURE, HAS_TEXTURE_ARRAY, HAS_VIRTUAL_TEXTURE) injected by ShaderVariants
+#pragma once
+
+#include "UniformBlocks.glsl"
+
+// Samplers cannot live in the uniform blocks
+
+uniform sampler2D texture1;
+uniform sampler2DArray textureArray; // Used instead of texture1 when material.layer >= 0
+uniform usampler2D pageTable;        // Virtual texture page table, used instead of texture1 when material.virtualTexture >= 0
+uniform sampler2D pageCache;         // Physical pages of all virtual textures
+
+#ifdef HAS_VIRTUAL_TEXTURE
+#include "VirtualTexture.glsl"
+
+// Look the page up in the page table (it may point at a coarser page that is loaded) and sample it from the cache
+vec4 SampleVirtual(vec2 uv)
+{
+    float level = VirtualLevel(uv, material.virtualSize, 0.0);
+    vec2 wrapped = fract(uv);
+
+    float pages = material.virtualSize / VT_PAGE_SIZE / exp2(level);
+    uvec4 entry = texelFetch(pageTable, ivec2(wrapped * pages), int(level));
+    if (entry.w == 0u)
+        return vec4(1.0);
+
+    float mappedPages = material.virtualSize / VT_PAGE_SIZE / exp2(float(entry.z));
+    vec2 texel = vec2(entry.xy) * VT_TILE_SIZE + VT_PAGE_BORDER + fract(wrapped * mappedPages) * VT_PAGE_SIZE;
+    return textureLod(pageCache, texel / vec2(textureSize(pageCache, 0)), 0.0);
+}
+#endif
+
+// Texture color of the material at the coordinates, white without a texture
+vec4 MaterialTexture(vec2 texCoord)
+{
+#if defined(HAS_VIRTUAL_TEXTURE)
+    return SampleVirtual(texCoord);
+#elif defined(HAS_TEXTURE_ARRAY)
+    // Repeat inside the atlas rectangle, gradients of the unwrapped coordinates keep the mip level smooth across the wrap
+    vec2 uv = material.uvOffset + fract(texCoord) * material.uvScale;
+    return textureGrad(textureArray, vec3(uv, material.layer), dFdx(texCoord) * material.uvScale, dFdy(texCoord) * material.uvScale);
+#elif defined(HAS_TEXTURE)
+    return texture(texture1, texCoord);
+#else
+    return vec4(1.0);
+#endif
+}
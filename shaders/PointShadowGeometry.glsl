@@ -0,0 +1,35 @@
+#version 430 core
+
+// Renders a light's six cube faces in one pass: one invocation per face, each into its own atlas viewport
+layout(triangles, invocations = 6) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+uniform mat4 faceMatrices[6];           // World to clip space of each face
+uniform uint faceMask;                  // Faces the caster touches, culled on the CPU
+
+void main()
+{
+    if ((faceMask & (1u << gl_InvocationID)) == 0u)
+        return;
+
+    vec4 corners[3];
+    for (int i = 0; i < 3; ++i)
+        corners[i] = faceMatrices[gl_InvocationID] * gl_in[i].gl_Position;
+
+    // Triangles entirely outside one side of this face's frustum never reach the rasterizer
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (corners[0][axis] > corners[0].w && corners[1][axis] > corners[1].w && corners[2][axis] > corners[2].w)
+            return;
+        if (corners[0][axis] < -corners[0].w && corners[1][axis] < -corners[1].w && corners[2][axis] < -corners[2].w)
+            return;
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        gl_Position = corners[i];
+        gl_ViewportIndex = gl_InvocationID;
+        EmitVertex();
+    }
+    EndPrimitive();
+}
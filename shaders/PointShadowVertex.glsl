@@ -0,0 +1,11 @@
+#version 430 core
+
+// Point shadow pass, reads the position-only vertex stream (Mesh::BindPositions), the geometry shader projects per face
+layout(location = 0) in vec3 aPos;      // Vertex position
+
+uniform mat4 model;
+
+void main()
+{
+    gl_Position = model * vec4(aPos, 1.0);
+}
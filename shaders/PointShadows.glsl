@@ -0,0 +1,54 @@
+// Cube shadows of point lights, six faces per light packed 3x2 into one atlas (see PointShadows)
+#pragma once
+
+struct PointShadow {
+    vec3 position;
+    float nearPlane;
+    vec2 origin;                 // Corner of the light's 3x2 block of faces in the atlas, in UV
+    float faceSize;              // Side of one face, in UV
+    float farPlane;              // Light radius
+};
+
+layout(std430, binding = 3) readonly buffer PointShadowBuffer {
+    PointShadow pointShadows[];
+};
+
+uniform sampler2DShadow pointShadowAtlas;
+
+// Face axes in +X, -X, +Y, -Y, +Z, -Z order, the same table as PointShadows::FACE_FORWARD and FACE_UP
+const vec3 SHADOW_FACE_FORWARD[6] = vec3[](vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0));
+const vec3 SHADOW_FACE_UP[6] = vec3[](vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0), vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0));
+
+// Fraction of a point light reaching a surface point, bilinear PCF from the face the point falls on, 1 if index < 0
+float PointLightShadow(int index, vec3 position, vec3 normal)
+{
+    if (index < 0)
+        return 1.0;
+
+    PointShadow shadow = pointShadows[index];
+    float faceTexels = shadow.faceSize * float(textureSize(pointShadowAtlas, 0).x);
+
+    // Push the lookup off the surface by about a texel, which grows with the distance to the light
+    vec3 toPoint = position - shadow.position;
+    toPoint += normal * (2.0 * length(toPoint) / faceTexels);
+
+    vec3 axis = abs(toPoint);
+    int face = axis.x >= axis.y && axis.x >= axis.z ? (toPoint.x >= 0.0 ? 0 : 1)
+        : axis.y >= axis.z ? (toPoint.y >= 0.0 ? 2 : 3) : (toPoint.z >= 0.0 ? 4 : 5);
+
+    // Same basis as Mat4::LookAt
+    vec3 forward = SHADOW_FACE_FORWARD[face];
+    vec3 right = normalize(cross(forward, SHADOW_FACE_UP[face]));
+    vec3 up = cross(right, forward);
+    float depth = dot(toPoint, forward);
+
+    // Stay a texel inside the face so the bilinear taps never read the neighbouring face
+    vec2 faceUV = clamp(vec2(dot(toPoint, right), dot(toPoint, up)) / depth * 0.5 + 0.5, 1.0 / faceTexels, 1.0 - 1.0 / faceTexels);
+    vec2 uv = shadow.origin + (vec2(face % 3, face / 3) + faceUV) * shadow.faceSize;
+
+    // Window depth of the 90 degree perspective the face was rendered with
+    float n = shadow.nearPlane, f = shadow.farPlane;
+    float ndcDepth = (f + n) / (f - n) - 2.0 * f * n / ((f - n) * depth);
+
+    return texture(pointShadowAtlas, vec3(uv, ndcDepth * 0.5 + 0.5));
+}
@@ -0,0 +1,12 @@
+#version 430 core
+
+// Depth-only pass of the shadow cascades, reads the position-only vertex stream (Mesh::BindPositions)
+layout(location = 0) in vec3 aPos;      // Vertex position
+
+uniform mat4 model;
+uniform mat4 lightViewProjection;       // Cascade being rendered
+
+void main()
+{
+    gl_Position = lightViewProjection * model * vec4(aPos, 1.0);
+}
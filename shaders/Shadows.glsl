@@ -0,0 +1,50 @@
+// Directional sun light with cascaded shadow maps (see ShadowCascades)
+#pragma once
+
+#include "UniformBlocks.glsl"
+
+uniform sampler2DArrayShadow shadowMap;
+
+// Fraction of the sun reaching a surface point, 3x3 PCF in the cascade covering its view depth, 1 past the last cascade
+float SunShadow(vec3 position, vec3 normal, float viewDepth)
+{
+    uint cascade = 0;
+    while (cascade < cascadeCount && viewDepth > cascadeSplits[cascade])
+        cascade++;
+
+    if (cascade >= cascadeCount)
+        return 1.0;
+
+    // Look up from a texel and a half off the surface, keeps acne away at grazing angles
+    vec3 offsetPosition = position + normalize(normal) * cascadeTexelSizes[cascade] * 1.5;
+    vec4 shadowPosition = cascadeMatrices[cascade] * vec4(offsetPosition, 1.0);
+    vec3 coords = shadowPosition.xyz / shadowPosition.w * 0.5 + 0.5;
+
+    float lit = 0.0;
+    for (int y = -1; y <= 1; ++y)
+    {
+        for (int x = -1; x <= 1; ++x)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * shadowTexelSize, float(cascade), coords.z - shadowBias));
+    }
+    return lit / 9.0;
+}
+
+// Sun light reflected towards the viewer, shadowed
+vec3 SunLighting(vec3 position, vec3 normal, float viewDepth, vec3 viewPosition, vec3 diffuseColor, vec3 specularColor, float shininess)
+{
+    vec3 norm = normalize(normal);
+    vec3 lightDir = -sunDirection.xyz;
+    float diff = max(dot(norm, lightDir), 0.0);
+    if (diff <= 0.0)
+        return vec3(0.0);
+
+    vec3 result = diff * diffuseColor;
+
+#ifdef HAS_SPECULAR
+    vec3 viewDir = normalize(viewPosition - position);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    result += pow(max(dot(viewDir, reflectDir), 0.0), shininess) * specularColor;
+#endif
+
+    return result * sunColor.rgb * SunShadow(position, norm, viewDepth);
+}
@@ -0,0 +1,28 @@
+#version 430 core
+
+// Resolve of the HDR scene to the screen: bloom added, exposure applied, then a filmic curve
+
+out vec4 FragColor;
+
+uniform sampler2D postSource;       // HDR scene
+uniform sampler2D postBloom;        // Top of the bloom pyramid
+
+uniform vec2 targetTexelSize;
+uniform float exposure;
+uniform float bloomIntensity;
+
+// ACES filmic curve (Narkowicz's fit): toe, shoulder, and 1 at infinity instead of clipping
+vec3 ACESFilm(vec3 x)
+{
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * targetTexelSize;
+
+    vec3 color = texture(postSource, uv).rgb + texture(postBloom, uv).rgb * bloomIntensity;
+
+    // Materials and textures are in display values already, so the curve's output goes to the screen as it is
+    FragColor = vec4(ACESFilm(color * exposure), 1.0);
+}
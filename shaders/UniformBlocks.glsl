@@ -0,0 +1,60 @@
+// Uniform blocks shared by every program, std140 so the structs in include/uniform_blocks.h mirror them byte for byte
+// Changing a member here means changing its C++ struct, BindUniformBlocks reports any mismatch after linking
+#pragma once
+
+struct Light {
+    vec3 position;
+    int shadowIndex;             // Point shadow entry, -1 if unshadowed
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+// Scalars fill the tail of each vec3
+struct Material {
+    vec3 ambient;
+    float shininess;
+    vec3 diffuse;
+    int layer;                   // Layer of textureArray, used instead of texture1 when >= 0
+    vec3 specular;
+    int virtualTexture;          // Virtual texture index, sampled through pageTable when >= 0
+    vec2 uvOffset;               // Rectangle of the image inside the layer
+    vec2 uvScale;
+    float virtualSize;           // Texels per side at level 0
+};
+
+// Camera, once per frame
+layout(std140) uniform FrameBlock {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+// Light of the mesh being drawn
+layout(std140) uniform LightBlock {
+    Light light;
+};
+
+// Material of the submesh being drawn
+layout(std140) uniform MaterialBlock {
+    Material material;
+};
+
+// Light cluster grid (see Clusters.glsl)
+layout(std140) uniform ClusterBlock {
+    uvec4 clusterGrid;           // Clusters along x, y and z, point lights in the scene
+    vec4 clusterDepth;           // Near, far, slice scale and bias (slice = log(depth) * scale + bias)
+    vec4 clusterScreen;          // Viewport size in pixels
+};
+
+// Sun and its shadow cascades (see Shadows.glsl)
+layout(std140) uniform ShadowBlock {
+    mat4 cascadeMatrices[4];     // World to shadow clip space, per cascade
+    vec4 cascadeSplits;          // View depth where each cascade ends
+    vec4 cascadeTexelSizes;      // World units per shadow map texel, per cascade
+    vec4 sunDirection;           // Direction the light travels
+    vec4 sunColor;               // Intensity included
+    uint cascadeCount;           // 0 without shadows
+    float shadowBias;            // In shadow map depth
+    float shadowTexelSize;       // 1 / resolution
+};
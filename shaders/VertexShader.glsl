@@ -1,4 +1,4 @@
-#version 330 core
+#version 430 core
 
 layout(location = 0) in vec3 aPos;      // Vertex position
 layout(location = 1) in vec3 aNormal;   // Vertex normal
@@ -8,9 +8,12 @@ out vec2 TexCoord;   // Texture coordinates
 out vec3 FragPos;    // Fragment position in world space
 out vec3 Normal;     // Normal vector to be used in the fragment shader
 
+#include "UniformBlocks.glsl"
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// Bit-identical to DepthPrepassVertex.glsl, so the depth test can be GL_EQUAL after a pre-pass
+invariant gl_Position;
 
 void main()
 {
@@ -0,0 +1,16 @@
+// Page layout and level selection of virtual textures, shared by the lighting and feedback shaders
+#pragma once
+
+// VT_ constants in virtual_texture.h
+const float VT_PAGE_SIZE = 128.0;
+const float VT_PAGE_BORDER = 4.0;
+const float VT_TILE_SIZE = 136.0;
+
+// Mip level of a virtual texture from the screen-space derivatives of its texel coordinates
+float VirtualLevel(vec2 uv, float size, float bias)
+{
+    vec2 dx = dFdx(uv * size);
+    vec2 dy = dFdy(uv * size);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + bias;
+    return clamp(floor(lod + 0.5), 0.0, log2(size / VT_PAGE_SIZE));
+}